@@ -9,6 +9,97 @@
 #import "AFCacheTests.h"
 #import "AFCache.h"
 #import "AFCacheableItem.h"
+#import "AFDownloadOperation.h"
+#import "AFDownloadScheduler.h"
+#import "AFFakeReachabilityProvider.h"
+#import "AFCacheInfoStore.h"
+#import "AFCacheAdmissionFilter.h"
+#import "AFRetryPolicy.h"
+#import "AFCacheKey.h"
+#import "AFHTTPRangeResponse.h"
+#import "AFCacheSharedStore.h"
+#import "AFCacheSlabStore.h"
+#import "AFRevalidationSweeper.h"
+#import "AFCacheClock.h"
+#import "AFStorageGovernor.h"
+#import "AFPackageInfo.h"
+#import "AFPackageArchive.h"
+#import "AFPackageArchiveWriter.h"
+#import "AFCacheBaseImage.h"
+#import "AFMemoryGovernor.h"
+#import "AFCacheTrace.h"
+#import "AFCacheSimulator.h"
+#import "AFCacheGarbageCollector.h"
+#import "AFCacheInvalidationIndex.h"
+#import "AFCache+PrivateAPI.h"
+#import "AFCache+Packaging.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <spawn.h>
+
+// see testSharedStoreChildProcess
+#define kAFCacheTestsSharedStoreDirectoryVariable @"AFCACHE_TESTS_SHARED_STORE_DIRECTORY"
+#define kAFCacheTestsReadyFD 3
+#define kAFCacheTestsProceedFD 4
+#define kAFCacheTestsClaimedURLString @"http://localhost:49000/shared/claimed"
+
+@interface AFRevalidationSweeper (Testing)
+- (NSArray*)candidatesForCache:(AFCache*)cache;
+@end
+
+@interface AFCache (AdmissionTesting)
+- (uint64_t)estimatedStoreSize;
+@end
+
+@interface AFCache (DeltaPackageTesting)
+- (BOOL)applyDeltaPackageWithManifest:(NSDictionary*)manifest stagingPath:(NSString*)stagingPath userData:(NSDictionary*)userData;
+- (NSString*)linkPackageArchiveAtPath:(NSString*)path;
+@end
+
+// archives an info the way it was archived before request and response records, see testInfoArchiveMigration
+@interface AFLegacyCacheableItemInfo : NSObject <NSCoding>
+@property (nonatomic, strong) NSURLRequest *request;
+@property (nonatomic, strong) NSURLResponse *response;
+@property (nonatomic, strong) NSDate *expireDate;
+@end
+
+@implementation AFLegacyCacheableItemInfo
+
+- (id)initWithCoder:(NSCoder *)coder {
+    return nil;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.request forKey:@"request"];
+    [coder encodeObject:self.response forKey:@"response"];
+    [coder encodeObject:self.expireDate forKey:@"expireDate"];
+    [coder encodeObject:@(200) forKey:@"statusCode"];
+    [coder encodeObject:@(42) forKey:@"contentLength"];
+    [coder encodeObject:[(NSHTTPURLResponse*)self.response allHeaderFields] forKey:@"headers"];
+}
+
+@end
+
+// hands out a fixed body and counts the reads, like a package archive that inflates an entry on every read
+@interface AFCountingBodySource : NSObject <AFCacheBodySource>
+@property (nonatomic, strong) NSData *body;
+@property (nonatomic, assign) NSUInteger readCount;
+@end
+
+@implementation AFCountingBodySource
+
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info {
+    return YES;
+}
+
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info {
+    @synchronized (self) {
+        self.readCount++;
+    }
+    return self.body;
+}
+
+@end
 
 @implementation AFCacheTests
 
@@ -80,4 +171,1341 @@
     STAssertTrue(failed, @"The request should have failed but did not - so the test fails.");
 }
 
+- (AFDownloadOperation*)downloadOperationForURLString:(NSString*)URLString
+{
+    AFCacheableItem *item = [[AFCacheableItem alloc] init];
+    item.url = [NSURL URLWithString:URLString];
+    item.info.request = [NSURLRequest requestWithURL:item.url];
+    return [[AFDownloadOperation alloc] initWithCacheableItem:item];
+}
+
+- (void)testDownloadSchedulerLanes
+{
+    AFDownloadScheduler *scheduler = [[AFDownloadScheduler alloc] init];
+    scheduler.suspended = YES;
+    scheduler.maxConcurrentOperationCount = 2;
+    scheduler.maxConcurrentOperationCountPerHost = 1;
+    
+    AFDownloadOperation *prefetch = [self downloadOperationForURLString:@"http://localhost:49000/file?numBytes=10"];
+    AFDownloadOperation *interactive = [self downloadOperationForURLString:@"http://localhost:49000/file?numBytes=20"];
+    [scheduler addOperation:prefetch lane:AFDownloadLanePrefetch];
+    [scheduler addOperation:interactive lane:AFDownloadLaneInteractive];
+    
+    STAssertEquals([[scheduler operations] count], (NSUInteger)2, @"Suspended scheduler must keep its operations queued");
+    STAssertEquals([scheduler executingOperationCount], (NSUInteger)0, @"Suspended scheduler must not start operations");
+    
+    [scheduler prioritizeOperation:prefetch];
+    STAssertEquals([scheduler pendingOperationCountForLane:AFDownloadLanePrefetch], (NSUInteger)0, @"Prioritized operation should have left the prefetch lane");
+    STAssertEquals([scheduler pendingOperationCountForLane:AFDownloadLaneInteractive], (NSUInteger)2, @"Prioritized operation should be in the interactive lane");
+    
+    // both operations go to the same host, so only one of them may be started
+    scheduler.suspended = NO;
+    STAssertEquals([scheduler executingOperationCountForHost:@"localhost"], (NSUInteger)1, @"Per-host limit exceeded");
+    STAssertTrue([prefetch isExecuting], @"Prioritized operation should have been started first");
+    
+    [scheduler cancelAllOperations];
+}
+
+- (void)testDownloadSchedulerCancellation
+{
+    AFDownloadScheduler *scheduler = [[AFDownloadScheduler alloc] init];
+    scheduler.suspended = YES;
+    
+    __block BOOL previousCompletionBlockCalled = NO;
+    AFDownloadOperation *operation = [self downloadOperationForURLString:@"http://localhost:49000/file?numBytes=10"];
+    [operation setCompletionBlock:^{
+        previousCompletionBlockCalled = YES;
+    }];
+    [scheduler addOperation:operation lane:AFDownloadLanePrefetch];
+    STAssertEquals([scheduler pendingOperationCountForLane:AFDownloadLanePrefetch], (NSUInteger)1, @"Operation should be pending");
+    AFCacheKey *key = [AFCacheKey keyWithURLString:@"http://LOCALHOST:49000/file?numBytes=10"];
+    STAssertEquals([scheduler nonCancelledOperationForKey:key], operation, @"Operations should be found by the key of their URL");
+    
+    // cancelled pending operations leave their lane right away, even while the scheduler is suspended
+    [operation cancel];
+    STAssertEquals([scheduler pendingOperationCountForLane:AFDownloadLanePrefetch], (NSUInteger)0, @"Cancelled operation should have been removed");
+    STAssertTrue([operation isFinished], @"Cancelled operation should have been finished");
+    STAssertNil([scheduler nonCancelledOperationForKey:key], @"Cancelled operations must not be found");
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while (!previousCompletionBlockCalled && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    STAssertTrue(previousCompletionBlockCalled, @"The operation's own completion block should still be called");
+    STAssertEquals([[scheduler operations] count], (NSUInteger)0, @"Finished operation should have left the scheduler");
+    STAssertEquals([[scheduler operationsForKey:key] count], (NSUInteger)0, @"Finished operation should have left the index");
+}
+
+- (void)testDownloadSchedulerYield
+{
+    AFDownloadScheduler *scheduler = [[AFDownloadScheduler alloc] init];
+    scheduler.suspended = YES;
+    scheduler.maxConcurrentOperationCount = 1;
+    
+    AFDownloadOperation *retrying = [self downloadOperationForURLString:@"http://localhost:49000/file?numBytes=10"];
+    AFDownloadOperation *waiting = [self downloadOperationForURLString:@"http://localhost:49000/file?numBytes=20"];
+    [scheduler addOperation:retrying lane:AFDownloadLaneInteractive];
+    [scheduler addOperation:waiting lane:AFDownloadLanePrefetch];
+    scheduler.suspended = NO;
+    STAssertTrue([retrying isExecuting], @"Interactive operation should have been started first");
+    STAssertFalse([scheduler yieldOperation:waiting forInterval:0.2 resumeBlock:^{}], @"Only executing operations can yield");
+    
+    __block BOOL resumed = NO;
+    STAssertTrue([scheduler yieldOperation:retrying forInterval:0.2 resumeBlock:^{
+        resumed = YES;
+    }], @"Executing operation should yield its slot");
+    STAssertTrue([waiting isExecuting], @"The slot should have been given to the waiting operation");
+    STAssertEquals([scheduler executingOperationCount], (NSUInteger)1, @"The yielded operation must not hold a slot");
+    STAssertEquals([[scheduler operations] count], (NSUInteger)2, @"The yielded operation should still be known to the scheduler");
+    
+    // a free slot is not taken before the interval has passed
+    scheduler.maxConcurrentOperationCount = 2;
+    STAssertFalse(resumed, @"Yielded operation resumed before its interval");
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while (!resumed && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    STAssertTrue(resumed, @"Yielded operation should have been resumed after its interval");
+    STAssertEquals([scheduler executingOperationCount], (NSUInteger)2, @"Resumed operation should hold a slot again");
+    
+    [scheduler cancelAllOperations];
+}
+
+- (void)testAdaptiveConcurrencyRestoresLimit
+{
+    AFCache *cache = [AFCache cacheForContext:@"adaptiveConcurrencyTest"];
+    cache.concurrentConnections = 12;
+    cache.minimumConcurrentConnections = 2;
+    cache.maximumConcurrentConnections = 8;
+    cache.adaptiveConcurrency = YES;
+    STAssertEquals(cache.concurrentConnections, 8, @"The controller should keep the limit within its maximum");
+    
+    // new bounds apply right away
+    cache.maximumConcurrentConnections = 4;
+    STAssertEquals(cache.concurrentConnections, 4, @"A lower maximum should lower the limit immediately");
+    cache.minimumConcurrentConnections = 6;
+    STAssertEquals(cache.concurrentConnections, 6, @"A higher minimum should raise the limit immediately");
+    
+    cache.adaptiveConcurrency = NO;
+    STAssertEquals(cache.concurrentConnections, 12, @"Turning adaptive concurrency off should restore the configured limit");
+}
+
+- (void)testReachabilityProvider
+{
+    AFCache *cache = [AFCache cacheForContext:@"reachabilityTest"];
+    AFFakeReachabilityProvider *provider = [[AFFakeReachabilityProvider alloc] initWithReachable:NO];
+    cache.reachabilityProvider = provider;
+    STAssertTrue([provider isMonitoring], @"The cache should start monitoring its provider");
+    
+    // changes are delivered asynchronously on the main thread
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    STAssertFalse([cache isConnectedToNetwork], @"The initial state of the provider should have been taken over");
+    
+    provider.reachable = YES;
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    STAssertTrue([cache isConnectedToNetwork], @"The cache should follow the provider");
+    
+    cache.reachabilityProvider = nil;
+    STAssertFalse([provider isMonitoring], @"A replaced provider should not be monitored anymore");
+}
+
+- (AFCacheableItemInfo*)revalidationInfoWithAccessCount:(NSUInteger)accessCount maxAge:(NSTimeInterval)maxAge validatedAgo:(NSTimeInterval)validatedAgo eTag:(NSString*)eTag
+{
+    AFCacheableItemInfo *info = [[AFCacheableItemInfo alloc] init];
+    NSTimeInterval validated = AFCacheNow() - validatedAgo;
+    info.requestTimestamp = validated;
+    info.responseTimestamp = validated;
+    info.serverDate = [NSDate dateWithTimeIntervalSinceReferenceDate:validated];
+    info.maxAge = @(maxAge);
+    info.eTag = eTag;
+    info.accessCount = accessCount;
+    return info;
+}
+
+- (void)testRevalidationSweeper
+{
+    AFCache *cache = [AFCache cacheForContext:@"revalidationSweeperTest"];
+    [cache.cachedItemInfos removeAllObjects];
+    // fresh for another 200, 150 and 100 seconds
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:2 maxAge:400 validatedAgo:200 eTag:@"a"] forKey:@"http://localhost:49000/a"];
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:5 maxAge:400 validatedAgo:250 eTag:@"b"] forKey:@"http://localhost:49000/b"];
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:5 maxAge:400 validatedAgo:300 eTag:@"c"] forKey:@"http://localhost:49000/c"];
+    // never used, no validator, fresh beyond the window
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:0 maxAge:400 validatedAgo:300 eTag:@"d"] forKey:@"http://localhost:49000/d"];
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:9 maxAge:400 validatedAgo:300 eTag:nil] forKey:@"http://localhost:49000/e"];
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:9 maxAge:3600 validatedAgo:0 eTag:@"f"] forKey:@"http://localhost:49000/f"];
+    // no freshness lifetime, expired, validated recently
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:9 maxAge:0 validatedAgo:300 eTag:@"g"] forKey:@"http://localhost:49000/g"];
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:9 maxAge:60 validatedAgo:120 eTag:@"h"] forKey:@"http://localhost:49000/h"];
+    [cache.cachedItemInfos setObject:[self revalidationInfoWithAccessCount:9 maxAge:120 validatedAgo:10 eTag:@"i"] forKey:@"http://localhost:49000/i"];
+    
+    AFRevalidationSweeper *sweeper = [[AFRevalidationSweeper alloc] initWithCache:cache];
+    NSArray *candidateURLs = [[sweeper candidatesForCache:cache] valueForKeyPath:@"url.absoluteString"];
+    NSArray *expectedURLs = @[@"http://localhost:49000/c", @"http://localhost:49000/b", @"http://localhost:49000/a"];
+    STAssertEqualObjects(candidateURLs, expectedURLs, @"Candidates should be ordered by access count, then by remaining freshness");
+    
+    cache.offlineMode = YES;
+    STAssertEquals([sweeper sweep], (NSUInteger)0, @"Sweeps should be skipped in offline mode");
+    STAssertEqualObjects([sweeper statistics][kAFRevalidationSweeperSkippedSweepsKey], @1, @"Skipped sweep should have been counted");
+    cache.offlineMode = NO;
+    
+    // lookups record accesses on any thread
+    AFCacheableItemInfo *info = [cache.cachedItemInfos objectForKey:@"http://localhost:49000/a"];
+    dispatch_apply(1000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        [info recordAccess];
+    });
+    STAssertEquals(info.accessCount, (NSUInteger)1002, @"Concurrent accesses should all have been recorded");
+    
+    [cache.cachedItemInfos removeAllObjects];
+}
+
+- (void)testInfoStoreConcurrentAccess
+{
+    AFCacheInfoStore *store = [AFCacheInfoStore dictionary];
+    // the assertions are made on this thread, the iterations only record what they read
+    NSMutableData *readBackResults = [NSMutableData dataWithLength:1000 * sizeof(BOOL)];
+    BOOL *readBack = [readBackResults mutableBytes];
+    dispatch_apply(1000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        NSString *key = [NSString stringWithFormat:@"http://localhost:49000/file?numBytes=%zu", i];
+        [store setObject:@(i) forKey:key];
+        readBack[i] = [[store objectForKey:key] isEqual:@(i)];
+        if (i % 2) {
+            [store removeObjectForKey:key];
+        }
+        [store copy]; // snapshots while others write
+    });
+    for (NSUInteger i = 0; i < 1000; i++) {
+        STAssertTrue(readBack[i], @"Value %lu must be readable immediately after it has been stored", (unsigned long)i);
+    }
+    STAssertEquals([store count], (NSUInteger)500, @"Every other entry should have been removed");
+    
+    NSData *archive = [NSKeyedArchiver archivedDataWithRootObject:store];
+    NSDictionary *unarchived = [NSKeyedUnarchiver unarchiveObjectWithData:archive];
+    STAssertEqualObjects([unarchived class], [NSMutableDictionary class], @"The store should be archived as a plain dictionary");
+    STAssertEqualObjects(unarchived, [store copy], @"Archived store differs");
+}
+
+- (void)testInfoStoreSnapshot
+{
+    AFCacheInfoStore *store = [AFCacheInfoStore dictionary];
+    [store setObject:@"a" forKey:@"1"];
+    uint64_t version = store.version;
+    
+    NSDictionary *snapshot = [store copy];
+    [store setObject:@"b" forKey:@"1"];
+    [store setObject:@"c" forKey:@"2"];
+    
+    STAssertEqualObjects(snapshot, @{@"1" : @"a"}, @"A snapshot must not see later writes");
+    STAssertEqualObjects([store copy], (@{@"1" : @"b", @"2" : @"c"}), @"The store must see its writes");
+    STAssertTrue(store.version > version, @"Writes must increment the version");
+    
+    NSArray *keys = [[store allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    NSArray *values = [[store allValues] sortedArrayUsingSelector:@selector(compare:)];
+    STAssertEqualObjects(keys, (@[@"1", @"2"]), @"allKeys should hand out the URL strings of the keys");
+    STAssertEqualObjects(values, (@[@"b", @"c"]), @"allValues should see the current values");
+    STAssertEqualObjects([[store keyEnumerator] allObjects], [store allKeys], @"keyEnumerator should enumerate allKeys");
+}
+
+- (void)testInfoArchiveMigration
+{
+    NSURL *url = [NSURL URLWithString:@"http://localhost:49000/legacy?a=1"];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+    [request setValue:@"text/plain" forHTTPHeaderField:@"Accept"];
+    AFLegacyCacheableItemInfo *legacyInfo = [[AFLegacyCacheableItemInfo alloc] init];
+    legacyInfo.request = request;
+    legacyInfo.response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1"
+                                                    headerFields:@{@"Content-Type" : @"text/plain", @"Etag" : @"\"1\"", @"X-Unretained" : @"1"}];
+    legacyInfo.expireDate = [NSDate dateWithTimeIntervalSinceReferenceDate:1000000];
+    
+    NSMutableData *archive = [NSMutableData data];
+    NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:archive];
+    [archiver setClassName:@"AFCacheableItemInfo" forClass:[AFLegacyCacheableItemInfo class]];
+    [archiver encodeObject:legacyInfo forKey:@"info"];
+    [archiver finishEncoding];
+    NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:archive];
+    AFCacheableItemInfo *info = [unarchiver decodeObjectForKey:@"info"];
+    [unarchiver finishDecoding];
+    
+    STAssertTrue([info isKindOfClass:[AFCacheableItemInfo class]], @"A legacy archive must be read");
+    STAssertEqualObjects(info.expireDate, legacyInfo.expireDate, @"Dates archived as NSDate must be read");
+    STAssertEquals(info.statusCode, (NSUInteger)200, @"The status code must be read");
+    STAssertEquals(info.contentLength, (uint64_t)42, @"The content length must be read");
+    STAssertEqualObjects([info.request URL], url, @"The request must be kept");
+    STAssertEqualObjects([info.request valueForHTTPHeaderField:@"Accept"], @"text/plain", @"Request headers must be kept");
+    NSHTTPURLResponse *response = (NSHTTPURLResponse*)info.response;
+    STAssertTrue([response isKindOfClass:[NSHTTPURLResponse class]], @"An HTTP response must stay one");
+    STAssertEquals([response statusCode], (NSInteger)200, @"The response status must be kept");
+    STAssertEqualObjects([response allHeaderFields][@"Content-Type"], @"text/plain", @"Retained headers must be kept");
+    STAssertNil([response allHeaderFields][@"X-Unretained"], @"Other headers must be dropped");
+    STAssertNil(info.headers[@"X-Unretained"], @"Other headers must be dropped from the info as well");
+}
+
+- (void)testInfoRecordRoundTrip
+{
+    NSURL *url = [NSURL URLWithString:@"https://localhost:49000/records/a%20b?c=d#e"];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:17];
+    [request setHTTPMethod:@"POST"];
+    [request setValue:@"1" forHTTPHeaderField:@"X-Request"];
+    NSURL *redirectURL = [NSURL URLWithString:@"http://localhost:49000/records/moved"];
+    
+    AFCacheableItemInfo *info = [[AFCacheableItemInfo alloc] init];
+    info.request = request;
+    info.response = [[NSURLResponse alloc] initWithURL:url MIMEType:@"text/plain" expectedContentLength:12 textEncodingName:@"utf-8"];
+    info.redirectRequest = [NSURLRequest requestWithURL:redirectURL];
+    info.redirectResponse = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:301 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Location" : [redirectURL absoluteString]}];
+    [info compact];
+    
+    AFCacheableItemInfo *unarchived = [NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:info]];
+    for (AFCacheableItemInfo *compacted in @[info, unarchived]) {
+        STAssertEqualObjects([compacted.request URL], url, @"The request URL must survive");
+        STAssertEqualObjects([compacted.request HTTPMethod], @"POST", @"The request method must survive");
+        STAssertEquals([compacted.request cachePolicy], NSURLRequestReloadIgnoringLocalCacheData, @"The cache policy must survive");
+        STAssertEquals([compacted.request timeoutInterval], (NSTimeInterval)17, @"The timeout must survive");
+        STAssertEqualObjects([compacted.request valueForHTTPHeaderField:@"X-Request"], @"1", @"Request headers must survive");
+        STAssertEqualObjects([compacted.response URL], url, @"The response URL must survive");
+        STAssertEqualObjects([compacted.response MIMEType], @"text/plain", @"The MIME type must survive");
+        STAssertEquals([compacted.response expectedContentLength], (long long)12, @"The expected length must survive");
+        STAssertEqualObjects([compacted.response textEncodingName], @"utf-8", @"The text encoding must survive");
+        STAssertEqualObjects([compacted.redirectRequest URL], redirectURL, @"The redirect request must survive");
+        STAssertEquals([(NSHTTPURLResponse*)compacted.redirectResponse statusCode], (NSInteger)301, @"The redirect status must survive");
+        STAssertEqualObjects([(NSHTTPURLResponse*)compacted.redirectResponse allHeaderFields][@"Location"], [redirectURL absoluteString], @"The redirect location must survive");
+    }
+    
+    // readers on other threads always find the object or its record while the info is compacted
+    NSURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    NSMutableData *readBackResults = [NSMutableData dataWithLength:1000 * sizeof(BOOL)];
+    BOOL *readBack = [readBackResults mutableBytes];
+    dispatch_apply(1000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        if (i % 2) {
+            info.response = response;
+            [info compact];
+        }
+        readBack[i] = [[info.response URL] isEqual:url];
+    });
+    for (NSUInteger i = 0; i < 1000; i++) {
+        STAssertTrue(readBack[i], @"The response must be readable while the info is compacted");
+    }
+}
+
+- (void)testCancellingJoinedDownload
+{
+    AFCache *cache = [AFCache cacheForContext:@"cancelDownloadTest"];
+    cache.suspended = YES;
+    
+    NSURL *url = [NSURL URLWithString:@"http://localhost:49000/file?numBytes=30"];
+    AFCacheableItem *item = [[AFCacheableItem alloc] init];
+    item.url = url;
+    item.cache = cache;
+    item.info.request = [NSURLRequest requestWithURL:url];
+    
+    // two clients wait for the same download
+    AFCacheableItemBlock firstCompletion = [^(AFCacheableItem *item) {} copy];
+    AFCacheableItemBlock secondCompletion = [^(AFCacheableItem *item) {} copy];
+    [item addCompletionBlock:firstCompletion failBlock:nil progressBlock:nil];
+    [item addCompletionBlock:secondCompletion failBlock:nil progressBlock:nil];
+    [cache addItemToDownloadQueue:item];
+    STAssertTrue([cache isQueuedURL:url], @"Download should be queued while the cache is suspended");
+    
+    [item removeCompletionBlock:firstCompletion failBlock:nil progressBlock:nil];
+    [cache cancelDownloadForItem:item];
+    STAssertTrue([cache isQueuedURL:url], @"Download must go on while another client is waiting for it");
+    
+    [item removeCompletionBlock:secondCompletion failBlock:nil progressBlock:nil];
+    STAssertFalse([item hasClientBlocks], @"No client should be left");
+    [cache cancelDownloadForItem:item];
+    STAssertFalse([cache isQueuedURL:url], @"Download should have been cancelled with its last client");
+    
+    cache.suspended = NO;
+}
+
+- (void)testBatchLookup
+{
+    AFCache *cache = [AFCache cacheForContext:@"batchLookupTest"];
+    NSURL *cachedURL = [NSURL URLWithString:@"http://localhost:49000/batch-cached"];
+    NSData *body = [@"cached body" dataUsingEncoding:NSUTF8StringEncoding];
+    [cache importObjectForURL:cachedURL data:body];
+    AFCacheableItemInfo *storedInfo = [cache.cachedItemInfos objectForKey:cachedURL];
+    NSString *storedCachePath = storedInfo.cachePath;
+    
+    NSURL *fileURL = [NSURL fileURLWithPath:@"/tmp/afcache-batch-lookup"];
+    AFRequestConfiguration *configuration = [[AFRequestConfiguration alloc] init];
+    configuration.options = kAFCacheNeverRevalidate;
+    __block NSUInteger completionCount = 0;
+    __block NSDictionary *completedItems = nil;
+    __block NSArray *completedFailedURLs = nil;
+    NSDictionary *hits = [cache cacheItemsForURLs:@[cachedURL, cachedURL, fileURL]
+                                    urlCredential:nil
+                             requestConfiguration:configuration
+                                  completionBlock:^(NSDictionary *items, NSArray *failedURLs) {
+                                      completionCount++;
+                                      completedItems = items;
+                                      completedFailedURLs = failedURLs;
+                                  }];
+    STAssertEquals([hits count], (NSUInteger)1, @"The cached URL should be returned once");
+    STAssertEqualObjects([hits[cachedURL] data], body, @"The hit should deliver the stored body");
+    STAssertEquals(completionCount, (NSUInteger)0, @"The completion block must not be called before returning");
+    STAssertEqualObjects(storedInfo.cachePath, storedCachePath, @"The batch must not modify the stored info");
+    
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while (completionCount == 0 && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    STAssertEquals(completionCount, (NSUInteger)1, @"The completion block should be called once");
+    STAssertEqualObjects(completedItems[cachedURL], hits[cachedURL], @"The hit should be part of the completed items");
+    STAssertEqualObjects(completedFailedURLs, @[fileURL], @"File URLs cannot be looked up in a batch");
+    
+    [cache purgeCacheableItemForURL:cachedURL];
+}
+
+- (void)testAdmissionFilter
+{
+    AFCacheAdmissionFilter *filter = [[AFCacheAdmissionFilter alloc] initWithExpectedItemCount:65536];
+    for (NSUInteger i = 0; i < 5; i++) {
+        [filter recordAccessForKey:@"http://localhost/hot"];
+    }
+    for (NSUInteger i = 0; i < 100; i++) {
+        [filter recordAccessForKey:[NSString stringWithFormat:@"http://localhost/scan/%lu", (unsigned long)i]];
+    }
+    
+    STAssertTrue([filter frequencyForKey:@"http://localhost/hot"] >= 5, @"A key's frequency must not be underestimated");
+    STAssertEquals([filter frequencyForKey:@"http://localhost/never"], (NSUInteger)0, @"An unknown key must have no frequency");
+    STAssertFalse([filter admitCandidateKey:@"http://localhost/scan/1" size:1000 victimKey:@"http://localhost/hot" size:1000], @"A one-off entry must not displace a hot one");
+    STAssertTrue([filter admitCandidateKey:@"http://localhost/hot" size:1000 victimKey:@"http://localhost/scan/1" size:1000], @"A hot entry must displace a one-off one");
+    STAssertFalse([filter admitCandidateKey:@"http://localhost/hot" size:100000 victimKey:@"http://localhost/scan/1" size:1000], @"An entry must be worth its bytes");
+    
+    for (NSUInteger i = 0; i < filter.sampleSize; i++) {
+        [filter recordAccessForKey:@"http://localhost/other"];
+    }
+    STAssertTrue([filter frequencyForKey:@"http://localhost/hot"] < 5, @"Frequencies must age");
+}
+
+- (void)testAdmissionOfImports
+{
+    AFCache *cache = [AFCache cacheForContext:@"admissionTest"];
+    [cache invalidateAll];
+    cache.admissionFilter = [[AFCacheAdmissionFilter alloc] initWithExpectedItemCount:1024];
+    cache.diskCacheDisplacementTresholdSize = 150;
+    NSMutableData *body = [NSMutableData dataWithLength:100];
+    
+    NSURL *hotURL = [NSURL URLWithString:@"http://localhost:49000/admission-hot"];
+    [cache importObjectForURL:hotURL data:body];
+    STAssertEquals([cache estimatedStoreSize], (uint64_t)100, @"Admitted bytes must be added to the estimate");
+    for (NSUInteger i = 0; i < 5; i++) {
+        [cache.admissionFilter recordAccessForKey:[hotURL absoluteString]];
+    }
+    
+    NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"afcache-admission-import"]];
+    [body writeToURL:fileURL atomically:NO];
+    AFCacheableItem *coldItem = [[AFCacheableItem alloc] initWithURL:[NSURL URLWithString:@"http://localhost:49000/admission-cold"] lastModified:[NSDate date] expireDate:nil];
+    STAssertFalse([cache importCacheableItem:coldItem dataWithFileAtURL:fileURL], @"A one-off entry must not displace a hot one");
+    STAssertEqualObjects(coldItem.data, body, @"A rejected import must still deliver its body");
+    STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path], @"A rejected import must consume its file");
+    
+    [cache purgeCacheableItemForURL:hotURL];
+    STAssertEquals([cache estimatedStoreSize], (uint64_t)0, @"Removed bytes must be subtracted from the estimate");
+    cache.admissionFilter = nil;
+}
+
+- (void)testMemoryPressure
+{
+    AFCache *cache = [AFCache cacheForContext:@"memoryPressureTest"];
+    [cache invalidateAll];
+    NSURL *url = [NSURL URLWithString:@"http://localhost:49000/memory-pressure"];
+    NSData *body = [NSMutableData dataWithLength:100];
+    [cache importObjectForURL:url data:body];
+    AFCacheableItem *item = [cache cacheableItemFromCacheStore:url];
+    STAssertEqualObjects(item.data, body, @"The stored body must be read");
+    
+    AFMemoryGovernor *governor = [AFMemoryGovernor sharedGovernor];
+    NSDictionary *statistics = [governor statistics];
+    __block NSUInteger notifications = 0;
+    id observer = [[NSNotificationCenter defaultCenter] addObserverForName:kAFMemoryGovernorMemoryPressureNotification
+                                                                    object:governor
+                                                                     queue:nil
+                                                                usingBlock:^(NSNotification *notification) {
+                                                                    notifications++;
+                                                                }];
+#if TARGET_OS_IPHONE
+    // the system's memory warning is the signal
+    [[NSNotificationCenter defaultCenter] postNotificationName:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+#else
+    // the memory pressure dispatch source cannot be triggered, the host may signal directly as well
+    [governor handleMemoryPressure];
+#endif
+    NSDictionary *statisticsAfterPressure = [governor statistics];
+    STAssertEquals(notifications, (NSUInteger)1, @"Memory pressure must be passed on to the caches");
+    STAssertEquals([statisticsAfterPressure[kAFMemoryGovernorMemoryPressureEventsKey] unsignedIntegerValue],
+                   [statistics[kAFMemoryGovernorMemoryPressureEventsKey] unsignedIntegerValue] + 1, @"The event must be counted");
+    STAssertTrue([statisticsAfterPressure[kAFMemoryGovernorReleasedBytesKey] unsignedLongLongValue] >=
+                 [statistics[kAFMemoryGovernorReleasedBytesKey] unsignedLongLongValue] + [body length], @"The item's body must be released");
+    STAssertEqualObjects(item.data, body, @"A released body must be read again");
+    
+#if TARGET_OS_IPHONE
+    governor.observesSystemMemoryPressure = NO;
+    [[NSNotificationCenter defaultCenter] postNotificationName:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    STAssertEquals(notifications, (NSUInteger)1, @"Memory warnings must be ignored unless observed");
+    governor.observesSystemMemoryPressure = YES;
+#endif
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+    [cache invalidateAll];
+}
+
+- (void)testStorageGovernor
+{
+    NSTimeInterval now = 1000000;
+    NSTimeInterval halfLife = 86400;
+    AFCacheableItemInfo *rare = [[AFCacheableItemInfo alloc] init];
+    rare.contentLength = 100;
+    rare.responseTimestamp = now;
+    AFCacheableItemInfo *frequent = [[AFCacheableItemInfo alloc] init];
+    frequent.contentLength = 100;
+    frequent.responseTimestamp = now;
+    frequent.accessCount = 9;
+    AFCacheableItemInfo *old = [[AFCacheableItemInfo alloc] init];
+    old.contentLength = 100;
+    old.responseTimestamp = now - halfLife;
+    AFCacheableItemInfo *large = [[AFCacheableItemInfo alloc] init];
+    large.contentLength = 1000;
+    large.responseTimestamp = now;
+    double rareUtility = [AFStorageGovernor utilityOfItemInfo:rare now:now halfLife:halfLife];
+    STAssertEqualsWithAccuracy([AFStorageGovernor utilityOfItemInfo:frequent now:now halfLife:halfLife], rareUtility * 10, 1e-9, @"Utility must grow with the accesses");
+    STAssertEqualsWithAccuracy([AFStorageGovernor utilityOfItemInfo:old now:now halfLife:halfLife], rareUtility / 2, 1e-9, @"Utility must halve with every half-life");
+    STAssertEqualsWithAccuracy([AFStorageGovernor utilityOfItemInfo:large now:now halfLife:halfLife], rareUtility / 10, 1e-9, @"Utility must be per byte");
+    AFCacheableItemInfo *sourced = [[AFCacheableItemInfo alloc] init];
+    sourced.contentLength = 100;
+    sourced.bodySourceKey = @"governor-source";
+    STAssertEquals([AFStorageGovernor storedBytesOfItemInfo:rare], (uint64_t)100, @"An entry must count its body");
+    STAssertEquals([AFStorageGovernor storedBytesOfItemInfo:sourced], (uint64_t)0, @"An entry with a body source must count with its body source");
+    
+    AFCache *cache = [AFCache cacheForContext:@"governorTest"];
+    [cache invalidateAll];
+    NSData *body = [NSMutableData dataWithLength:100];
+    NSArray *urls = @[[NSURL URLWithString:@"http://localhost:49000/governor-a"],
+                      [NSURL URLWithString:@"http://localhost:49000/governor-b"],
+                      [NSURL URLWithString:@"http://localhost:49000/governor-c"]];
+    for (NSURL *url in urls) {
+        [cache importObjectForURL:url data:body];
+        [[cache.cachedItemInfos objectForKey:url] recordAccess];
+    }
+    // b and c are used more often, a goes first
+    [[cache.cachedItemInfos objectForKey:urls[1]] recordAccess];
+    [[cache.cachedItemInfos objectForKey:urls[2]] recordAccess];
+    
+    AFStorageGovernor *governor = [[AFStorageGovernor alloc] init];
+    [governor registerCache:cache];
+    [governor setMinimumBytes:0 maximumBytes:250 forContext:@"governorTest"];
+    [governor enforce];
+    
+    STAssertNil([cache.cachedItemInfos objectForKey:urls[0]], @"The entry with the lowest utility must be evicted");
+    STAssertNotNil([cache.cachedItemInfos objectForKey:urls[1]], @"Entries within the maximum must be kept");
+    STAssertNotNil([cache.cachedItemInfos objectForKey:urls[2]], @"Entries within the maximum must be kept");
+    NSDictionary *statistics = [governor statisticsForContext:@"governorTest"];
+    STAssertEqualObjects(statistics[kAFStorageGovernorContextEvictedItemsKey], @1, @"One entry must have been evicted");
+    STAssertEqualObjects(statistics[kAFStorageGovernorContextUsageKey], @200, @"The usage must be updated after eviction");
+    [governor unregisterCache:cache];
+}
+
+- (void)testPinning
+{
+    AFCache *cache = [AFCache cacheForContext:@"pinningTest"];
+    [cache invalidateAll];
+    NSURL *pinnedURL = [NSURL URLWithString:@"http://localhost:49000/pinned"];
+    
+    // pins are counted and belong to the URL, it does not need to be cached
+    [cache pinCachedItemForURL:pinnedURL];
+    [cache pinCachedItemForURL:pinnedURL];
+    STAssertTrue([cache isPinnedURL:pinnedURL], @"A pinned URL must be pinned before it is cached");
+    [cache unpinCachedItemForURL:pinnedURL];
+    STAssertTrue([cache isPinnedURL:pinnedURL], @"A URL must stay pinned until every pin has been released");
+    [cache unpinCachedItemForURL:pinnedURL];
+    STAssertFalse([cache isPinnedURL:pinnedURL], @"A URL must be unpinned with its last pin");
+    [cache unpinCachedItemForURL:pinnedURL];
+    [cache pinCachedItemForURL:pinnedURL];
+    [cache unpinCachedItemForURL:pinnedURL];
+    STAssertFalse([cache isPinnedURL:pinnedURL], @"Unpinning an unpinned URL must not leave a pin behind");
+    
+    // pinned entries are not evicted, even if they have the lowest utility
+    NSURL *otherURL = [NSURL URLWithString:@"http://localhost:49000/unpinned"];
+    NSData *body = [NSMutableData dataWithLength:100];
+    [cache importObjectForURL:pinnedURL data:body];
+    [cache importObjectForURL:otherURL data:body];
+    [[cache.cachedItemInfos objectForKey:otherURL] recordAccess];
+    [[cache.cachedItemInfos objectForKey:otherURL] recordAccess];
+    [cache pinCachedItemForURL:pinnedURL];
+    AFStorageGovernor *governor = [[AFStorageGovernor alloc] init];
+    [governor registerCache:cache];
+    [governor setMinimumBytes:0 maximumBytes:150 forContext:@"pinningTest"];
+    [governor enforce];
+    STAssertNotNil([cache.cachedItemInfos objectForKey:pinnedURL], @"A pinned entry must not be evicted");
+    STAssertNil([cache.cachedItemInfos objectForKey:otherURL], @"Unpinned entries must be evicted instead");
+    STAssertEqualObjects([governor statisticsForContext:@"pinningTest"][kAFStorageGovernorContextPinnedBytesKey], @100, @"Pinned bytes must be reported");
+    [governor unregisterCache:cache];
+    [cache unpinCachedItemForURL:pinnedURL];
+    
+    // a package pins itself and its resources
+    NSURL *packageURL = [NSURL URLWithString:@"http://localhost:49000/pinned-package.zip"];
+    STAssertFalse([cache pinPackageArchiveForURL:packageURL], @"A package that has not been consumed cannot be pinned");
+    STAssertFalse([cache isPinnedURL:packageURL], @"A failed pin must not pin anything");
+    AFPackageInfo *packageInfo = [[AFPackageInfo alloc] init];
+    packageInfo.packageURL = packageURL;
+    packageInfo.resourceURLs = @[@"http://localhost:49000/pinned-package/a", @"http://localhost:49000/pinned-package/b"];
+    [cache.packageInfos setObject:packageInfo forKey:[packageURL absoluteString]];
+    STAssertTrue([cache pinPackageArchiveForURL:packageURL], @"A consumed package must be pinned");
+    [cache pinCachedItemForURL:[NSURL URLWithString:packageInfo.resourceURLs[0]]];
+    STAssertTrue([cache isPinnedURL:packageURL], @"The package must be pinned");
+    for (NSString *resourceURL in packageInfo.resourceURLs) {
+        STAssertTrue([cache isPinnedURL:[NSURL URLWithString:resourceURL]], @"The package's resources must be pinned");
+    }
+    [cache unpinPackageArchiveForURL:packageURL];
+    STAssertFalse([cache isPinnedURL:packageURL], @"The package must be unpinned");
+    STAssertTrue([cache isPinnedURL:[NSURL URLWithString:packageInfo.resourceURLs[0]]], @"Pins of a resource's own must be kept");
+    STAssertFalse([cache isPinnedURL:[NSURL URLWithString:packageInfo.resourceURLs[1]]], @"The package's resources must be unpinned");
+    
+    [cache unpinCachedItemForURL:[NSURL URLWithString:packageInfo.resourceURLs[0]]];
+    [cache.packageInfos removeObjectForKey:[packageURL absoluteString]];
+    [cache invalidateAll];
+}
+
+- (void)testDeltaPackage
+{
+    AFCache *cache = [AFCache cacheForContext:@"deltaPackageTest"];
+    [cache invalidateAll];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *baseKey = @"http://localhost:49000/delta-base.zip";
+    NSString *aURL = @"http://localhost:49000/delta/a";
+    NSString *bURL = @"http://localhost:49000/delta/b";
+    NSString *cURL = @"http://localhost:49000/delta/c";
+    
+    AFPackageInfo *basePackageInfo = [[AFPackageInfo alloc] init];
+    basePackageInfo.packageURL = [NSURL URLWithString:baseKey];
+    basePackageInfo.version = @"1";
+    basePackageInfo.resourceURLs = @[aURL, bURL];
+    [cache.packageInfos setObject:basePackageInfo forKey:baseKey];
+    NSString *readOnlyPath = [cache.dataPath stringByAppendingPathComponent:@"readonly"];
+    [fileManager createDirectoryAtPath:readOnlyPath withIntermediateDirectories:YES attributes:nil error:nil];
+    [@"old a" writeToFile:[cache.dataPath stringByAppendingPathComponent:@"a"] atomically:NO encoding:NSUTF8StringEncoding error:nil];
+    [@"old c" writeToFile:[readOnlyPath stringByAppendingPathComponent:@"c"] atomically:NO encoding:NSUTF8StringEncoding error:nil];
+    for (NSString *URL in @[aURL, bURL]) {
+        AFCacheableItemInfo *info = [[AFCacheableItemInfo alloc] init];
+        info.filename = [URL lastPathComponent];
+        [cache.cachedItemInfos setObject:info forKey:URL];
+    }
+    
+    NSString *stagingPath = [cache.dataPath stringByAppendingPathComponent:@".delta-staging"];
+    [fileManager createDirectoryAtPath:[stagingPath stringByAppendingPathComponent:@"readonly"] withIntermediateDirectories:YES attributes:nil error:nil];
+    [@"new a" writeToFile:[stagingPath stringByAppendingPathComponent:@"a"] atomically:NO encoding:NSUTF8StringEncoding error:nil];
+    [@"new c" writeToFile:[stagingPath stringByAppendingPathComponent:@"readonly/c"] atomically:NO encoding:NSUTF8StringEncoding error:nil];
+    AFCacheableItemInfo *aInfo = [[AFCacheableItemInfo alloc] init];
+    aInfo.filename = @"a";
+    AFCacheableItemInfo *cInfo = [[AFCacheableItemInfo alloc] init];
+    cInfo.filename = @"readonly/c";
+    NSMutableDictionary *manifest = [@{kAFPackageManifestBasePackageURLKey : baseKey,
+                                       kAFPackageManifestBaseVersionKey : @"0",
+                                       kAFPackageManifestVersionKey : @"2",
+                                       kAFPackageManifestRemovedKey : @[bURL],
+                                       kAFPackageManifestResourceURLsKey : @[aURL, cURL],
+                                       kAFPackageManifestCacheInfosKey : @{aURL : aInfo, cURL : cInfo}} mutableCopy];
+    STAssertFalse([cache applyDeltaPackageWithManifest:manifest stagingPath:stagingPath userData:nil], @"A delta must not apply to another version");
+    
+    // c cannot be replaced, so a has to be put back
+    manifest[kAFPackageManifestBaseVersionKey] = @"1";
+    [fileManager setAttributes:@{NSFilePosixPermissions : @0555} ofItemAtPath:readOnlyPath error:nil];
+    STAssertFalse([cache applyDeltaPackageWithManifest:manifest stagingPath:stagingPath userData:nil], @"A delta whose files cannot be moved must fail");
+    [fileManager setAttributes:@{NSFilePosixPermissions : @0755} ofItemAtPath:readOnlyPath error:nil];
+    STAssertEqualObjects([NSString stringWithContentsOfFile:[cache.dataPath stringByAppendingPathComponent:@"a"] encoding:NSUTF8StringEncoding error:nil], @"old a", @"A failed delta must restore replaced files");
+    STAssertTrue([fileManager fileExistsAtPath:[stagingPath stringByAppendingPathComponent:@"a"]], @"A failed delta must put its files back");
+    STAssertNotNil([cache.cachedItemInfos objectForKey:bURL], @"A failed delta must not remove entries");
+    STAssertEqualObjects([[cache.packageInfos objectForKey:baseKey] version], @"1", @"A failed delta must not change the package info");
+    
+    STAssertTrue([cache applyDeltaPackageWithManifest:manifest stagingPath:stagingPath userData:nil], @"The delta must apply to its base version");
+    STAssertEqualObjects([NSString stringWithContentsOfFile:[cache.dataPath stringByAppendingPathComponent:@"a"] encoding:NSUTF8StringEncoding error:nil], @"new a", @"Changed files must be replaced");
+    STAssertEqualObjects([NSString stringWithContentsOfFile:[readOnlyPath stringByAppendingPathComponent:@"c"] encoding:NSUTF8StringEncoding error:nil], @"new c", @"Added files must be moved into place");
+    STAssertNil([cache.cachedItemInfos objectForKey:bURL], @"Removed entries must be gone");
+    STAssertEquals([cache.cachedItemInfos objectForKey:cURL], cInfo, @"Added entries must be stored");
+    AFPackageInfo *packageInfo = [cache.packageInfos objectForKey:baseKey];
+    STAssertEqualObjects(packageInfo.version, @"2", @"The package info must have the delta's version");
+    STAssertEqualObjects(packageInfo.resourceURLs, (@[aURL, cURL]), @"The package info must list the resources after the delta");
+    
+    [fileManager removeItemAtPath:stagingPath error:nil];
+    [cache invalidateAll];
+}
+
+- (void)testPackageArchive
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"afcache-package-archive.zip"];
+    NSData *stored = [@"stored" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *compressible = [NSMutableData dataWithLength:4096];
+    memset([compressible mutableBytes], 'a', [compressible length]);
+    uint32_t crc = 0;
+    NSData *deflated = [AFPackageArchiveWriter deflatedData:compressible crc:&crc];
+    STAssertNotNil(deflated, @"Repetitive data must deflate");
+    
+    AFPackageArchiveWriter *writer = [[AFPackageArchiveWriter alloc] initWithPath:path];
+    [writer addEntryNamed:@"stored.txt" data:stored modificationDate:nil];
+    [writer addEntryNamed:@"dir/deflated.txt" data:compressible modificationDate:nil];
+    [writer addEntryNamed:@"corrupt.txt" compressedData:deflated method:kAFPackageArchiveMethodDeflated crc:crc + 1 uncompressedSize:[compressible length] modificationDate:nil];
+    STAssertTrue([writer close], @"The archive must be written");
+    
+    AFPackageArchive *archive = [[AFPackageArchive alloc] initWithContentsOfFile:path];
+    STAssertNotNil(archive, @"The archive must open");
+    STAssertEqualObjects([NSSet setWithArray:archive.entryNames], ([NSSet setWithObjects:@"stored.txt", @"dir/deflated.txt", @"corrupt.txt", nil]), @"The central directory must list every entry");
+    STAssertEquals([archive uncompressedSizeOfEntryNamed:@"dir/deflated.txt"], (uint64_t)[compressible length], @"The uncompressed size must be read from the central directory");
+    STAssertEquals([archive uncompressedSizeOfEntryNamed:@"missing.txt"], (uint64_t)0, @"An unknown entry has no size");
+    STAssertNil([archive dataForEntryNamed:@"missing.txt"], @"An unknown entry has no data");
+    
+    uint16_t method = 0xFFFF;
+    STAssertEqualObjects([archive dataForEntryNamed:@"stored.txt"], stored, @"A stored entry must be served as it is");
+    STAssertEqualObjects([archive compressedDataForEntryNamed:@"stored.txt" method:&method crc:NULL], stored, @"A stored entry is its own compressed data");
+    STAssertEquals(method, (uint16_t)kAFPackageArchiveMethodStored, @"The small entry must have been stored");
+    STAssertEqualObjects([archive dataForEntryNamed:@"dir/deflated.txt"], compressible, @"A deflated entry must inflate to its data");
+    STAssertEqualObjects([archive compressedDataForEntryNamed:@"dir/deflated.txt" method:&method crc:NULL], deflated, @"The compressed data must be copied as it is");
+    STAssertEquals(method, (uint16_t)kAFPackageArchiveMethodDeflated, @"The repetitive entry must have been deflated");
+    STAssertNil([archive dataForEntryNamed:@"corrupt.txt"], @"An entry with the wrong CRC must not be served");
+    
+    // the package item's file is removed when it is evicted, the linked archive stays
+    AFCache *cache = [AFCache cacheForContext:@"packageArchiveTest"];
+    NSString *itemPath = [cache.dataPath stringByAppendingPathComponent:@"package-item.zip"];
+    [[NSFileManager defaultManager] copyItemAtPath:path toPath:itemPath error:nil];
+    NSString *archivePath = [cache linkPackageArchiveAtPath:itemPath];
+    STAssertTrue([[archivePath stringByDeletingLastPathComponent] hasSuffix:kAFCachePackageArchiveDirectoryName], @"The archive must be linked into the archive directory");
+    [[NSFileManager defaultManager] removeItemAtPath:itemPath error:nil];
+    STAssertEqualObjects([[[AFPackageArchive alloc] initWithContentsOfFile:archivePath] dataForEntryNamed:@"stored.txt"], stored, @"The linked archive must outlive the package item's file");
+    [[NSFileManager defaultManager] removeItemAtPath:archivePath error:nil];
+    
+    NSData *zip = [NSData dataWithContentsOfFile:path];
+    [[zip subdataWithRange:NSMakeRange(0, [zip length] - 10)] writeToFile:path atomically:NO];
+    STAssertNil([[AFPackageArchive alloc] initWithContentsOfFile:path], @"A truncated archive must not open");
+    [stored writeToFile:path atomically:NO];
+    STAssertNil([[AFPackageArchive alloc] initWithContentsOfFile:path], @"A file that is no ZIP file must not open");
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testBaseImage
+{
+    AFCache *cache = [AFCache cacheForContext:@"baseImageTest"];
+    [cache invalidateAll];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"afcache-base-image.zip"];
+    NSString *URLString = @"http://localhost:49000/image/a";
+    NSData *body = [@"image body" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *manifest = [NSString stringWithFormat:@"version = 1\n%@ ; Mon, 01 Jan 2024 00:00:00 GMT ; Sun, 01 Jan 2090 00:00:00 GMT ; text/plain ; a.txt", URLString];
+    AFPackageArchiveWriter *writer = [[AFPackageArchiveWriter alloc] initWithPath:path];
+    [writer addEntryNamed:@"manifest.afcache" data:[manifest dataUsingEncoding:NSASCIIStringEncoding] modificationDate:nil];
+    [writer addEntryNamed:@"a.txt" data:body modificationDate:nil];
+    STAssertTrue([writer close], @"The image must be written");
+    
+    AFCacheBaseImage *image = [[AFCacheBaseImage alloc] initWithContentsOfFile:path cache:cache];
+    AFCacheableItemInfo *first = [image newInfoForURLString:URLString];
+    AFCacheableItemInfo *second = [image newInfoForURLString:@"HTTP://localhost:49000/image/a"];
+    STAssertNotNil(first, @"The image must have an info for its entry");
+    STAssertTrue(first != second, @"Every lookup must get an info of its own");
+    STAssertEqualObjects(second.expireDate, first.expireDate, @"The parsed entry must be reused");
+    STAssertEqualObjects(first.mimeType, @"text/plain", @"The MIME type must be taken from the manifest");
+    STAssertEquals(first.contentLength, (uint64_t)[body length], @"The content length must be taken from the archive");
+    STAssertEqualObjects(first.bodySourceKey, image.bodySourceKey, @"The image must be the entry's body source");
+    first.expireDate = [NSDate distantPast];
+    STAssertEqualObjects([image newInfoForURLString:URLString].expireDate, second.expireDate, @"Changing an info must not change the image");
+    STAssertNil([image newInfoForURLString:@"http://localhost:49000/image/missing"], @"The image must have no info for other URLs");
+    
+    STAssertNil([cache bodySourceForKey:image.bodySourceKey], @"An image that is not mounted must not serve bodies");
+    STAssertTrue([cache mountBaseImageAtPath:path], @"The image must mount");
+    STAssertEqualObjects([cache bodyForItemInfo:second], body, @"The mounted image must serve its bodies");
+    [cache.cachedItemInfos setObject:second forKey:URLString];
+    [cache unmountBaseImage];
+    STAssertNil([cache bodyForItemInfo:second], @"An unmounted image must not serve bodies");
+    STAssertTrue([cache mountBaseImageAtPath:path], @"The image must mount again");
+    STAssertEqualObjects([cache bodyForItemInfo:second], body, @"Stored entries must find their image once it is mounted again");
+    
+    [cache unmountBaseImage];
+    [cache invalidateAll];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+// records a lookup of key at offset seconds from the start of the trace
+- (void)addTraceRecordWithKey:(NSString*)key offset:(NSTimeInterval)offset size:(uint64_t)size freshnessLifetime:(NSTimeInterval)freshnessLifetime
+                       status:(AFCacheTraceStatus)status start:(NSTimeInterval)start recorder:(AFCacheTraceRecorder*)recorder
+{
+    NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+    AFCacheTraceRecord record;
+    record.timestamp = start + offset;
+    record.duration = 0.1;
+    record.keyHash = [AFCacheKey hash128OfBytes:[keyData bytes] length:[keyData length]];
+    record.size = size;
+    record.freshnessLifetime = freshnessLifetime;
+    record.status = status;
+    [recorder addRecord:record];
+}
+
+- (void)testGarbageCollectorWalk
+{
+    AFCache *cache = [AFCache cacheForContext:@"garbageCollectorTest"];
+    [cache invalidateAll];
+    NSURL *url = [NSURL URLWithString:@"http://localhost:49000/garbage-collector-live"];
+    [cache importObjectForURL:url data:[NSMutableData dataWithLength:10]];
+    NSString *livePath = [cache fullPathForCacheableItem:[cache cacheableItemFromCacheStore:url]];
+    
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    [fileManager createDirectoryAtPath:[cache.dataPath stringByAppendingPathComponent:@"sub"] withIntermediateDirectories:YES attributes:nil error:nil];
+    NSArray *orphans = @[@"a-orphan", @"sub/b-orphan", @"sub/c-orphan", @"z-orphan"];
+    NSDictionary *oldAttributes = @{NSFileModificationDate : [NSDate dateWithTimeIntervalSinceNow:-3600]};
+    for (NSString *orphan in orphans) {
+        NSString *path = [cache.dataPath stringByAppendingPathComponent:orphan];
+        [[NSData dataWithBytes:"x" length:1] writeToFile:path atomically:NO];
+        [fileManager setAttributes:oldAttributes ofItemAtPath:path error:nil];
+    }
+    [fileManager setAttributes:oldAttributes ofItemAtPath:livePath error:nil];
+    
+    AFCacheGarbageCollector *collector = [[AFCacheGarbageCollector alloc] initWithCache:cache];
+    collector.sliceDuration = 10;
+    collector.minimumAge = 60;
+    
+    // an interrupted walk continues after the file examined last
+    collector.cursor = @"sub/b-orphan";
+    STAssertTrue([collector collectSlice], @"The walk should be complete in a single slice");
+    STAssertNil(collector.cursor, @"A complete walk must clear the cursor");
+    STAssertTrue([fileManager fileExistsAtPath:[cache.dataPath stringByAppendingPathComponent:@"a-orphan"]], @"Files before the cursor are not visited again");
+    STAssertTrue([fileManager fileExistsAtPath:[cache.dataPath stringByAppendingPathComponent:@"sub/b-orphan"]], @"The file at the cursor is not visited again");
+    STAssertFalse([fileManager fileExistsAtPath:[cache.dataPath stringByAppendingPathComponent:@"sub/c-orphan"]], @"Files after the cursor in its directory are visited");
+    STAssertFalse([fileManager fileExistsAtPath:[cache.dataPath stringByAppendingPathComponent:@"z-orphan"]], @"Directories after the cursor's are visited");
+    
+    STAssertTrue([collector collectSlice], @"The next walk should be complete in a single slice");
+    STAssertFalse([fileManager fileExistsAtPath:[cache.dataPath stringByAppendingPathComponent:@"a-orphan"]], @"A new walk starts at the beginning");
+    STAssertFalse([fileManager fileExistsAtPath:[cache.dataPath stringByAppendingPathComponent:@"sub/b-orphan"]], @"A new walk visits every file");
+    STAssertTrue([fileManager fileExistsAtPath:livePath], @"The files of entries must be kept");
+    
+    NSDictionary *statistics = [collector statistics];
+    STAssertEquals([statistics[kAFCacheGarbageCollectorPassesKey] unsignedIntegerValue], (NSUInteger)2, @"Both walks should be counted");
+    STAssertTrue([statistics[kAFCacheGarbageCollectorRemovedFilesKey] unsignedIntegerValue] >= [orphans count], @"Every orphan should be counted");
+    
+    // a young file may still be written
+    NSString *youngPath = [cache.dataPath stringByAppendingPathComponent:@"young-orphan"];
+    [[NSData dataWithBytes:"x" length:1] writeToFile:youngPath atomically:NO];
+    [collector collectSlice];
+    STAssertTrue([fileManager fileExistsAtPath:youngPath], @"Files younger than minimumAge must be kept");
+    
+    // a file written again after its entry was removed is kept, even within the same second
+    NSString *rewrittenPath = [cache.dataPath stringByAppendingPathComponent:@"rewritten"];
+    NSString *removedPath = [cache.dataPath stringByAppendingPathComponent:@"removed"];
+    [[NSData dataWithBytes:"x" length:1] writeToFile:removedPath atomically:NO];
+    NSDate *removalDate = [NSDate date];
+    [NSThread sleepForTimeInterval:0.01];
+    [[NSData dataWithBytes:"x" length:1] writeToFile:rewrittenPath atomically:NO];
+    [collector removeFilesAtPaths:@[removedPath, rewrittenPath] unlessModifiedAfter:removalDate];
+    [collector statistics]; // waits for the removal
+    STAssertTrue([fileManager fileExistsAtPath:rewrittenPath], @"Files modified after the removal must be kept");
+    [collector removeFilesAtPaths:@[removedPath] unlessModifiedAfter:[NSDate dateWithTimeIntervalSinceNow:1]];
+    [collector statistics];
+    STAssertFalse([fileManager fileExistsAtPath:removedPath], @"Files not modified after the removal must be unlinked");
+    
+    [fileManager removeItemAtPath:rewrittenPath error:nil];
+    [fileManager removeItemAtPath:youngPath error:nil];
+    [fileManager removeItemAtPath:[cache.dataPath stringByAppendingPathComponent:@"sub"] error:nil];
+    [cache invalidateAll];
+}
+
+- (void)testTraceReplay
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"afcache-replay.trace"];
+    NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate];
+    AFCacheTraceRecorder *recorder = [[AFCacheTraceRecorder alloc] initWithPath:path];
+    [self addTraceRecordWithKey:@"a" offset:0 size:100 freshnessLifetime:60 status:kAFCacheTraceStatusMiss start:start recorder:recorder];
+    [self addTraceRecordWithKey:@"a" offset:10 size:100 freshnessLifetime:60 status:kAFCacheTraceStatusHit start:start recorder:recorder];
+    [self addTraceRecordWithKey:@"b" offset:20 size:50 freshnessLifetime:0 status:kAFCacheTraceStatusMiss start:start recorder:recorder];
+    [self addTraceRecordWithKey:@"b" offset:30 size:60 freshnessLifetime:0 status:kAFCacheTraceStatusRevalidated start:start recorder:recorder];
+    [self addTraceRecordWithKey:@"c" offset:40 size:0 freshnessLifetime:0 status:kAFCacheTraceStatusFailed start:start recorder:recorder];
+    [self addTraceRecordWithKey:@"a" offset:100 size:100 freshnessLifetime:60 status:kAFCacheTraceStatusRevalidated start:start recorder:recorder];
+    [self addTraceRecordWithKey:@"a" offset:110 size:100 freshnessLifetime:60 status:kAFCacheTraceStatusHit start:start recorder:recorder];
+    [recorder close];
+    
+    AFCacheTraceReader *reader = [[AFCacheTraceReader alloc] initWithPath:path];
+    STAssertNotNil(reader, @"The trace must be read");
+    STAssertEquals(reader.recordCount, (NSUInteger)7, @"Every record must be read");
+    STAssertEqualsWithAccuracy(reader.startTimestamp, start, 1.0, @"The start of the recording must be read");
+    AFCacheTraceRecord record;
+    for (NSUInteger i = 0; i < 4; i++) {
+        STAssertTrue([reader readRecord:&record], @"Record %lu must be read", (unsigned long)i);
+    }
+    NSData *keyData = [@"b" dataUsingEncoding:NSUTF8StringEncoding];
+    AFCacheKeyHash128 keyHash = [AFCacheKey hash128OfBytes:[keyData bytes] length:[keyData length]];
+    STAssertEqualsWithAccuracy(record.timestamp, start + 30, 0.01, @"Timestamps are kept to the millisecond");
+    STAssertEqualsWithAccuracy(record.duration, 0.1, 0.001, @"Durations are kept to the millisecond");
+    STAssertTrue(record.keyHash.h1 == keyHash.h1 && record.keyHash.h2 == keyHash.h2, @"The key's hash must be kept");
+    STAssertEquals(record.size, (uint64_t)60, @"The size must be kept");
+    STAssertEquals(record.status, kAFCacheTraceStatusRevalidated, @"The status must be kept");
+    [reader rewind];
+    STAssertTrue([reader readRecord:&record] && record.freshnessLifetime == 60, @"Rewinding must start over");
+    
+    // the replay keeps its time to itself
+    AFCacheManualClock *clock = [[AFCacheManualClock alloc] initWithTime:0];
+    [AFCacheClock setCurrentClock:clock];
+    AFCacheSimulator *simulator = [[AFCacheSimulator alloc] initWithTraceReader:reader];
+    AFCacheSimulatorConfiguration *configuration = [[AFCacheSimulatorConfiguration alloc] init];
+    configuration.byteBudget = 0;
+    NSDictionary *result = [simulator runWithConfiguration:configuration];
+    STAssertEquals([AFCacheClock currentClock], (AFCacheClock*)clock, @"A replay must not change the process's clock");
+    STAssertEquals([clock now], (NSTimeInterval)0, @"A replay must not move the process's clock");
+    [AFCacheClock setCurrentClock:nil];
+    
+    STAssertEquals([result[kAFCacheSimulatorRequestsKey] unsignedIntegerValue], (NSUInteger)7, @"Every lookup is a request");
+    STAssertEquals([result[kAFCacheSimulatorHitsKey] unsignedIntegerValue], (NSUInteger)2, @"Fresh entries are hits");
+    STAssertEquals([result[kAFCacheSimulatorMissesKey] unsignedIntegerValue], (NSUInteger)2, @"Unknown keys are misses");
+    STAssertEquals([result[kAFCacheSimulatorRevalidationsKey] unsignedIntegerValue], (NSUInteger)2, @"Stale entries are revalidated");
+    STAssertEquals([result[kAFCacheSimulatorFailuresKey] unsignedIntegerValue], (NSUInteger)1, @"Failed lookups are counted");
+    STAssertEquals([result[kAFCacheSimulatorRequestedBytesKey] unsignedLongLongValue], (uint64_t)510, @"Requested bytes");
+    STAssertEquals([result[kAFCacheSimulatorHitBytesKey] unsignedLongLongValue], (uint64_t)200, @"Hit bytes");
+    STAssertEquals([result[kAFCacheSimulatorTransferredBytesKey] unsignedLongLongValue], (uint64_t)210, @"Only misses and modified entries are downloaded");
+    STAssertEquals([result[kAFCacheSimulatorEvictedItemsKey] unsignedIntegerValue], (NSUInteger)0, @"Nothing is evicted without a budget");
+    
+    configuration.byteBudget = 100;
+    configuration.enforcementInterval = 1;
+    result = [simulator runWithConfiguration:configuration];
+    STAssertTrue([result[kAFCacheSimulatorEvictedItemsKey] unsignedIntegerValue] > 0, @"The budget must be enforced");
+    STAssertNil([[AFStorageGovernor sharedGovernor] statisticsForContext:@"simulator"], @"A replay must enforce with a governor of its own");
+    STAssertEquals([result[kAFCacheSimulatorRequestsKey] unsignedIntegerValue], (NSUInteger)7, @"Every replay starts at the beginning");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (NSArray*)sortedURLStringsOfKeys:(NSArray*)keys
+{
+    return [[keys valueForKey:@"URLString"] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+- (void)testInvalidationIndex
+{
+    STAssertEqualObjects([AFCacheInvalidationIndex tagsInHeaderValue:@" a b,c ,, a\tb "], (@[@"a", @"b", @"c"]), @"Tags are separated by spaces or commas");
+    STAssertNil([AFCacheInvalidationIndex tagsInHeaderValue:@" , "], @"A value without tags has none");
+    STAssertNil([AFCacheInvalidationIndex tagsInHeaderValue:nil], @"A missing header has no tags");
+    
+    [AFCacheableItemInfo retainHeaderNamed:kAFCacheDefaultSurrogateKeyHeaderName];
+    NSArray *URLStrings = @[@"http://localhost:49000/api/items/1", @"http://localhost:49000/api/items/2",
+                            @"http://localhost:49000/api.json", @"http://localhost:49000/apidocs/index", @"http://localhost:49000/other"];
+    NSArray *tagHeaders = @[@"item-1 items", @"items", @"", @"docs", @""];
+    NSMutableArray *infos = [NSMutableArray array];
+    AFCacheInfoStore *store = [AFCacheInfoStore dictionary];
+    AFCacheInvalidationIndex *index = [[AFCacheInvalidationIndex alloc] initWithTagHeaderName:kAFCacheDefaultSurrogateKeyHeaderName];
+    for (NSUInteger i = 0; i < [URLStrings count]; i++) {
+        AFCacheableItemInfo *info = [[AFCacheableItemInfo alloc] init];
+        info.headers = @{@"surrogate-key" : tagHeaders[i], @"Content-Type" : @"text/plain"};
+        [infos addObject:info];
+        [store setObject:info forKey:URLStrings[i]];
+        if (i == 1) {
+            // entries stored before are indexed when the index is attached
+            [index attachToInfoStore:store];
+        }
+    }
+    
+    NSString *items1 = [AFCacheKey normalizedURLString:URLStrings[0]];
+    NSString *items2 = [AFCacheKey normalizedURLString:URLStrings[1]];
+    NSString *json = [AFCacheKey normalizedURLString:URLStrings[2]];
+    NSString *docs = [AFCacheKey normalizedURLString:URLStrings[3]];
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithPrefix:@"http://localhost:49000/api/"]], (@[items1, items2]), @"A prefix ending in / matches what is beneath");
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithPrefix:@"http://localhost:49000/api"]], ([@[items1, items2, json, docs] sortedArrayUsingSelector:@selector(compare:)]), @"A prefix matches the start of a component");
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithPrefix:@"HTTP://LOCALHOST:49000/api/items/1"]], (@[items1]), @"Prefixes are normalized like keys");
+    STAssertEquals([[index keysWithPrefix:@"http://localhost:49000/none/"] count], (NSUInteger)0, @"An unknown prefix matches nothing");
+    
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithTag:@"items"]], (@[items1, items2]), @"Every key of a tag must be found");
+    STAssertEquals([[index keysWithTag:@"Items"] count], (NSUInteger)0, @"Tags are case-sensitive");
+    STAssertEqualObjects([index tagsOfKey:[AFCacheKey keyWithURLString:URLStrings[0]]], (@[@"item-1", @"items"]), @"The tags of a key must be found");
+    STAssertNil([index tagsOfKey:[AFCacheKey keyWithURLString:URLStrings[2]]], @"An entry without tags has none");
+    
+    // headers updated in place, e.g. by a 304, are indexed when the entry is stored again
+    [(AFCacheableItemInfo*)infos[0] setHeaders:@{@"Surrogate-Key" : @"item-1"}];
+    [store setObject:infos[0] forKey:URLStrings[0]];
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithTag:@"items"]], (@[items2]), @"Tags that were dropped must be forgotten");
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithTag:@"item-1"]], (@[items1]), @"Tags that were kept must be kept");
+    
+    [store removeObjectForKey:URLStrings[1]];
+    STAssertEquals([[index keysWithTag:@"items"] count], (NSUInteger)0, @"Removed entries must leave their tags");
+    STAssertEqualObjects([self sortedURLStringsOfKeys:[index keysWithPrefix:@"http://localhost:49000/api/"]], (@[items1]), @"Removed entries must leave the trie");
+    STAssertEqualObjects([index statistics][kAFCacheInvalidationIndexKeysKey], @4, @"The index must count its keys");
+    
+    [index attachToInfoStore:nil];
+}
+
+- (void)testCacheKeys
+{
+    STAssertEqualObjects([AFCacheKey normalizedURLString:@"HTTP://Example.COM:80/a#frag"], @"http://example.com/a", @"Scheme, host, default port and fragment must be normalized");
+    STAssertEqualObjects([AFCacheKey normalizedURLString:@"http://host?x"], @"http://host/?x", @"An empty path must become /");
+    STAssertEqualObjects([AFCacheKey normalizedURLString:@"https://User@Host:8443/Path"], @"https://User@host:8443/Path", @"User info, other ports and the path must be kept");
+    
+    AFCacheKey *key = [AFCacheKey keyWithURLString:@"http://Localhost:80/item#top"];
+    AFCacheKey *equalKey = [AFCacheKey keyWithURL:[NSURL URLWithString:@"http://localhost/item"]];
+    STAssertEqualObjects(key, equalKey, @"Keys of equivalent URLs must be equal");
+    STAssertEquals([key hash], [equalKey hash], @"Equal keys must have equal hashes");
+    STAssertFalse([key isEqual:[AFCacheKey keyWithURLString:@"http://localhost/Item"]], @"Paths are case-sensitive");
+    
+    AFCacheKeyHash128 hash = [AFCacheKey hash128OfBytes:"hello" length:5];
+    STAssertEquals(hash.h1, 0xcbd8a7b341bd9b02ULL, @"The hash must be MurmurHash3_x64_128");
+    STAssertEquals(hash.h2, 0x5b1e906a48ae1d19ULL, @"The hash must be MurmurHash3_x64_128");
+    
+    AFCacheInfoStore *store = [AFCacheInfoStore dictionary];
+    [store setObject:@"a" forKey:@"http://localhost/item"];
+    STAssertEqualObjects([store objectForKey:key], @"a", @"A string key must be found by its cache key");
+    STAssertEqualObjects([store objectForKey:@"HTTP://localhost/item"], @"a", @"A string key must be normalized");
+    STAssertEqualObjects([store allKeys], @[@"http://localhost/item"], @"The store must enumerate URL strings");
+}
+
+- (void)testRetryPolicyDecisions
+{
+    AFRetryPolicy *policy = [[AFRetryPolicy alloc] init];
+    policy.jitter = 0;
+    policy.retryBudgetCapacity = 2;
+    policy.retryBudgetRatio = 0.5;
+
+    STAssertEquals([policy retryDelayForStatusCode:404 error:nil retryCount:0 retryAfter:nil], kAFRetryPolicyNoRetry, @"A 404 must not be retried");
+    NSError *cancelled = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+    STAssertEquals([policy retryDelayForStatusCode:0 error:cancelled retryCount:0 retryAfter:nil], kAFRetryPolicyNoRetry, @"A cancelled request must not be retried");
+    STAssertEquals([policy retryDelayForStatusCode:503 error:nil retryCount:3 retryAfter:nil], kAFRetryPolicyNoRetry, @"Retries must stop after maximumRetryCount");
+
+    NSError *timedOut = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil];
+    STAssertEqualsWithAccuracy([policy retryDelayForStatusCode:0 error:timedOut retryCount:1 retryAfter:nil], 1.0, 0.001, @"The second retry waits twice the initial backoff");
+    STAssertEqualsWithAccuracy([policy retryDelayForStatusCode:503 error:nil retryCount:0 retryAfter:@"7"], 7.0, 0.001, @"Retry-After must be honored");
+    STAssertEquals([policy retryDelayForStatusCode:503 error:nil retryCount:0 retryAfter:nil], kAFRetryPolicyNoRetry, @"The budget must be exhausted");
+
+    [policy recordAttempt];
+    [policy recordAttempt];
+    STAssertTrue([policy retryDelayForStatusCode:503 error:nil retryCount:0 retryAfter:nil] >= 0, @"Attempts must refill the budget");
+    STAssertEquals([[policy statistics][kAFRetryPolicyRetriesDeniedByBudgetKey] unsignedIntegerValue], (NSUInteger)1, @"The denied retry must be counted");
+}
+
+/*
+ * Needs testserver.py, which fails requests of /flaky as told by the query
+ */
+- (AFCacheableItem*)waitForItemWithURLString:(NSString*)URLString success:(BOOL*)success
+{
+    __block BOOL requestHandled = NO;
+    __block BOOL requestSucceeded = NO;
+    __block AFCacheableItem *result = nil;
+    [[AFCache sharedInstance] cacheItemForURL:[NSURL URLWithString:URLString]
+                                urlCredential:nil
+                              completionBlock:^(AFCacheableItem *item) {
+                                  result = item;
+                                  requestSucceeded = YES;
+                                  requestHandled = YES;
+                              }
+                                    failBlock:^(AFCacheableItem *item) {
+                                        result = item;
+                                        requestHandled = YES;
+                                    }];
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:20.0];
+    while (!requestHandled && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    }
+    *success = requestSucceeded;
+    return result;
+}
+
+- (void)testRetryPolicyAgainstFaultyServer
+{
+    AFCache *cache = [AFCache sharedInstance];
+    AFRetryPolicy *policy = [[AFRetryPolicy alloc] init];
+    policy.initialBackoff = 0.05;
+    cache.retryPolicy = policy;
+    NSString *run = [[NSProcessInfo processInfo] globallyUniqueString];
+    BOOL success = NO;
+
+    // two 503s, then the body
+    NSString *flaky = [NSString stringWithFormat:@"http://localhost:49000/flaky?id=%@-retry&failures=2", run];
+    AFCacheableItem *item = [self waitForItemWithURLString:flaky success:&success];
+    STAssertTrue(success, @"Transient errors must be retried");
+    STAssertEquals([item.data length], (NSUInteger)100, @"The body of the successful retry must be delivered");
+
+    // a dropped connection is retried as well
+    NSString *dropped = [NSString stringWithFormat:@"http://localhost:49000/flaky?id=%@-dropped&status=0", run];
+    [self waitForItemWithURLString:dropped success:&success];
+    STAssertTrue(success, @"A lost connection must be retried");
+
+    // a 404 is not
+    NSString *missing = [NSString stringWithFormat:@"http://localhost:49000/flaky?id=%@-missing&status=404", run];
+    [self waitForItemWithURLString:missing success:&success];
+    STAssertFalse(success, @"A 404 must fail without retry");
+
+    // served once, stale after a second, then every revalidation fails
+    policy.serveStaleOnError = YES;
+    policy.maximumRetryCount = 1;
+    NSString *stale = [NSString stringWithFormat:@"http://localhost:49000/flaky?id=%@-stale&after=1&failures=100&maxAge=1", run];
+    [self waitForItemWithURLString:stale success:&success];
+    STAssertTrue(success, @"The first request must succeed");
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:1.5]];
+    item = [self waitForItemWithURLString:stale success:&success];
+    STAssertTrue(success, @"The stale entry must be served when revalidating fails");
+    STAssertEquals(item.cacheStatus, kCacheStatusStale, @"The entry must be flagged as stale");
+    STAssertTrue([[policy statistics][kAFRetryPolicyStaleResponsesKey] unsignedIntegerValue] >= 1, @"The stale response must be counted");
+
+    cache.retryPolicy = nil;
+}
+
+- (void)testByteRanges
+{
+    NSArray *ranges = [AFHTTPRangeResponse rangesForHeader:@"bytes=0-9, 20-, -5" length:100];
+    STAssertEquals([ranges count], (NSUInteger)3, @"All three ranges must be parsed");
+    STAssertTrue(NSEqualRanges([ranges[0] rangeValue], NSMakeRange(0, 10)), @"A closed range must be parsed");
+    STAssertTrue(NSEqualRanges([ranges[1] rangeValue], NSMakeRange(20, 80)), @"An open-ended range must end with the body");
+    STAssertTrue(NSEqualRanges([ranges[2] rangeValue], NSMakeRange(95, 5)), @"A suffix range must cover the last bytes");
+    ranges = [AFHTTPRangeResponse rangesForHeader:@"bytes=90-200" length:100];
+    STAssertTrue(NSEqualRanges([ranges[0] rangeValue], NSMakeRange(90, 10)), @"A range must be clipped to the body");
+    STAssertNil([AFHTTPRangeResponse rangesForHeader:@"bytes=5-2" length:100], @"An inverted range is invalid");
+    STAssertNil([AFHTTPRangeResponse rangesForHeader:@"items=0-1" length:100], @"Only byte ranges are supported");
+    STAssertEquals([[AFHTTPRangeResponse rangesForHeader:@"bytes=100-" length:100] count], (NSUInteger)0, @"A range beyond the body is unsatisfiable");
+
+    NSMutableData *data = [NSMutableData dataWithCapacity:100];
+    for (uint8_t i = 0; i < 100; i++) {
+        [data appendBytes:&i length:1];
+    }
+    NSURL *url = [NSURL URLWithString:@"http://localhost:49000/ranges"];
+    AFCacheableItem *item = [[AFCacheableItem alloc] initWithURL:url lastModified:[NSDate date] expireDate:nil];
+    item.data = data;
+    STAssertEquals([item bodyLength], (uint64_t)100, @"The body length must be that of the data");
+    STAssertEqualObjects([item dataInRange:NSMakeRange(10, 5)], [data subdataWithRange:NSMakeRange(10, 5)], @"The bytes of the range must be returned");
+    STAssertNil([item dataInRange:NSMakeRange(98, 5)], @"A range beyond the body must not be read");
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+    [request setValue:@"bytes=10-19" forHTTPHeaderField:@"Range"];
+    AFHTTPRangeResponse *response = [[AFHTTPRangeResponse alloc] initWithRequest:request item:item];
+    STAssertEquals([response.response statusCode], (NSInteger)206, @"A single range must be answered with 206");
+    STAssertEqualObjects([response.response allHeaderFields][@"Content-Range"], @"bytes 10-19/100", @"The Content-Range must describe the range");
+    STAssertEqualObjects([response body], [data subdataWithRange:NSMakeRange(10, 10)], @"The body must be the bytes of the range");
+
+    [request setValue:@"bytes=0-1,-2" forHTTPHeaderField:@"Range"];
+    response = [[AFHTTPRangeResponse alloc] initWithRequest:request item:item];
+    STAssertTrue([[response.response allHeaderFields][@"Content-Type"] hasPrefix:@"multipart/byteranges"], @"Several ranges must be answered with a multipart body");
+    STAssertEquals((uint64_t)[[response body] length], response.contentLength, @"The Content-Length must match the multipart body");
+
+    [request setValue:@"bytes=200-" forHTTPHeaderField:@"Range"];
+    response = [[AFHTTPRangeResponse alloc] initWithRequest:request item:item];
+    STAssertEquals([response.response statusCode], (NSInteger)416, @"An unsatisfiable range must be answered with 416");
+
+    [request setValue:@"bytes=0-1" forHTTPHeaderField:@"Range"];
+    [request setValue:@"\"outdated\"" forHTTPHeaderField:@"If-Range"];
+    STAssertNil([[AFHTTPRangeResponse alloc] initWithRequest:request item:item], @"A mismatching If-Range must be served whole");
+
+    // a body source is read once per response, however many chunks the ranges take
+    AFCache *cache = [AFCache cacheForContext:@"rangeTest"];
+    AFCountingBodySource *bodySource = [[AFCountingBodySource alloc] init];
+    NSMutableData *sourceBody = [NSMutableData dataWithLength:kAFHTTPRangeResponseChunkSize * 2 + 100];
+    memset([sourceBody mutableBytes], 'b', [sourceBody length]);
+    bodySource.body = sourceBody;
+    [cache registerBodySource:bodySource forKey:@"counting"];
+    AFCacheableItem *sourceItem = [[AFCacheableItem alloc] initWithURL:url lastModified:[NSDate date] expireDate:nil];
+    sourceItem.cache = cache;
+    sourceItem.info.bodySourceKey = @"counting";
+    sourceItem.info.bodySourceEntry = @"body";
+    sourceItem.info.contentLength = [sourceBody length];
+    STAssertEquals([sourceItem bodyLength], (uint64_t)[sourceBody length], @"The body length must be that of the info");
+    STAssertEquals(bodySource.readCount, (NSUInteger)0, @"The body length must not read the body");
+    request = [NSMutableURLRequest requestWithURL:url];
+    [request setValue:@"bytes=1-,0-9" forHTTPHeaderField:@"Range"];
+    response = [[AFHTTPRangeResponse alloc] initWithRequest:request item:sourceItem];
+    STAssertEquals((uint64_t)[[response body] length], response.contentLength, @"The Content-Length must match the multipart body");
+    STAssertEquals(bodySource.readCount, (NSUInteger)1, @"The body source must be read once");
+    [cache unregisterBodySourceForKey:@"counting"];
+}
+
+/*
+ * Run by testSharedStoreAcrossProcesses in a process of its own, spawned with the test runner and the environment
+ * variable set to the shared directory. Signals on kAFCacheTestsReadyFD that it has claimed the download and
+ * dies holding the claim once told so on kAFCacheTestsProceedFD.
+ */
+- (void)testSharedStoreChildProcess
+{
+    NSString *directory = [[NSProcessInfo processInfo] environment][kAFCacheTestsSharedStoreDirectoryVariable];
+    if (!directory) {
+        return;
+    }
+    AFCacheSharedStore *childStore = [[AFCacheSharedStore alloc] initWithDirectory:directory];
+    childStore.flushInterval = 0;
+    AFCacheInfoStore *childInfos = [AFCacheInfoStore dictionary];
+    [childStore setInfoStore:childInfos forName:@"infos"];
+    [childStore synchronize];
+    childInfos[@"http://localhost:49000/shared/a"] = @"a";
+    childInfos[@"http://localhost:49000/shared/b"] = @"b";
+    [childInfos removeObjectForKey:@"http://localhost:49000/shared/b"];
+    [childStore flush];
+    char claimed = [childStore beginDownloadForKey:[AFCacheKey keyWithURLString:kAFCacheTestsClaimedURLString]] ? 1 : 0;
+    write(kAFCacheTestsReadyFD, &claimed, 1);
+    read(kAFCacheTestsProceedFD, &claimed, 1);
+    _exit(0);
+}
+
+- (void)testSharedStoreAcrossProcesses
+{
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    AFCacheKey *claimedKey = [AFCacheKey keyWithURLString:kAFCacheTestsClaimedURLString];
+    int ready[2];
+    int proceed[2];
+    STAssertEquals(pipe(ready), 0, @"The pipe must be created");
+    STAssertEquals(pipe(proceed), 0, @"The pipe must be created");
+
+    // Foundation must not be used in a forked child, the test runner is started again to run testSharedStoreChildProcess
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_adddup2(&fileActions, ready[1], kAFCacheTestsReadyFD);
+    posix_spawn_file_actions_adddup2(&fileActions, proceed[0], kAFCacheTestsProceedFD);
+    NSArray *arguments = @[[[NSBundle mainBundle] executablePath], @"-SenTest",
+                           [NSString stringWithFormat:@"%@/testSharedStoreChildProcess", NSStringFromClass([self class])],
+                           [[NSBundle bundleForClass:[self class]] bundlePath]];
+    NSMutableArray *environment = [NSMutableArray array];
+    [[[NSProcessInfo processInfo] environment] enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSString *value, BOOL *stop) {
+        [environment addObject:[NSString stringWithFormat:@"%@=%@", name, value]];
+    }];
+    [environment addObject:[NSString stringWithFormat:@"%@=%@", kAFCacheTestsSharedStoreDirectoryVariable, directory]];
+    char **argv = calloc([arguments count] + 1, sizeof(char*));
+    char **envp = calloc([environment count] + 1, sizeof(char*));
+    [arguments enumerateObjectsUsingBlock:^(NSString *argument, NSUInteger index, BOOL *stop) {
+        argv[index] = (char*)[argument fileSystemRepresentation];
+    }];
+    [environment enumerateObjectsUsingBlock:^(NSString *variable, NSUInteger index, BOOL *stop) {
+        envp[index] = (char*)[variable UTF8String];
+    }];
+    pid_t child = 0;
+    int spawnResult = posix_spawn(&child, argv[0], &fileActions, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&fileActions);
+    free(argv);
+    free(envp);
+    close(ready[1]);
+    close(proceed[0]);
+    STAssertEquals(spawnResult, 0, @"The child process must be spawned");
+    if (spawnResult != 0) {
+        close(ready[0]);
+        close(proceed[1]);
+        return;
+    }
+
+    AFCacheSharedStore *store = [[AFCacheSharedStore alloc] initWithDirectory:directory];
+    store.flushInterval = 0;
+    AFCacheInfoStore *infos = [AFCacheInfoStore dictionary];
+    [store setInfoStore:infos forName:@"infos"];
+    char claimed = 0;
+    read(ready[0], &claimed, 1);
+    STAssertEquals(claimed, (char)1, @"The child must claim the download");
+    STAssertFalse([store beginDownloadForKey:claimedKey], @"A download claimed by a live process must not start");
+    STAssertEquals([store downloadingProcessForKey:claimedKey], child, @"The claim must be the child's");
+
+    // appended behind the child's records and read back by the same synchronize
+    NSMutableString *liveObject = [NSMutableString stringWithString:@"archived"];
+    infos[@"http://localhost:49000/shared/live"] = liveObject;
+    [liveObject setString:@"modified"];
+    [store synchronize];
+    STAssertTrue(infos[@"http://localhost:49000/shared/live"] == liveObject, @"Own records must not replace the stored object");
+    STAssertEquals([[store statistics][kAFCacheSharedStoreReplayedRecordsKey] unsignedIntegerValue], (NSUInteger)3, @"Only the child's records must be replayed");
+    STAssertEqualObjects(infos[@"http://localhost:49000/shared/a"], @"a", @"Entries of another process must be replayed");
+    STAssertNil(infos[@"http://localhost:49000/shared/b"], @"Removals of another process must be replayed");
+    infos[@"http://localhost:49000/shared/c"] = @"c";
+    [store synchronize];
+    STAssertEqualObjects(infos[@"http://localhost:49000/shared/c"], @"c", @"Own entries must survive replaying the journal");
+
+    // another store, as if of another process, checkpoints before this one has replayed its own appended record
+    __block NSDictionary *checkpoint = nil;
+    AFCacheSharedStore *otherStore = [[AFCacheSharedStore alloc] initWithDirectory:directory];
+    otherStore.flushInterval = 0;
+    AFCacheInfoStore *otherInfos = [AFCacheInfoStore dictionary];
+    [otherStore setInfoStore:otherInfos forName:@"infos"];
+    otherStore.checkpointWriter = ^{
+        checkpoint = @{@"infos" : [otherInfos snapshot]};
+    };
+    store.checkpointLoader = ^NSDictionary*{
+        return checkpoint;
+    };
+    [otherStore checkpoint];
+    infos[@"http://localhost:49000/shared/d"] = @"d";
+    [store flush];
+    [store synchronize];
+    STAssertEquals([[store statistics][kAFCacheSharedStoreReloadsKey] unsignedIntegerValue], (NSUInteger)1, @"The checkpoint must be reloaded");
+    STAssertEqualObjects(infos[@"http://localhost:49000/shared/c"], @"c", @"Own entries must be reloaded from the checkpoint");
+    STAssertEqualObjects(infos[@"http://localhost:49000/shared/d"], @"d", @"Own records appended after the checkpoint must survive reloading it");
+    [otherStore close];
+
+    write(proceed[1], &claimed, 1);
+    int status = 0;
+    waitpid(child, &status, 0);
+    STAssertTrue([store beginDownloadForKey:claimedKey], @"The claim of a dead process must be taken over");
+    STAssertEquals([[store statistics][kAFCacheSharedStoreTakenOverClaimsKey] unsignedIntegerValue], (NSUInteger)1, @"The takeover must be counted");
+    [store endDownloadForKey:claimedKey];
+    STAssertEquals([store downloadingProcessForKey:claimedKey], (pid_t)0, @"The claim must be released");
+
+    // more claims than slots, one after the other
+    for (NSUInteger i = 0; i <= kAFCacheSharedStoreSlotCount; i++) {
+        @autoreleasepool {
+            AFCacheKey *key = [AFCacheKey keyWithURLString:[NSString stringWithFormat:@"http://localhost:49000/shared/slot%lu", (unsigned long)i]];
+            [store beginDownloadForKey:key];
+            [store endDownloadForKey:key];
+        }
+    }
+    [store beginDownloadForKey:claimedKey];
+    STAssertEquals([store downloadingProcessForKey:claimedKey], getpid(), @"Released claims must free their slots");
+    [store endDownloadForKey:claimedKey];
+
+    [store close];
+    close(ready[0]);
+    close(proceed[1]);
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+}
+
+- (void)testSlabStore
+{
+    AFCache *cache = [AFCache cacheForContext:@"slabStoreTest"];
+    [cache invalidateAll];
+    AFCacheSlabStore *slabStore = cache.slabStore;
+    slabStore.compactionMinimumAge = 0;
+    slabStore.compactionLiveRatio = 1.0;
+    slabStore.maximumMappedSegmentCount = 1;
+    
+    NSData *liveBody = [@"live body" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *deadBody = [@"body of a removed entry" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *liveEntry = [slabStore appendBody:liveBody];
+    STAssertNotNil([slabStore appendBody:deadBody], @"A small body must be appended");
+    STAssertNil([slabStore appendBody:[NSData data]], @"An empty body must not be appended");
+    STAssertNil([slabStore appendBody:[NSMutableData dataWithLength:(NSUInteger)slabStore.segmentLength + 1]], @"A body longer than a segment must not be appended");
+    
+    AFCacheableItemInfo *info = [[AFCacheableItemInfo alloc] init];
+    info.bodySourceKey = kAFCacheSlabStoreBodySourceKey;
+    info.bodySourceEntry = liveEntry;
+    [cache.cachedItemInfos setObject:info forKey:@"http://localhost:49000/slab/live"];
+    STAssertTrue([slabStore containsBodyOfItemInfo:info], @"The body must be in the slab store");
+    STAssertTrue([slabStore hasBodyForItemInfo:info], @"The appended body must be found");
+    STAssertEqualObjects([slabStore bodyForItemInfo:info], liveBody, @"The appended body must be read back");
+    NSData *slice = [slabStore bodyForItemInfo:info];
+    
+    // sealed, so the segment may be compacted
+    [slabStore reset];
+    NSString *compactedPath = [[[cache.dataPath stringByAppendingPathComponent:kAFCacheSlabStoreDirectoryName]
+                                stringByAppendingPathComponent:[liveEntry componentsSeparatedByString:@":"][0]]
+                               stringByAppendingPathExtension:kAFCacheSlabStoreSegmentExtension];
+    __block BOOL compacted = NO;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        // the moved entries are rewritten on the main thread
+        [slabStore compact];
+        compacted = YES;
+    });
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:10.0];
+    while (!compacted && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    STAssertTrue(compacted, @"The compaction should be done");
+    STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:compactedPath], @"The compacted segment must be removed");
+    STAssertFalse([info.bodySourceEntry isEqualToString:liveEntry], @"The entry must point at the moved body");
+    STAssertEqualObjects([slabStore bodyForItemInfo:info], liveBody, @"The moved body must be read");
+    STAssertEqualObjects(slice, liveBody, @"A slice must outlive the compaction of its segment");
+    NSDictionary *statistics = [slabStore statistics];
+    STAssertEquals([statistics[kAFCacheSlabStoreMovedBodiesKey] unsignedIntegerValue], (NSUInteger)1, @"The live body must be moved");
+    STAssertEquals([statistics[kAFCacheSlabStoreRemovedSegmentsKey] unsignedIntegerValue], (NSUInteger)1, @"The segment must be removed");
+    STAssertEquals([statistics[kAFCacheSlabStoreReclaimedBytesKey] unsignedLongLongValue], (uint64_t)[deadBody length], @"The dead body must be reclaimed");
+    
+    // a new segment replaces the least recently used mapping
+    [slabStore reset];
+    AFCacheableItemInfo *otherInfo = [[AFCacheableItemInfo alloc] init];
+    otherInfo.bodySourceKey = kAFCacheSlabStoreBodySourceKey;
+    otherInfo.bodySourceEntry = [slabStore appendBody:deadBody];
+    STAssertEqualObjects([slabStore bodyForItemInfo:info], liveBody, @"The moved body must be mapped again");
+    STAssertEqualObjects([slabStore bodyForItemInfo:otherInfo], deadBody, @"The body of a new segment must be read");
+    statistics = [slabStore statistics];
+    STAssertEquals([statistics[kAFCacheSlabStoreMappedSegmentsKey] unsignedIntegerValue], (NSUInteger)1, @"No more than maximumMappedSegmentCount segments must stay mapped");
+    STAssertEquals([statistics[kAFCacheSlabStoreUnmappedSegmentsKey] unsignedIntegerValue], (NSUInteger)1, @"The least recently used segment must be unmapped");
+    
+    [cache invalidateAll];
+}
+
 @end
@@ -80,13 +80,24 @@ int main(int argc, char *argv[])
 
 	// Key under which userdata can be accessed. Default is no key.
 	[options setValue:[args stringForKey:@"userdatakey"] forKey:kPackagerOptionUserDataKey];
+
+	// Version of the package. Default is a unique string.
+	[options setValue:[args stringForKey:@"version"] forKey:kPackagerOptionVersion];
+
+	// Create a delta package against the resources in this folder
+	[options setValue:[args stringForKey:@"basefolder"] forKey:kPackagerOptionBaseFolder];
+	[options setValue:[args stringForKey:@"basepackageurl"] forKey:kPackagerOptionBasePackageURL];
+	[options setValue:[args stringForKey:@"baseversion"] forKey:kPackagerOptionBaseVersion];
+
+	// Copy the entries of unchanged files from this package instead of compressing them again
+	[options setValue:[args stringForKey:@"previouspackage"] forKey:kPackagerOptionPreviousPackage];
 	
 	// Create ZIP archive
 	BOOL showHelp = ( 0 == [[options valueForKey: kPackagerOptionBaseURL] length] );
 	@try {	
 		if (showHelp==YES) {
 			printf("\n");
-			printf("Usage: afcpkg [-outfile] [-maxage] [-baseurl] [-file] [-folder] [-json] [-h] [-a] [-outfile] [-maxItemFileSize] [-userdata]\n");
+			printf("Usage: afcpkg [-outfile] [-maxage] [-baseurl] [-file] [-folder] [-json] [-h] [-a] [-outfile] [-maxItemFileSize] [-userdata] [-version] [-basefolder -basepackageurl [-baseversion]] [-previouspackage]\n");
 			printf("\n");
 			printf("\t-maxage \t\tmax-age in seconds\n");
 			printf("\t-baseurl \t\tbase url, e.g. http://www.foo.bar (WITHOUT trailing slash)\n");
@@ -100,12 +111,25 @@ int main(int argc, char *argv[])
 			printf("\t-maxItemFileSize \t\t\tMaximum filesize of a cacheable item. Default is unlimited.\n");
 			printf("\t-userdata \t\t\tFolder containing arbitrary user data (will be accesible via userDataPathForPackageArchiveKey: in AFCache+Packaging.m\n");
 			printf("\t-userdatakey \t\t\tKey under which userdata can be accessed. Default is no key (nil).\n");
+			printf("\t-version \t\t\tVersion of the package. Default is a unique string.\n");
+			printf("\t-basefolder \t\t\tCreate a delta package with the files of -folder that are new or differ from this folder\n");
+			printf("\t-basepackageurl \t\tURL of the package the delta package applies to\n");
+			printf("\t-baseversion \t\t\tVersion of the package the delta package applies to\n");
+			printf("\t-previouspackage \t\tPackage built before from the same folder. Unchanged files are copied from it.\n");
 			printf("\n");
 			exit(0);
 		} else {
             if (NO == [packager createPackageWithOptions:options error:&error]) {
                 [NSException raise:@"Package creation error" format:@"Reason: %@", [error localizedDescription]];
             }
+            NSDictionary *statistics = packager.statistics;
+            printf("Packed %lu files (%lu reused) in %.2f s: %.1f MB/s, %.0f files/s, %llu bytes written\n",
+                   [statistics[kPackagerStatisticsFileCountKey] unsignedLongValue],
+                   [statistics[kPackagerStatisticsReusedFileCountKey] unsignedLongValue],
+                   [statistics[kPackagerStatisticsDurationKey] doubleValue],
+                   [statistics[kPackagerStatisticsBytesPerSecondKey] doubleValue] / (1024 * 1024),
+                   [statistics[kPackagerStatisticsFilesPerSecondKey] doubleValue],
+                   [statistics[kPackagerStatisticsBytesWrittenKey] unsignedLongLongValue]);
             
 		}	
 	}
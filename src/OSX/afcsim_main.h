@@ -0,0 +1,14 @@
+//
+//  afcsim_main.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Cocoa/Cocoa.h>
+
+@interface afcsim_main : NSObject
+
+- (int)simulateWithArgs:(NSUserDefaults*)args;
+
+@end
@@ -0,0 +1,111 @@
+//
+//  afcsim_main.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "afcsim_main.h"
+#import "AFCache.h"
+#import "AFCacheTrace.h"
+#import "AFCacheSimulator.h"
+
+#import <Cocoa/Cocoa.h>
+
+#pragma mark -
+#pragma mark main
+
+/* ================================================================================================
+ * Main
+ * ================================================================================================ */
+
+int main(int argc, char *argv[])
+{
+    @autoreleasepool {
+        NSUserDefaults *args = [NSUserDefaults standardUserDefaults];
+        afcsim_main *main = [[afcsim_main alloc] init];
+        return [main simulateWithArgs:args];
+    }
+}
+
+@implementation afcsim_main
+
+#pragma mark -
+#pragma mark commandline handling
+
+/* ================================================================================================
+ * Replay a trace against every combination of the given budgets and admission settings
+ * ================================================================================================ */
+
+- (int)simulateWithArgs:(NSUserDefaults*)args {
+    NSString *tracePath = [args stringForKey:@"trace"];
+    if ([tracePath length] == 0) {
+        printf("\n");
+        printf("Usage: afcsim -trace [-budgets] [-admission] [-halflife] [-interval] [-items]\n");
+        printf("\n");
+        printf("\t-trace \t\t\ttrace recorded by -[AFCache traceRecorder]\n");
+        printf("\t-budgets \t\tcomma separated byte budgets to compare, 0 = unlimited. Default is %d\n", kDefaultDiskCacheDisplacementTresholdSize);
+        printf("\t-admission \t\tYES, NO or both. Default is both\n");
+        printf("\t-halflife \t\tutility half-life of the storage governor in seconds. Default is one day\n");
+        printf("\t-interval \t\tseconds between enforcements of the budget. Default is 30\n");
+        printf("\t-items \t\t\texpected item count of the admission filter. Default is 10000\n");
+        printf("\n");
+        return 1;
+    }
+
+    AFCacheTraceReader *reader = [[AFCacheTraceReader alloc] initWithPath:tracePath];
+    if (!reader) {
+        printf("Error. See log for details.\n");
+        return 1;
+    }
+
+    NSMutableArray *budgets = [NSMutableArray array];
+    for (NSString *budget in [[args stringForKey:@"budgets"] componentsSeparatedByString:@","]) {
+        if ([budget length] > 0) {
+            [budgets addObject:@(strtoull([budget UTF8String], NULL, 10))];
+        }
+    }
+    if ([budgets count] == 0) {
+        [budgets addObject:@(kDefaultDiskCacheDisplacementTresholdSize)];
+    }
+
+    NSString *admission = [args stringForKey:@"admission"];
+    NSArray *admissionSettings = @[@NO, @YES];
+    if ([admission length] > 0 && [admission caseInsensitiveCompare:@"both"] != NSOrderedSame) {
+        admissionSettings = @[@([args boolForKey:@"admission"])];
+    }
+
+    printf("%lu requests in %s\n\n", (unsigned long)reader.recordCount, [tracePath fileSystemRepresentation]);
+    printf("%16s %10s %10s %10s %10s %16s %16s\n", "budget", "admission", "hit ratio", "byte hits", "write ampl", "transferred", "evicted");
+
+    AFCacheSimulator *simulator = [[AFCacheSimulator alloc] initWithTraceReader:reader];
+    for (NSNumber *budget in budgets) {
+        for (NSNumber *admissionFilter in admissionSettings) {
+            AFCacheSimulatorConfiguration *configuration = [[AFCacheSimulatorConfiguration alloc] init];
+            configuration.byteBudget = [budget unsignedLongLongValue];
+            configuration.admissionFilter = [admissionFilter boolValue];
+            if ([args objectForKey:@"halflife"]) {
+                configuration.utilityHalfLife = [args doubleForKey:@"halflife"];
+            }
+            if ([args objectForKey:@"interval"]) {
+                configuration.enforcementInterval = [args doubleForKey:@"interval"];
+            }
+            if ([args integerForKey:@"items"] > 0) {
+                configuration.expectedItemCount = (NSUInteger)[args integerForKey:@"items"];
+            }
+
+            NSDictionary *result = [simulator runWithConfiguration:configuration];
+            printf("%16llu %10s %10.4f %10.4f %10.4f %16llu %16llu\n",
+                   configuration.byteBudget,
+                   configuration.admissionFilter ? "on" : "off",
+                   [result[kAFCacheSimulatorHitRatioKey] doubleValue],
+                   [result[kAFCacheSimulatorByteHitRatioKey] doubleValue],
+                   [result[kAFCacheSimulatorWriteAmplificationKey] doubleValue],
+                   [result[kAFCacheSimulatorTransferredBytesKey] unsignedLongLongValue],
+                   [result[kAFCacheSimulatorEvictedBytesKey] unsignedLongLongValue]);
+        }
+    }
+    return 0;
+}
+
+@end
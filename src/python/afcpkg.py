@@ -23,15 +23,91 @@ import time
 import logging
 import mimetypes
 import fnmatch
+import filecmp
+import uuid
+import zlib
+import struct
+from multiprocessing import Pool, cpu_count
 from urlparse import urlparse
 from optparse import OptionParser
-from zipfile import ZipFile
+from zipfile import ZipFile, BadZipfile, ZIP_STORED, ZIP_DEFLATED
 
 rfc1123_format = '%a, %d %b %Y %H:%M:%S GMT+00:00'
 
 # add mimetypes
 mimetypes.add_type('application/json', '.json', strict=True)
 
+# zip file records, see the .ZIP File Format Specification (APPNOTE.TXT)
+_local_header_format = '<4s5H3L2H'
+_local_header_size = struct.calcsize(_local_header_format)
+_central_header_format = '<4s6H3L5H2L'
+_end_of_central_directory_format = '<4s4H2LH'
+_flag_utf8 = 0x800
+_version = 20           # 2.0: deflate
+_version_made_by = 0x314  # unix, 2.0
+
+def _zip_date_time(mtime):
+    # zip files store the modification time in local time, to two seconds
+    date_time = time.localtime(mtime)[:6]
+    return date_time[:5] + (date_time[5] // 2 * 2,)
+
+def _compress_file(path):
+    # runs in a worker process
+    f = open(path, 'rb')
+    try:
+        data = f.read()
+    finally:
+        f.close()
+    return _compress_data(data)
+
+def _compress_data(data):
+    # raw deflate data as zip files contain it, stored if deflate does not make it smaller
+    crc = zlib.crc32(data) & 0xffffffff
+    compressor = zlib.compressobj(zlib.Z_DEFAULT_COMPRESSION, zlib.DEFLATED, -15)
+    deflated = compressor.compress(data) + compressor.flush()
+    if len(deflated) < len(data):
+        return (ZIP_DEFLATED, crc, len(data), deflated)
+    return (ZIP_STORED, crc, len(data), data)
+
+def _raw_entry_data(fp, info):
+    # the entry's data as stored, without decompressing it. The local header may have another extra field than the directory.
+    fp.seek(info.header_offset)
+    header = struct.unpack(_local_header_format, fp.read(_local_header_size))
+    fp.seek(header[9] + header[10], os.SEEK_CUR)
+    return fp.read(info.compress_size)
+
+class _ZipWriter(object):
+    # writes entries that are compressed already, which ZipFile cannot do. No ZIP64: less than 65535 entries and 4 GB.
+
+    def __init__(self, path):
+        self.fp = open(path, 'wb')
+        self.central_directory = []
+
+    def write_entry(self, name, date_time, compress_type, crc, file_size, data):
+        offset = self.fp.tell()
+        if len(self.central_directory) >= 0xffff or file_size > 0xffffffff or offset + len(data) > 0xffffffff:
+            raise IOError('the package would need ZIP64, which is not supported')
+        if isinstance(name, unicode):
+            name = name.encode('utf-8')
+        dos_date = (date_time[0] - 1980) << 9 | date_time[1] << 5 | date_time[2]
+        dos_time = date_time[3] << 11 | date_time[4] << 5 | date_time[5] // 2
+        self.fp.write(struct.pack(_local_header_format, 'PK\x03\x04', _version, _flag_utf8, compress_type,
+                                  dos_time, dos_date, crc, len(data), file_size, len(name), 0))
+        self.fp.write(name)
+        self.fp.write(data)
+        self.central_directory.append(struct.pack(_central_header_format, 'PK\x01\x02', _version_made_by, _version,
+                                                  _flag_utf8, compress_type, dos_time, dos_date, crc, len(data),
+                                                  file_size, len(name), 0, 0, 0, 0, 0644 << 16L, offset) + name)
+
+    def close(self):
+        offset = self.fp.tell()
+        directory = ''.join(self.central_directory)
+        self.fp.write(directory)
+        count = len(self.central_directory)
+        self.fp.write(struct.pack(_end_of_central_directory_format, 'PK\x05\x06', 0, 0, count, count,
+                                  len(directory), offset, 0))
+        self.fp.close()
+
 class AFCachePackager(object):
     
     def __init__(self, **kwargs):
@@ -50,6 +126,14 @@ class AFCachePackager(object):
         self.max_size     = kwargs.get('max_size')
         self.excludes     = kwargs.get('excludes', [])
         self.mime         = kwargs.get('mime')
+        self.version      = kwargs.get('version')
+        if not self.version:
+            self.version = uuid.uuid4().hex
+        self.basefolder   = kwargs.get('basefolder')
+        self.basepackageurl = kwargs.get('basepackageurl')
+        self.baseversion  = kwargs.get('baseversion')
+        self.previous     = kwargs.get('previous')
+        self.jobs         = kwargs.get('jobs') or cpu_count()
         self.errors       = []
         self.logger       = kwargs.get('logger',logging.getLogger(__file__))
         self._check_input()
@@ -62,6 +146,15 @@ class AFCachePackager(object):
             
         if not self.maxage:
             self.errors.append('maxage is missing')        
+
+        if self.previous and not os.path.isfile(self.previous):
+            self.errors.append('previous package does not exists')
+
+        if self.basefolder:
+            if not os.path.isdir(self.basefolder):
+                self.errors.append('base folder does not exists')
+            if not self.basepackageurl:
+                self.errors.append('basepackageurl is missing, a delta package needs the url of its base package')
                     
     def _get_host(self, baseurl):
         p = urlparse(baseurl)
@@ -71,20 +164,81 @@ class AFCachePackager(object):
             self.errors.append('baseurl invalid')
             return None
         
+    def _is_hidden(self, name, path):
+        return name.startswith('.') or path.find('/.') > -1
+
+    def _unchanged_in_base(self, rel_path, path):
+        # a delta package only contains files that are new or differ from the base folder
+        if not self.basefolder:
+            return False
+        base_path = os.path.join(self.basefolder, rel_path.lstrip('/'))
+        return os.path.isfile(base_path) and filecmp.cmp(path, base_path, shallow=False)
+
+    def _removed_urls(self):
+        removed = []
+        for dirpath, dirnames, filenames in os.walk(self.basefolder):
+            for name in filenames:
+                path = os.path.join(dirpath, name)
+                if not self.include_all and self._is_hidden(name, path):
+                    continue
+                rel_path = os.path.join(dirpath.replace(os.path.normpath(self.basefolder),''),name)
+                if not os.path.exists(os.path.join(self.folder, rel_path.lstrip('/'))):
+                    self.logger.info("removing "+ self.baseurl+rel_path)
+                    removed.append(self.baseurl+rel_path)
+        return removed
+
+    def _manifest_header(self):
+        header = ['baseURL = %s' % self.baseurl, 'version = %s' % self.version]
+        if self.basefolder:
+            header.append('basePackageURL = %s' % self.basepackageurl)
+            if self.baseversion:
+                header.append('baseVersion = %s' % self.baseversion)
+            for url in self._removed_urls():
+                header.append('removed = %s' % url)
+        return header
+
+    def _previous_entry(self, previous, exported_path, path):
+        # an entry of the previous package can be copied if the file still has the same size and modification time
+        if not previous:
+            return None
+        try:
+            info = previous.getinfo(exported_path)
+        except KeyError:
+            return None
+        if info.file_size != os.path.getsize(path) or info.date_time != _zip_date_time(os.path.getmtime(path)):
+            return None
+        return info
+
+    def _open_previous(self):
+        if not self.previous:
+            return None
+        try:
+            return ZipFile(self.previous, 'r')
+        except (IOError, BadZipfile), e:
+            self.logger.warning("cannot reuse %s, packing all files: %s" % (self.previous, e))
+            return None
+
     def build_zipcache(self):
                     
         manifest = []
+        files = []
         hostname = self._get_host(self.baseurl)
         
         if self.errors:
             return None
 
+        started = time.time()
+        partial = self.outfile + '.partial'
         try:
-            zip = ZipFile(self.outfile, 'w')
+            zip = _ZipWriter(partial)
         except IOError, e:
             self.logger.error('exiting: creation of zipfile failed!')
             return None
-        else:        
+        pool = None
+        previous = None
+        previous_fp = None
+        done = False
+        try:
             for dirpath, dirnames, filenames in os.walk(self.folder):            
                 # skip empty dirs
                 if not filenames:
@@ -95,7 +249,7 @@ class AFCachePackager(object):
                     path = os.path.join(dirpath, name)
                     # skip hidden files if
                     if not self.include_all:                
-                        if name.startswith('.') or path.find('/.') > -1:
+                        if self._is_hidden(name, path):
                             self.logger.info("skipping "+path)
                             continue                                
                     
@@ -132,9 +286,11 @@ class AFCachePackager(object):
                     rel_path = os.path.join(dirpath.replace(os.path.normpath(self.folder),''),name)
                     exported_path = hostname+rel_path
 
-                    # add data
-                    self.logger.info("adding "+ exported_path)
-                    zip.write(path, exported_path)
+                    if self._unchanged_in_base(rel_path, path):
+                        self.logger.info("unchanged "+ exported_path)
+                        continue
+
+                    files.append((path, exported_path))
     
                     # add manifest line
                     last_mod_date = time.strftime(rfc1123_format,time.gmtime(lastmod))
@@ -145,11 +301,66 @@ class AFCachePackager(object):
                     if self.mime: 
                         manifest_line += ' ; '+mime_type
                     manifest.append(manifest_line)
+
+            # copy unchanged entries of the previous package, compress the other files on all cores
+            previous = self._open_previous()
+            if previous:
+                previous_fp = open(self.previous, 'rb')
+            reused = {}
+            for path, exported_path in files:
+                info = self._previous_entry(previous, exported_path, path)
+                if info:
+                    reused[exported_path] = info
+            compress_paths = [path for path, exported_path in files if exported_path not in reused]
+            pool = Pool(self.jobs)
+            compressed = pool.imap(_compress_file, compress_paths, 16)
+
+            bytes_read = 0
+            for path, exported_path in files:
+                mtime = os.path.getmtime(path)
+                info = reused.get(exported_path)
+                if info:
+                    self.logger.info("reusing "+ exported_path)
+                    zip.write_entry(exported_path, _zip_date_time(mtime), info.compress_type, info.CRC, info.file_size,
+                                    _raw_entry_data(previous_fp, info))
+                    bytes_read += info.file_size
+                else:
+                    self.logger.info("adding "+ exported_path)
+                    compress_type, crc, file_size, data = compressed.next()
+                    zip.write_entry(exported_path, _zip_date_time(mtime), compress_type, crc, file_size, data)
+                    bytes_read += file_size
+            pool.close()
+            pool.join()
+            pool = None
                     
             # add manifest to zip
             self.logger.info("adding manifest")
-            zip.writestr("manifest.afcache", "\n".join(manifest))     
+            compress_type, crc, file_size, data = _compress_data("\n".join(self._manifest_header() + manifest))
+            zip.write_entry("manifest.afcache", _zip_date_time(time.time()), compress_type, crc, file_size, data)
+            zip.close()
+            os.rename(partial, self.outfile)
+            done = True
+
+            duration = max(time.time() - started, 0.001)
+            self.logger.info("packed %d files (%d reused) in %.2f s: %.1f MB/s, %.0f files/s, %d bytes written" %
+                             (len(files), len(reused), duration, bytes_read / duration / (1024 * 1024),
+                              len(files) / duration, os.path.getsize(self.outfile)))
             return True
+        except (IOError, OSError, zlib.error), e:
+            self.logger.error('exiting: writing %s failed: %s' % (partial, e))
+            return None
+        finally:
+            if pool:
+                pool.terminate()
+            if previous:
+                previous.close()
+            if previous_fp:
+                previous_fp.close()
+            if not done:
+                # do not leave a broken package behind
+                zip.fp.close()
+                if os.path.exists(partial):
+                    os.remove(partial)
 
 def main():
 
@@ -179,6 +390,18 @@ def main():
                     help="Regexp filter for filepaths. Add one --exclude for every pattern.")      
     parser.add_option("--mime", dest="mime", action="store_true",
                     help="add file mime types to manifest.afcache")
+    parser.add_option("--version", dest="version",
+                    help="version of the package. Default: a unique string")
+    parser.add_option("--basefolder", dest="basefolder",
+                    help="create a delta package with the files of --folder that are new or differ from this folder")
+    parser.add_option("--basepackageurl", dest="basepackageurl",
+                    help="url of the package the delta package applies to")
+    parser.add_option("--baseversion", dest="baseversion",
+                    help="version of the package the delta package applies to")
+    parser.add_option("--previous", dest="previous",
+                    help="package built before from the same folder. Entries of files with the same size and modification time are copied from it")
+    parser.add_option("--jobs", dest="jobs", type="int",
+                    help="number of processes compressing files. Default: number of cores")
                     
                         
     (options, args) = parser.parse_args()
@@ -195,6 +418,12 @@ def main():
                         max_size=options.max_size,
                         excludes=options.excludes,
                         mime=options.mime,
+                        version=options.version,
+                        basefolder=options.basefolder,
+                        basepackageurl=options.basepackageurl,
+                        baseversion=options.baseversion,
+                        previous=options.previous,
+                        jobs=options.jobs,
                         logger=logger
                     )
 
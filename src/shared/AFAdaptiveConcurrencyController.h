@@ -0,0 +1,64 @@
+//
+//  AFAdaptiveConcurrencyController.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#define kAFAdaptiveConcurrencyLimitKey @"limit"
+#define kAFAdaptiveConcurrencyMinimumKey @"minimum"
+#define kAFAdaptiveConcurrencyMaximumKey @"maximum"
+#define kAFAdaptiveConcurrencyBaselineLatencyKey @"baselineLatency"
+#define kAFAdaptiveConcurrencyLatencyKey @"latency"
+#define kAFAdaptiveConcurrencyThroughputKey @"throughput"
+#define kAFAdaptiveConcurrencyLastDecisionKey @"lastDecision"
+#define kAFAdaptiveConcurrencyIncreasesKey @"increases"
+#define kAFAdaptiveConcurrencyDecreasesKey @"decreases"
+#define kAFAdaptiveConcurrencySamplesKey @"samples"
+
+/*
+ * AIMD controller for the number of concurrent downloads.
+ *
+ * Samples of finished downloads are collected in windows of as many samples as the current limit.
+ * At the end of every window the limit is
+ * - decreased multiplicatively if a download failed or the average latency exceeded the baseline latency by latencyTolerance
+ * - increased by one if the throughput of the window did not drop compared to the previous window
+ * - kept otherwise.
+ * The limit always stays within [minimumConcurrency, maximumConcurrency].
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFAdaptiveConcurrencyController : NSObject
+
+@property (nonatomic, assign) NSInteger minimumConcurrency;
+@property (nonatomic, assign) NSInteger maximumConcurrency;
+@property (nonatomic, readonly) NSInteger concurrency;
+
+/*
+ * a window's average latency may be this many times the baseline latency before the limit is decreased. Default is 2.0
+ */
+@property (nonatomic, assign) double latencyTolerance;
+
+/*
+ * the limit is multiplied by this factor when it is decreased. Default is 0.75
+ */
+@property (nonatomic, assign) double backoffRatio;
+
+- (instancetype)initWithConcurrency:(NSInteger)concurrency minimum:(NSInteger)minimum maximum:(NSInteger)maximum;
+
+/*
+ * @param latency time from starting the download until the response has been received
+ * @param duration time from starting the download until it finished
+ * @param byteCount number of body bytes received
+ * @param failed YES if the download failed because of a network error
+ * @return the new concurrency limit
+ */
+- (NSInteger)recordSampleWithLatency:(NSTimeInterval)latency duration:(NSTimeInterval)duration byteCount:(uint64_t)byteCount failed:(BOOL)failed;
+
+- (void)resetToConcurrency:(NSInteger)concurrency;
+
+- (NSDictionary*)statistics;
+
+@end
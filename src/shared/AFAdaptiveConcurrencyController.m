@@ -0,0 +1,158 @@
+//
+//  AFAdaptiveConcurrencyController.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFAdaptiveConcurrencyController.h"
+#import "AFCache_Logging.h"
+
+// the baseline follows rising latencies slowly, so a permanently slower link is accepted eventually
+#define kAFAdaptiveConcurrencyBaselineDrift 0.05
+
+// a window's throughput may drop by this fraction and still be considered "not dropping"
+#define kAFAdaptiveConcurrencyThroughputSlack 0.05
+
+@interface AFAdaptiveConcurrencyController ()
+@property (nonatomic, assign) NSInteger concurrency;
+@property (nonatomic, assign) NSUInteger windowSampleCount;
+@property (nonatomic, assign) NSUInteger windowFailureCount;
+@property (nonatomic, assign) NSTimeInterval windowLatencySum;
+@property (nonatomic, assign) uint64_t windowByteCount;
+@property (nonatomic, assign) NSTimeInterval windowStartTimestamp;
+@property (nonatomic, assign) NSTimeInterval baselineLatency;
+@property (nonatomic, assign) NSTimeInterval lastLatency;
+@property (nonatomic, assign) double lastThroughput;
+@property (nonatomic, copy) NSString *lastDecision;
+@property (nonatomic, assign) NSUInteger increaseCount;
+@property (nonatomic, assign) NSUInteger decreaseCount;
+@property (nonatomic, assign) NSUInteger sampleCount;
+@end
+
+@implementation AFAdaptiveConcurrencyController
+
+- (instancetype)initWithConcurrency:(NSInteger)concurrency minimum:(NSInteger)minimum maximum:(NSInteger)maximum {
+    self = [super init];
+    if (self) {
+        _minimumConcurrency = MAX(1, minimum);
+        _maximumConcurrency = MAX(_minimumConcurrency, maximum);
+        _latencyTolerance = 2.0;
+        _backoffRatio = 0.75;
+        _lastDecision = @"none";
+        [self resetToConcurrency:concurrency];
+    }
+    return self;
+}
+
+- (void)resetToConcurrency:(NSInteger)concurrency {
+    @synchronized (self) {
+        self.concurrency = [self clampedConcurrency:concurrency];
+        [self startWindow];
+    }
+}
+
+- (void)setMinimumConcurrency:(NSInteger)minimumConcurrency {
+    @synchronized (self) {
+        _minimumConcurrency = MAX(1, minimumConcurrency);
+        _maximumConcurrency = MAX(_minimumConcurrency, _maximumConcurrency);
+        self.concurrency = [self clampedConcurrency:self.concurrency];
+    }
+}
+
+- (void)setMaximumConcurrency:(NSInteger)maximumConcurrency {
+    @synchronized (self) {
+        _maximumConcurrency = MAX(_minimumConcurrency, maximumConcurrency);
+        self.concurrency = [self clampedConcurrency:self.concurrency];
+    }
+}
+
+- (NSInteger)recordSampleWithLatency:(NSTimeInterval)latency duration:(NSTimeInterval)duration byteCount:(uint64_t)byteCount failed:(BOOL)failed {
+    @synchronized (self) {
+        self.sampleCount++;
+        self.windowSampleCount++;
+        self.windowByteCount += byteCount;
+        if (failed) {
+            self.windowFailureCount++;
+        } else {
+            self.windowLatencySum += MAX(0, latency);
+        }
+
+        if (self.windowSampleCount >= (NSUInteger)self.concurrency) {
+            [self finishWindow];
+        }
+        return self.concurrency;
+    }
+}
+
+#pragma mark - Windows
+
+- (void)startWindow {
+    self.windowSampleCount = 0;
+    self.windowFailureCount = 0;
+    self.windowLatencySum = 0;
+    self.windowByteCount = 0;
+    self.windowStartTimestamp = [NSDate timeIntervalSinceReferenceDate];
+}
+
+- (void)finishWindow {
+    NSUInteger successCount = self.windowSampleCount - self.windowFailureCount;
+    NSTimeInterval averageLatency = successCount > 0 ? self.windowLatencySum / successCount : 0;
+    NSTimeInterval elapsed = MAX(0.001, [NSDate timeIntervalSinceReferenceDate] - self.windowStartTimestamp);
+    double throughput = self.windowByteCount / elapsed;
+
+    if (successCount > 0) {
+        if (self.baselineLatency <= 0 || averageLatency < self.baselineLatency) {
+            self.baselineLatency = averageLatency;
+        } else {
+            self.baselineLatency += (averageLatency - self.baselineLatency) * kAFAdaptiveConcurrencyBaselineDrift;
+        }
+    }
+
+    NSInteger previousConcurrency = self.concurrency;
+    BOOL congested = self.windowFailureCount > 0 || (successCount > 0 && averageLatency > self.baselineLatency * self.latencyTolerance);
+    if (congested) {
+        self.concurrency = [self clampedConcurrency:(NSInteger)floor(self.concurrency * self.backoffRatio)];
+        self.lastDecision = @"decrease";
+    } else if (throughput >= self.lastThroughput * (1.0 - kAFAdaptiveConcurrencyThroughputSlack)) {
+        self.concurrency = [self clampedConcurrency:self.concurrency + 1];
+        self.lastDecision = @"increase";
+    } else {
+        self.lastDecision = @"hold";
+    }
+
+    if (self.concurrency > previousConcurrency) {
+        self.increaseCount++;
+    } else if (self.concurrency < previousConcurrency) {
+        self.decreaseCount++;
+    }
+    AFLog(@"adaptive concurrency: %@ to %ld (latency %f, baseline %f, throughput %f)", self.lastDecision, (long)self.concurrency, averageLatency, self.baselineLatency, throughput);
+
+    self.lastLatency = averageLatency;
+    self.lastThroughput = throughput;
+    [self startWindow];
+}
+
+- (NSInteger)clampedConcurrency:(NSInteger)concurrency {
+    return MIN(self.maximumConcurrency, MAX(self.minimumConcurrency, concurrency));
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFAdaptiveConcurrencyLimitKey : @(self.concurrency),
+                 kAFAdaptiveConcurrencyMinimumKey : @(self.minimumConcurrency),
+                 kAFAdaptiveConcurrencyMaximumKey : @(self.maximumConcurrency),
+                 kAFAdaptiveConcurrencyBaselineLatencyKey : @(self.baselineLatency),
+                 kAFAdaptiveConcurrencyLatencyKey : @(self.lastLatency),
+                 kAFAdaptiveConcurrencyThroughputKey : @(self.lastThroughput),
+                 kAFAdaptiveConcurrencyLastDecisionKey : self.lastDecision,
+                 kAFAdaptiveConcurrencyIncreasesKey : @(self.increaseCount),
+                 kAFAdaptiveConcurrencyDecreasesKey : @(self.decreaseCount),
+                 kAFAdaptiveConcurrencySamplesKey : @(self.sampleCount),
+                 };
+    }
+}
+
+@end
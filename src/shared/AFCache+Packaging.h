@@ -10,9 +10,15 @@
 #import "AFCache.h"
 #import "AFPackageInfo.h"
 
+@class AFPackageArchive;
+
+// archives the resources of packages are served from, see -[AFCache servePackageResourcesFromArchive]
+#define kAFCachePackageArchiveDirectoryName @"afcache_packages"
+
 // TODO: Is this a real category? It relays on the existence of properties (e.g. packageArchiveQueue) that are only used by this category
 @interface AFCache (Packaging)
 
+// return NO if the item is being downloaded or the admissionFilter rejected it (the item's data is set anyway)
 - (BOOL)importCacheableItem:(AFCacheableItem*)cacheableItem withData:(NSData*)theData;
 - (BOOL)importCacheableItem:(AFCacheableItem*)cacheableItem dataWithFileAtURL:(NSURL*)URL;
 - (AFCacheableItem*)importObjectForURL:(NSURL*)url data:(NSData*)data;
@@ -31,11 +37,20 @@
 // remove an imported package zip
 - (void)purgePackageArchiveForURL:(NSURL*)url;
 
+// pin the package zip and every resource of the package (AFPackageInfo.resourceURLs), see -[AFCache pinCachedItemForURL:].
+// Returns NO if the package has not been consumed yet. Unpin with the same package, before a newer version replaces its resources.
+- (BOOL)pinPackageArchiveForURL:(NSURL*)url;
+- (void)unpinPackageArchiveForURL:(NSURL*)url;
+
 // announce files residing in the urlcachestore folder by reading the cache manifest file
 // this method assumes that the files already have been extracted into the urlcachestore folder
 - (AFPackageInfo*)newPackageInfoByImportingCacheManifestAtPath:(NSString*)manifestPath intoCacheStoreWithPath:(NSString*)urlCacheStorePath withPackageURL:(NSURL*)packageURL;
 - (void)storeCacheInfo:(NSDictionary*)dictionary;
 
+// parse the contents of a manifest.afcache. The content lengths are taken from the archive's entries if given,
+// otherwise from the files in filesPath. See kAFPackageManifest...Key in AFPackageInfo.h for the keys of the result.
+- (NSDictionary*)manifestWithString:(NSString*)manifest filesAtPath:(NSString*)filesPath archive:(AFPackageArchive*)archive;
+
 // Deprecated methods:
 
 #pragma mark -
@@ -13,6 +13,7 @@
 #import "ZipArchive.h"
 #import "DateParser.h"
 #import "AFPackageInfo.h"
+#import "AFPackageArchive.h"
 #import "AFCache+Packaging.h"
 #import "AFCache_Logging.h"
 
@@ -101,11 +102,47 @@ enum ManifestKeys {
 	    BOOL preservePackageInfo		= [arguments[@"preservePackageInfo"] boolValue];
 	    NSDictionary *userData			= arguments[@"userData"];
 
-        ZipArchive *zip = [[ZipArchive alloc] init];
-        BOOL success = [zip UnzipOpenFile:pathToZip];
-        [zip UnzipFileTo:[pathToZip stringByDeletingLastPathComponent] overWrite:YES];
-        [zip UnzipCloseFile];
-        if (success) {
+        // Serve the resources from the mapped archive instead of extracting them, if asked to and possible
+        NSString *archivePath = self.servePackageResourcesFromArchive ? [self linkPackageArchiveAtPath:pathToZip] : nil;
+        AFPackageArchive *archive = archivePath ? [[AFPackageArchive alloc] initWithContentsOfFile:archivePath] : nil;
+        NSString *archivedManifest = archive ? [[NSString alloc] initWithData:[archive dataForEntryNamed:@"manifest.afcache"] encoding:NSASCIIStringEncoding] : nil;
+        BOOL servesFromArchive = archivedManifest && ![self isDeltaManifest:archivedManifest];
+        BOOL isDelta = NO;
+        BOOL success = NO;
+
+        if (servesFromArchive) {
+            success = [self servePackageArchive:archive
+                                   withManifest:[self manifestWithString:archivedManifest filesAtPath:nil archive:archive]
+                                     packageURL:cacheableItem.url
+                                       userData:userData];
+        }
+        if (archivePath && !(servesFromArchive && success)) {
+            [[NSFileManager defaultManager] removeItemAtPath:archivePath error:nil];
+        }
+        if (!servesFromArchive) {
+            // Extract into a staging folder first, so a broken archive or a delta that does not apply leaves the store untouched
+            NSString *stagingPath = [[pathToZip stringByDeletingLastPathComponent] stringByAppendingPathComponent:
+                                     [NSString stringWithFormat:@".afcache-staging-%@", [[NSProcessInfo processInfo] globallyUniqueString]]];
+            ZipArchive *zip = [[ZipArchive alloc] init];
+            success = [zip UnzipOpenFile:pathToZip];
+            if (success) {
+                success = [zip UnzipFileTo:stagingPath overWrite:YES];
+                [zip UnzipCloseFile];
+            }
+
+            NSString *stagedManifestPath = [stagingPath stringByAppendingPathComponent:@"manifest.afcache"];
+            isDelta = success && [self isDeltaManifest:[NSString stringWithContentsOfFile:stagedManifestPath encoding:NSASCIIStringEncoding error:nil]];
+            if (isDelta) {
+                success = [self applyDeltaPackageWithManifest:[self manifestAtPath:stagedManifestPath filesAtPath:stagingPath]
+                                                  stagingPath:stagingPath
+                                                     userData:userData];
+            } else if (success) {
+                success = [self mergeContentsOfDirectoryAtPath:stagingPath intoDirectoryAtPath:[pathToZip stringByDeletingLastPathComponent]];
+            }
+            [[NSFileManager defaultManager] removeItemAtPath:stagingPath error:nil];
+        }
+
+        if (success && !isDelta && !servesFromArchive) {
             __unsafe_unretained NSString *pathToManifest = [NSString stringWithFormat:@"%@/%@", urlCacheStorePath, @"manifest.afcache"];
 
             __unsafe_unretained AFPackageInfo *packageInfo;
@@ -130,7 +167,11 @@ enum ManifestKeys {
                 [packageInfo.userData addEntriesFromDictionary:userData];
                 [self.packageInfos setObject:packageInfo forKey:[cacheableItem.url absoluteString]];
             }
-            else {
+        }
+
+        if (success) {
+            // a delta is recorded in the package info of its base package, see applyDeltaPackageWithManifest:
+            if (!servesFromArchive && (!preservePackageInfo || isDelta)) {
                 NSError *error = nil;
                 [[NSFileManager defaultManager] removeItemAtPath:pathToZip error:&error];
             }
@@ -146,7 +187,7 @@ enum ManifestKeys {
             [self performSelectorOnMainThread:@selector(archive) withObject:nil waitUntilDone:YES];
             AFLog(@"finished unzipping archive");
         } else {
-            AFLog(@"Unzipping failed. Broken archive?");
+            AFLog(@"Unzipping failed. Broken archive or delta package that does not apply?");
             [self performSelectorOnMainThread:@selector(performUnarchivingFailedWithItem:)
                                    withObject:cacheableItem
                                 waitUntilDone:YES];
@@ -154,9 +195,114 @@ enum ManifestKeys {
 	}
 }
 
-- (AFPackageInfo*)newPackageInfoByImportingCacheManifestAtPath:(NSString*)manifestPath intoCacheStoreWithPath:(NSString*)urlCacheStorePath withPackageURL:(NSURL*)packageURL {
+/*
+ * Moves every file below sourcePath to the same relative path below destinationPath, replacing existing files.
+ * Renaming within the cache directory does not copy any data.
+ */
+- (BOOL)mergeContentsOfDirectoryAtPath:(NSString*)sourcePath intoDirectoryAtPath:(NSString*)destinationPath {
+    return [self mergeContentsOfDirectoryAtPath:sourcePath intoDirectoryAtPath:destinationPath backupPath:nil];
+}
+
+/*
+ * Same as above. If backupPath is given, replaced files are moved there instead of being deleted, and a merge that
+ * fails is rolled back: the merged files go back to sourcePath and the replaced ones to their place.
+ * The caller removes backupPath when done.
+ */
+- (BOOL)mergeContentsOfDirectoryAtPath:(NSString*)sourcePath intoDirectoryAtPath:(NSString*)destinationPath backupPath:(NSString*)backupPath {
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+
+    // list first, moving files out of a directory that is being enumerated is not safe
+    NSMutableArray *relativePaths = [NSMutableArray array];
+    NSMutableSet *directories = [NSMutableSet set];
+    NSDirectoryEnumerator *enumerator = [fileManager enumeratorAtPath:sourcePath];
+    for (NSString *relativePath in enumerator) {
+        [relativePaths addObject:relativePath];
+        if ([[[enumerator fileAttributes] fileType] isEqualToString:NSFileTypeDirectory]) {
+            [directories addObject:relativePath];
+        }
+    }
+
+    NSMutableArray *mergedPaths = [NSMutableArray array]; // for the rollback
+    for (NSString *relativePath in relativePaths) {
+        NSString *source = [sourcePath stringByAppendingPathComponent:relativePath];
+        NSString *destination = [destinationPath stringByAppendingPathComponent:relativePath];
+        NSError *error = nil;
+        if ([directories containsObject:relativePath]) {
+            BOOL isDirectory = NO;
+            if ([fileManager fileExistsAtPath:destination isDirectory:&isDirectory] && !isDirectory) {
+                [fileManager removeItemAtPath:destination error:nil];
+            }
+            if (!isDirectory && ![fileManager createDirectoryAtPath:destination withIntermediateDirectories:YES attributes:nil error:&error]) {
+                NSLog(@"AFCache: Could not create directory \"%@\" (Error: %@)", destination, [error localizedDescription]);
+                [self rollBackMergeOfPaths:mergedPaths fromDirectoryAtPath:sourcePath intoDirectoryAtPath:destinationPath backupPath:backupPath];
+                return NO;
+            }
+            continue;
+        }
+        if (backupPath && [fileManager fileExistsAtPath:destination]) {
+            NSString *backup = [backupPath stringByAppendingPathComponent:relativePath];
+            if (![fileManager createDirectoryAtPath:[backup stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:&error] ||
+                ![fileManager moveItemAtPath:destination toPath:backup error:&error]) {
+                NSLog(@"AFCache: Could not move \"%@\" aside (Error: %@)", destination, [error localizedDescription]);
+                [self rollBackMergeOfPaths:mergedPaths fromDirectoryAtPath:sourcePath intoDirectoryAtPath:destinationPath backupPath:backupPath];
+                return NO;
+            }
+        } else {
+            [fileManager removeItemAtPath:destination error:nil];
+        }
+        if (![fileManager moveItemAtPath:source toPath:destination error:&error]) {
+            NSLog(@"AFCache: Could not move \"%@\" to \"%@\" (Error: %@)", source, destination, [error localizedDescription]);
+            if (backupPath) {
+                [fileManager moveItemAtPath:[backupPath stringByAppendingPathComponent:relativePath] toPath:destination error:nil];
+                [self rollBackMergeOfPaths:mergedPaths fromDirectoryAtPath:sourcePath intoDirectoryAtPath:destinationPath backupPath:backupPath];
+            }
+            return NO;
+        }
+        [mergedPaths addObject:relativePath];
+    }
+    return YES;
+}
+
+- (void)rollBackMergeOfPaths:(NSArray*)relativePaths fromDirectoryAtPath:(NSString*)sourcePath intoDirectoryAtPath:(NSString*)destinationPath backupPath:(NSString*)backupPath {
+    if (!backupPath) {
+        return;
+    }
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+    for (NSString *relativePath in [relativePaths reverseObjectEnumerator]) {
+        NSString *destination = [destinationPath stringByAppendingPathComponent:relativePath];
+        NSString *backup = [backupPath stringByAppendingPathComponent:relativePath];
+        [fileManager moveItemAtPath:destination toPath:[sourcePath stringByAppendingPathComponent:relativePath] error:nil];
+        if ([fileManager fileExistsAtPath:backup]) {
+            [fileManager moveItemAtPath:backup toPath:destination error:nil];
+        }
+    }
+}
+
+- (BOOL)isDeltaManifest:(NSString*)manifest {
+    NSString *prefix = [kAFPackageManifestBasePackageURLKey stringByAppendingString:@" = "];
+    for (NSString *entry in [manifest componentsSeparatedByString:@"\n"]) {
+        if ([entry hasPrefix:prefix]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (NSDictionary*)manifestAtPath:(NSString*)manifestPath filesAtPath:(NSString*)filesPath {
+	NSString *manifest = [NSString stringWithContentsOfFile:manifestPath encoding:NSASCIIStringEncoding error:nil];
+	return [self manifestWithString:manifest filesAtPath:filesPath archive:nil];
+}
+
+/*
+ * Parses manifest.afcache. Returns a dictionary with
+ * - the header values (kAFPackageManifest...Key -> NSString)
+ * - kAFPackageManifestRemovedKey -> NSArray of URL strings
+ * - kAFPackageManifestResourceURLsKey -> NSArray of URL strings in manifest order
+ * - kAFPackageManifestCacheInfosKey -> NSDictionary of URL string -> AFCacheableItemInfo
+ * The content lengths are taken from the entries of the archive if given, otherwise from the files in filesPath.
+ */
+- (NSDictionary*)manifestWithString:(NSString*)manifest filesAtPath:(NSString*)filesPath archive:(AFPackageArchive*)archive {
 
-	NSError *error = nil;
 	AFCacheableItemInfo *info = nil;
 	NSString *URL = nil;
 	NSString *lastModified = nil;
@@ -165,15 +311,10 @@ enum ManifestKeys {
     NSString *filename = nil;
 	int line = 0;
 	
-    // create a package info object for this package
-	// that enables the cache to keep track of items that have been included in a package
-	AFPackageInfo *packageInfo = [[AFPackageInfo alloc] init];
-	packageInfo.packageURL = packageURL;
-
+	NSMutableDictionary *result = [NSMutableDictionary dictionary];
 	NSMutableArray *resourceURLs = [[NSMutableArray alloc] init];
+	NSMutableArray *removedURLs = [[NSMutableArray alloc] init];
 	
-    //NSString *pathToMetaFolder = [NSString stringWithFormat:@"%@/%@", urlCacheStorePath, @".userdata"];
-	NSString *manifest = [NSString stringWithContentsOfFile:manifestPath encoding:NSASCIIStringEncoding error:&error];
 	NSArray *entries = [manifest componentsSeparatedByString:@"\n"];
 	
 	NSMutableDictionary* cacheInfoDictionary = [NSMutableDictionary dictionary];    
@@ -191,8 +332,10 @@ enum ManifestKeys {
 			if ([keyval count] == 2) {
 				NSString *key_ = [keyval objectAtIndex:0];
 				NSString *val_ = [keyval objectAtIndex:1];
-				if ([@"baseURL" isEqualToString:key_]) {
-					packageInfo.baseURL = [NSURL URLWithString:val_];
+				if ([kAFPackageManifestRemovedKey isEqualToString:key_]) {
+					[removedURLs addObject:val_];
+				} else {
+					[result setObject:val_ forKey:key_];
 				}
 			} else {
 				NSLog(@"Invalid entry in manifest in line %d: %@", line, entry);
@@ -227,7 +370,7 @@ enum ManifestKeys {
             NSLog(@"No filename given for entry in line %d: %@", line, entry);
         }
 
-        uint64_t contentLength = [self setContentLengthForFileAtPath:[urlCacheStorePath stringByAppendingPathComponent: filename]];
+        uint64_t contentLength = archive ? [archive uncompressedSizeOfEntryNamed:filename] : [self setContentLengthForFileAtPath:[filesPath stringByAppendingPathComponent: filename]];
 
 		info.contentLength = contentLength;
 
@@ -239,27 +382,229 @@ enum ManifestKeys {
                                                    MIMEType:mimeType
                                       expectedContentLength: contentLength
                                            textEncodingName: nil];
+        [info compact];
 
         [resourceURLs addObject:URL];
 		
 		[cacheInfoDictionary setObject:info forKey:URL];               
 	}
 	
-	packageInfo.resourceURLs = [NSArray arrayWithArray:resourceURLs];
+	[result setObject:resourceURLs forKey:kAFPackageManifestResourceURLsKey];
+	[result setObject:removedURLs forKey:kAFPackageManifestRemovedKey];
+	[result setObject:cacheInfoDictionary forKey:kAFPackageManifestCacheInfosKey];
+	return result;
+}
+
+- (AFPackageInfo*)newPackageInfoByImportingCacheManifestAtPath:(NSString*)manifestPath intoCacheStoreWithPath:(NSString*)urlCacheStorePath withPackageURL:(NSURL*)packageURL {
+	NSDictionary *manifest = [self manifestAtPath:manifestPath filesAtPath:urlCacheStorePath];
+
+    // create a package info object for this package
+	// that enables the cache to keep track of items that have been included in a package
+	AFPackageInfo *packageInfo = [[AFPackageInfo alloc] init];
+	packageInfo.packageURL = packageURL;
+	if (manifest[kAFPackageManifestBaseURLKey]) {
+		packageInfo.baseURL = [NSURL URLWithString:manifest[kAFPackageManifestBaseURLKey]];
+	}
+	packageInfo.version = manifest[kAFPackageManifestVersionKey];
+	packageInfo.resourceURLs = [NSArray arrayWithArray:manifest[kAFPackageManifestResourceURLsKey]];
 	
 	// import generated cacheInfos in to the AFCache info store
-	[self storeCacheInfo:cacheInfoDictionary];
+	[self storeCacheInfo:manifest[kAFPackageManifestCacheInfosKey]];
 	
 	return packageInfo;
 }
 
-- (void)storeCacheInfo:(NSDictionary*)dictionary {
-    @synchronized(self) {
-        for (NSString* key in dictionary) {
-            AFCacheableItemInfo* info = [dictionary objectForKey:key];
-            [self.cachedItemInfos setObject:info forKey:key];
+#pragma mark - Delta packages
+
+/*
+ * A delta package carries the added and changed entries of its base package and lists the removed ones.
+ * It applies only if the base package has been consumed with preservePackageInfo and its version matches
+ * the delta's baseVersion. The staged files are checked first. Then, in one step on the main thread, the files are
+ * moved into place and the info store and the base package's info are updated. If a file cannot be moved, the
+ * files moved so far are put back and the cache is left as it was.
+ */
+- (BOOL)applyDeltaPackageWithManifest:(NSDictionary*)manifest stagingPath:(NSString*)stagingPath userData:(NSDictionary*)userData {
+    NSDictionary *cacheInfos = manifest[kAFPackageManifestCacheInfosKey];
+    for (AFCacheableItemInfo *info in [cacheInfos allValues]) {
+        if (!info.filename || ![[NSFileManager defaultManager] fileExistsAtPath:[stagingPath stringByAppendingPathComponent:info.filename]]) {
+            NSLog(@"AFCache: delta package lacks file %@", info.filename);
+            return NO;
         }
     }
+    [[NSFileManager defaultManager] removeItemAtPath:[stagingPath stringByAppendingPathComponent:@"manifest.afcache"] error:nil];
+
+    __block BOOL applied = NO;
+    void (^commit)(void) = ^{
+        applied = [self commitDeltaPackageWithManifest:manifest stagingPath:stagingPath userData:userData];
+    };
+    if ([NSThread isMainThread]) {
+        commit();
+    } else {
+        dispatch_sync(dispatch_get_main_queue(), commit);
+    }
+    return applied;
+}
+
+// must be called on the main thread
+- (BOOL)commitDeltaPackageWithManifest:(NSDictionary*)manifest stagingPath:(NSString*)stagingPath userData:(NSDictionary*)userData {
+    NSString *basePackageKey = manifest[kAFPackageManifestBasePackageURLKey];
+    AFPackageInfo *basePackageInfo = [self.packageInfos objectForKey:basePackageKey];
+    if (!basePackageInfo) {
+        NSLog(@"AFCache: base package %@ of delta package has not been consumed with preservePackageInfo", basePackageKey);
+        return NO;
+    }
+    NSString *baseVersion = manifest[kAFPackageManifestBaseVersionKey];
+    if (baseVersion && ![baseVersion isEqualToString:basePackageInfo.version]) {
+        NSLog(@"AFCache: delta package for version %@ of %@ does not apply to version %@", baseVersion, basePackageKey, basePackageInfo.version);
+        return NO;
+    }
+
+    NSString *backupPath = [stagingPath stringByAppendingString:@"-replaced"];
+    BOOL merged = [self mergeContentsOfDirectoryAtPath:stagingPath intoDirectoryAtPath:self.dataPath backupPath:backupPath];
+    [[NSFileManager defaultManager] removeItemAtPath:backupPath error:nil];
+    if (!merged) {
+        return NO;
+    }
+
+    AFPackageInfo *packageInfo = [[AFPackageInfo alloc] init];
+    packageInfo.packageURL = basePackageInfo.packageURL;
+    packageInfo.baseURL = manifest[kAFPackageManifestBaseURLKey] ? [NSURL URLWithString:manifest[kAFPackageManifestBaseURLKey]] : basePackageInfo.baseURL;
+    packageInfo.version = manifest[kAFPackageManifestVersionKey];
+    NSMutableOrderedSet *resourceURLs = [NSMutableOrderedSet orderedSetWithArray:basePackageInfo.resourceURLs];
+    [resourceURLs removeObjectsInArray:manifest[kAFPackageManifestRemovedKey]];
+    [resourceURLs addObjectsFromArray:manifest[kAFPackageManifestResourceURLsKey]];
+    packageInfo.resourceURLs = [resourceURLs array];
+    // resources the delta did not change are still served from the base package's archive
+    packageInfo.archivePath = basePackageInfo.archivePath;
+    [packageInfo.userData addEntriesFromDictionary:basePackageInfo.userData];
+    [packageInfo.userData addEntriesFromDictionary:userData];
+
+    for (NSString *removedURL in manifest[kAFPackageManifestRemovedKey]) {
+        AFCacheableItemInfo *info = [self.cachedItemInfos objectForKey:removedURL];
+        if (info) {
+            [self removeCacheEntry:info fileOnly:NO fallbackURL:[NSURL URLWithString:removedURL]];
+        }
+    }
+    NSDictionary *cacheInfos = manifest[kAFPackageManifestCacheInfosKey];
+    [self storeCacheInfo:cacheInfos];
+    [self.packageInfos setObject:packageInfo forKey:basePackageKey];
+    AFLog(@"applied delta package to %@: %lu entries added or changed, %lu removed", basePackageKey,
+          (unsigned long)[cacheInfos count], (unsigned long)[manifest[kAFPackageManifestRemovedKey] count]);
+    return YES;
+}
+
+#pragma mark - Packages served from the archive
+
+/*
+ * Registers the mapped archive as the body source of the package's resources. Only the user data is extracted.
+ * Files of resources that an earlier, extracted version of the package left behind are deleted.
+ */
+/*
+ * Links the downloaded ZIP into kAFCachePackageArchiveDirectoryName. Evicting or invalidating the package item removes
+ * its file, the link keeps the archive its resources are served from. nil if it cannot be linked.
+ */
+- (NSString*)linkPackageArchiveAtPath:(NSString*)path {
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+    NSString *directory = [self.dataPath stringByAppendingPathComponent:kAFCachePackageArchiveDirectoryName];
+    NSError *error = nil;
+    if (![fileManager fileExistsAtPath:directory]) {
+        if (![fileManager createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:&error]) {
+            NSLog(@"AFCache: Could not create directory \"%@\" (Error: %@)", directory, [error localizedDescription]);
+            return nil;
+        }
+        [AFCache addSkipBackupAttributeToItemAtURL:[NSURL fileURLWithPath:directory]];
+    }
+    NSString *archivePath = [[directory stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]] stringByAppendingPathExtension:@"zip"];
+    if (![fileManager linkItemAtPath:path toPath:archivePath error:&error]) {
+        NSLog(@"AFCache: Could not link package archive %@ (Error: %@)", path, [error localizedDescription]);
+        return nil;
+    }
+    return archivePath;
+}
+
+- (BOOL)servePackageArchive:(AFPackageArchive*)archive withManifest:(NSDictionary*)manifest packageURL:(NSURL*)packageURL userData:(NSDictionary*)userData {
+    NSString *packageKey = [packageURL absoluteString];
+    NSDictionary *cacheInfos = manifest[kAFPackageManifestCacheInfosKey];
+    for (AFCacheableItemInfo *info in [cacheInfos allValues]) {
+        if (![archive hasEntryNamed:info.filename]) {
+            NSLog(@"AFCache: package archive %@ lacks entry %@", archive.path, info.filename);
+            return NO;
+        }
+        info.bodySourceKey = packageKey;
+        info.bodySourceEntry = info.filename;
+    }
+    if (![self extractUserDataOfPackageArchive:archive]) {
+        return NO;
+    }
+
+    NSString *archivePath = archive.path;
+    NSString *dataPathPrefix = [self.dataPath stringByAppendingString:@"/"];
+    if ([archivePath hasPrefix:dataPathPrefix]) {
+        archivePath = [archivePath substringFromIndex:[dataPathPrefix length]];
+    }
+
+    AFPackageInfo *packageInfo = [[AFPackageInfo alloc] init];
+    packageInfo.packageURL = packageURL;
+    if (manifest[kAFPackageManifestBaseURLKey]) {
+        packageInfo.baseURL = [NSURL URLWithString:manifest[kAFPackageManifestBaseURLKey]];
+    }
+    packageInfo.version = manifest[kAFPackageManifestVersionKey];
+    packageInfo.resourceURLs = [NSArray arrayWithArray:manifest[kAFPackageManifestResourceURLsKey]];
+    packageInfo.archivePath = archivePath;
+    [packageInfo.userData addEntriesFromDictionary:userData];
+
+    [self performSelectorOnMainThread:@selector(commitArchivedPackage:)
+                           withObject:@{@"packageKey" : packageKey,
+                                        @"archive" : archive,
+                                        @"packageInfo" : packageInfo,
+                                        @"cacheInfos" : cacheInfos}
+                        waitUntilDone:YES];
+    AFLog(@"serving %lu resources from package archive %@", (unsigned long)[cacheInfos count], archive.path);
+    return YES;
+}
+
+- (void)commitArchivedPackage:(NSDictionary*)package {
+    [self registerBodySource:package[@"archive"] forKey:package[@"packageKey"]];
+    [package[@"cacheInfos"] enumerateKeysAndObjectsUsingBlock:^(NSString *URL, AFCacheableItemInfo *info, BOOL *stop) {
+        AFCacheableItemInfo *previousInfo = [self.cachedItemInfos objectForKey:URL];
+        if (previousInfo && !previousInfo.bodySourceKey) {
+            [self removeCacheEntry:previousInfo fileOnly:YES fallbackURL:[NSURL URLWithString:URL]];
+        }
+    }];
+    [self storeCacheInfo:package[@"cacheInfos"]];
+    [self.packageInfos setObject:package[@"packageInfo"] forKey:package[@"packageKey"]];
+}
+
+- (BOOL)extractUserDataOfPackageArchive:(AFPackageArchive*)archive {
+    NSString *prefix = [kAFCacheUserDataFolder stringByAppendingString:@"/"];
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+    for (NSString *name in archive.entryNames) {
+        if (![name hasPrefix:prefix] || [[name pathComponents] containsObject:@".."]) {
+            continue;
+        }
+        NSString *path = [self.dataPath stringByAppendingPathComponent:name];
+        NSError *error = nil;
+        if (![fileManager createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:&error] ||
+            ![[archive dataForEntryNamed:name] writeToFile:path options:NSDataWritingAtomic error:&error]) {
+            NSLog(@"AFCache: Could not extract user data %@ of package archive %@ (Error: %@)", name, archive.path, [error localizedDescription]);
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (id<AFCacheBodySource>)newPackageArchiveForKey:(NSString*)key {
+    AFPackageInfo *packageInfo = [self.packageInfos objectForKey:key];
+    if (!packageInfo.archivePath) {
+        return nil;
+    }
+    NSString *path = [packageInfo.archivePath isAbsolutePath] ? packageInfo.archivePath : [self.dataPath stringByAppendingPathComponent:packageInfo.archivePath];
+    return [[AFPackageArchive alloc] initWithContentsOfFile:path];
+}
+
+- (void)storeCacheInfo:(NSDictionary*)dictionary {
+    // the info store is thread-safe, no need to lock the whole cache
+    [self.cachedItemInfos addEntriesFromDictionary:dictionary];
 }
 
 #pragma mark serialization methods
@@ -278,24 +623,39 @@ enum ManifestKeys {
 
 // import and optionally overwrite a cacheableitem. might fail if a download with the very same url is in progress.
 - (BOOL)importCacheableItem:(AFCacheableItem*)cacheableItem withData:(NSData*)theData {	
-    if (cacheableItem == nil || [self isQueuedOrDownloadingURL:cacheableItem.url]) {
+    if (cacheableItem == nil || [self isQueuedOrDownloadingKey:cacheableItem.cacheKey]) {
         return NO;
     }
 
+    // setDataAndFile: asks the admission filter
     [cacheableItem setDataAndFile:theData];
-	[self.cachedItemInfos setObject:cacheableItem.info forKey:[cacheableItem.url absoluteString]];
+    if (cacheableItem.rejectedByAdmissionFilter) {
+        return NO;
+    }
+	[self.cachedItemInfos setObject:cacheableItem.info forKey:cacheableItem.cacheKey];
 	[self archive];
     
 	return YES;
 }
 
 - (BOOL)importCacheableItem:(AFCacheableItem*)cacheableItem dataWithFileAtURL:(NSURL *)URL {
-    if (cacheableItem == nil || [self isQueuedOrDownloadingURL:cacheableItem.url]) {
+    if (cacheableItem == nil || [self isQueuedOrDownloadingKey:cacheableItem.cacheKey]) {
         return NO;
     }
     
     NSString *fullPathForCacheableItem = [self fullPathForCacheableItem:cacheableItem];
-    
+
+    NSNumber *fileSize = nil;
+    [URL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:nil];
+    BOOL replacesStoredFile = [[NSFileManager defaultManager] fileExistsAtPath:fullPathForCacheableItem];
+    cacheableItem.rejectedByAdmissionFilter = !replacesStoredFile && ![self shouldAdmitItem:cacheableItem size:[fileSize unsignedLongLongValue]];
+    if (cacheableItem.rejectedByAdmissionFilter) {
+        // The file is consumed like an imported one: a mapping stays valid after the file has been removed
+        cacheableItem.data = [NSData dataWithContentsOfURL:URL options:NSDataReadingMappedIfSafe error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:URL error:nil];
+        return NO;
+    }
+
     NSError *error = nil;
     BOOL didMoveItemAtPath = [[NSFileManager defaultManager] moveItemAtPath:URL.path toPath:fullPathForCacheableItem error:&error];
     if (!didMoveItemAtPath) {
@@ -306,7 +666,7 @@ enum ManifestKeys {
     cacheableItem.data = data;
     cacheableItem.info.contentLength = [data length];
 
-    [self.cachedItemInfos setObject:cacheableItem.info forKey:[cacheableItem.url absoluteString]];
+    [self.cachedItemInfos setObject:cacheableItem.info forKey:cacheableItem.cacheKey];
     [self archive];
     
     return YES;
@@ -346,6 +706,45 @@ enum ManifestKeys {
 
 - (void)purgePackageArchiveForURL:(NSURL*)url {
 	[self purgeCacheableItemForURL:url];
+
+	// resources served from the archive are gone with it
+	NSString *key = [url absoluteString];
+	AFPackageInfo *packageInfo = [self packageInfoForURL:url];
+	if (packageInfo.archivePath) {
+		for (NSString *resourceURL in packageInfo.resourceURLs) {
+			AFCacheableItemInfo *info = [self.cachedItemInfos objectForKey:resourceURL];
+			if ([info.bodySourceKey isEqualToString:key]) {
+				[self.cachedItemInfos removeObjectForKey:resourceURL];
+			}
+		}
+		[self.packageInfos removeObjectForKey:key];
+		[self unregisterBodySourceForKey:key];
+		// slices read before keep the mapping
+		if ([[packageInfo.archivePath pathComponents] containsObject:kAFCachePackageArchiveDirectoryName]) {
+			NSString *path = [packageInfo.archivePath isAbsolutePath] ? packageInfo.archivePath : [self.dataPath stringByAppendingPathComponent:packageInfo.archivePath];
+			[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+		}
+	}
+}
+
+- (BOOL)pinPackageArchiveForURL:(NSURL*)url {
+	AFPackageInfo *packageInfo = [self packageInfoForURL:url];
+	if (!packageInfo) {
+		return NO;
+	}
+	[self pinCachedItemForURL:url];
+	for (NSString *resourceURL in packageInfo.resourceURLs) {
+		[self pinCachedItemForURL:[NSURL URLWithString:resourceURL]];
+	}
+	return YES;
+}
+
+- (void)unpinPackageArchiveForURL:(NSURL*)url {
+	AFPackageInfo *packageInfo = [self packageInfoForURL:url];
+	[self unpinCachedItemForURL:url];
+	for (NSString *resourceURL in packageInfo.resourceURLs) {
+		[self unpinCachedItemForURL:[NSURL URLWithString:resourceURL]];
+	}
 }
 
 - (NSString*)userDataPathForPackageArchiveKey:(NSString*)archiveKey {
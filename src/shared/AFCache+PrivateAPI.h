@@ -19,27 +19,60 @@
  */
 
 #import "AFCache.h"
+#import "AFCacheBodySource.h"
+#import "AFStorageGovernor.h"
 
 @class AFCache;
 @class AFCacheableItem;
+@class AFDownloadScheduler;
+@class AFCacheKey;
 
-@interface AFCache (PrivateAPI)
+// the storage governor measures and evicts the cache's entries, see AFStorageGovernor.h
+@interface AFCache (PrivateAPI) <AFStorageGovernorStore>
 
 - (void)updateModificationDataAndTriggerArchiving:(AFCacheableItem *)obj;
 
 - (void)setConnectedToNetwork:(BOOL)connected;
+- (NSString*)context;
 - (void)reinitialize;
 - (void)removeCacheEntryWithFilePath:(NSString*)filePath fileOnly:(BOOL) fileOnly;
 
 - (NSOutputStream*)createOutputStreamForItem:(AFCacheableItem*)cacheableItem;
+// expectedLength of the body, -1 if unknown. A body the slab store packs is written to a memory stream, see storeBody:inSlabStoreForItem:
+- (NSOutputStream*)createOutputStreamForItem:(AFCacheableItem*)cacheableItem expectedLength:(long long)expectedLength;
+// appends the body written to such a memory stream to the slab store, or writes it to the item's file if it cannot be packed.
+// NO if it ended up in the file.
+- (BOOL)storeBody:(NSData*)body inSlabStoreForItem:(AFCacheableItem*)cacheableItem;
++ (BOOL)addSkipBackupAttributeToItemAtURL:(NSURL*)URL;
+- (BOOL)shouldAdmitItem:(AFCacheableItem*)cacheableItem size:(uint64_t)size;
 - (void)addItemToDownloadQueue:(AFCacheableItem*)item;
+- (NSMutableURLRequest*)IMSRequestForCacheableItem:(AFCacheableItem*)item;
+- (BOOL)revalidateCachedItemInBackgroundForURL:(NSURL*)url;
+// cancels the item's download unless a client is still waiting for it, see -[AFCacheableItem hasClientBlocks]
+- (void)cancelDownloadForItem:(AFCacheableItem*)item;
+- (NSUInteger)executingDownloadCount;
 - (BOOL)isQueuedURL:(NSURL*)url;
+// like isQueuedOrDownloadingURL: and isDownloadingURL:, for callers that have the key of the URL already
+- (BOOL)isQueuedOrDownloadingKey:(AFCacheKey*)key;
+- (BOOL)isDownloadingKey:(AFCacheKey*)key;
 - (BOOL)_fileExistsOrPendingForCacheableItem:(AFCacheableItem*)item;
 - (void)removeCacheEntry:(AFCacheableItemInfo*)info fileOnly:(BOOL) fileOnly;
 - (void)removeCacheEntry:(AFCacheableItemInfo*)info fileOnly:(BOOL) fileOnly fallbackURL:(NSURL *)fallbackURL;
 
 // TODO: This getter to its property is necessary as the category "Packaging" needs to access the private property. This is due to Packaging not being a real category
 - (NSOperationQueue*) packageArchiveQueue;
+// an operation waiting to retry gives its slot to others, see -[AFDownloadScheduler yieldOperation:forInterval:resumeBlock:]
+- (AFDownloadScheduler*)downloadScheduler;
+
+// body sources of entries without a file of their own, see AFCacheBodySource.h
+- (void)registerBodySource:(id<AFCacheBodySource>)bodySource forKey:(NSString*)key;
+- (void)unregisterBodySourceForKey:(NSString*)key;
+- (id<AFCacheBodySource>)bodySourceForKey:(NSString*)key;
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info;
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info;
+
+// implemented in AFCache+Packaging.m, reopens the archive of a package whose resources are served from the archive
+- (id<AFCacheBodySource>)newPackageArchiveForKey:(NSString*)key;
 
 @end
 
@@ -50,8 +83,15 @@
 // Making synthesized getter and setter for private property public for private API
 - (void)setHasReturnedCachedItemBeforeRevalidation:(BOOL)value;
 - (BOOL)hasReturnedCachedItemBeforeRevalidation;
+
+// used by AFMemoryGovernor. Releasing resident data returns the number of bytes released, 0 if the data was set, not read.
+- (NSTimeInterval)lastDataAccessTime;
+- (uint64_t)releaseResidentData;
 @end
 
 @interface AFCacheableItemInfo (PrivateAPI)
 - (NSString*)newUniqueFilename;
+
+// replaces request and response objects by compact records, see AFCacheableItemInfo.h
+- (void)compact;
 @end
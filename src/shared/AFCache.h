@@ -35,7 +35,11 @@
 #define kAFCacheInfoStoreCachedObjectsKey @"cachedObjects"
 #define kAFCacheInfoStoreRedirectsKey @"redirects"
 #define kAFCacheInfoStorePackageInfosKey @"packageInfos"
+#define kAFCacheInfoStorePinCountsKey @"pinCounts"
 #define kAFCacheVersionKey @"afcacheVersion"
+#define kAFCacheBaseImageKey @"baseImage"
+#define kAFCacheBaseImageRemovedURLsKey @"baseImageRemovedURLs"
+#define kAFCacheGarbageCollectionCursorKey @"garbageCollectionCursor"
 
 #define LOG_AFCACHE(m) NSLog(m);
 
@@ -47,6 +51,19 @@
 // max number of concurrent connections
 #define kAFCacheDefaultConcurrentConnections 5
 
+// max number of concurrent connections to the same host
+#define kAFCacheDefaultConcurrentConnectionsPerHost 4
+
+// bounds for the number of concurrent connections if adaptive concurrency is enabled
+#define kAFCacheDefaultMinimumConcurrentConnections 2
+#define kAFCacheDefaultMaximumConcurrentConnections 16
+
+// waiting this many seconds promotes a queued download by one priority lane
+#define kAFCacheDefaultDownloadAgingInterval 10.0
+
+// number of stored entries the admission filter compares a new entry against
+#define kAFCacheAdmissionVictimSampleCount 8
+
 #define kHTTPHeaderIfModifiedSince @"If-Modified-Since"
 #define kHTTPHeaderIfNoneMatch @"If-None-Match"
 
@@ -62,6 +79,23 @@
 #define kAFCacheNSErrorDomain @"AFCache"
 #define USE_ASSERTS true
 
+// keys of the dictionary returned by -[AFCache statistics]
+#define kAFCacheStatisticsTotalRequestsKey @"totalRequests"
+#define kAFCacheStatisticsConcurrentConnectionsKey @"concurrentConnections"
+#define kAFCacheStatisticsExecutingDownloadsKey @"executingDownloads"
+#define kAFCacheStatisticsPendingDownloadsKey @"pendingDownloads"
+#define kAFCacheStatisticsAdaptiveConcurrencyKey @"adaptiveConcurrency" // see AFAdaptiveConcurrencyController.h for the keys
+#define kAFCacheStatisticsRevalidationKey @"revalidation" // see AFRevalidationSweeper.h for the keys
+#define kAFCacheStatisticsAdmissionKey @"admission" // see AFCacheAdmissionFilter.h for the keys
+#define kAFCacheStatisticsStorageKey @"storage" // usage and quota of this context, see AFStorageGovernor.h for the keys
+#define kAFCacheStatisticsRetryKey @"retry" // see AFRetryPolicy.h for the keys
+#define kAFCacheStatisticsMemoryKey @"memory" // items of all caches in the process, see AFMemoryGovernor.h for the keys
+#define kAFCacheStatisticsGarbageCollectionKey @"garbageCollection" // see AFCacheGarbageCollector.h for the keys
+#define kAFCacheStatisticsPinnedURLsKey @"pinnedURLs" // pinned bytes are reported by the storage governor
+#define kAFCacheStatisticsInvalidationIndexKey @"invalidationIndex" // see AFCacheInvalidationIndex.h for the keys
+#define kAFCacheStatisticsSlabStoreKey @"slabStore" // see AFCacheSlabStore.h for the keys
+#define kAFCacheStatisticsSharedStoreKey @"sharedStore" // only if shareStoreAcrossProcesses, see AFCacheSharedStore.h for the keys
+
 #define AFCachingURLHeader @"X-AFCache"
 #define AFCacheInternalRequestHeader @"X-AFCache-IntReq"
 
@@ -77,6 +111,7 @@ enum {
 	kAFCacheRevalidateEntry         = 1 << 13, // revalidate even when cache is running in offline mode
 	kAFCacheNeverRevalidate         = 1 << 14,
     kAFCacheJustFetchHTTPHeader     = 1 << 15, // just fetch the http header
+    kAFCachePrefetch                = 1 << 16, // speculative request, downloaded with lowest priority
 };
 
 
@@ -89,6 +124,22 @@ typedef struct NetworkTimeoutIntervals {
 
 @class AFCache;
 @class AFCacheableItem;
+@class AFRevalidationSweeper;
+@class AFCacheGarbageCollector;
+@class AFCacheInvalidationIndex;
+@class AFCacheSharedStore;
+@class AFCacheSlabStore;
+@class AFCacheAdmissionFilter;
+@class AFCacheLookup;
+@class AFCacheBaseImage;
+@class AFRetryPolicy;
+@class AFCacheTraceRecorder;
+
+/*
+ * items maps every requested URL that could be served to its AFCacheableItem, failedURLs contains the others.
+ */
+typedef void (^AFCacheBatchCompletionBlock)(NSDictionary *items, NSArray *failedURLs);
+@protocol AFReachabilityProvider;
 
 @interface AFCache : NSObject
 
@@ -99,6 +150,7 @@ typedef struct NetworkTimeoutIntervals {
 
 /**
  * Maps from URL-String to AFCacheableItemInfo
+ * The info store dictionaries are AFCacheInfoStores and may be used from any thread, see AFCacheInfoStore.h
  */
 @property (nonatomic, strong) NSMutableDictionary *cachedItemInfos;
 /**
@@ -107,6 +159,10 @@ typedef struct NetworkTimeoutIntervals {
 @property (nonatomic, strong) NSMutableDictionary *urlRedirects;
 // TODO: "packageInfos" is not a good descriptive name. What means "info"?
 @property (nonatomic, strong) NSMutableDictionary *packageInfos;
+/**
+ * Maps from URL-String to the number of times it is pinned, see pinCachedItemForURL:
+ */
+@property (nonatomic, strong) NSMutableDictionary *pinCounts;
 // holds CacheableItem objects (former NSURLConnection, changed 2013/03/26 by mic)
 @property (nonatomic, readonly) int totalRequestsForSession;
 @property (nonatomic, strong) NSDictionary *suffixToMimeTypeMap;
@@ -139,6 +195,131 @@ typedef struct NetworkTimeoutIntervals {
 // TODO: Rename to maxConcurrentConnections and introduce forward property with old name in DeprecatedAPI category
 @property (nonatomic, assign, getter=concurrentConnections, setter=setConcurrentConnections:) int concurrentConnections;
 
+/*
+ * set the number of maximum concurrent downloadable items per host, so a slow host can't occupy every connection
+ * Default is 4, 0 means no limit
+ */
+@property (nonatomic, assign) int concurrentConnectionsPerHost;
+
+/*
+ * queued downloads are started by priority: interactive requests first, then revalidations, package archives and prefetches.
+ * A download waiting for this many seconds is promoted by one priority, so low priority downloads are never starved.
+ * Default is 10s
+ */
+@property (nonatomic, assign) NSTimeInterval downloadAgingInterval;
+
+/*
+ * adjust the number of concurrent connections to the observed latency and throughput of finished downloads.
+ * concurrentConnections is used as the initial value and kept within minimum- and maximumConcurrentConnections.
+ * Turning it off restores the concurrentConnections set last.
+ * Default is NO
+ */
+@property (nonatomic, assign) BOOL adaptiveConcurrency;
+@property (nonatomic, assign) int minimumConcurrentConnections;
+@property (nonatomic, assign) int maximumConcurrentConnections;
+
+/*
+ * revalidate frequently used entries in the background before they expire, see AFRevalidationSweeper.h.
+ * Sweeps pause while offlineMode or suspended is set.
+ * Default is NO
+ */
+@property (nonatomic, assign) BOOL backgroundRevalidation;
+
+/*
+ * the sweeper used for backgroundRevalidation. Set its interval and budgets here.
+ */
+@property (nonatomic, readonly) AFRevalidationSweeper *revalidationSweeper;
+
+/*
+ * remove files no entry refers to from the cache directory in the background, a few milliseconds at a time,
+ * see AFCacheGarbageCollector.h. Default is NO
+ */
+@property (nonatomic, assign) BOOL backgroundGarbageCollection;
+
+/*
+ * the collector used for backgroundGarbageCollection and doHousekeepingWithRequiredCacheItemURLs:
+ */
+@property (nonatomic, readonly) AFCacheGarbageCollector *garbageCollector;
+
+/*
+ * response header whose space- or comma-separated values tag an entry for invalidateURLsWithSurrogateKey:.
+ * Setting it retains the header (see +[AFCacheableItemInfo retainHeaderNamed:]) and indexes the stored entries again,
+ * entries stored before the header was retained have no tags. nil disables tagging.
+ * Default is kAFCacheDefaultSurrogateKeyHeaderName ("Surrogate-Key")
+ */
+@property (nonatomic, copy) NSString *surrogateKeyHeaderName;
+
+/*
+ * index of the stored entries by URL prefix and tag, see AFCacheInvalidationIndex.h
+ */
+@property (nonatomic, readonly) AFCacheInvalidationIndex *invalidationIndex;
+
+/*
+ * bodies of at most this many bytes are packed into the segment files of the slabStore instead of files of their own.
+ * The announced Content-Length decides, bodies of unknown length always get a file.
+ * 0 disables packing, packed bodies stay readable. Default is 0, e.g. 16384 packs bodies up to 16 KB
+ */
+@property (nonatomic, assign) uint64_t slabObjectThreshold;
+
+/*
+ * holds the packed bodies and compacts its segments in the background, see AFCacheSlabStore.h
+ */
+@property (nonatomic, readonly) AFCacheSlabStore *slabStore;
+
+/*
+ * let other processes (e.g. an app and its extensions) use the same dataPath at the same time, see AFCacheSharedStore.h.
+ * Modifications of the info stores are journaled and replayed before lookups instead of being archived wholesale,
+ * so no process overwrites the entries of another, and a URL is only downloaded by one process at a time.
+ * Every process must enable it before it downloads anything. Stays NO if the shared files cannot be created.
+ * Default is NO
+ */
+@property (nonatomic, assign) BOOL shareStoreAcrossProcesses;
+
+/*
+ * the store used for shareStoreAcrossProcesses, nil while it is disabled
+ */
+@property (nonatomic, readonly) AFCacheSharedStore *sharedStore;
+
+/*
+ * if set, a new entry is only written to disk while the cache is above diskCacheDisplacementTresholdSize
+ * if the filter considers it more valuable than the least frequently used of kAFCacheAdmissionVictimSampleCount
+ * randomly sampled entries, see AFCacheAdmissionFilter.h. Keeps one-off downloads from displacing hot entries.
+ * Rejected downloads are still delivered, but not stored.
+ * Default is nil
+ */
+@property (nonatomic, strong) AFCacheAdmissionFilter *admissionFilter;
+
+/*
+ * if set, downloads that fail with a transient error (e.g. 503 or a timeout) are tried again after a backoff,
+ * and a revalidation that still fails may deliver the stale entry instead, see AFRetryPolicy.h
+ * Default is nil, a failed download fails at once
+ */
+@property (nonatomic, strong) AFRetryPolicy *retryPolicy;
+
+/*
+ * if set, every lookup (cacheItemForURL:... and cacheItemsForURLs:...) is recorded with the hash of its key, the size,
+ * whether it was a hit, a miss or a revalidation and when it was served, see AFCacheTrace.h.
+ * Misses and revalidations are recorded when their download has finished.
+ * Replay the trace with AFCacheSimulator, or the afcsim tool, to compare other budgets and admission settings.
+ * Default is nil
+ */
+@property (nonatomic, strong) AFCacheTraceRecorder *traceRecorder;
+
+/*
+ * consumed package archives are not extracted. The ZIP is kept and mapped into memory, and its resources are served
+ * from the mapping, see AFPackageArchive.h: no second copy on disk and no file per resource.
+ * The ZIP is linked into kAFCachePackageArchiveDirectoryName, so it outlives the package item's file, which is removed
+ * when the package item is evicted or invalidated. It is removed by purgePackageArchiveForURL:.
+ * Applies to packages consumed after it has been set; delta packages and archives that cannot be mapped are still extracted.
+ * Default is NO
+ */
+@property (nonatomic, assign) BOOL servePackageResourcesFromArchive;
+
+/*
+ * read-only layer beneath the store, see mountBaseImageAtPath:
+ */
+@property (readonly) AFCacheBaseImage *baseImage;
+
 /*
  * the download fails if HTTP error is above 400
  * Default is YES
@@ -172,9 +353,16 @@ typedef struct NetworkTimeoutIntervals {
 
 /*
  * check if we have an internet connection. can be observed
+ * The state is cached and updated asynchronously by the reachabilityProvider and by finished downloads.
  */
 @property (nonatomic, readonly) BOOL isConnectedToNetwork;
 
+/*
+ * source of connectivity changes, see AFReachabilityProvider.h. Set nil to rely on download results only.
+ * Default is an AFSystemReachabilityProvider
+ */
+@property (nonatomic, strong) id<AFReachabilityProvider> reachabilityProvider;
+
 /*
  * ignore any invalid SSL certificates
  * be careful with invalid SSL certificates! use only for testing or debugging
@@ -182,8 +370,22 @@ typedef struct NetworkTimeoutIntervals {
  */
 @property (nonatomic, assign) BOOL disableSSLCertificateValidation;
 
+/*
+ * All instances share the disk budget of [AFStorageGovernor sharedGovernor], which also holds the per-context quotas
+ */
 + (AFCache*)cacheForContext:(NSString*)context;
 
+/*
+ * Mounts a package built by afcpkg, e.g. one shipped with the app, as a read-only base layer beneath the store.
+ * Lookups that miss the store fall through to the image and are served from it without copying anything into dataPath,
+ * see AFCacheBaseImage.h. Only entries that are revalidated or downloaded again get an entry in the store, which then
+ * shadows the image; entries removed from the cache stay hidden until an image with another version is mounted.
+ * The image is not remembered, mount it on every launch before the first lookup. Replaces an image mounted before.
+ * Returns NO if the file is no package that can be mapped.
+ */
+- (BOOL)mountBaseImageAtPath:(NSString*)path;
+- (void)unmountBaseImage;
+
 - (NSString *)filenameForURL: (NSURL *) url;
 - (NSString *)filenameForURLString: (NSString *) URLString;
 - (NSString *)filePath: (NSString *) filename;
@@ -265,12 +467,44 @@ typedef struct NetworkTimeoutIntervals {
 - (void)setOfflineMode:(BOOL)value;
 - (int)totalRequestsForSession;
 - (void)doHousekeeping;
+
+/*
+ * removes all entries whose URL is not in requiredURLs. Their files and any other orphaned files
+ * are removed by the garbage collector in the background.
+ */
 - (void)doHousekeepingWithRequiredCacheItemURLs:(NSSet*)requiredURLs;
 
+/*
+ * A pinned entry is never evicted by the storage governor or the admission filter, nor removed by housekeeping,
+ * whichever URLs are passed as required. Purging it removes it all the same.
+ * Pins are counted, a URL stays pinned until it has been unpinned as often as it was pinned.
+ * They belong to the URL, not to its entry: a URL may be pinned before it is downloaded, and its pins survive
+ * downloads of new versions. Pin counts are archived with the info store, checking for a pin is a single lookup.
+ */
+- (void)pinCachedItemForURL:(NSURL*)url;
+- (void)unpinCachedItemForURL:(NSURL*)url;
+- (BOOL)isPinnedURL:(NSURL*)url;
+
+/*
+ * remove every stored entry whose normalized URL starts with prefix (e.g. @"https://example.com/api/v2/catalog/")
+ * or that is tagged with surrogateKey, and return how many were removed.
+ * The entries are found with the invalidationIndex, so the cost depends on the number of entries removed,
+ * not on the size of the cache. Redirects from their URLs are removed with them, their files are left to
+ * the garbage collector and the info store is archived once for all of them.
+ * Like purging, invalidation removes pinned entries, but not their pins. Entries of the base image are not affected.
+ */
+- (NSUInteger)invalidateURLsWithPrefix:(NSString*)prefix;
+- (NSUInteger)invalidateURLsWithSurrogateKey:(NSString*)surrogateKey;
+
 - (BOOL)hasCachedItemForURL:(NSURL *)url;
 - (AFCacheableItem *)cacheableItemFromCacheStore: (NSURL *) url;
 - (unsigned long)diskCacheSize;
 
+/*
+ * Snapshot of the cache's counters and decisions, see kAFCacheStatistics... keys
+ */
+- (NSDictionary*)statistics;
+
 /*
  * Cancel any asynchronous operations and downloads
  */
@@ -335,6 +569,53 @@ typedef struct NetworkTimeoutIntervals {
                        progressBlock:(AFCacheableItemBlock)progressBlock
                 requestConfiguration:(AFRequestConfiguration*)requestConfiguration;
 
+#pragma mark - Asynchronous API for getting cache items
+
+/*
+ * Get a cached item from cache without blocking the calling thread.
+ *
+ * The lookup, including all file checks and mapping the item's data, is done on a serial I/O queue owned by the cache.
+ * The blocks are always called on deliveryQueue (the main queue if NULL), never before this method returns.
+ *
+ * @param url the requested url
+ * @param urlCredential the credential for requested url
+ * @param requestConfiguration may be nil
+ * @param deliveryQueue the queue the blocks are called on
+ * @param completionBlock
+ * @param failBlock
+ * @param progressBlock
+ * @return a handle to cancel the lookup
+ */
+- (AFCacheLookup *)cacheItemForURL:(NSURL *)url
+                     urlCredential:(NSURLCredential*)urlCredential
+              requestConfiguration:(AFRequestConfiguration*)requestConfiguration
+                     deliveryQueue:(dispatch_queue_t)deliveryQueue
+                   completionBlock:(AFCacheableItemBlock)completionBlock
+                         failBlock:(AFCacheableItemBlock)failBlock
+                     progressBlock:(AFCacheableItemBlock)progressBlock;
+
+#pragma mark - Batch API for getting cache items
+
+/*
+ * Get many cached items at once, e.g. all images of a screen.
+ *
+ * The info store and the download queue are looked at once for the whole batch and the files are checked in path order.
+ * Fresh items are returned immediately. Misses and stale items are downloaded resp. revalidated as one group;
+ * the completion block is called once on the main thread when all of them have finished (also if there are none).
+ * Supported options of the request configuration: kAFCacheInvalidateEntry, kAFCacheNeverRevalidate,
+ * kAFCacheReturnFileBeforeRevalidation (stale items are returned immediately and revalidated) and kAFCachePrefetch.
+ *
+ * @param urls NSURLs to look up, duplicates are looked up once
+ * @param urlCredential the credential for the requested urls
+ * @param requestConfiguration may be nil
+ * @param completionBlock
+ * @return the items that are served from cache right away, keyed by requested URL
+ */
+- (NSDictionary *)cacheItemsForURLs:(NSArray *)urls
+                      urlCredential:(NSURLCredential*)urlCredential
+               requestConfiguration:(AFRequestConfiguration*)requestConfiguration
+                    completionBlock:(AFCacheBatchCompletionBlock)completionBlock;
+
 @end
 
 #pragma mark - LoggingSupport
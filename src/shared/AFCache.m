@@ -22,15 +22,29 @@
 #import "AFCache+Mimetypes.h"
 #import "DateParser.h"
 
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#import <SystemConfiguration/SCNetworkReachability.h>
 #import <MacTypes.h>
 #import "AFRegexString.h"
 #import "AFCache_Logging.h"
 #import "AFDownloadOperation.h"
+#import "AFDownloadScheduler.h"
+#import "AFAdaptiveConcurrencyController.h"
+#import "AFRevalidationSweeper.h"
+#import "AFCacheGarbageCollector.h"
+#import "AFCacheInvalidationIndex.h"
+#import "AFCacheSharedStore.h"
+#import "AFCacheSlabStore.h"
+#import "AFSystemReachabilityProvider.h"
+#import "AFCacheInfoStore.h"
+#import "AFCacheAdmissionFilter.h"
+#import "AFStorageGovernor.h"
+#import "AFCacheLookup+Private.h"
 #import "AFCacheableItem+FileAttributes.h"
+#import "AFCacheBaseImage.h"
+#import "AFRetryPolicy.h"
+#import "AFMemoryGovernor.h"
+#import "AFPackageInfo.h"
+#import "AFCacheClock.h"
+#import "AFCacheTrace.h"
 
 #import <VersionIntrospection/SPVIVersionIntrospection.h>
 
@@ -52,7 +66,26 @@ extern NSString* const UIApplicationWillResignActiveNotification;
 @property (nonatomic, assign) BOOL wantsToArchive;
 @property (nonatomic, assign) BOOL connectedToNetwork;
 @property (nonatomic, strong) NSOperationQueue *packageArchiveQueue;
-@property (nonatomic, strong) NSOperationQueue *downloadOperationQueue;
+@property (nonatomic, strong) AFDownloadScheduler *downloadScheduler;
+@property (nonatomic, assign) int configuredConcurrentConnections; // restored when adaptiveConcurrency is turned off
+@property (nonatomic, strong) AFRevalidationSweeper *revalidationSweeper;
+@property (nonatomic, strong) AFCacheGarbageCollector *garbageCollector;
+@property (nonatomic, strong) AFCacheInvalidationIndex *invalidationIndex;
+@property (nonatomic, strong) AFCacheSharedStore *sharedStore;
+@property (nonatomic, strong) AFCacheSlabStore *slabStore;
+@property (nonatomic, assign) uint64_t admissionStoreSize;
+@property (nonatomic, assign) NSTimeInterval admissionStoreSizeTimestamp;
+@property (nonatomic, strong) NSMutableDictionary *bodySources; // key -> id<AFCacheBodySource>
+@property (strong) AFCacheBaseImage *baseImage;
+@property (nonatomic, strong) NSMutableSet *baseImageRemovedURLs; // hidden entries of the image, synchronized on itself
+@property (nonatomic, copy) NSString *baseImageRemovedURLsKey;    // bodySourceKey of the image they were removed from
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t archiveQueue;
+@property (nonatomic, strong) dispatch_queue_t ioQueue;
+#else
+@property (nonatomic, assign) dispatch_queue_t archiveQueue;
+@property (nonatomic, assign) dispatch_queue_t ioQueue;
+#endif
 @property (nonatomic, strong) NSString* version;
 @property (nonatomic, assign, readonly) NSString* infoDictionaryPath;
 @property (nonatomic, assign, readonly) NSString* metaDataDictionaryPath;
@@ -98,6 +131,10 @@ static NSMutableDictionary* AFCache_contextCache = nil;
                                                      name:UIApplicationWillTerminateNotification
                                                    object:nil];
 #endif
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(releaseMemory)
+                                                     name:kAFMemoryGovernorMemoryPressureNotification
+                                                   object:nil];
         if (!AFCache_contextCache) {
             AFCache_contextCache = [[NSMutableDictionary alloc] init];
         }
@@ -109,6 +146,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         _context = [context copy];
         [self reinitialize];
 		[self initMimeTypes];
+        [[AFStorageGovernor sharedGovernor] registerCache:self];
 	}
 	return self;
 }
@@ -116,7 +154,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 - (void)initialize {
     _offlineMode = NO;
     _wantsToArchive = NO;
-    _connectedToNetwork = NO;
+    _connectedToNetwork = YES; // optimistic until the reachability provider or a download tells otherwise
     _archiveInterval = kAFCacheArchiveDelay;
     _failOnStatusCodeAbove400 = YES;
     _cacheWithHashname = YES;
@@ -125,11 +163,47 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     _networkTimeoutIntervals.GETRequest = kDefaultNetworkTimeoutIntervalGETRequest;
     _networkTimeoutIntervals.PackageRequest = kDefaultNetworkTimeoutIntervalPackageRequest;
     _totalRequestsForSession = 0;
+    if (!_archiveQueue) {
+        _archiveQueue = dispatch_queue_create("de.artifacts.afcache.archive", DISPATCH_QUEUE_SERIAL);
+    }
+    if (!_ioQueue) {
+        _ioQueue = dispatch_queue_create("de.artifacts.afcache.io", DISPATCH_QUEUE_SERIAL);
+    }
+    // packed bodies stay readable whatever the threshold
+    _slabStore = [[AFCacheSlabStore alloc] initWithCache:self];
+    _slabObjectThreshold = 0;
+    _bodySources = [NSMutableDictionary dictionaryWithObject:_slabStore forKey:kAFCacheSlabStoreBodySourceKey];
+    _baseImage = nil;
     _packageArchiveQueue = [[NSOperationQueue alloc] init];
     [_packageArchiveQueue setMaxConcurrentOperationCount:1];
 
-    _downloadOperationQueue = [[NSOperationQueue alloc] init];
-    [_downloadOperationQueue setMaxConcurrentOperationCount:kAFCacheDefaultConcurrentConnections];
+    _downloadScheduler = [[AFDownloadScheduler alloc] init];
+    [_downloadScheduler setMaxConcurrentOperationCount:kAFCacheDefaultConcurrentConnections];
+    [_downloadScheduler setMaxConcurrentOperationCountPerHost:kAFCacheDefaultConcurrentConnectionsPerHost];
+    [_downloadScheduler setAgingInterval:kAFCacheDefaultDownloadAgingInterval];
+    _configuredConcurrentConnections = kAFCacheDefaultConcurrentConnections;
+    _adaptiveConcurrency = NO;
+    _minimumConcurrentConnections = kAFCacheDefaultMinimumConcurrentConnections;
+    _maximumConcurrentConnections = kAFCacheDefaultMaximumConcurrentConnections;
+
+    [_revalidationSweeper stop];
+    _revalidationSweeper = [[AFRevalidationSweeper alloc] initWithCache:self];
+    _backgroundRevalidation = NO;
+
+    [_garbageCollector stop];
+    _garbageCollector = [[AFCacheGarbageCollector alloc] initWithCache:self];
+    _backgroundGarbageCollection = NO;
+
+    // the index is attached to the info store when it is unarchived
+    [AFCacheableItemInfo retainHeaderNamed:kAFCacheDefaultSurrogateKeyHeaderName];
+    _surrogateKeyHeaderName = kAFCacheDefaultSurrogateKeyHeaderName;
+    [_invalidationIndex attachToInfoStore:nil];
+    _invalidationIndex = [[AFCacheInvalidationIndex alloc] initWithTagHeaderName:_surrogateKeyHeaderName];
+
+    // the data path may have changed, the store is opened again on request
+    [_sharedStore close];
+    _sharedStore = nil;
+    _shareStoreAcrossProcesses = NO;
 
     if (!_dataPath)
     {
@@ -166,15 +240,64 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     }
 
     [AFCache addSkipBackupAttributeToItemAtURL:[NSURL fileURLWithPath:_dataPath]];
+
+    if (!_reachabilityProvider) {
+        [self setReachabilityProvider:[[AFSystemReachabilityProvider alloc] init]];
+    }
 }
 
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [_revalidationSweeper stop];
+    [_garbageCollector stop];
+    [_sharedStore close];
+    [_reachabilityProvider stopMonitoring];
+#if !OS_OBJECT_USE_OBJC
+    if (_archiveQueue) {
+        dispatch_release(_archiveQueue);
+    }
+    if (_ioQueue) {
+        dispatch_release(_ioQueue);
+    }
+#endif
 
     if (_context)
     {
         [AFCache_contextCache removeObjectForKey:_context];
     }
+    [[AFStorageGovernor sharedGovernor] unregisterCache:self];
+}
+
+#pragma mark - Info store
+
+// The info store must stay thread-safe, even if a client assigns a plain dictionary
+
+- (void)setCachedItemInfos:(NSMutableDictionary *)cachedItemInfos {
+    _cachedItemInfos = [self infoStoreWithDictionary:cachedItemInfos];
+    [self.invalidationIndex attachToInfoStore:(AFCacheInfoStore*)_cachedItemInfos];
+    [self.sharedStore setInfoStore:(AFCacheInfoStore*)_cachedItemInfos forName:kAFCacheInfoStoreCachedObjectsKey];
+}
+
+- (void)setUrlRedirects:(NSMutableDictionary *)urlRedirects {
+    _urlRedirects = [self infoStoreWithDictionary:urlRedirects];
+    [self.sharedStore setInfoStore:(AFCacheInfoStore*)_urlRedirects forName:kAFCacheInfoStoreRedirectsKey];
+}
+
+- (void)setPackageInfos:(NSMutableDictionary *)packageInfos {
+    _packageInfos = [self infoStoreWithDictionary:packageInfos];
+    [self.sharedStore setInfoStore:(AFCacheInfoStore*)_packageInfos forName:kAFCacheInfoStorePackageInfosKey];
+}
+
+- (void)setPinCounts:(NSMutableDictionary *)pinCounts {
+    _pinCounts = [self infoStoreWithDictionary:pinCounts];
+    [self.sharedStore setInfoStore:(AFCacheInfoStore*)_pinCounts forName:kAFCacheInfoStorePinCountsKey];
+}
+
+- (AFCacheInfoStore*)infoStoreWithDictionary:(NSDictionary*)dictionary {
+    if (!dictionary || [dictionary isKindOfClass:[AFCacheInfoStore class]]) {
+        return (AFCacheInfoStore*)dictionary;
+    }
+    return [AFCacheInfoStore dictionaryWithDictionary:dictionary];
 }
 
 - (void)setDataPath:(NSString*)newDataPath {
@@ -194,11 +317,131 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 }
 
 - (int)concurrentConnections {
-    return [self.downloadOperationQueue maxConcurrentOperationCount];
+    return (int)[self.downloadScheduler maxConcurrentOperationCount];
 }
 
 - (void)setConcurrentConnections:(int)maxConcurrentConnections {
-    [self.downloadOperationQueue setMaxConcurrentOperationCount:maxConcurrentConnections];
+    self.configuredConcurrentConnections = maxConcurrentConnections;
+    if (self.adaptiveConcurrency) {
+        [self.downloadScheduler.concurrencyController resetToConcurrency:maxConcurrentConnections];
+        maxConcurrentConnections = (int)[self.downloadScheduler.concurrencyController concurrency];
+    }
+    [self.downloadScheduler setMaxConcurrentOperationCount:maxConcurrentConnections];
+}
+
+- (void)setAdaptiveConcurrency:(BOOL)adaptiveConcurrency {
+    _adaptiveConcurrency = adaptiveConcurrency;
+    if (adaptiveConcurrency) {
+        AFAdaptiveConcurrencyController *controller = [[AFAdaptiveConcurrencyController alloc] initWithConcurrency:self.configuredConcurrentConnections
+                                                                                                          minimum:self.minimumConcurrentConnections
+                                                                                                          maximum:self.maximumConcurrentConnections];
+        [self.downloadScheduler setConcurrencyController:controller];
+    } else {
+        // the controller has been changing the scheduler's limit
+        [self.downloadScheduler setConcurrencyController:nil];
+        [self.downloadScheduler setMaxConcurrentOperationCount:self.configuredConcurrentConnections];
+    }
+}
+
+- (void)setMinimumConcurrentConnections:(int)minimumConcurrentConnections {
+    _minimumConcurrentConnections = minimumConcurrentConnections;
+    AFAdaptiveConcurrencyController *controller = self.downloadScheduler.concurrencyController;
+    [controller setMinimumConcurrency:minimumConcurrentConnections];
+    [self applyConcurrencyOfController:controller];
+}
+
+- (void)setMaximumConcurrentConnections:(int)maximumConcurrentConnections {
+    _maximumConcurrentConnections = maximumConcurrentConnections;
+    AFAdaptiveConcurrencyController *controller = self.downloadScheduler.concurrencyController;
+    [controller setMaximumConcurrency:maximumConcurrentConnections];
+    [self applyConcurrencyOfController:controller];
+}
+
+// the controller clamps its concurrency to new bounds, the scheduler would only take it over with the next finished download
+- (void)applyConcurrencyOfController:(AFAdaptiveConcurrencyController*)controller {
+    if (controller) {
+        [self.downloadScheduler setMaxConcurrentOperationCount:[controller concurrency]];
+    }
+}
+
+- (void)setBackgroundRevalidation:(BOOL)backgroundRevalidation {
+    _backgroundRevalidation = backgroundRevalidation;
+    if (backgroundRevalidation) {
+        [self.revalidationSweeper start];
+    } else {
+        [self.revalidationSweeper stop];
+    }
+}
+
+- (void)setSurrogateKeyHeaderName:(NSString *)surrogateKeyHeaderName {
+    _surrogateKeyHeaderName = [surrogateKeyHeaderName copy];
+    [AFCacheableItemInfo retainHeaderNamed:_surrogateKeyHeaderName];
+    // the store retains its observers
+    [self.invalidationIndex attachToInfoStore:nil];
+    self.invalidationIndex = [[AFCacheInvalidationIndex alloc] initWithTagHeaderName:_surrogateKeyHeaderName];
+    [self.invalidationIndex attachToInfoStore:(AFCacheInfoStore*)self.cachedItemInfos];
+}
+
+- (void)setShareStoreAcrossProcesses:(BOOL)shareStoreAcrossProcesses {
+    if (shareStoreAcrossProcesses == _shareStoreAcrossProcesses) {
+        return;
+    }
+    if (!shareStoreAcrossProcesses) {
+        // the archives are written wholesale again from now on
+        self.sharedStore.checkpointWriter = nil;
+        [self.sharedStore close];
+        self.sharedStore = nil;
+        _shareStoreAcrossProcesses = NO;
+        [self archive];
+        return;
+    }
+
+    AFCacheSharedStore *sharedStore = [[AFCacheSharedStore alloc] initWithDirectory:self.dataPath];
+    if (!sharedStore) {
+        NSLog(@"AFCache: Could not share the store in %@ across processes", self.dataPath);
+        return;
+    }
+    __weak AFCache *weakSelf = self;
+    sharedStore.checkpointLoader = ^NSDictionary*{
+        return [weakSelf archivedInfoStores];
+    };
+    sharedStore.checkpointWriter = ^{
+        AFCache *cache = weakSelf;
+        [cache serializeState:[cache stateDictionary]];
+    };
+    [sharedStore setInfoStore:(AFCacheInfoStore*)self.cachedItemInfos forName:kAFCacheInfoStoreCachedObjectsKey];
+    [sharedStore setInfoStore:(AFCacheInfoStore*)self.urlRedirects forName:kAFCacheInfoStoreRedirectsKey];
+    [sharedStore setInfoStore:(AFCacheInfoStore*)self.pinCounts forName:kAFCacheInfoStorePinCountsKey];
+    [sharedStore setInfoStore:(AFCacheInfoStore*)self.packageInfos forName:kAFCacheInfoStorePackageInfosKey];
+    self.sharedStore = sharedStore;
+    _shareStoreAcrossProcesses = YES;
+    // what this process has not archived yet is lost, the stores of all processes are those of the last checkpoint
+    [sharedStore synchronize];
+}
+
+- (void)setBackgroundGarbageCollection:(BOOL)backgroundGarbageCollection {
+    _backgroundGarbageCollection = backgroundGarbageCollection;
+    if (backgroundGarbageCollection) {
+        [self.garbageCollector start];
+    } else {
+        [self.garbageCollector stop];
+    }
+}
+
+- (int)concurrentConnectionsPerHost {
+    return (int)[self.downloadScheduler maxConcurrentOperationCountPerHost];
+}
+
+- (void)setConcurrentConnectionsPerHost:(int)maxConcurrentConnectionsPerHost {
+    [self.downloadScheduler setMaxConcurrentOperationCountPerHost:maxConcurrentConnectionsPerHost];
+}
+
+- (NSTimeInterval)downloadAgingInterval {
+    return [self.downloadScheduler agingInterval];
+}
+
+- (void)setDownloadAgingInterval:(NSTimeInterval)downloadAgingInterval {
+    [self.downloadScheduler setAgingInterval:downloadAgingInterval];
 }
 
 // TODO: If we really need "named" caches ("context" is the wrong word), then realize this concept as a category, but not here
@@ -256,43 +499,188 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 }
 
 // remove all cache entries are not in a given set
+// Only the info store is changed here. Unlinking the files is left to the garbage collector, which also walks the
+// cache directory for files no entry refers to, so the caller is not blocked by the file system.
 - (void)doHousekeepingWithRequiredCacheItemURLs:(NSSet*)requiredURLs
 {
-    NSMutableSet* fileNames = [NSMutableSet set];
-    
-    NSMutableDictionary* cacheInfoForFileName = [NSMutableDictionary dictionary];
-    for (NSURL* cacheURL in requiredURLs) {
-        AFCacheableItem* item = [self cacheableItemFromCacheStore:cacheURL];
-        if (item.info) {
-            NSString* fileName = item.info.filename;
-            [fileNames addObject:fileName];
-            [cacheInfoForFileName setObject:item.info forKey:fileName];
+    NSMutableSet *requiredKeys = [NSMutableSet setWithCapacity:[requiredURLs count]];
+    for (NSURL *url in requiredURLs) {
+        AFCacheKey *key = [AFCacheKey keyWithURL:url];
+        if (key) {
+            [requiredKeys addObject:key.URLString];
         }
+    }
 
+    NSDate *removalDate = [NSDate date];
+    NSMutableSet *removedKeys = [NSMutableSet set];
+    NSMutableArray *pathsToRemove = [NSMutableArray array];
+    NSDictionary *cachedItemInfos = [self.cachedItemInfos copy];
+    [cachedItemInfos enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+        if ([requiredKeys containsObject:key] || [self.pinCounts objectForKey:key]) {
+            return;
+        }
+        NSString *filePath = [self filePathOfInfo:info URL:[NSURL URLWithString:key]];
+        if (filePath) {
+            [pathsToRemove addObject:filePath];
+        }
+        [self.cachedItemInfos removeObjectForKey:key];
+        [self hideBaseImageEntryForURLString:key];
+        [removedKeys addObject:key];
+    }];
+
+    // remove redirects to the removed entries
+    NSDictionary *urlRedirects = [self.urlRedirects copy];
+    [urlRedirects enumerateKeysAndObjectsUsingBlock:^(id redirectKey, id redirectTarget, BOOL *stop) {
+        if ([redirectTarget isKindOfClass:[NSString class]] && [removedKeys containsObject:redirectTarget]) {
+            [self.urlRedirects removeObjectForKey:redirectKey];
+        }
+    }];
+
+    AFLog(@"housekeeping removed %lu entries, %lu remain", (unsigned long)[removedKeys count], (unsigned long)[self.cachedItemInfos count]);
+    [self.garbageCollector removeFilesAtPaths:pathsToRemove unlessModifiedAfter:removalDate];
+    [self.garbageCollector setNeedsCollection];
+    [self.slabStore setNeedsCompaction];
+    [self archive];
+}
+
+// path of the entry's own file, nil if its body is kept elsewhere
+- (NSString*)filePathOfInfo:(AFCacheableItemInfo*)info URL:(NSURL*)url {
+    if (!self.cacheWithHashname) {
+        return [self filePathForURL:url];
     }
-    [fileNames addObject:kAFCachePackageInfoDictionaryFilename];
-    [fileNames addObject:kAFCacheMetadataFilename];
-    [fileNames addObject:kAFCacheExpireInfoDictionaryFilename];
-    NSSet* fileNameSet = [NSSet setWithSet:fileNames];
-    __block NSMutableArray* urlsToRemove = [NSMutableArray array];
-    [self performBlockOnAllCacheFiles:^(NSURL *url) {
-        NSError *error;
-        NSNumber *isDirectory = nil;
-        if (! [url getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:&error]) {
-            NSLog(@"ERROR: cleanup encountered error: %@", error);
-        }
-        else if (! [isDirectory boolValue]) {
-            NSString* fileName = [url lastPathComponent];
-            if(![fileNameSet containsObject:[fileName stringByDeletingPathExtension]])
-            {
-                [urlsToRemove addObject:url];
-            }
+    if ([info.filename length] > 0) {
+        return [self filePathForFilename:info.filename pathExtension:[url pathExtension]];
+    }
+    return nil;
+}
+
+#pragma mark - Invalidation
+
+- (NSUInteger)invalidateURLsWithPrefix:(NSString*)prefix {
+    return [self removeCacheEntriesForKeys:[self.invalidationIndex keysWithPrefix:prefix]];
+}
+
+- (NSUInteger)invalidateURLsWithSurrogateKey:(NSString*)surrogateKey {
+    return [self removeCacheEntriesForKeys:[self.invalidationIndex keysWithTag:surrogateKey]];
+}
+
+// Like doHousekeepingWithRequiredCacheItemURLs:, but only looks at the given entries. Redirects to them are left,
+// finding those would mean looking at every redirect. They lead to no entry, so a lookup misses as it should.
+- (NSUInteger)removeCacheEntriesForKeys:(NSArray*)keys {
+    if ([keys count] == 0) {
+        return 0;
+    }
+    NSDate *removalDate = [NSDate date];
+    NSUInteger removedCount = 0;
+    NSMutableArray *pathsToRemove = [NSMutableArray array];
+    for (AFCacheKey *key in keys) {
+        AFCacheableItemInfo *info = [self.cachedItemInfos objectForKey:key];
+        if (!info) {
+            continue;
+        }
+        NSString *filePath = [self filePathOfInfo:info URL:[key URL]];
+        if (filePath) {
+            [pathsToRemove addObject:filePath];
+        }
+        [self.cachedItemInfos removeObjectForKey:key];
+        [self.urlRedirects removeObjectForKey:key];
+        [self hideBaseImageEntryForURLString:key.URLString];
+        removedCount++;
+    }
+
+    AFLog(@"invalidated %lu entries", (unsigned long)removedCount);
+    if (removedCount > 0) {
+        [self.garbageCollector removeFilesAtPaths:pathsToRemove unlessModifiedAfter:removalDate];
+        [self.slabStore setNeedsCompaction];
+        [self archive];
+    }
+    return removedCount;
+}
+
+#pragma mark - Pinning
+
+- (void)pinCachedItemForURL:(NSURL*)url {
+    AFCacheKey *key = [AFCacheKey keyWithURL:url];
+    if (!key) {
+        return;
+    }
+    @synchronized (self.pinCounts) {
+        NSUInteger pinCount = [[self.pinCounts objectForKey:key] unsignedIntegerValue];
+        [self.pinCounts setObject:@(pinCount + 1) forKey:key];
+    }
+    [self archive];
+}
+
+- (void)unpinCachedItemForURL:(NSURL*)url {
+    AFCacheKey *key = [AFCacheKey keyWithURL:url];
+    if (!key) {
+        return;
+    }
+    @synchronized (self.pinCounts) {
+        NSUInteger pinCount = [[self.pinCounts objectForKey:key] unsignedIntegerValue];
+        if (pinCount == 0) {
+            NSLog(@"AFCache: %@ is not pinned", url);
+            return;
+        }
+        if (pinCount == 1) {
+            [self.pinCounts removeObjectForKey:key];
+        } else {
+            [self.pinCounts setObject:@(pinCount - 1) forKey:key];
+        }
+    }
+    [self archive];
+}
+
+- (BOOL)isPinnedURL:(NSURL*)url {
+    AFCacheKey *key = [AFCacheKey keyWithURL:url];
+    return key && [self.pinCounts objectForKey:key] != nil;
+}
+
+#pragma mark - Storage governor
+
+- (NSString*)storageGovernorContext {
+    return self.context;
+}
+
+- (NSDictionary*)storageGovernorItemInfos {
+    return [self.cachedItemInfos copy];
+}
+
+- (BOOL)storageGovernorIsPinnedKey:(NSString*)key {
+    return [self.pinCounts objectForKey:key] != nil;
+}
+
+// resources of consumed packages and the archives they are served from
+- (NSSet*)storageGovernorRetainedKeys {
+    NSMutableSet *packageResources = [NSMutableSet set];
+    [[self.packageInfos copy] enumerateKeysAndObjectsUsingBlock:^(NSString *packageKey, AFPackageInfo *packageInfo, BOOL *stop) {
+        [packageResources addObjectsFromArray:packageInfo.resourceURLs];
+        if (packageInfo.archivePath) {
+            // the resources are served from the archive
+            [packageResources addObject:packageKey];
         }
     }];
-    for (NSURL* url in urlsToRemove) {
-        [self removeCacheEntryAndFileForFileURL:url];
+    return packageResources;
+}
+
+- (BOOL)storageGovernorEvictKey:(NSString*)key info:(AFCacheableItemInfo*)info {
+    NSURL *url = [NSURL URLWithString:key];
+    if (!url || [self isQueuedOrDownloadingURL:url]) {
+        return NO;
     }
+    if ([self.cachedItemInfos objectForKey:key] != info) {
+        // removed or replaced since it was measured
+        return NO;
+    }
+    [self removeCacheEntry:info fileOnly:NO fallbackURL:url];
+    // NO if the file could not be deleted
+    return [self.cachedItemInfos objectForKey:key] == nil;
 }
+
+- (void)storageGovernorDidEvict {
+    [self archive];
+}
+
 -(void)performBlockOnAllCacheFiles:(void (^)(NSURL* url))cacheItemActionBlock
 {
     NSFileManager *fileManager = [NSFileManager defaultManager];
@@ -325,6 +713,9 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 			keys = [self.cachedItemInfos allKeysForObject:info];
 			if ([keys count] > 0) {
 				key = [keys objectAtIndex:0];
+				if ([self.pinCounts objectForKey:key]) {
+					continue;
+				}
 				[self removeCacheEntry:info fileOnly:NO];
                 NSString* fullPath = [self.dataPath stringByAppendingPathComponent:key];
 				[self removeCacheEntryWithFilePath:fullPath fileOnly:NO];
@@ -362,6 +753,50 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 	return size;
 }
 
+#pragma mark - Statistics
+
+- (NSUInteger)executingDownloadCount {
+    return [self.downloadScheduler executingOperationCount];
+}
+
+- (NSDictionary*)statistics {
+    NSMutableDictionary *statistics = [NSMutableDictionary dictionary];
+    statistics[kAFCacheStatisticsTotalRequestsKey] = @(self.totalRequestsForSession);
+    statistics[kAFCacheStatisticsConcurrentConnectionsKey] = @(self.concurrentConnections);
+    statistics[kAFCacheStatisticsExecutingDownloadsKey] = @([self executingDownloadCount]);
+    NSUInteger pendingDownloads = 0;
+    for (NSUInteger lane = 0; lane < kAFDownloadLaneCount; lane++) {
+        pendingDownloads += [self.downloadScheduler pendingOperationCountForLane:(AFDownloadLane)lane];
+    }
+    statistics[kAFCacheStatisticsPendingDownloadsKey] = @(pendingDownloads);
+    AFAdaptiveConcurrencyController *concurrencyController = self.downloadScheduler.concurrencyController;
+    if (concurrencyController) {
+        statistics[kAFCacheStatisticsAdaptiveConcurrencyKey] = [concurrencyController statistics];
+    }
+    if (self.backgroundRevalidation) {
+        statistics[kAFCacheStatisticsRevalidationKey] = [self.revalidationSweeper statistics];
+    }
+    statistics[kAFCacheStatisticsGarbageCollectionKey] = [self.garbageCollector statistics];
+    statistics[kAFCacheStatisticsPinnedURLsKey] = @([self.pinCounts count]);
+    statistics[kAFCacheStatisticsInvalidationIndexKey] = [self.invalidationIndex statistics];
+    statistics[kAFCacheStatisticsSlabStoreKey] = [self.slabStore statistics];
+    if (self.sharedStore) {
+        statistics[kAFCacheStatisticsSharedStoreKey] = [self.sharedStore statistics];
+    }
+    if (self.admissionFilter) {
+        statistics[kAFCacheStatisticsAdmissionKey] = [self.admissionFilter statistics];
+    }
+    if (self.retryPolicy) {
+        statistics[kAFCacheStatisticsRetryKey] = [self.retryPolicy statistics];
+    }
+    NSDictionary *storageStatistics = [[AFStorageGovernor sharedGovernor] statisticsForContext:self.context];
+    if (storageStatistics) {
+        statistics[kAFCacheStatisticsStorageKey] = storageStatistics;
+    }
+    statistics[kAFCacheStatisticsMemoryKey] = [[AFMemoryGovernor sharedGovernor] statistics];
+    return statistics;
+}
+
 #pragma mark - Public API for getting cached items (do not use any other)
 
 - (AFCacheableItem*)cacheItemForURL:(NSURL *)url
@@ -409,6 +844,333 @@ static NSMutableDictionary* AFCache_contextCache = nil;
                      requestConfiguration:requestConfiguration];
 }
 
+#pragma mark - Asynchronous API for getting cached items
+
+- (AFCacheLookup*)cacheItemForURL:(NSURL *)url
+                    urlCredential:(NSURLCredential *)urlCredential
+             requestConfiguration:(AFRequestConfiguration*)requestConfiguration
+                    deliveryQueue:(dispatch_queue_t)deliveryQueue
+                  completionBlock:(AFCacheableItemBlock)completionBlock
+                        failBlock:(AFCacheableItemBlock)failBlock
+                    progressBlock:(AFCacheableItemBlock)progressBlock
+{
+    AFCacheLookup *lookup = [[AFCacheLookup alloc] initWithURL:url cache:self];
+    lookup.deliveryQueue = deliveryQueue ?: dispatch_get_main_queue();
+    
+    dispatch_async(self.ioQueue, ^{
+        if ([lookup isCancelled]) {
+            return;
+        }
+        
+        // Completion blocks are called on the I/O queue for cache hits and on the main thread for downloads.
+        // Either way the file is mapped on the I/O queue, so that -[AFCacheableItem data] does not touch storage on the delivery queue.
+        AFCacheableItemBlock completion = nil;
+        if (completionBlock) {
+            completion = ^(AFCacheableItem *item) {
+                dispatch_async(self.ioQueue, ^{
+                    if (![lookup isCancelled]) {
+                        [item data];
+                        [lookup deliverBlock:completionBlock item:item];
+                    }
+                });
+            };
+        }
+        AFCacheableItemBlock fail = nil;
+        if (failBlock) {
+            fail = ^(AFCacheableItem *item) {
+                [lookup deliverBlock:failBlock item:item];
+            };
+        }
+        AFCacheableItemBlock progress = nil;
+        if (progressBlock) {
+            progress = ^(AFCacheableItem *item) {
+                [lookup deliverBlock:progressBlock item:item];
+            };
+        }
+        
+        lookup.completionBlock = completion;
+        lookup.failBlock = fail;
+        lookup.progressBlock = progress;
+        AFCacheableItem *item = [self _internalCacheItemForURL:url
+                                                 urlCredential:urlCredential
+                                               completionBlock:completion
+                                                     failBlock:fail
+                                                 progressBlock:progress
+                                          requestConfiguration:requestConfiguration];
+        [lookup didLookUpItem:item];
+    });
+    
+    return lookup;
+}
+
+- (void)cancelDownloadForItem:(AFCacheableItem*)item {
+    // other clients have joined the download
+    if ([item hasClientBlocks]) {
+        return;
+    }
+    for (AFDownloadOperation *downloadOperation in [self.downloadScheduler operationsForKey:item.cacheKey]) {
+        if (downloadOperation.cacheableItem == item) {
+            [downloadOperation cancel];
+        }
+    }
+}
+
+#pragma mark - Batch API for getting cached items
+
+- (NSDictionary*)cacheItemsForURLs:(NSArray*)urls
+                     urlCredential:(NSURLCredential*)urlCredential
+              requestConfiguration:(AFRequestConfiguration*)requestConfiguration
+                   completionBlock:(AFCacheBatchCompletionBlock)completionBlock
+{
+    BOOL invalidateCacheEntry = (requestConfiguration.options & kAFCacheInvalidateEntry) != 0;
+    BOOL neverRevalidate = (requestConfiguration.options & kAFCacheNeverRevalidate) != 0;
+    BOOL returnFileBeforeRevalidation = (requestConfiguration.options & kAFCacheReturnFileBeforeRevalidation) != 0;
+    BOOL offline = [self offlineMode] || ![self isConnectedToNetwork];
+
+    NSMutableDictionary *hits = [NSMutableDictionary dictionary];
+    NSMutableDictionary *items = [NSMutableDictionary dictionary];
+    NSMutableArray *failedURLs = [NSMutableArray array];
+    NSMutableArray *candidates = [NSMutableArray array];      // @[requested URL, item, file path] with a cache info, file not checked yet
+    NSMutableArray *pendingItems = [NSMutableArray array];    // @[requested URL, item] to be downloaded or revalidated
+    NSMutableArray *joinedItems = [NSMutableArray array];     // @[requested URL, item, operation] of downloads that are running already
+
+    // One snapshot of the info store for the whole batch, running downloads are looked up by key
+    [self.sharedStore synchronize];
+    NSDictionary *cachedItemInfos = [self.cachedItemInfos copy];
+    NSDictionary *urlRedirects = [self.urlRedirects copy];
+
+    NSMutableSet *requestedKeys = [NSMutableSet setWithCapacity:[urls count]];
+    for (NSURL *requestedURL in urls) {
+        if (![self isValidRequestURL:requestedURL] || [requestedURL isFileURL]) {
+            if (requestedURL) {
+                [failedURLs addObject:requestedURL];
+            }
+            continue;
+        }
+        AFCacheKey *requestedKey = [AFCacheKey keyWithURL:requestedURL];
+        if ([requestedKeys containsObject:requestedKey]) {
+            continue;
+        }
+        [requestedKeys addObject:requestedKey];
+        _totalRequestsForSession++;
+
+        // see urlOrRedirectURLInOfflineModeForURL:redirected:
+        NSURL *url = requestedURL;
+        NSString *redirectURLString = urlRedirects[requestedKey];
+        BOOL didRewriteURL = [self offlineMode] && redirectURLString;
+        if (didRewriteURL) {
+            url = [NSURL URLWithString:redirectURLString];
+        }
+        AFCacheKey *key = didRewriteURL ? [AFCacheKey keyWithURL:url] : requestedKey;
+
+        AFDownloadOperation *downloadOperation = [self.downloadScheduler nonCancelledOperationForKey:key];
+        if (downloadOperation) {
+            [joinedItems addObject:@[requestedURL, downloadOperation.cacheableItem, downloadOperation]];
+            continue;
+        }
+
+        AFCacheableItemInfo *info = invalidateCacheEntry ? nil : [self cachedInfoForKey:key infos:cachedItemInfos redirects:urlRedirects];
+        AFCacheableItem *item = [[AFCacheableItem alloc] init];
+        [self setUpItem:item forURL:url urlCredential:urlCredential requestConfiguration:requestConfiguration didRewriteURL:didRewriteURL];
+        if (info) {
+            // The info is shared with every other lookup of the URL, so the path is kept here instead of in the info
+            item.info = info;
+            [candidates addObject:@[requestedURL, item, [self fullPathForCacheableItem:item]]];
+        } else if ([self offlineMode]) {
+            [failedURLs addObject:requestedURL];
+        } else {
+            [pendingItems addObject:@[requestedURL, item]];
+        }
+        [self recordAccessForItem:item];
+    }
+
+    // Check the files in path order, which is the order they are laid out in the cache directory
+    [candidates sortUsingComparator:^NSComparisonResult(NSArray *a, NSArray *b) {
+        return [(NSString*)a[2] compare:b[2]];
+    }];
+    for (NSArray *candidate in candidates) {
+        NSURL *requestedURL = candidate[0];
+        AFCacheableItem *item = candidate[1];
+
+        BOOL fileExists = YES;
+        BOOL complete = item.info.bodySourceKey ? [self hasBodyForItemInfo:item.info] : [item hasCompleteFileAtPath:candidate[2] exists:&fileExists];
+        if (!complete) {
+            if (!fileExists) {
+                // same as cacheableItemFromCacheStore: the info store is out of sync
+                [self removeCacheEntry:item.info fileOnly:YES];
+            }
+            if ([self offlineMode]) {
+                [failedURLs addObject:requestedURL];
+                continue;
+            }
+            item.info = [[AFCacheableItemInfo alloc] init];
+            [item.info recordAccess];
+            [pendingItems addObject:@[requestedURL, item]];
+            continue;
+        }
+
+        item.servedFromCache = YES;
+        BOOL fresh = offline || neverRevalidate || [item isFresh];
+        if (fresh || returnFileBeforeRevalidation) {
+            item.cacheStatus = kCacheStatusFresh;
+            item.currentContentLength = item.info.contentLength;
+            hits[requestedURL] = item;
+            items[requestedURL] = item;
+        }
+        if (!fresh) {
+            // The batch completion needs a signal for a 304, too, so the item is not flagged as returned.
+            // Revalidations of returned items still belong into the revalidation lane.
+            item.isBackgroundRevalidation = returnFileBeforeRevalidation;
+            item.isRevalidating = YES;
+            item.cacheStatus = kCacheStatusRevalidationPending;
+            item.IMSRequest = [self IMSRequestForCacheableItem:item];
+            [pendingItems addObject:@[requestedURL, item]];
+        }
+    }
+
+    // Misses and revalidations finish as a group, with a single completion
+    NSMutableArray *waitingItems = [NSMutableArray arrayWithArray:pendingItems];
+    [waitingItems addObjectsFromArray:joinedItems];
+    __block NSUInteger remaining = [waitingItems count];
+    NSObject *lock = [[NSObject alloc] init];
+    NSMutableSet *finishedURLs = [NSMutableSet setWithCapacity:remaining];
+    void (^itemDidFinish)(NSURL*, AFCacheableItem*, BOOL) = ^(NSURL *requestedURL, AFCacheableItem *item, BOOL success) {
+        BOOL finished = NO;
+        @synchronized (lock) {
+            // a joined download may be reported by its signal and by the check below
+            if ([finishedURLs containsObject:requestedURL]) {
+                return;
+            }
+            [finishedURLs addObject:requestedURL];
+            if (success) {
+                items[requestedURL] = item;
+            } else if (!items[requestedURL]) {
+                [failedURLs addObject:requestedURL];
+            }
+            finished = (--remaining == 0);
+        }
+        if (finished && completionBlock) {
+            completionBlock(items, failedURLs);
+        }
+    };
+
+    NSMutableArray *itemBlocks = [NSMutableArray arrayWithCapacity:[waitingItems count]]; // @[completion block, fail block]
+    for (NSArray *waitingItem in waitingItems) {
+        NSURL *requestedURL = waitingItem[0];
+        AFCacheableItem *item = waitingItem[1];
+        AFCacheableItemBlock itemCompletionBlock = ^(AFCacheableItem *finishedItem) {
+            itemDidFinish(requestedURL, finishedItem, YES);
+        };
+        AFCacheableItemBlock itemFailBlock = ^(AFCacheableItem *failedItem) {
+            itemDidFinish(requestedURL, failedItem, NO);
+        };
+        [item addCompletionBlock:itemCompletionBlock failBlock:itemFailBlock progressBlock:nil];
+        [itemBlocks addObject:@[itemCompletionBlock, itemFailBlock]];
+    }
+
+    // A download signals its clients after it has finished. One that is not finished yet calls the blocks just added,
+    // one that finished after the queue was scanned may have signalled before, so its result is taken from the item.
+    NSUInteger joinedItemsOffset = [pendingItems count];
+    for (NSUInteger i = 0; i < [joinedItems count]; i++) {
+        NSArray *joinedItem = joinedItems[i];
+        if (![(AFDownloadOperation*)joinedItem[2] isFinished]) {
+            continue;
+        }
+        NSURL *requestedURL = joinedItem[0];
+        AFCacheableItem *item = joinedItem[1];
+        NSArray *blocks = itemBlocks[joinedItemsOffset + i];
+        [item removeCompletionBlock:blocks[0] failBlock:blocks[1] progressBlock:nil];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            itemDidFinish(requestedURL, item, [item isComplete] && !item.error);
+        });
+    }
+
+    if (self.traceRecorder) {
+        for (AFCacheableItem *item in [hits allValues]) {
+            [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusHit];
+        }
+        for (NSArray *waitingItem in waitingItems) {
+            AFCacheableItem *item = waitingItem[1];
+            if (hits[waitingItem[0]]) {
+                // returned before revalidation
+                continue;
+            }
+            [self traceLookupForKey:item.cacheKey item:item status:item.servedFromCache ? kAFCacheTraceStatusRevalidated : kAFCacheTraceStatusMiss];
+        }
+        NSArray *failedURLsBeforeDownloading = nil;
+        @synchronized (lock) {
+            failedURLsBeforeDownloading = [failedURLs copy];
+        }
+        for (NSURL *failedURL in failedURLsBeforeDownloading) {
+            [self traceLookupForKey:[AFCacheKey keyWithURL:failedURL] item:nil status:kAFCacheTraceStatusFailed];
+        }
+    }
+
+    NSMutableDictionary *operationsByLane = [NSMutableDictionary dictionary];
+    for (NSArray *pendingItem in pendingItems) {
+        AFCacheableItem *item = pendingItem[1];
+        if (!item.servedFromCache) {
+            [self storeInfoOfItemToBeDownloaded:item];
+        }
+        AFDownloadLane lane = [self downloadLaneForItem:item];
+        NSMutableArray *operations = operationsByLane[@(lane)];
+        if (!operations) {
+            operations = [NSMutableArray array];
+            operationsByLane[@(lane)] = operations;
+        }
+        [operations addObject:[self downloadOperationForItem:item]];
+    }
+    for (NSNumber *lane in operationsByLane) {
+        [self.downloadScheduler addOperations:operationsByLane[lane] lane:(AFDownloadLane)[lane intValue]];
+    }
+
+    if ([waitingItems count] == 0 && completionBlock) {
+        // never call the completion block before returning
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock(items, failedURLs);
+        });
+    }
+
+    return hits;
+}
+
+#pragma mark - Internal lookup
+
+/*
+ * the info stored for key or for the URL key has been redirected to, else the info of the base image
+ */
+- (AFCacheableItemInfo*)cachedInfoForKey:(AFCacheKey*)key infos:(NSDictionary*)infos redirects:(NSDictionary*)redirects {
+    AFCacheableItemInfo *info = [infos objectForKey:key];
+    if (!info) {
+        NSString *redirectURLString = [redirects objectForKey:key];
+        info = redirectURLString ? [infos objectForKey:redirectURLString] : nil;
+    }
+    return info ?: [self baseImageInfoForURLString:key.URLString];
+}
+
+- (void)setUpItem:(AFCacheableItem*)item forURL:(NSURL*)url urlCredential:(NSURLCredential*)urlCredential requestConfiguration:(AFRequestConfiguration*)requestConfiguration didRewriteURL:(BOOL)didRewriteURL {
+    item.tag = self.totalRequestsForSession;
+    item.cache = self; // calling this particular setter does not increase the retain count to avoid a cyclic reference from a cacheable item to the cache.
+    item.url = url;
+    item.userData = requestConfiguration.userData;
+    item.urlCredential = urlCredential;
+    item.justFetchHTTPHeader = (requestConfiguration.options & kAFCacheJustFetchHTTPHeader) != 0;
+    item.isPackageArchive = (requestConfiguration.options & kAFCacheIsPackageArchive) != 0;
+    item.isPrefetch = (requestConfiguration.options & kAFCachePrefetch) != 0;
+    item.URLInternallyRewritten = didRewriteURL;
+}
+
+/*
+ * A miss gets a new info, which is stored before the download starts: lookups that come meanwhile find the entry
+ * and the running download (see cacheableItemFromCacheStore:) instead of starting another one.
+ */
+- (void)storeInfoOfItemToBeDownloaded:(AFCacheableItem*)item {
+    if (!self.cacheWithHashname) {
+        item.info.filename = [self filenameForURL:item.url];
+    }
+    [self.cachedItemInfos setObject:item.info forKey:item.cacheKey];
+}
+
 - (AFCacheableItem*)_internalCacheItemForURL:(NSURL *)url urlCredential:(NSURLCredential *)urlCredential completionBlock:(AFCacheableItemBlock)completionBlock failBlock:(AFCacheableItemBlock)failBlock progressBlock:(AFCacheableItemBlock)progressBlock requestConfiguration:(AFRequestConfiguration*)requestConfiguration
 {
 	// validate URL and handle invalid url
@@ -441,8 +1203,6 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     // extract option-parts from requestConfiguration.options
     BOOL invalidateCacheEntry = (requestConfiguration.options & kAFCacheInvalidateEntry) != 0;
     BOOL revalidateCacheEntry = (requestConfiguration.options & kAFCacheRevalidateEntry) != 0;
-    BOOL justFetchHTTPHeader = (requestConfiguration.options & kAFCacheJustFetchHTTPHeader) != 0;
-    BOOL isPackageArchive = (requestConfiguration.options & kAFCacheIsPackageArchive) != 0;
     BOOL neverRevalidate = (requestConfiguration.options & kAFCacheNeverRevalidate) != 0;
     BOOL returnFileBeforeRevalidation = (requestConfiguration.options & kAFCacheReturnFileBeforeRevalidation) != 0;
 
@@ -461,6 +1221,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     if (!item) {
         // if we are in offline mode and do not have a cached version, so return nil
         if (!url.isFileURL && [self offlineMode]) {
+            [self traceLookupForKey:[AFCacheKey keyWithURL:url] item:nil status:kAFCacheTraceStatusFailed];
             if (failBlock) {
                 failBlock(nil);
             }
@@ -473,17 +1234,11 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     }
 
     // setup item
-    item.tag = self.totalRequestsForSession;
-    item.cache = self; // calling this particular setter does not increase the retain count to avoid a cyclic reference from a cacheable item to the cache.
-    item.url = url;
-    item.userData = requestConfiguration.userData;
-    item.urlCredential = urlCredential;
-    item.justFetchHTTPHeader = justFetchHTTPHeader;
-    item.isPackageArchive = isPackageArchive;
-    item.URLInternallyRewritten = didRewriteURL;
+    [self setUpItem:item forURL:url urlCredential:urlCredential requestConfiguration:requestConfiguration didRewriteURL:didRewriteURL];
     item.servedFromCache = !performGETRequest;
     item.info.request = requestConfiguration.request;
     item.hasReturnedCachedItemBeforeRevalidation = NO;
+    [self recordAccessForItem:item];
 
     if (!self.cacheWithHashname) {
         item.info.filename = [self filenameForURL:item.url];
@@ -492,9 +1247,9 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     [item addCompletionBlock:completionBlock failBlock:failBlock progressBlock:progressBlock];
 
     if (performGETRequest) {
-        // TODO: Why do we cache the item here? Nothing has been downloaded yet?
-        [self.cachedItemInfos setObject:item.info forKey:[url absoluteString]];
+        [self storeInfoOfItemToBeDownloaded:item];
         
+        [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusMiss];
         [self addItemToDownloadQueue:item];
         return item;
     }
@@ -508,15 +1263,17 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         if (![self isConnectedToNetwork] || ([self offlineMode] && !revalidateCacheEntry)) {
             // return item and call delegate only if fully loaded
             if (item.data) {
+                [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusHit];
                 if (completionBlock) {
                     completionBlock(item);
                 }
                 return item;
             }
             
-            if (![self isQueuedOrDownloadingURL:item.url]) {
+            if (![self isQueuedOrDownloadingKey:item.cacheKey]) {
                 if ([item hasValidContentLength] && !item.canMapData) {
                     // Perhaps the item just can not be mapped.
+                    [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusHit];
                     if (completionBlock) {
                         completionBlock(item);
                     }
@@ -525,6 +1282,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
                 
                 // nobody is downloading, but we got the item from the cachestore.
                 // Something is wrong -> fail
+                [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusFailed];
                 if (failBlock) {
                     failBlock(item);
                 }
@@ -536,6 +1294,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         
         // Check if item is fully loaded already
         if (item.canMapData && !item.data && ![item hasValidContentLength]) {
+            [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusMiss];
             [self addItemToDownloadQueue:item];
             return item;
         }
@@ -543,6 +1302,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         // Item is fresh, so call didLoad selector and return the cached item.
         if ([item isFresh] || returnFileBeforeRevalidation || neverRevalidate) {
             item.cacheStatus = kCacheStatusFresh;
+            [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusHit];
 #ifdef RESUMEABLE_DOWNLOAD
             if(item.currentContentLength < item.info.contentLength) {
                 //resume download
@@ -573,33 +1333,64 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         // save information that object was in cache and has to be revalidated
         item.cacheStatus = kCacheStatusRevalidationPending;
         
-        NSMutableURLRequest *IMSRequest = [NSMutableURLRequest requestWithURL:url
-                                                                  cachePolicy:NSURLRequestReloadIgnoringLocalCacheData
-                                                              timeoutInterval:self.networkTimeoutIntervals.IMSRequest];
-        
-        NSDate *lastModified = [NSDate dateWithTimeIntervalSinceReferenceDate: [item.info.lastModified timeIntervalSinceReferenceDate]];
-        [IMSRequest addValue:[DateParser formatHTTPDate:lastModified] forHTTPHeaderField:kHTTPHeaderIfModifiedSince];
-        [IMSRequest setValue:@"" forHTTPHeaderField:AFCacheInternalRequestHeader];
-        
-        if (item.info.eTag) {
-            [IMSRequest addValue:item.info.eTag forHTTPHeaderField:kHTTPHeaderIfNoneMatch];
-        }
-        else {
-            NSDate *lastModified = [NSDate dateWithTimeIntervalSinceReferenceDate:
-                                    [item.info.lastModified timeIntervalSinceReferenceDate]];
-            // TODO: Why do we overwrite the existing header field here already set above?
-            [IMSRequest addValue:[DateParser formatHTTPDate:lastModified] forHTTPHeaderField:kHTTPHeaderIfModifiedSince];
-        }
-        
-        item.IMSRequest = IMSRequest;
-        ASSERT_NO_CONNECTION_WHEN_IN_OFFLINE_MODE_FOR_URL(IMSRequest.URL);
+        item.IMSRequest = [self IMSRequestForCacheableItem:item];
+        ASSERT_NO_CONNECTION_WHEN_IN_OFFLINE_MODE_FOR_URL(item.IMSRequest.URL);
 
+        if (!item.hasReturnedCachedItemBeforeRevalidation) {
+            [self traceLookupForKey:item.cacheKey item:item status:kAFCacheTraceStatusRevalidated];
+        }
         [self addItemToDownloadQueue:item];
     }
     
     return item;
 }
 
+- (NSMutableURLRequest*)IMSRequestForCacheableItem:(AFCacheableItem*)item {
+    NSMutableURLRequest *IMSRequest = [NSMutableURLRequest requestWithURL:item.url
+                                                              cachePolicy:NSURLRequestReloadIgnoringLocalCacheData
+                                                          timeoutInterval:self.networkTimeoutIntervals.IMSRequest];
+    
+    NSDate *lastModified = [NSDate dateWithTimeIntervalSinceReferenceDate: [item.info.lastModified timeIntervalSinceReferenceDate]];
+    [IMSRequest addValue:[DateParser formatHTTPDate:lastModified] forHTTPHeaderField:kHTTPHeaderIfModifiedSince];
+    [IMSRequest setValue:@"" forHTTPHeaderField:AFCacheInternalRequestHeader];
+    
+    if (item.info.eTag) {
+        [IMSRequest addValue:item.info.eTag forHTTPHeaderField:kHTTPHeaderIfNoneMatch];
+    }
+    else {
+        NSDate *lastModified = [NSDate dateWithTimeIntervalSinceReferenceDate:
+                                [item.info.lastModified timeIntervalSinceReferenceDate]];
+        // TODO: Why do we overwrite the existing header field here already set above?
+        [IMSRequest addValue:[DateParser formatHTTPDate:lastModified] forHTTPHeaderField:kHTTPHeaderIfModifiedSince];
+    }
+    return IMSRequest;
+}
+
+/*
+ * Sends an If-Modified-Since request for a cached, completely loaded item without a client waiting for it.
+ * Returns NO if the item is not cached, incomplete or already being downloaded.
+ */
+- (BOOL)revalidateCachedItemInBackgroundForURL:(NSURL*)url {
+    if ([self offlineMode] || [self isQueuedOrDownloadingURL:url]) {
+        return NO;
+    }
+    AFCacheableItem *item = [self cacheableItemFromCacheStore:url];
+    if (!item || ![item hasValidContentLength]) {
+        return NO;
+    }
+    
+    item.isRevalidating = YES;
+    item.isBackgroundRevalidation = YES;
+    item.servedFromCache = YES;
+    item.cacheStatus = kCacheStatusRevalidationPending;
+    item.info.request = nil; // addItemToDownloadQueue prefers a stored request over the IMS request
+    item.IMSRequest = [self IMSRequestForCacheableItem:item];
+    ASSERT_NO_CONNECTION_WHEN_IN_OFFLINE_MODE_FOR_URL(item.IMSRequest.URL);
+    
+    [self addItemToDownloadQueue:item];
+    return YES;
+}
+
 - (AFCacheableItem *)cacheableItemFromCacheForURL:(NSURL *)url {
     AFCacheableItem *item = [self cacheableItemFromCacheStore:url];
 
@@ -850,20 +1641,21 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 #pragma mark - URL cache state testing
 
 - (BOOL)isQueuedOrDownloadingURL: (NSURL*)url {
-    return ([self isQueuedURL:url] || [self isDownloadingURL:url]);
+    return [self isQueuedOrDownloadingKey:[AFCacheKey keyWithURL:url]];
 }
 
 - (BOOL)isDownloadingURL:(NSURL *)url {
-    return ([[self nonCancelledDownloadOperationForURL:url] isExecuting]);
+    return [self isDownloadingKey:[AFCacheKey keyWithURL:url]];
 }
 
-- (AFDownloadOperation*)nonCancelledDownloadOperationForURL:(NSURL*)url {
-    for (AFDownloadOperation *downloadOperation in [self.downloadOperationQueue operations]) {
-        if (![downloadOperation isCancelled] && [[downloadOperation.cacheableItem.url absoluteString] isEqualToString:[url absoluteString]]) {
-            return downloadOperation;
-        }
-    }
-    return nil;
+// queued or executing
+- (BOOL)isQueuedOrDownloadingKey:(AFCacheKey*)key {
+    AFDownloadOperation *downloadOperation = [self.downloadScheduler nonCancelledOperationForKey:key];
+    return downloadOperation && ![downloadOperation isFinished];
+}
+
+- (BOOL)isDownloadingKey:(AFCacheKey*)key {
+    return [[self.downloadScheduler nonCancelledOperationForKey:key] isExecuting];
 }
 
 #pragma mark - State (de-)serialization
@@ -872,15 +1664,24 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     @synchronized (self.archiveTimer) {
         [self.archiveTimer invalidate];
         self.wantsToArchive = NO;
-        [self serializeState:[self stateDictionary]];
+        if (self.sharedStore) {
+            [self.sharedStore flush];
+            [self.sharedStore checkpointIfNeeded];
+        } else {
+            [self serializeState:[self stateDictionary]];
+        }
     }
 }
 
+// Copying the info stores only takes copy-on-write snapshots, see AFCacheInfoStore.h
 - (NSDictionary*)stateDictionary {
-    return @{kAFCacheInfoStoreCachedObjectsKey : self.cachedItemInfos,
-            kAFCacheInfoStoreRedirectsKey : self.urlRedirects,
-            kAFCacheInfoStorePackageInfosKey : self.packageInfos,
+    return @{kAFCacheInfoStoreCachedObjectsKey : [self.cachedItemInfos copy],
+            kAFCacheInfoStoreRedirectsKey : [self.urlRedirects copy],
+            kAFCacheInfoStorePinCountsKey : [self.pinCounts copy],
+            kAFCacheInfoStorePackageInfosKey : [self.packageInfos copy],
             kAFCacheVersionKey : self.version?:@"",
+            kAFCacheBaseImageKey : [self baseImageState],
+            kAFCacheGarbageCollectionCursorKey : self.garbageCollector.cursor ?: @"",
              };
 }
 
@@ -898,13 +1699,16 @@ static NSMutableDictionary* AFCache_contextCache = nil;
                 
                NSDictionary *infoStore = @{
                         kAFCacheInfoStoreCachedObjectsKey : state[kAFCacheInfoStoreCachedObjectsKey],
-                        kAFCacheInfoStoreRedirectsKey : state[kAFCacheInfoStoreRedirectsKey]};
+                        kAFCacheInfoStoreRedirectsKey : state[kAFCacheInfoStoreRedirectsKey],
+                        kAFCacheInfoStorePinCountsKey : state[kAFCacheInfoStorePinCountsKey]};
                 [self saveDictionary:infoStore ToFile:self.expireInfoDictionaryPath];
                 
                 NSDictionary* packageInfos = [state valueForKey:kAFCacheInfoStorePackageInfosKey];
                 [self saveDictionary:packageInfos ToFile:self.infoDictionaryPath];
                 
-                NSDictionary* metaData = @{kAFCacheVersionKey:[state valueForKey:kAFCacheVersionKey]};
+                NSDictionary* metaData = @{kAFCacheVersionKey:[state valueForKey:kAFCacheVersionKey],
+                                           kAFCacheBaseImageKey:[state valueForKey:kAFCacheBaseImageKey],
+                                           kAFCacheGarbageCollectionCursorKey:[state valueForKey:kAFCacheGarbageCollectionCursorKey]};
                 [self saveDictionary:metaData ToFile:self.metaDataDictionaryPath];
             }
         }
@@ -937,36 +1741,64 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     }
 }
 
+/*
+ * the archived info stores by key of the state dictionary, missing ones are nil
+ */
+- (NSDictionary*)archivedInfoStores {
+    NSMutableDictionary *stores = [NSMutableDictionary dictionary];
+    NSDictionary *archivedExpireDates = [NSKeyedUnarchiver unarchiveObjectWithFile: self.expireInfoDictionaryPath];
+    if ([archivedExpireDates isKindOfClass:[NSDictionary class]]) {
+        for (NSString *storeKey in @[kAFCacheInfoStoreCachedObjectsKey, kAFCacheInfoStoreRedirectsKey, kAFCacheInfoStorePinCountsKey]) {
+            NSDictionary *store = archivedExpireDates[storeKey];
+            if ([store isKindOfClass:[NSDictionary class]]) {
+                stores[storeKey] = store;
+            }
+        }
+    }
+    NSDictionary *archivedPackageInfos = [NSKeyedUnarchiver unarchiveObjectWithFile: self.infoDictionaryPath];
+    if ([archivedPackageInfos isKindOfClass:[NSDictionary class]]) {
+        stores[kAFCacheInfoStorePackageInfosKey] = archivedPackageInfos;
+    }
+    return stores;
+}
+
 - (void)deserializeState {
     // Deserialize cacheable item info store
-    NSDictionary *archivedExpireDates = [NSKeyedUnarchiver unarchiveObjectWithFile: self.expireInfoDictionaryPath];
-    NSMutableDictionary *cachedItemInfos = [archivedExpireDates objectForKey:kAFCacheInfoStoreCachedObjectsKey];
-    NSMutableDictionary *urlRedirects = [archivedExpireDates objectForKey:kAFCacheInfoStoreRedirectsKey];
+    NSDictionary *archivedStores = [self archivedInfoStores];
+    NSMutableDictionary *cachedItemInfos = archivedStores[kAFCacheInfoStoreCachedObjectsKey];
+    NSMutableDictionary *urlRedirects = archivedStores[kAFCacheInfoStoreRedirectsKey];
     if (cachedItemInfos && urlRedirects) {
-        _cachedItemInfos = [NSMutableDictionary dictionaryWithDictionary:cachedItemInfos];
-        _urlRedirects = [NSMutableDictionary dictionaryWithDictionary: urlRedirects];
+        _cachedItemInfos = [AFCacheInfoStore dictionaryWithDictionary:cachedItemInfos];
+        _urlRedirects = [AFCacheInfoStore dictionaryWithDictionary: urlRedirects];
         AFLog(@ "Successfully unarchived expires dictionary");
     } else {
-        _cachedItemInfos = [NSMutableDictionary dictionary];
-        _urlRedirects = [NSMutableDictionary dictionary];
+        _cachedItemInfos = [AFCacheInfoStore dictionary];
+        _urlRedirects = [AFCacheInfoStore dictionary];
         AFLog(@ "Created new expires dictionary");
     }
+    [self.invalidationIndex attachToInfoStore:(AFCacheInfoStore*)_cachedItemInfos];
+    // archives of older versions have no pins
+    NSDictionary *pinCounts = archivedStores[kAFCacheInfoStorePinCountsKey];
+    _pinCounts = pinCounts ? [AFCacheInfoStore dictionaryWithDictionary:pinCounts] : [AFCacheInfoStore dictionary];
 
     // Deserialize package infos
-    NSDictionary *archivedPackageInfos = [NSKeyedUnarchiver unarchiveObjectWithFile: self.infoDictionaryPath];
+    NSDictionary *archivedPackageInfos = archivedStores[kAFCacheInfoStorePackageInfosKey];
     if (archivedPackageInfos) {
-        _packageInfos = [NSMutableDictionary dictionaryWithDictionary: archivedPackageInfos];
+        _packageInfos = [AFCacheInfoStore dictionaryWithDictionary: archivedPackageInfos];
         AFLog(@ "Successfully unarchived package infos dictionary");
     }
     else {
-        _packageInfos = [[NSMutableDictionary alloc] init];
+        _packageInfos = [[AFCacheInfoStore alloc] init];
         AFLog(@ "Created new package infos dictionary");
     }
     
     // Deserialize metaData
 
     NSDictionary* metaData = [NSKeyedUnarchiver unarchiveObjectWithFile: self.metaDataDictionaryPath];
+    [self restoreBaseImageState:[metaData isKindOfClass:[NSDictionary class]] ? metaData[kAFCacheBaseImageKey] : nil];
     if ([metaData isKindOfClass:[NSDictionary class]]) {
+        NSString *cursor = metaData[kAFCacheGarbageCollectionCursorKey];
+        self.garbageCollector.cursor = [cursor isKindOfClass:[NSString class]] && [cursor length] > 0 ? cursor : nil;
         [self migrateFromVersion:metaData[kAFCacheVersionKey]];
     }
     else
@@ -975,20 +1807,26 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     }
 }
 
-- (void)startArchiveThread:(NSTimer*)timer {
+// The state is a snapshot, so it is not altered while it is persisted on the archive queue.
+// The serial queue also makes sure that archives are written one after another, in the order they were taken.
+- (void)startArchiving:(NSTimer*)timer {
     self.wantsToArchive = NO;
-    NSMutableDictionary* state = [NSMutableDictionary dictionaryWithDictionary: [self stateDictionary]];
-
-    // Copy state items as they shall not be altered when state is persisted
-    // TODO: This copy code must be synchronized with state modifications
-    for (id key in [state allKeys]) {
-        NSObject *stateItem = [state objectForKey:key];
-        [state setObject:[stateItem copy] forKey:key];
+    AFCacheSharedStore *sharedStore = self.sharedStore;
+    if (sharedStore) {
+        // modifications are journaled, the archives are only written by checkpoints
+        dispatch_async(self.archiveQueue, ^{
+            [sharedStore flush];
+            [sharedStore checkpointIfNeeded];
+        });
+        [[AFStorageGovernor sharedGovernor] setNeedsEnforcement];
+        return;
     }
+    NSDictionary *state = [self stateDictionary];
 
-    [NSThread detachNewThreadSelector:@selector(serializeState:)
-                             toTarget:self
-                           withObject:state];
+    dispatch_async(self.archiveQueue, ^{
+        [self serializeState:state];
+    });
+    [[AFStorageGovernor sharedGovernor] setNeedsEnforcement];
 }
 
 - (void)archive {
@@ -997,7 +1835,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         if (self.archiveInterval > 0) {
             self.archiveTimer = [NSTimer scheduledTimerWithTimeInterval:[self archiveInterval]
                                                                  target:self
-                                                               selector:@selector(startArchiveThread:)
+                                                               selector:@selector(startArchiving:)
                                                                userInfo:nil
                                                                 repeats:NO];
         }
@@ -1008,13 +1846,31 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 - (void)archiveNow {
     @synchronized (self.archiveTimer) {
         [self.archiveTimer invalidate];
-        [self startArchiveThread:nil];
+        [self startArchiving:nil];
         [self archive];
     }
 }
 
 /* removes every file in the cache directory */
 - (void)invalidateAll {
+    if (self.sharedStore) {
+        // other processes still use the directory, the removals are journaled and the files collected
+        [self.cachedItemInfos removeAllObjects];
+        [self.urlRedirects removeAllObjects];
+        @synchronized (self.bodySources) {
+            [self.bodySources removeAllObjects];
+            self.bodySources[kAFCacheSlabStoreBodySourceKey] = self.slabStore;
+        }
+        self.baseImage = nil;
+        @synchronized (self.baseImageRemovedURLs) {
+            [self.baseImageRemovedURLs removeAllObjects];
+        }
+        [self.garbageCollector setNeedsCollection];
+        [self.slabStore setNeedsCompaction];
+        [self archive];
+        return;
+    }
+
 	NSError *error;
 	
 	/* remove the cache directory and its contents */
@@ -1031,8 +1887,18 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 		NSLog(@ "Failed to create new cache directory at path: %@", self.dataPath);
 		return; // this is serious. we need this directory.
 	}
-	self.cachedItemInfos = [NSMutableDictionary dictionary];
-    self.urlRedirects = [NSMutableDictionary dictionary];
+	self.cachedItemInfos = [AFCacheInfoStore dictionary];
+    self.urlRedirects = [AFCacheInfoStore dictionary];
+    [self.slabStore reset];
+    @synchronized (self.bodySources) {
+        [self.bodySources removeAllObjects];
+        self.bodySources[kAFCacheSlabStoreBodySourceKey] = self.slabStore;
+    }
+    // the base image belongs to the cache contents, it is gone until it is mounted again
+    self.baseImage = nil;
+    @synchronized (self.baseImageRemovedURLs) {
+        [self.baseImageRemovedURLs removeAllObjects];
+    }
     [self archive];
 }
 
@@ -1151,40 +2017,14 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     BOOL fileNonExistentOrDeleted = [self deleteFileAtPath:filePath];
     
     if (!fileOnly && (fileNonExistentOrDeleted)) {
-        if (fallbackURL) {
-            [self.cachedItemInfos removeObjectForKey:[fallbackURL absoluteString]];
+        AFCacheKey *key = [AFCacheKey keyWithURL:fallbackURL ?: [info.request URL]];
+        if (key) {
+            [self.cachedItemInfos removeObjectForKey:key];
+            [self hideBaseImageEntryForURLString:key.URLString];
+            [self subtractFromEstimatedStoreSize:info.contentLength];
         }
-        else {
-            NSURL* requestURL = [info.request URL];
-            if (requestURL) {
-                 [self.cachedItemInfos removeObjectForKey:[requestURL absoluteString]];
-            }
-        }
-    }
-}
-
--(void)removeCacheEntryAndFileForFileURL:(NSURL*)fileURL
-{
-    NSSet* results = [self.cachedItemInfos keysOfEntriesPassingTest:^BOOL(id key, id evaluatedObject, BOOL *stop) {
-        if ([evaluatedObject isKindOfClass:[AFCacheableItemInfo class]]) {
-            return [((AFCacheableItemInfo*)evaluatedObject).filename isEqualToString:[[fileURL lastPathComponent] stringByDeletingPathExtension]];
-        }
-        return NO;
-    }];
-    
-    if ([results count] > 0) {
-        //delete file and entry for files with corresponding infos (should only be one)
-        for (NSString* key in results) {
-            AFCacheableItemInfo* info = self.cachedItemInfos[key];
-            [self removeCacheEntry:info fileOnly:NO fallbackURL:[NSURL URLWithString:key]];
-        }
-    }
-    else
-    {
-        NSError* error = nil;
-        if(![[NSFileManager defaultManager] removeItemAtURL:fileURL error: &error])
-        {
-            NSLog(@"WARNING: failed to delete orphaned cache file at %@ with error : %@", fileURL, error);
+        if ([self.slabStore containsBodyOfItemInfo:info]) {
+            [self.slabStore setNeedsCompaction];
         }
     }
 }
@@ -1219,21 +2059,58 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 	/* reset the file's modification date to indicate that the URL has been checked */
 	NSDictionary *dict = [[NSDictionary alloc] initWithObjectsAndKeys: [NSDate date], NSFileModificationDate, nil];
 	
-	if (![[NSFileManager defaultManager] setAttributes:dict ofItemAtPath:filePath error:&error]) {
+	if (!cacheableItem.info.bodySourceKey && ![[NSFileManager defaultManager] setAttributes:dict ofItemAtPath:filePath error:&error]) {
 		NSLog(@ "Failed to reset modification date for cache item %@", filePath);
 	}
+    if (self.sharedStore && cacheableItem.info) {
+        // the info was stored when the response arrived, other processes need its final lengths
+        [self.cachedItemInfos setObject:cacheableItem.info forKey:cacheableItem.cacheKey];
+    }
 	[self archive];
 }
 
 - (NSOutputStream*)createOutputStreamForItem:(AFCacheableItem*)cacheableItem
+{
+    return [self createOutputStreamForItem:cacheableItem expectedLength:(long long)cacheableItem.info.contentLength];
+}
+
+- (NSOutputStream*)createOutputStreamForItem:(AFCacheableItem*)cacheableItem expectedLength:(long long)expectedLength
 {
     NSString *filePath = [self fullPathForCacheableItem: cacheableItem];
     
 	// remove file if exists
-	if ([[NSFileManager defaultManager] fileExistsAtPath: filePath]) {
+    BOOL replacesStoredFile = [[NSFileManager defaultManager] fileExistsAtPath: filePath];
+	if (replacesStoredFile) {
 		[self removeCacheEntry:cacheableItem.info fileOnly:YES];
 		AFLog(@"removing %@", filePath);
 	}
+
+    // the new body replaces the one of the body source
+    if (cacheableItem.info.bodySourceKey) {
+        if ([self.slabStore containsBodyOfItemInfo:cacheableItem.info]) {
+            [self.slabStore setNeedsCompaction];
+        }
+        replacesStoredFile = YES;
+        cacheableItem.info.bodySourceKey = nil;
+        cacheableItem.info.bodySourceEntry = nil;
+    }
+
+    // An updated entry has already been admitted, a new one has to be worth its bytes. Without a length
+    // the decision is deferred until the body is complete, see -[AFDownloadOperation connectionDidFinishLoading:].
+    cacheableItem.admissionDeferred = !replacesStoredFile && expectedLength < 0 && self.admissionFilter != nil;
+    cacheableItem.rejectedByAdmissionFilter = !replacesStoredFile && expectedLength >= 0 && ![self shouldAdmitItem:cacheableItem size:(uint64_t)expectedLength];
+    if (cacheableItem.rejectedByAdmissionFilter) {
+        AFLog(@"admission filter rejected %@", cacheableItem.url);
+        return nil;
+    }
+
+    // a small body is collected in memory and packed into a segment once complete
+    if (expectedLength > 0 && (uint64_t)expectedLength <= self.slabObjectThreshold &&
+        (self.maxItemFileSize == kAFCacheInfiniteFileSize || expectedLength < self.maxItemFileSize)) {
+        NSOutputStream *outputStream = [NSOutputStream outputStreamToMemory];
+        [outputStream open];
+        return outputStream;
+    }
 	
 	// create directory if not exists
 	NSString *pathToDirectory = [filePath stringByDeletingLastPathComponent];
@@ -1279,16 +2156,40 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 	}
 	else {
 		NSLog(@ "AFCache: item %@ \nsize exceeds maxItemFileSize (%f). Won't write file to disk",cacheableItem.url, self.maxItemFileSize);
-		[self.cachedItemInfos removeObjectForKey: [cacheableItem.url absoluteString]];
+		[self.cachedItemInfos removeObjectForKey: cacheableItem.cacheKey];
         return nil;
 	}
 }
 
+- (BOOL)storeBody:(NSData*)body inSlabStoreForItem:(AFCacheableItem*)cacheableItem {
+    NSString *entry = [self.slabStore appendBody:body];
+    if (entry) {
+        cacheableItem.info.bodySourceKey = kAFCacheSlabStoreBodySourceKey;
+        cacheableItem.info.bodySourceEntry = entry;
+        cacheableItem.info.contentLength = [body length];
+        return YES;
+    }
+
+    // longer than a segment or not writable, the body gets a file after all
+    NSString *filePath = [self fullPathForCacheableItem:cacheableItem];
+    NSError *error = nil;
+    [[NSFileManager defaultManager] createDirectoryAtPath:[filePath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+    if (![body writeToFile:filePath options:NSDataWritingAtomic error:&error]) {
+        NSLog(@"AFCache: Could not write file \"%@\" (Error: %@)", filePath, [error localizedDescription]);
+    }
+    [AFCache addSkipBackupAttributeToItemAtURL:[NSURL fileURLWithPath:filePath]];
+    return NO;
+}
+
 - (BOOL)_fileExistsOrPendingForCacheableItem:(AFCacheableItem*)item {
     if (![self isValidRequestURL:item.url]) {
         return NO;
     }
     
+    if (item.info.bodySourceKey && [self hasBodyForItemInfo:item.info]) {
+        return YES;
+    }
+
 	// the complete path
 	NSString *filePath = [self fullPathForCacheableItem:item];
     
@@ -1297,7 +2198,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 	if (![[NSFileManager defaultManager] fileExistsAtPath: filePath])
     {
         // file doesn't exist. check if someone else is downloading the url already
-        if ([self isQueuedOrDownloadingURL:item.url])
+        if ([self isQueuedOrDownloadingKey:item.cacheKey])
 		{
             AFLog(@"Someone else is already downloading the URL: %@.", [item.url absoluteString]);
 		}
@@ -1321,11 +2222,9 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         return nil;
 	}
     
-    AFCacheableItemInfo *info = [self.cachedItemInfos objectForKey: [URL absoluteString]];
-    if (!info) {
-        NSString *redirectURLString = [self.urlRedirects valueForKey:[URL absoluteString]];
-        info = [self.cachedItemInfos objectForKey: redirectURLString];
-    }
+    [self.sharedStore synchronize];
+    AFCacheKey *key = [AFCacheKey keyWithURL:URL];
+    AFCacheableItemInfo *info = [self cachedInfoForKey:key infos:self.cachedItemInfos redirects:self.urlRedirects];
     if (!info) {
         return nil;
     }
@@ -1334,7 +2233,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 
     // check if there is an item in pendingConnections
     AFCacheableItem *cacheableItem;
-    AFDownloadOperation *downloadOperation = [self nonCancelledDownloadOperationForURL:URL];
+    AFDownloadOperation *downloadOperation = [self.downloadScheduler nonCancelledOperationForKey:key];
     if ([downloadOperation isExecuting]) {
         // TODO: This concept of AFCache was broken: Returning a running download request does not conform to this method's name
         cacheableItem = downloadOperation.cacheableItem;
@@ -1390,16 +2289,264 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     return cacheableItem;
 }
 
+#pragma mark - Admission
+
+- (void)recordAccessForItem:(AFCacheableItem*)item {
+    [item.info recordAccess];
+    [self.admissionFilter recordAccessForKey:item.cacheKey];
+}
+
+// the estimated size of the store is recomputed from the info store at most this often
+#define kAFCacheAdmissionStoreSizeRefreshInterval 30.0
+
+- (BOOL)shouldAdmitItem:(AFCacheableItem*)cacheableItem size:(uint64_t)size {
+    AFCacheAdmissionFilter *admissionFilter = self.admissionFilter;
+    if (!admissionFilter || cacheableItem.isPackageArchive) {
+        return YES;
+    }
+
+    uint64_t byteBudget = self.diskCacheDisplacementTresholdSize > 0 ? (uint64_t)self.diskCacheDisplacementTresholdSize : 0;
+    BOOL admit = [admissionFilter shouldAdmitCandidateKey:cacheableItem.cacheKey
+                                                     info:cacheableItem.info
+                                                     size:size
+                                                storeSize:[self estimatedStoreSize]
+                                               byteBudget:byteBudget
+                                                   sample:^NSDictionary *{
+        // The victim is the least frequently used of a few random entries. Pinned entries cannot be displaced.
+        NSMutableDictionary *sample = [NSMutableDictionary dictionary];
+        [[(AFCacheInfoStore*)self.cachedItemInfos sampleWithCount:kAFCacheAdmissionVictimSampleCount] enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+            if (![self.pinCounts objectForKey:key]) {
+                sample[key] = info;
+            }
+        }];
+        return sample;
+    }];
+    if (admit) {
+        [self addToEstimatedStoreSize:size];
+    }
+    return admit;
+}
+
+/*
+ * Sum of the content lengths in the info store. Summing up is O(n), so it is only done every
+ * kAFCacheAdmissionStoreSizeRefreshInterval seconds, in between admitted bytes are added and the bytes of
+ * removed entries are subtracted.
+ */
+- (uint64_t)estimatedStoreSize {
+    NSTimeInterval now = AFCacheNow();
+    @synchronized (self) {
+        if (now - self.admissionStoreSizeTimestamp < kAFCacheAdmissionStoreSizeRefreshInterval) {
+            return self.admissionStoreSize;
+        }
+    }
+    uint64_t size = 0;
+    for (AFCacheableItemInfo *info in [[self.cachedItemInfos copy] objectEnumerator]) {
+        if (!info.bodySourceKey || [self.slabStore containsBodyOfItemInfo:info]) {
+            size += info.contentLength;
+        }
+    }
+    @synchronized (self) {
+        self.admissionStoreSize = size;
+        self.admissionStoreSizeTimestamp = now;
+        return size;
+    }
+}
+
+- (void)addToEstimatedStoreSize:(uint64_t)size {
+    @synchronized (self) {
+        self.admissionStoreSize += size;
+    }
+}
+
+- (void)subtractFromEstimatedStoreSize:(uint64_t)size {
+    @synchronized (self) {
+        self.admissionStoreSize -= MIN(size, self.admissionStoreSize);
+    }
+}
+
+#pragma mark - Trace
+
+- (void)traceLookupForKey:(AFCacheKey*)key item:(AFCacheableItem*)item status:(AFCacheTraceStatus)status {
+    AFCacheTraceRecorder *traceRecorder = self.traceRecorder;
+    if (!traceRecorder || !key) {
+        return;
+    }
+    AFCacheTraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.timestamp = AFCacheNow();
+    record.keyHash = key.hash128;
+    record.status = status;
+    if (status == kAFCacheTraceStatusHit || status == kAFCacheTraceStatusFailed) {
+        record.size = item.info.contentLength;
+        record.freshnessLifetime = [item.info freshnessLifetime];
+        [traceRecorder addRecord:record];
+        return;
+    }
+
+    // size and lifetime are known once the download has finished
+    [item addCompletionBlock:^(AFCacheableItem *finishedItem) {
+        AFCacheTraceRecord finishedRecord = record;
+        finishedRecord.duration = AFCacheNow() - record.timestamp;
+        finishedRecord.size = finishedItem.info.contentLength;
+        finishedRecord.freshnessLifetime = [finishedItem.info freshnessLifetime];
+        [traceRecorder addRecord:finishedRecord];
+    } failBlock:^(AFCacheableItem *failedItem) {
+        AFCacheTraceRecord failedRecord = record;
+        failedRecord.duration = AFCacheNow() - record.timestamp;
+        failedRecord.status = kAFCacheTraceStatusFailed;
+        [traceRecorder addRecord:failedRecord];
+    } progressBlock:nil];
+}
+
+#pragma mark - Body sources
+
+- (void)registerBodySource:(id<AFCacheBodySource>)bodySource forKey:(NSString*)key {
+    if (!key) {
+        return;
+    }
+    @synchronized (self.bodySources) {
+        if (bodySource) {
+            self.bodySources[key] = bodySource;
+        } else {
+            [self.bodySources removeObjectForKey:key];
+        }
+    }
+}
+
+- (void)unregisterBodySourceForKey:(NSString*)key {
+    [self registerBodySource:nil forKey:key];
+}
+
+// Body sources are not archived, they are reopened on first use after a restart
+- (id<AFCacheBodySource>)bodySourceForKey:(NSString*)key {
+    if (!key) {
+        return nil;
+    }
+    if ([key hasPrefix:kAFCacheBaseImageBodySourceKeyPrefix]) {
+        // entries stored from an image that is not mounted (anymore) have no body
+        AFCacheBaseImage *baseImage = self.baseImage;
+        return [baseImage.bodySourceKey isEqualToString:key] ? baseImage : nil;
+    }
+    @synchronized (self.bodySources) {
+        id<AFCacheBodySource> bodySource = self.bodySources[key];
+        if (!bodySource) {
+            bodySource = [self newPackageArchiveForKey:key];
+            if (bodySource) {
+                self.bodySources[key] = bodySource;
+            }
+        }
+        return bodySource;
+    }
+}
+
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info {
+    return [[self bodySourceForKey:info.bodySourceKey] hasBodyForItemInfo:info];
+}
+
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info {
+    return [[self bodySourceForKey:info.bodySourceKey] bodyForItemInfo:info];
+}
+
+#pragma mark - Memory pressure
+
+/*
+ * Called on kAFMemoryGovernorMemoryPressureNotification, after the governor has released the items' bodies.
+ * Only drops what is read again on demand: archives of packages are reopened by -bodySourceForKey:,
+ * the base image and body sources registered by others stay.
+ */
+- (void)releaseMemory {
+    NSUInteger closedArchives = 0;
+    @synchronized (self.bodySources) {
+        for (NSString *key in [self.bodySources allKeys]) {
+            AFPackageInfo *packageInfo = [self.packageInfos objectForKey:key];
+            if (packageInfo.archivePath) {
+                [self.bodySources removeObjectForKey:key];
+                closedArchives++;
+            }
+        }
+    }
+    [(AFCacheInfoStore*)self.cachedItemInfos compact];
+    [(AFCacheInfoStore*)self.urlRedirects compact];
+    [(AFCacheInfoStore*)self.packageInfos compact];
+    AFLog(@"memory pressure: closed %lu package archives, compacted info stores", (unsigned long)closedArchives);
+}
+
+#pragma mark - Base image
+
+- (BOOL)mountBaseImageAtPath:(NSString*)path {
+    AFCacheBaseImage *baseImage = [[AFCacheBaseImage alloc] initWithContentsOfFile:path cache:self];
+    if (!baseImage) {
+        return NO;
+    }
+    [self unmountBaseImage];
+    BOOL otherVersion = NO;
+    @synchronized (self.baseImageRemovedURLs) {
+        otherVersion = ![self.baseImageRemovedURLsKey isEqualToString:baseImage.bodySourceKey];
+        if (otherVersion) {
+            // entries removed from another version of the image may be fresh in this one
+            [self.baseImageRemovedURLs removeAllObjects];
+            self.baseImageRemovedURLsKey = baseImage.bodySourceKey;
+        }
+    }
+    if (otherVersion) {
+        [self archive];
+    }
+    self.baseImage = baseImage;
+    AFLog(@"mounted base image %@ with %lu entries", path, (unsigned long)baseImage.count);
+    return YES;
+}
+
+- (void)unmountBaseImage {
+    self.baseImage = nil;
+}
+
+/*
+ * The image is below the store: only asked if the store has no entry. A new info for every call, see AFCacheBaseImage.h
+ */
+- (AFCacheableItemInfo*)baseImageInfoForURLString:(NSString*)URLString {
+    AFCacheBaseImage *baseImage = self.baseImage;
+    if (!baseImage || !URLString) {
+        return nil;
+    }
+    @synchronized (self.baseImageRemovedURLs) {
+        if ([self.baseImageRemovedURLs containsObject:URLString]) {
+            return nil;
+        }
+    }
+    return [baseImage newInfoForURLString:URLString];
+}
+
+// An entry removed from the cache must not fall through to the image
+- (void)hideBaseImageEntryForURLString:(NSString*)URLString {
+    if (![self.baseImage hasInfoForURLString:URLString]) {
+        return;
+    }
+    @synchronized (self.baseImageRemovedURLs) {
+        [self.baseImageRemovedURLs addObject:URLString];
+    }
+}
+
+- (NSDictionary*)baseImageState {
+    @synchronized (self.baseImageRemovedURLs) {
+        return @{kAFCacheBaseImageKey : self.baseImageRemovedURLsKey ?: @"",
+                 kAFCacheBaseImageRemovedURLsKey : [self.baseImageRemovedURLs allObjects] ?: @[]};
+    }
+}
+
+- (void)restoreBaseImageState:(NSDictionary*)state {
+    NSArray *removedURLs = [state isKindOfClass:[NSDictionary class]] ? state[kAFCacheBaseImageRemovedURLsKey] : nil;
+    self.baseImageRemovedURLs = [NSMutableSet setWithArray:[removedURLs isKindOfClass:[NSArray class]] ? removedURLs : @[]];
+    self.baseImageRemovedURLsKey = [state isKindOfClass:[NSDictionary class]] ? state[kAFCacheBaseImageKey] : nil;
+}
+
 #pragma mark - Cancel requests on cache
 
 - (void)cancelAllRequestsForURL:(NSURL *)url {
     if (!url) {
         return;
     }
-    for (AFDownloadOperation *downloadOperation in [self.downloadOperationQueue operations]) {
-        if ([[downloadOperation.cacheableItem.url absoluteString] isEqualToString:[url absoluteString]]) {
-            [downloadOperation cancel];
-        }
+    for (AFDownloadOperation *downloadOperation in [self.downloadScheduler operationsForKey:[AFCacheKey keyWithURL:url]]) {
+        [downloadOperation cancel];
     }
 }
 
@@ -1408,8 +2555,8 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     if (!url || !itemDelegate) {
         return;
     }
-    for (AFDownloadOperation *downloadOperation in [self.downloadOperationQueue operations]) {
-        if ((downloadOperation.cacheableItem.delegate == itemDelegate) && ([[downloadOperation.cacheableItem.url absoluteString] isEqualToString:[url absoluteString]])) {
+    for (AFDownloadOperation *downloadOperation in [self.downloadScheduler operationsForKey:[AFCacheKey keyWithURL:url]]) {
+        if (downloadOperation.cacheableItem.delegate == itemDelegate) {
             [downloadOperation cancel];
         }
     }
@@ -1421,7 +2568,7 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         return;
     }
 
-    for (AFDownloadOperation *downloadOperation in [self.downloadOperationQueue operations]) {
+    for (AFDownloadOperation *downloadOperation in [self.downloadScheduler operations]) {
         if (downloadOperation.cacheableItem.delegate == itemDelegate) {
             [downloadOperation cancel];
         }
@@ -1430,18 +2577,37 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 
 - (void)cancelAllDownloads
 {
-    [self.downloadOperationQueue cancelAllOperations];
+    [self.downloadScheduler cancelAllOperations];
 }
 
 - (BOOL)isQueuedURL:(NSURL*)url
 {
-    AFDownloadOperation *downloadOperation = [self nonCancelledDownloadOperationForURL:url];
+    AFDownloadOperation *downloadOperation = [self.downloadScheduler nonCancelledOperationForKey:[AFCacheKey keyWithURL:url]];
     return downloadOperation && !([downloadOperation isExecuting] || [downloadOperation isFinished]);
 }
 
 - (void)prioritizeURL:(NSURL*)url
 {
-    [[self nonCancelledDownloadOperationForURL:url] setQueuePriority:NSOperationQueuePriorityVeryHigh];
+    [self.downloadScheduler prioritizeOperation:[self.downloadScheduler nonCancelledOperationForKey:[AFCacheKey keyWithURL:url]]];
+}
+
+/**
+ * Package archives and speculative prefetches must not delay requests a client is waiting for.
+ * Background revalidations (the cached file has already been returned, or the revalidation sweeper
+ * issued them) only keep the cache fresh.
+ */
+- (AFDownloadLane)downloadLaneForItem:(AFCacheableItem*)item
+{
+    if (item.isPackageArchive) {
+        return AFDownloadLanePackage;
+    }
+    if (item.isPrefetch) {
+        return AFDownloadLanePrefetch;
+    }
+    if (item.IMSRequest && (item.hasReturnedCachedItemBeforeRevalidation || item.isBackgroundRevalidation)) {
+        return AFDownloadLaneRevalidation;
+    }
+    return AFDownloadLaneInteractive;
 }
 
 /**
@@ -1462,13 +2628,22 @@ static NSMutableDictionary* AFCache_contextCache = nil;
     }
     
     // check if we are downloading already
-    if ([self isDownloadingURL: item.url])
+    if ([self isDownloadingKey:item.cacheKey])
     {
         // don't start another connection
         AFLog(@"We are downloading already. Won't start another connection for %@", item.url);
         return;
     }
     
+    AFDownloadOperation *downloadOperation = [self downloadOperationForItem:item];
+    [self.downloadScheduler addOperation:downloadOperation lane:[self downloadLaneForItem:item]];
+}
+
+/**
+ * Prepares the item's request and creates the operation to download it
+ */
+- (AFDownloadOperation*)downloadOperationForItem:(AFCacheableItem*)item
+{
 	NSURLRequest *theRequest = item.info.request;
     
     // no original request, check if we want to send an IMS request
@@ -1483,6 +2658,14 @@ static NSMutableDictionary* AFCache_contextCache = nil;
                                          timeoutInterval: timeout];
 	}
 
+    // the cache stores whole bodies and serves the ranges a client asked for itself, see AFHTTPRangeResponse.h
+    if ([theRequest valueForHTTPHeaderField:@"Range"] || [theRequest valueForHTTPHeaderField:@"If-Range"]) {
+        NSMutableURLRequest *fullRequest = [theRequest mutableCopy];
+        [fullRequest setValue:nil forHTTPHeaderField:@"Range"];
+        [fullRequest setValue:nil forHTTPHeaderField:@"If-Range"];
+        theRequest = fullRequest;
+    }
+
     if ([theRequest isKindOfClass:[NSMutableURLRequest class]])
     {
 #ifdef RESUMEABLE_DOWNLOAD
@@ -1497,14 +2680,13 @@ static NSMutableDictionary* AFCache_contextCache = nil;
         [(NSMutableURLRequest*)theRequest setValue:@"" forHTTPHeaderField:AFCacheInternalRequestHeader];
     }
     
-    item.info.requestTimestamp = [NSDate timeIntervalSinceReferenceDate];
+    item.info.requestTimestamp = AFCacheNow();
     item.info.responseTimestamp = 0.0;
     item.info.request = theRequest;
     
     ASSERT_NO_CONNECTION_WHEN_IN_OFFLINE_MODE_FOR_URL(theRequest.URL);
 
-    AFDownloadOperation *downloadOperation = [[AFDownloadOperation alloc] initWithCacheableItem:item];
-    [self.downloadOperationQueue addOperation:downloadOperation];
+    return [[AFDownloadOperation alloc] initWithCacheableItem:item];
 }
 
 - (BOOL)hasCachedItemForURL:(NSURL *)url
@@ -1521,11 +2703,11 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 #pragma mark - offline mode & pause methods
 
 - (BOOL)suspended {
-    return [self.downloadOperationQueue isSuspended];
+    return [self.downloadScheduler isSuspended];
 }
 
 - (void)setSuspended:(BOOL)pause {
-    [self.downloadOperationQueue setSuspended:pause];
+    [self.downloadScheduler setSuspended:pause];
     [self.packageArchiveQueue setSuspended:pause];
 
     // TODO: Do we really need to cancel already running downloads? If not, just remove the following lines
@@ -1538,30 +2720,29 @@ static NSMutableDictionary* AFCache_contextCache = nil;
 }
 
 /*
- * Returns whether we currently have a working connection
- * Note: This should be done asynchronously, i.e. use
- * SCNetworkReachabilityScheduleWithRunLoop and let it update our information.
+ * Returns whether we currently have a working connection.
+ * This is the last state reported by the reachability provider or a download operation, it never blocks.
  */
 - (BOOL)isConnectedToNetwork  {
-	// Create zero address
-	struct sockaddr_in zeroAddress;
-	bzero( &zeroAddress, sizeof(zeroAddress) );
-	zeroAddress.sin_len = sizeof(zeroAddress);
-	zeroAddress.sin_family = AF_INET;
-	
-	// Recover reachability flags
-	SCNetworkReachabilityRef defaultRouteReachability = SCNetworkReachabilityCreateWithAddress(NULL, (struct sockaddr *)&zeroAddress);
-	SCNetworkReachabilityFlags flags;
-	BOOL didRetrieveFlags = SCNetworkReachabilityGetFlags(defaultRouteReachability, &flags);
-	CFRelease(defaultRouteReachability);
-	if (!didRetrieveFlags) {
-		//NSLog(@"Error. Could not recover network reachability flags\n");
-		return 0;
-	}
-	BOOL isReachable = (flags & kSCNetworkFlagsReachable) == kSCNetworkFlagsReachable;
-	BOOL needsConnection = (flags & kSCNetworkFlagsConnectionRequired) == kSCNetworkFlagsConnectionRequired;
-    
-	return isReachable && !needsConnection;
+	return _connectedToNetwork;
+}
+
++ (NSSet *)keyPathsForValuesAffectingIsConnectedToNetwork {
+    return [NSSet setWithObject:@"connectedToNetwork"];
+}
+
+- (void)setReachabilityProvider:(id<AFReachabilityProvider>)reachabilityProvider
+{
+    [_reachabilityProvider stopMonitoring];
+    _reachabilityProvider = reachabilityProvider;
+
+    // Observers of connectedToNetwork expect changes on the main thread, like those from download operations
+    __weak AFCache *weakSelf = self;
+    [reachabilityProvider startMonitoringWithChangeBlock:^(BOOL reachable) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf setConnectedToNetwork:reachable];
+        });
+    }];
 }
 
 - (void)setConnectedToNetwork:(BOOL)connected
@@ -0,0 +1,87 @@
+//
+//  AFCacheAdmissionFilter.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheableItemInfo;
+
+#define kAFCacheAdmissionFilterAdmittedKey @"admitted"
+#define kAFCacheAdmissionFilterRejectedKey @"rejected"
+#define kAFCacheAdmissionFilterRejectedBytesKey @"rejectedBytes"
+#define kAFCacheAdmissionFilterResetsKey @"resets"
+#define kAFCacheAdmissionFilterSampleSizeKey @"sampleSize"
+
+/*
+ * TinyLFU admission filter.
+ *
+ * Keeps an approximate access frequency for every key in a count-min sketch of 4 bit counters
+ * (4 rows of `width` counters) in front of which sits a doorkeeper bloom filter: the first access of a key
+ * only sets its doorkeeper bits, so one-off keys never touch the sketch.
+ * After sampleSize recorded accesses all counters are halved and the doorkeeper is cleared, so the
+ * frequencies follow the workload and do not grow forever.
+ *
+ * The filter does not store keys. Its memory is about width bytes, independent of the number of keys.
+ * Keys are AFCacheKeys or URL strings, which are turned into their AFCacheKey; both count for the same entry.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFCacheAdmissionFilter : NSObject
+
+/*
+ * number of accesses after which the frequencies are aged (10 times the width)
+ */
+@property (nonatomic, readonly) NSUInteger sampleSize;
+
+/*
+ * @param expectedItemCount number of items the cache usually holds; the width of the sketch is the next power of two
+ */
+- (instancetype)initWithExpectedItemCount:(NSUInteger)expectedItemCount;
+
+- (void)recordAccessForKey:(id)key;
+
+/*
+ * estimated number of accesses since the last aging, 0..16
+ */
+- (NSUInteger)frequencyForKey:(id)key;
+
+/*
+ * YES if the candidate is worth its bytes compared to the victim that would have to make room for it,
+ * i.e. its accesses per byte are higher than the victim's.
+ * A victim of unknown size (0) counts as one byte.
+ */
+- (BOOL)admitCandidateKey:(id)candidateKey size:(uint64_t)candidateSize victimKey:(id)victimKey size:(uint64_t)victimSize;
+
+/*
+ * the key of the entry of sample (key -> AFCacheableItemInfo) that would have to make room for the candidate:
+ * the least frequently used one, the least recently used one on a tie. The candidate's own entry is skipped.
+ * nil if sample has no other entry.
+ */
+- (NSString*)victimKeyInSample:(NSDictionary*)sample candidateKey:(id)candidateKey candidateInfo:(AFCacheableItemInfo*)candidateInfo;
+
+/*
+ * counts an admission decision that was made without comparing to a victim, e.g. because the store had room
+ */
+- (void)recordAdmissionWithoutVictim;
+
+/*
+ * The admission decision of the cache: a candidate of size bytes is admitted if the store has room for it
+ * within byteBudget (0 = unlimited), otherwise if it is worth more than the victim chosen from the sample,
+ * see above. sampleBlock returns the entries the victim may be chosen from and is only called if there is no room.
+ * If it has no other entry the candidate is admitted.
+ */
+- (BOOL)shouldAdmitCandidateKey:(id)candidateKey
+                           info:(AFCacheableItemInfo*)candidateInfo
+                           size:(uint64_t)size
+                      storeSize:(uint64_t)storeSize
+                     byteBudget:(uint64_t)byteBudget
+                         sample:(NSDictionary* (^)(void))sampleBlock;
+
+- (void)clear;
+
+- (NSDictionary*)statistics;
+
+@end
@@ -0,0 +1,226 @@
+//
+//  AFCacheAdmissionFilter.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheAdmissionFilter.h"
+#import "AFCache_Logging.h"
+#import "AFCacheKey.h"
+#import "AFCacheableItemInfo.h"
+
+#define kAFCacheAdmissionFilterDepth 4
+#define kAFCacheAdmissionFilterMaxCount 15
+#define kAFCacheAdmissionFilterMinWidth 64
+
+// The cache key's MurmurHash3, which the item has computed already. -[NSString hash] only looks at some of the characters, which is useless for URLs.
+static uint64_t AFCacheAdmissionFilterHash(id key) {
+    return [AFCacheKey keyWithObject:key].hash128.h1;
+}
+
+@implementation AFCacheAdmissionFilter {
+    uint8_t *_counters;    // kAFCacheAdmissionFilterDepth rows of _width 4 bit counters, two per byte
+    uint8_t *_doorkeeper;  // _width bits
+    NSUInteger _width;
+    NSUInteger _additions;
+    NSUInteger _admittedCount;
+    NSUInteger _rejectedCount;
+    uint64_t _rejectedBytes;
+    NSUInteger _resetCount;
+}
+
+- (instancetype)initWithExpectedItemCount:(NSUInteger)expectedItemCount {
+    self = [super init];
+    if (self) {
+        _width = kAFCacheAdmissionFilterMinWidth;
+        while (_width < expectedItemCount) {
+            _width <<= 1;
+        }
+        _sampleSize = _width * 10;
+        _counters = calloc(kAFCacheAdmissionFilterDepth * _width / 2, 1);
+        _doorkeeper = calloc(_width / 8, 1);
+    }
+    return self;
+}
+
+- (instancetype)init {
+    return [self initWithExpectedItemCount:4096];
+}
+
+- (void)dealloc {
+    free(_counters);
+    free(_doorkeeper);
+}
+
+#pragma mark - Counters
+
+- (NSUInteger)indexForHash:(uint64_t)hash row:(NSUInteger)row {
+    // double hashing: the rows use h1 + row * h2
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    return row * _width + ((h1 + row * h2) & (_width - 1));
+}
+
+- (NSUInteger)counterAtIndex:(NSUInteger)index {
+    uint8_t byte = _counters[index / 2];
+    return (index & 1) ? (byte >> 4) : (byte & 0x0F);
+}
+
+- (void)incrementCounterAtIndex:(NSUInteger)index {
+    if ([self counterAtIndex:index] < kAFCacheAdmissionFilterMaxCount) {
+        _counters[index / 2] += (index & 1) ? 0x10 : 0x01;
+    }
+}
+
+- (BOOL)doorkeeperContainsHash:(uint64_t)hash {
+    NSUInteger bit1 = (uint32_t)hash & (_width - 1);
+    NSUInteger bit2 = (uint32_t)(hash >> 32) & (_width - 1);
+    return (_doorkeeper[bit1 / 8] & (1 << (bit1 % 8))) && (_doorkeeper[bit2 / 8] & (1 << (bit2 % 8)));
+}
+
+- (void)addToDoorkeeperHash:(uint64_t)hash {
+    NSUInteger bit1 = (uint32_t)hash & (_width - 1);
+    NSUInteger bit2 = (uint32_t)(hash >> 32) & (_width - 1);
+    _doorkeeper[bit1 / 8] |= (1 << (bit1 % 8));
+    _doorkeeper[bit2 / 8] |= (1 << (bit2 % 8));
+}
+
+- (NSUInteger)frequencyForHash:(uint64_t)hash {
+    NSUInteger frequency = kAFCacheAdmissionFilterMaxCount;
+    for (NSUInteger row = 0; row < kAFCacheAdmissionFilterDepth; row++) {
+        frequency = MIN(frequency, [self counterAtIndex:[self indexForHash:hash row:row]]);
+    }
+    return frequency + ([self doorkeeperContainsHash:hash] ? 1 : 0);
+}
+
+/*
+ * Halves every counter and clears the doorkeeper. Both nibbles of a byte are shifted at once.
+ */
+- (void)age {
+    NSUInteger byteCount = kAFCacheAdmissionFilterDepth * _width / 2;
+    for (NSUInteger i = 0; i < byteCount; i++) {
+        _counters[i] = (_counters[i] >> 1) & 0x77;
+    }
+    memset(_doorkeeper, 0, _width / 8);
+    _additions /= 2;
+    _resetCount++;
+    AFLog(@"admission filter aged after %lu accesses", (unsigned long)_sampleSize);
+}
+
+#pragma mark - Public
+
+- (void)recordAccessForKey:(id)key {
+    if (!key) {
+        return;
+    }
+    uint64_t hash = AFCacheAdmissionFilterHash(key);
+    @synchronized (self) {
+        if (![self doorkeeperContainsHash:hash]) {
+            [self addToDoorkeeperHash:hash];
+        } else {
+            for (NSUInteger row = 0; row < kAFCacheAdmissionFilterDepth; row++) {
+                [self incrementCounterAtIndex:[self indexForHash:hash row:row]];
+            }
+        }
+        if (++_additions >= _sampleSize) {
+            [self age];
+        }
+    }
+}
+
+- (NSUInteger)frequencyForKey:(id)key {
+    if (!key) {
+        return 0;
+    }
+    uint64_t hash = AFCacheAdmissionFilterHash(key);
+    @synchronized (self) {
+        return [self frequencyForHash:hash];
+    }
+}
+
+- (BOOL)admitCandidateKey:(id)candidateKey size:(uint64_t)candidateSize victimKey:(id)victimKey size:(uint64_t)victimSize {
+    NSUInteger candidateFrequency = [self frequencyForKey:candidateKey];
+    NSUInteger victimFrequency = [self frequencyForKey:victimKey];
+
+    // compare accesses per byte, in double to avoid overflowing with large sizes
+    BOOL admit = (double)candidateFrequency * MAX(1, victimSize) > (double)victimFrequency * MAX(1, candidateSize);
+    @synchronized (self) {
+        if (admit) {
+            _admittedCount++;
+        } else {
+            _rejectedCount++;
+            _rejectedBytes += candidateSize;
+        }
+    }
+    AFLog(@"admission filter %@ %@ (frequency %lu, %llu bytes) against %@ (frequency %lu, %llu bytes)",
+          admit ? @"admitted" : @"rejected", candidateKey, (unsigned long)candidateFrequency, candidateSize,
+          victimKey, (unsigned long)victimFrequency, victimSize);
+    return admit;
+}
+
+- (NSString*)victimKeyInSample:(NSDictionary*)sample candidateKey:(id)candidateKey candidateInfo:(AFCacheableItemInfo*)candidateInfo {
+    AFCacheKey *candidate = [AFCacheKey keyWithObject:candidateKey];
+    __block NSString *victimKey = nil;
+    __block AFCacheableItemInfo *victim = nil;
+    __block NSUInteger victimFrequency = NSUIntegerMax;
+    [sample enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+        if (info == candidateInfo || [[AFCacheKey keyWithObject:key] isEqualToKey:candidate]) {
+            return;
+        }
+        NSUInteger frequency = [self frequencyForKey:key];
+        if (frequency < victimFrequency || (frequency == victimFrequency && info.lastAccessTimestamp < victim.lastAccessTimestamp)) {
+            victimKey = key;
+            victim = info;
+            victimFrequency = frequency;
+        }
+    }];
+    return victimKey;
+}
+
+- (void)recordAdmissionWithoutVictim {
+    @synchronized (self) {
+        _admittedCount++;
+    }
+}
+
+- (BOOL)shouldAdmitCandidateKey:(id)candidateKey
+                           info:(AFCacheableItemInfo*)candidateInfo
+                           size:(uint64_t)size
+                      storeSize:(uint64_t)storeSize
+                     byteBudget:(uint64_t)byteBudget
+                         sample:(NSDictionary* (^)(void))sampleBlock {
+    if (byteBudget == 0 || storeSize + size <= byteBudget) {
+        [self recordAdmissionWithoutVictim];
+        return YES;
+    }
+    NSDictionary *sample = sampleBlock();
+    NSString *victimKey = [self victimKeyInSample:sample candidateKey:candidateKey candidateInfo:candidateInfo];
+    AFCacheableItemInfo *victim = victimKey ? sample[victimKey] : nil;
+    if (!victim) {
+        [self recordAdmissionWithoutVictim];
+        return YES;
+    }
+    return [self admitCandidateKey:candidateKey size:size victimKey:victimKey size:victim.contentLength];
+}
+
+- (void)clear {
+    @synchronized (self) {
+        memset(_counters, 0, kAFCacheAdmissionFilterDepth * _width / 2);
+        memset(_doorkeeper, 0, _width / 8);
+        _additions = 0;
+    }
+}
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFCacheAdmissionFilterAdmittedKey : @(_admittedCount),
+                 kAFCacheAdmissionFilterRejectedKey : @(_rejectedCount),
+                 kAFCacheAdmissionFilterRejectedBytesKey : @(_rejectedBytes),
+                 kAFCacheAdmissionFilterResetsKey : @(_resetCount),
+                 kAFCacheAdmissionFilterSampleSizeKey : @(_sampleSize),
+                 };
+    }
+}
+
+@end
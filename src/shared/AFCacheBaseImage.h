@@ -0,0 +1,58 @@
+//
+//  AFCacheBaseImage.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFCacheBodySource.h"
+
+@class AFCache;
+
+#define kAFCacheBaseImageBodySourceKeyPrefix @"baseimage:"
+
+/*
+ * Read-only, prebuilt layer beneath the writable store of a cache, see -[AFCache mountBaseImageAtPath:].
+ *
+ * The image is a package ZIP as built by afcpkg: manifest.afcache is the index, the entries are the bodies.
+ * Opening it maps the file and reads the central directory and the manifest lines, nothing is copied or extracted.
+ * A manifest line is parsed on the first lookup of its URL and kept. Every lookup gets a new AFCacheableItemInfo,
+ * so infos that are handed out (and stored in the writable layer once they are revalidated) never change the image.
+ *
+ * The image is the body source of its entries while it is mounted; -[AFCache bodySourceForKey:] resolves
+ * its bodySourceKey to the mounted image when asked, the image is not registered.
+ *
+ * Stored entries are served from the mapping, deflated entries are inflated on every read (see AFPackageArchive.h).
+ * Delta packages cannot be used as an image. Thread-safe.
+ */
+@interface AFCacheBaseImage : NSObject <AFCacheBodySource>
+
+@property (nonatomic, readonly) NSString *path;
+
+/*
+ * version from the manifest, nil if it has none
+ */
+@property (nonatomic, readonly) NSString *version;
+
+/*
+ * key of the image among the body sources of its cache. Differs for every version of the image,
+ * so entries taken from one version are not served from another.
+ */
+@property (nonatomic, readonly) NSString *bodySourceKey;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+/*
+ * nil if the file cannot be mapped or is no complete package
+ */
+- (instancetype)initWithContentsOfFile:(NSString*)path cache:(AFCache*)cache;
+
+- (BOOL)hasInfoForURLString:(NSString*)URLString;
+
+/*
+ * a new info for every call, nil if the image has no entry for the URL
+ */
+- (AFCacheableItemInfo*)newInfoForURLString:(NSString*)URLString;
+
+@end
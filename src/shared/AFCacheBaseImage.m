@@ -0,0 +1,155 @@
+//
+//  AFCacheBaseImage.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheBaseImage.h"
+#import "AFCache+Packaging.h"
+#import "AFCacheableItemInfo.h"
+#import "AFPackageArchive.h"
+#import "AFPackageInfo.h"
+#import "AFCache_Logging.h"
+#import "AFCacheKey.h"
+
+// a manifest line as parsed on its first lookup
+@interface AFCacheBaseImageEntry : NSObject
+@property (nonatomic, strong) NSDate *lastModified;
+@property (nonatomic, strong) NSDate *expireDate;
+@property (nonatomic, copy) NSString *mimeType;
+@property (nonatomic, copy) NSString *filename;
+@property (nonatomic, assign) uint64_t contentLength;
+@end
+
+@implementation AFCacheBaseImageEntry
+@end
+
+@implementation AFCacheBaseImage {
+    AFPackageArchive *_archive;
+    __weak AFCache *_cache;
+    NSDictionary *_manifestLines; // AFCacheKey -> manifest line
+    NSMutableDictionary *_entries; // AFCacheKey -> AFCacheBaseImageEntry or NSNull, synchronized on itself
+}
+
+- (instancetype)initWithContentsOfFile:(NSString*)path cache:(AFCache*)cache {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _cache = cache;
+        _entries = [NSMutableDictionary dictionary];
+        _archive = [[AFPackageArchive alloc] initWithContentsOfFile:path];
+        NSData *manifestData = [_archive dataForEntryNamed:@"manifest.afcache"];
+        NSString *manifest = manifestData ? [[NSString alloc] initWithData:manifestData encoding:NSASCIIStringEncoding] : nil;
+        if (!manifest) {
+            NSLog(@"AFCache: %@ is no package that can be mounted as base image", path);
+            return nil;
+        }
+        if (![self readManifest:manifest]) {
+            NSLog(@"AFCache: %@ is a delta package, it cannot be mounted as base image", path);
+            return nil;
+        }
+        _bodySourceKey = [kAFCacheBaseImageBodySourceKeyPrefix stringByAppendingString:_version ?: [path lastPathComponent]];
+        AFLog(@"opened base image %@ (version %@) with %lu entries", path, _version, (unsigned long)[_manifestLines count]);
+    }
+    return self;
+}
+
+/*
+ * Only splits the manifest into lines and keeps them by URL, the lines are parsed when they are looked up
+ */
+- (BOOL)readManifest:(NSString*)manifest {
+    NSString *versionPrefix = [kAFPackageManifestVersionKey stringByAppendingString:@" = "];
+    NSString *basePackageURLPrefix = [kAFPackageManifestBasePackageURLKey stringByAppendingString:@" = "];
+    NSMutableDictionary *manifestLines = [NSMutableDictionary dictionary];
+    __block NSString *version = nil;
+    __block BOOL isDelta = NO;
+    [manifest enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+        NSRange separator = [line rangeOfString:@" ; "];
+        if (separator.location != NSNotFound) {
+            manifestLines[[AFCacheKey keyWithURLString:[line substringToIndex:separator.location]]] = line;
+        } else if ([line hasPrefix:versionPrefix]) {
+            version = [line substringFromIndex:[versionPrefix length]];
+        } else if ([line hasPrefix:basePackageURLPrefix]) {
+            isDelta = YES;
+            *stop = YES;
+        }
+    }];
+    _version = [version length] > 0 ? version : nil;
+    _manifestLines = manifestLines;
+    return !isDelta;
+}
+
+- (NSUInteger)count {
+    return [_manifestLines count];
+}
+
+- (BOOL)hasInfoForURLString:(NSString*)URLString {
+    AFCacheKey *key = [AFCacheKey keyWithURLString:URLString];
+    return key && _manifestLines[key] != nil;
+}
+
+- (AFCacheableItemInfo*)newInfoForURLString:(NSString*)URLString {
+    AFCacheKey *key = [AFCacheKey keyWithURLString:URLString];
+    AFCacheBaseImageEntry *entry = key ? [self entryForKey:key] : nil;
+    if (!entry) {
+        return nil;
+    }
+    AFCacheableItemInfo *info = [[AFCacheableItemInfo alloc] init];
+    info.lastModified = entry.lastModified;
+    info.expireDate = entry.expireDate;
+    info.mimeType = entry.mimeType;
+    info.filename = entry.filename;
+    info.contentLength = entry.contentLength;
+    info.response = [[NSURLResponse alloc] initWithURL:[NSURL URLWithString:URLString]
+                                              MIMEType:entry.mimeType
+                                 expectedContentLength:entry.contentLength
+                                      textEncodingName:nil];
+    [info compact];
+    info.bodySourceKey = self.bodySourceKey;
+    info.bodySourceEntry = entry.filename;
+    return info;
+}
+
+// Parsing a line, the dates above all, is done once per entry. nil if the line or its body is broken.
+- (AFCacheBaseImageEntry*)entryForKey:(AFCacheKey*)key {
+    @synchronized (_entries) {
+        id entry = _entries[key];
+        if (entry) {
+            return entry != [NSNull null] ? entry : nil;
+        }
+    }
+    NSString *line = _manifestLines[key];
+    AFCache *cache = _cache;
+    if (!line || !cache) {
+        return nil;
+    }
+    NSDictionary *manifest = [cache manifestWithString:line filesAtPath:nil archive:_archive];
+    // the line's only entry, its URL may be written differently than the normalized one
+    AFCacheableItemInfo *info = [[manifest[kAFPackageManifestCacheInfosKey] allValues] lastObject];
+    AFCacheBaseImageEntry *entry = nil;
+    if ([_archive hasEntryNamed:info.filename]) {
+        entry = [[AFCacheBaseImageEntry alloc] init];
+        entry.lastModified = info.lastModified;
+        entry.expireDate = info.expireDate;
+        entry.mimeType = info.mimeType;
+        entry.filename = info.filename;
+        entry.contentLength = info.contentLength;
+    }
+    @synchronized (_entries) {
+        _entries[key] = entry ?: [NSNull null];
+    }
+    return entry;
+}
+
+#pragma mark - AFCacheBodySource
+
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info {
+    return [_archive hasBodyForItemInfo:info];
+}
+
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info {
+    return [_archive bodyForItemInfo:info];
+}
+
+@end
@@ -0,0 +1,30 @@
+//
+//  AFCacheBodySource.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheableItemInfo;
+
+/*
+ * Holds the bodies of cache entries that have no file of their own in dataPath.
+ *
+ * An entry whose info has a bodySourceKey is read from the body source AFCache has registered under that key,
+ * bodySourceEntry names the body within the source. Writing a new body for such an entry (a download or an import)
+ * turns it back into a regular file entry.
+ *
+ * Implementations must be thread-safe.
+ */
+@protocol AFCacheBodySource <NSObject>
+
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info;
+
+/*
+ * nil if the source does not hold the body or it cannot be read
+ */
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info;
+
+@end
@@ -0,0 +1,57 @@
+//
+//  AFCacheClock.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Time source of the freshness, access and eviction logic.
+ *
+ * The cache asks +currentClock instead of NSDate for the time at which an entry was requested, received and
+ * accessed and for the current time when it computes freshness or utility. The system clock is used unless
+ * another clock has been installed, e.g. an AFCacheManualClock by a test. Code that keeps a time of its own, like
+ * AFCacheSimulator, passes it to the ...AtTime: variants instead of installing a clock for the whole process.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFCacheClock : NSObject
+
+/*
+ * the installed clock, the system clock if none is installed
+ */
++ (AFCacheClock*)currentClock;
+
+/*
+ * installs clock for the whole process. nil reinstalls the system clock.
+ */
++ (void)setCurrentClock:(AFCacheClock*)clock;
+
+/*
+ * seconds since the reference date, like +[NSDate timeIntervalSinceReferenceDate]
+ */
+- (NSTimeInterval)now;
+
+@end
+
+/*
+ * Clock that only moves when it is told to
+ */
+@interface AFCacheManualClock : AFCacheClock
+
+- (instancetype)initWithTime:(NSTimeInterval)time;
+
+- (void)setNow:(NSTimeInterval)now;
+- (void)advanceBy:(NSTimeInterval)interval;
+
+@end
+
+static inline NSTimeInterval AFCacheNow(void) {
+    return [[AFCacheClock currentClock] now];
+}
+
+static inline NSDate *AFCacheNowDate(void) {
+    return [NSDate dateWithTimeIntervalSinceReferenceDate:AFCacheNow()];
+}
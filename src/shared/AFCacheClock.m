@@ -0,0 +1,77 @@
+//
+//  AFCacheClock.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheClock.h"
+
+static AFCacheClock *AFCacheInstalledClock = nil;
+
+@implementation AFCacheClock
+
++ (AFCacheClock*)systemClock {
+    static AFCacheClock *systemClock = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        systemClock = [[AFCacheClock alloc] init];
+    });
+    return systemClock;
+}
+
++ (AFCacheClock*)currentClock {
+    AFCacheClock *clock = nil;
+    @synchronized ([AFCacheClock class]) {
+        clock = AFCacheInstalledClock;
+    }
+    return clock ?: [self systemClock];
+}
+
++ (void)setCurrentClock:(AFCacheClock*)clock {
+    @synchronized ([AFCacheClock class]) {
+        AFCacheInstalledClock = clock;
+    }
+}
+
+- (NSTimeInterval)now {
+    return [NSDate timeIntervalSinceReferenceDate];
+}
+
+@end
+
+@implementation AFCacheManualClock {
+    NSTimeInterval _now;
+}
+
+- (instancetype)initWithTime:(NSTimeInterval)time {
+    self = [super init];
+    if (self) {
+        _now = time;
+    }
+    return self;
+}
+
+- (instancetype)init {
+    return [self initWithTime:[NSDate timeIntervalSinceReferenceDate]];
+}
+
+- (NSTimeInterval)now {
+    @synchronized (self) {
+        return _now;
+    }
+}
+
+- (void)setNow:(NSTimeInterval)now {
+    @synchronized (self) {
+        _now = now;
+    }
+}
+
+- (void)advanceBy:(NSTimeInterval)interval {
+    @synchronized (self) {
+        _now += interval;
+    }
+}
+
+@end
@@ -0,0 +1,91 @@
+//
+//  AFCacheGarbageCollector.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCache;
+
+#define kAFCacheGarbageCollectorDefaultInterval (10 * 60.0)
+#define kAFCacheGarbageCollectorDefaultSliceDuration 0.01
+#define kAFCacheGarbageCollectorDefaultSlicePause 0.1
+#define kAFCacheGarbageCollectorDefaultBatchSize 64
+#define kAFCacheGarbageCollectorDefaultMinimumAge (10 * 60.0)
+#define kAFCacheGarbageCollectorDefaultMaxConsecutiveDeferrals 50
+
+// keys of the dictionary returned by -[AFCacheGarbageCollector statistics]
+#define kAFCacheGarbageCollectorPassesKey @"passes"              // completed walks of the cache directory
+#define kAFCacheGarbageCollectorSlicesKey @"slices"
+#define kAFCacheGarbageCollectorDeferredSlicesKey @"deferredSlices" // postponed because downloads were executing
+#define kAFCacheGarbageCollectorExaminedFilesKey @"examinedFiles"
+#define kAFCacheGarbageCollectorRemovedFilesKey @"removedFiles"
+#define kAFCacheGarbageCollectorReclaimedBytesKey @"reclaimedBytes"
+
+/*
+ * Removes files from the cache directory that no entry of the cache refers to, e.g. left behind by a crash,
+ * by entries removed from the info store without their file or by an older version of the cache.
+ *
+ * The directory is walked in the order of its sorted file names, in slices of at most sliceDuration,
+ * with a pause of slicePause between them. The path of the file examined last is the cursor of the walk.
+ * The cache archives it with its metadata, so an interrupted walk continues where it stopped after a relaunch.
+ * A walk that is complete starts over after interval.
+ *
+ * A file is kept if its path, with or without its extension, is the filename of an entry in the info store,
+ * if it is an archive of a package or one of the cache's own files, or if it was modified less than minimumAge ago,
+ * which protects downloads in progress and entries added after the walk took its snapshot of the info store.
+ * The package user data folder and the segments of the slab store are skipped. Orphans are unlinked in batches of batchSize.
+ *
+ * The collector runs on a serial queue that targets the background priority global queue, so its I/O is throttled
+ * in favour of the app's. Slices are also postponed while the cache has downloads executing,
+ * but at most maxConsecutiveDeferrals times in a row, so a busy cache is still collected.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFCacheGarbageCollector : NSObject
+
+@property (nonatomic, weak, readonly) AFCache *cache;
+
+@property (nonatomic, assign) NSTimeInterval interval;
+@property (nonatomic, assign) NSTimeInterval sliceDuration;
+@property (nonatomic, assign) NSTimeInterval slicePause;
+@property (nonatomic, assign) NSUInteger batchSize;
+@property (nonatomic, assign) NSTimeInterval minimumAge;
+@property (nonatomic, assign) NSUInteger maxConsecutiveDeferrals;
+
+/*
+ * path of the file examined last, relative to the cache directory. nil if no walk is in progress.
+ */
+@property (atomic, copy) NSString *cursor;
+
+@property (nonatomic, readonly, getter=isRunning) BOOL running;
+
+- (instancetype)initWithCache:(AFCache*)cache;
+
+/*
+ * collect periodically. A walk that was interrupted continues after slicePause, otherwise the next one starts after interval.
+ */
+- (void)start;
+- (void)stop;
+
+/*
+ * starts a walk soon, or continues the current one, whether the collector is running or not
+ */
+- (void)setNeedsCollection;
+
+/*
+ * performs a single slice and returns YES if it completed the walk. Blocks until done, do not call on the main thread.
+ */
+- (BOOL)collectSlice;
+
+/*
+ * unlinks the files in the background, unless they were modified after date, compared with nanoseconds.
+ * For files of entries that have just been removed from the info store.
+ */
+- (void)removeFilesAtPaths:(NSArray*)paths unlessModifiedAfter:(NSDate*)date;
+
+- (NSDictionary*)statistics;
+
+@end
@@ -0,0 +1,472 @@
+//
+//  AFCacheGarbageCollector.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheGarbageCollector.h"
+#import "AFCache+PrivateAPI.h"
+#import "AFCacheableItemInfo.h"
+#import "AFPackageInfo.h"
+#import "AFCacheSharedStore.h"
+#import "AFCacheSlabStore.h"
+#import "AFCache_Logging.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void *kAFCacheGarbageCollectorQueueKey = &kAFCacheGarbageCollectorQueueKey;
+
+/*
+ * YES if the file may have been modified after limit, seconds since 1970. Compares with nanoseconds,
+ * a file written again in the same second as its entry was removed is kept. File systems that only store
+ * whole seconds leave tv_nsec 0, then a modification in the second of limit counts as after it.
+ * Files kept in doubt are orphans the next walk removes.
+ */
+static BOOL AFCacheFileModifiedAfter(const struct stat *fileStatus, NSTimeInterval limit) {
+    struct timespec modified = fileStatus->st_mtimespec;
+    time_t limitSeconds = (time_t)floor(limit);
+    if (modified.tv_nsec == 0) {
+        return modified.tv_sec >= limitSeconds;
+    }
+    long limitNanoseconds = (long)((limit - limitSeconds) * NSEC_PER_SEC);
+    return modified.tv_sec > limitSeconds || (modified.tv_sec == limitSeconds && modified.tv_nsec > limitNanoseconds);
+}
+
+/*
+ * A directory on the stack of the walk
+ */
+@interface AFCacheGarbageCollectorDirectory : NSObject
+@property (nonatomic, copy) NSString *relativePath;   // @"" for the cache directory
+@property (nonatomic, strong) NSArray *names;         // sorted
+@property (nonatomic, strong) NSSet *directoryNames;
+@property (nonatomic, assign) NSUInteger index;       // of the next name to visit
+@end
+
+@implementation AFCacheGarbageCollectorDirectory
+@end
+
+@interface AFCacheGarbageCollector ()
+@property (nonatomic, weak) AFCache *cache;
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+#endif
+@end
+
+@implementation AFCacheGarbageCollector {
+    // all confined to the queue
+    BOOL _running;
+    BOOL _collectionRequested;
+    BOOL _sliceScheduled;
+    NSUInteger _generation;
+    NSUInteger _consecutiveDeferrals;
+
+    NSString *_dataPath;
+    NSSet *_liveNames;
+    NSMutableArray *_directories;       // nil if no walk is in progress
+    NSTimeInterval _walkStartTime;      // since 1970, like file modification times
+
+    NSMutableArray *_batchPaths;
+    NSMutableArray *_batchSizes;
+
+    NSUInteger _passCount;
+    NSUInteger _sliceCount;
+    NSUInteger _deferredSliceCount;
+    NSUInteger _examinedFileCount;
+    NSUInteger _removedFileCount;
+    uint64_t _reclaimedByteCount;
+}
+
+- (instancetype)initWithCache:(AFCache*)cache {
+    self = [super init];
+    if (self) {
+        _cache = cache;
+        _interval = kAFCacheGarbageCollectorDefaultInterval;
+        _sliceDuration = kAFCacheGarbageCollectorDefaultSliceDuration;
+        _slicePause = kAFCacheGarbageCollectorDefaultSlicePause;
+        _batchSize = kAFCacheGarbageCollectorDefaultBatchSize;
+        _minimumAge = kAFCacheGarbageCollectorDefaultMinimumAge;
+        _maxConsecutiveDeferrals = kAFCacheGarbageCollectorDefaultMaxConsecutiveDeferrals;
+        _batchPaths = [NSMutableArray array];
+        _batchSizes = [NSMutableArray array];
+        _queue = dispatch_queue_create("de.artifacts.afcache.garbagecollector", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(_queue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+        dispatch_queue_set_specific(_queue, kAFCacheGarbageCollectorQueueKey, (__bridge void *)self, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+#if !OS_OBJECT_USE_OBJC
+    if (_queue) {
+        dispatch_release(_queue);
+    }
+#endif
+}
+
+#pragma mark - Scheduling
+
+/*
+ * Runs block on the queue and waits for it. On the queue itself it runs right away: a slice holds the cache while
+ * it runs, so releasing the cache's last reference there deallocates it on the queue, and it stops the collector.
+ */
+- (void)performOnQueueAndWait:(dispatch_block_t)block {
+    if (dispatch_get_specific(kAFCacheGarbageCollectorQueueKey) == (__bridge void *)self) {
+        block();
+    } else {
+        dispatch_sync(self.queue, block);
+    }
+}
+
+- (BOOL)isRunning {
+    __block BOOL running;
+    [self performOnQueueAndWait:^{
+        running = self->_running;
+    }];
+    return running;
+}
+
+- (void)start {
+    [self performOnQueueAndWait:^{
+        self->_running = YES;
+        [self cancelScheduledSlice];
+        [self scheduleSliceAfter:self->_directories || self.cursor ? self.slicePause : self.interval];
+    }];
+}
+
+- (void)stop {
+    [self performOnQueueAndWait:^{
+        self->_running = NO;
+        self->_collectionRequested = NO;
+        [self cancelScheduledSlice];
+    }];
+}
+
+- (void)setNeedsCollection {
+    dispatch_async(self.queue, ^{
+        self->_collectionRequested = YES;
+        [self scheduleSliceAfter:self.slicePause];
+    });
+}
+
+// on the queue
+- (void)cancelScheduledSlice {
+    _generation++;
+    _sliceScheduled = NO;
+}
+
+// on the queue. Calls are coalesced while a slice is scheduled.
+- (void)scheduleSliceAfter:(NSTimeInterval)delay {
+    if (_sliceScheduled) {
+        return;
+    }
+    _sliceScheduled = YES;
+    NSUInteger generation = _generation;
+    __weak AFCacheGarbageCollector *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.queue, ^{
+        AFCacheGarbageCollector *collector = weakSelf;
+        if (!collector || collector->_generation != generation) {
+            return;
+        }
+        collector->_sliceScheduled = NO;
+        [collector performScheduledSlice];
+    });
+}
+
+// on the queue
+- (void)performScheduledSlice {
+    AFCache *cache = self.cache;
+    if (!cache) {
+        return;
+    }
+    if ([cache executingDownloadCount] > 0 && _consecutiveDeferrals < self.maxConsecutiveDeferrals) {
+        _deferredSliceCount++;
+        _consecutiveDeferrals++;
+        [self scheduleSliceAfter:self.slicePause];
+        return;
+    }
+    _consecutiveDeferrals = 0;
+
+    if (![self collectSliceOfCache:cache]) {
+        if (_running || _collectionRequested) {
+            [self scheduleSliceAfter:self.slicePause];
+        }
+        return;
+    }
+    _collectionRequested = NO;
+    if (_running) {
+        [self scheduleSliceAfter:self.interval];
+    }
+}
+
+#pragma mark - Collecting
+
+- (BOOL)collectSlice {
+    __block BOOL complete = YES;
+    [self performOnQueueAndWait:^{
+        AFCache *cache = self.cache;
+        if (cache) {
+            complete = [self collectSliceOfCache:cache];
+        }
+    }];
+    return complete;
+}
+
+// on the queue, returns YES if the walk is complete
+- (BOOL)collectSliceOfCache:(AFCache*)cache {
+    if (!_directories) {
+        [self beginWalkOfCache:cache];
+    }
+    _sliceCount++;
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    BOOL complete = NO;
+    NSString *cursor = nil;
+    while (CFAbsoluteTimeGetCurrent() - start < self.sliceDuration) {
+        NSString *relativePath = [self nextFile];
+        if (!relativePath) {
+            complete = YES;
+            break;
+        }
+        _examinedFileCount++;
+        cursor = relativePath;
+        if ([_liveNames containsObject:relativePath] || [_liveNames containsObject:[relativePath stringByDeletingPathExtension]]) {
+            continue;
+        }
+        NSString *path = [_dataPath stringByAppendingPathComponent:relativePath];
+        struct stat fileStatus;
+        if (lstat([path fileSystemRepresentation], &fileStatus) != 0) {
+            continue;
+        }
+        if (fileStatus.st_mtime > _walkStartTime - self.minimumAge) {
+            continue;
+        }
+        [self addPathToBatch:path size:(uint64_t)fileStatus.st_size];
+    }
+    [self unlinkBatch];
+
+    if (complete) {
+        _directories = nil;
+        _liveNames = nil;
+        self.cursor = nil;
+        _passCount++;
+        AFLog(@"garbage collection of %@ complete, %lu files removed so far", _dataPath, (unsigned long)_removedFileCount);
+    } else if (cursor) {
+        self.cursor = cursor;
+    }
+    return complete;
+}
+
+// on the queue. Files created after the snapshot are younger than the walk and protected by minimumAge.
+- (void)beginWalkOfCache:(AFCache*)cache {
+    _dataPath = [cache.dataPath copy];
+    _walkStartTime = [[NSDate date] timeIntervalSince1970];
+
+    NSMutableSet *liveNames = [NSMutableSet setWithObjects:kAFCacheExpireInfoDictionaryFilename,
+                               kAFCacheRedirectInfoDictionaryFilename,
+                               kAFCachePackageInfoDictionaryFilename,
+                               kAFCacheMetadataFilename,
+                               kAFCacheSharedStoreIndexFilename,
+                               kAFCacheSharedStoreJournalFilename,
+                               kAFCacheSharedStoreLockFilename, nil];
+    // files of other processes sharing the directory are live once their entries have been replayed
+    [cache.sharedStore synchronize];
+    NSDictionary *cachedItemInfos = [cache.cachedItemInfos copy];
+    [cachedItemInfos enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+        if (info.filename) {
+            [liveNames addObject:info.filename];
+        }
+    }];
+    NSString *dataPathPrefix = [_dataPath stringByAppendingString:@"/"];
+    NSDictionary *packageInfos = [cache.packageInfos copy];
+    for (AFPackageInfo *packageInfo in [packageInfos allValues]) {
+        if (![packageInfo isKindOfClass:[AFPackageInfo class]] || !packageInfo.archivePath) {
+            continue;
+        }
+        NSString *archivePath = packageInfo.archivePath;
+        if ([archivePath hasPrefix:dataPathPrefix]) {
+            archivePath = [archivePath substringFromIndex:[dataPathPrefix length]];
+        }
+        [liveNames addObject:archivePath];
+    }
+    _liveNames = liveNames;
+
+    [self resumeWalkAtCursor:self.cursor];
+    AFLog(@"garbage collection of %@ %@ with %lu live files", _dataPath, self.cursor ? @"resumed" : @"started", (unsigned long)[liveNames count]);
+}
+
+#pragma mark - Walking
+
+// on the queue. The stack ends up where the walk stood after visiting cursor, or at the start without one.
+- (void)resumeWalkAtCursor:(NSString*)cursor {
+    _directories = [NSMutableArray array];
+    AFCacheGarbageCollectorDirectory *directory = [self directoryAtRelativePath:@""];
+    if (!directory) {
+        return;
+    }
+    [_directories addObject:directory];
+
+    NSArray *components = [cursor length] > 0 ? [cursor pathComponents] : @[];
+    for (NSUInteger i = 0; i < [components count]; i++) {
+        NSString *component = components[i];
+        // the insertion index after equal names is the first name that sorts after the component
+        NSUInteger index = [directory.names indexOfObject:component
+                                            inSortedRange:NSMakeRange(0, [directory.names count])
+                                                  options:NSBinarySearchingInsertionIndex | NSBinarySearchingLastEqual
+                                          usingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+                                              return [a compare:b];
+                                          }];
+        directory.index = index;
+        BOOL found = index > 0 && [directory.names[index - 1] isEqualToString:component];
+        if (i + 1 == [components count] || !found || ![directory.directoryNames containsObject:component]) {
+            break;
+        }
+        // the cursor lies within this directory, its siblings follow once it is done
+        AFCacheGarbageCollectorDirectory *child = [self directoryAtRelativePath:[directory.relativePath stringByAppendingPathComponent:component]];
+        if (!child) {
+            break;
+        }
+        [_directories addObject:child];
+        directory = child;
+    }
+}
+
+// on the queue, nil at the end of the walk
+- (NSString*)nextFile {
+    while ([_directories count] > 0) {
+        AFCacheGarbageCollectorDirectory *directory = [_directories lastObject];
+        if (directory.index >= [directory.names count]) {
+            [_directories removeLastObject];
+            continue;
+        }
+        NSString *name = directory.names[directory.index];
+        directory.index++;
+        NSString *relativePath = [directory.relativePath stringByAppendingPathComponent:name];
+        if (![directory.directoryNames containsObject:name]) {
+            return relativePath;
+        }
+        // user data extracted from packages belongs to the app, segments are compacted by the slab store
+        if ([directory.relativePath length] == 0 && ([name isEqualToString:kAFCacheUserDataFolder] || [name isEqualToString:kAFCacheSlabStoreDirectoryName])) {
+            continue;
+        }
+        AFCacheGarbageCollectorDirectory *child = [self directoryAtRelativePath:relativePath];
+        if (child) {
+            [_directories addObject:child];
+        }
+    }
+    return nil;
+}
+
+// on the queue. readdir tells directories from files without a stat per entry on most file systems.
+- (AFCacheGarbageCollectorDirectory*)directoryAtRelativePath:(NSString*)relativePath {
+    NSString *path = [relativePath length] > 0 ? [_dataPath stringByAppendingPathComponent:relativePath] : _dataPath;
+    DIR *dir = opendir([path fileSystemRepresentation]);
+    if (!dir) {
+        if (errno != ENOENT) {
+            NSLog(@"AFCache: Could not read directory %@ (errno %d)", path, errno);
+        }
+        return nil;
+    }
+    NSMutableArray *names = [NSMutableArray array];
+    NSMutableSet *directoryNames = [NSMutableSet set];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        NSString *name = [fileManager stringWithFileSystemRepresentation:entry->d_name length:strlen(entry->d_name)];
+        if (!name) {
+            continue;
+        }
+        BOOL isDirectory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat fileStatus;
+            isDirectory = lstat([[path stringByAppendingPathComponent:name] fileSystemRepresentation], &fileStatus) == 0 && S_ISDIR(fileStatus.st_mode);
+        }
+        [names addObject:name];
+        if (isDirectory) {
+            [directoryNames addObject:name];
+        }
+    }
+    closedir(dir);
+    [names sortUsingSelector:@selector(compare:)];
+
+    AFCacheGarbageCollectorDirectory *directory = [[AFCacheGarbageCollectorDirectory alloc] init];
+    directory.relativePath = relativePath;
+    directory.names = names;
+    directory.directoryNames = directoryNames;
+    return directory;
+}
+
+#pragma mark - Removing
+
+- (void)removeFilesAtPaths:(NSArray*)paths unlessModifiedAfter:(NSDate*)date {
+    NSArray *pathsToRemove = [paths copy];
+    NSTimeInterval limit = [date timeIntervalSince1970];
+    dispatch_async(self.queue, ^{
+        for (NSString *path in pathsToRemove) {
+            struct stat fileStatus;
+            if (lstat([path fileSystemRepresentation], &fileStatus) != 0) {
+                continue;
+            }
+            // written again by a new entry meanwhile
+            if (AFCacheFileModifiedAfter(&fileStatus, limit)) {
+                continue;
+            }
+            [self addPathToBatch:path size:(uint64_t)fileStatus.st_size];
+        }
+        [self unlinkBatch];
+    });
+}
+
+// on the queue
+- (void)addPathToBatch:(NSString*)path size:(uint64_t)size {
+    [_batchPaths addObject:path];
+    [_batchSizes addObject:@(size)];
+    if ([_batchPaths count] >= self.batchSize) {
+        [self unlinkBatch];
+    }
+}
+
+// on the queue
+- (void)unlinkBatch {
+    if ([_batchPaths count] == 0) {
+        return;
+    }
+    NSUInteger removed = 0;
+    for (NSUInteger i = 0; i < [_batchPaths count]; i++) {
+        NSString *path = _batchPaths[i];
+        if (unlink([path fileSystemRepresentation]) == 0) {
+            removed++;
+            _reclaimedByteCount += [_batchSizes[i] unsignedLongLongValue];
+        } else if (errno != ENOENT) {
+            NSLog(@"AFCache: Could not remove orphaned file %@ (errno %d)", path, errno);
+        }
+    }
+    AFLog(@"garbage collection removed %lu of %lu orphaned files", (unsigned long)removed, (unsigned long)[_batchPaths count]);
+    _removedFileCount += removed;
+    [_batchPaths removeAllObjects];
+    [_batchSizes removeAllObjects];
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    __block NSDictionary *statistics = nil;
+    [self performOnQueueAndWait:^{
+        statistics = @{kAFCacheGarbageCollectorPassesKey : @(self->_passCount),
+                       kAFCacheGarbageCollectorSlicesKey : @(self->_sliceCount),
+                       kAFCacheGarbageCollectorDeferredSlicesKey : @(self->_deferredSliceCount),
+                       kAFCacheGarbageCollectorExaminedFilesKey : @(self->_examinedFileCount),
+                       kAFCacheGarbageCollectorRemovedFilesKey : @(self->_removedFileCount),
+                       kAFCacheGarbageCollectorReclaimedBytesKey : @(self->_reclaimedByteCount),
+                       };
+    }];
+    return statistics;
+}
+
+@end
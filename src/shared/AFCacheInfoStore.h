@@ -0,0 +1,83 @@
+//
+//  AFCacheInfoStore.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#define kAFCacheInfoStoreShardCount 16
+
+@class AFCacheInfoStore;
+@class AFCacheKey;
+
+/*
+ * Told about every modification of a store, e.g. to keep an index of its keys (see AFCacheInvalidationIndex.h)
+ * or to share it with other processes (see AFCacheSharedStore.h).
+ * The methods are called with the write lock of the key's shard held, so the writes of a key are seen in order.
+ * They must not call back into the store.
+ */
+@protocol AFCacheInfoStoreObserver <NSObject>
+- (void)infoStore:(AFCacheInfoStore*)store didSetObject:(id)object forKey:(AFCacheKey*)key;
+- (void)infoStore:(AFCacheInfoStore*)store didRemoveObjectForKey:(AFCacheKey*)key;
+- (void)infoStoreDidRemoveAllObjects:(AFCacheInfoStore*)store;
+@end
+
+/*
+ * Mutable dictionary that may be read and written from any thread.
+ *
+ * Used for the cache's info store (cachedItemInfos, urlRedirects, packageInfos), which is written by download
+ * operations on the main thread and by the package queue and read by lookups on any thread and by the archiver.
+ *
+ * Keys are AFCacheKeys. Every other key (an NSString or NSURL) is turned into the AFCacheKey of its URL, so entries
+ * may still be looked up and stored by URL string, but callers that have the item's cacheKey should pass that and
+ * save the normalization and hashing. Enumeration, allKeys, snapshots and the archive hand out the keys' URL strings.
+ *
+ * Threading contract:
+ * - Keys are distributed over kAFCacheInfoStoreShardCount shards by the second half of their hash. Every shard has its own
+ *   read-write lock, so lookups never wait for each other and only wait for a writer of the same shard.
+ * - Every single operation (objectForKey:, setObject:forKey:, removeObjectForKey:, count) is atomic.
+ * - allKeys, allValues and keyEnumerator copy the shards one after the other under their read lock. Block enumeration
+ *   and copy work on a snapshot taken shard by shard. Either way an entry changed meanwhile is seen before or after
+ *   the change, but never half written.
+ * - Snapshots are copy-on-write: taking one only marks the shards as shared, which is O(shard count).
+ *   The first write to a shared shard copies that shard, so a snapshot never blocks writers for longer than that.
+ * - Sequences of operations are not atomic. A caller that needs that (e.g. "add unless present") must lock itself.
+ * - The stored objects are not protected by the store. AFCacheableItemInfos are modified on the main thread
+ *   (download operations, slab compaction) or before they are inserted, e.g. on the package queue.
+ *   The exception is -[AFCacheableItemInfo recordAccess], which locks the info and may be called on any thread.
+ *
+ * The store is archived as a plain NSMutableDictionary, so archives stay compatible.
+ */
+@interface AFCacheInfoStore : NSMutableDictionary
+
+/*
+ * incremented by every modification
+ */
+@property (readonly) uint64_t version;
+
+/*
+ * observers are retained until they are removed
+ */
+- (void)addObserver:(id<AFCacheInfoStoreObserver>)observer;
+- (void)removeObserver:(id<AFCacheInfoStoreObserver>)observer;
+
+/*
+ * immutable view of the store at the time of the call, see above. -copy returns the same.
+ */
+- (NSDictionary*)snapshot;
+
+/*
+ * up to count entries picked at random positions, without taking a snapshot.
+ * Cost is independent of the size of the store, so it may be used on every write (e.g. to find an eviction victim).
+ */
+- (NSDictionary*)sampleWithCount:(NSUInteger)count;
+
+/*
+ * rebuilds every shard that is not part of a snapshot at the size of its content. Dictionaries never shrink
+ * by themselves, a shard that once held many entries keeps their room. Does not change the version.
+ */
+- (void)compact;
+
+@end
@@ -0,0 +1,376 @@
+//
+//  AFCacheInfoStore.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheInfoStore.h"
+#import "AFCacheKey.h"
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
+
+// The second half of the hash, the shard's dictionary uses the first
+static inline NSUInteger AFCacheInfoStoreShardIndex(AFCacheKey *key) {
+    return (NSUInteger)(key.hash128.h2 % kAFCacheInfoStoreShardCount);
+}
+
+/*
+ * Immutable dictionary over frozen shards of an AFCacheInfoStore. The shards are never modified again,
+ * the store copies a shard before writing to it once it has been handed out.
+ * Like the store it takes any key AFCacheKey accepts and hands out the URL strings of the keys.
+ */
+@interface AFCacheInfoStoreSnapshot : NSDictionary {
+    NSArray *_shards;
+    NSUInteger _count;
+}
+- (instancetype)initWithShards:(NSArray*)shards;
+@end
+
+@implementation AFCacheInfoStoreSnapshot
+
+- (instancetype)initWithShards:(NSArray*)shards {
+    self = [super init];
+    if (self) {
+        _shards = shards;
+        for (NSDictionary *shard in shards) {
+            _count += [shard count];
+        }
+    }
+    return self;
+}
+
+- (NSUInteger)count {
+    return _count;
+}
+
+- (id)objectForKey:(id)aKey {
+    AFCacheKey *key = [AFCacheKey keyWithObject:aKey];
+    if (!key) {
+        return nil;
+    }
+    return [_shards[AFCacheInfoStoreShardIndex(key)] objectForKey:key];
+}
+
+- (NSEnumerator *)keyEnumerator {
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:_count];
+    for (NSDictionary *shard in _shards) {
+        for (AFCacheKey *key in shard) {
+            [keys addObject:key.URLString];
+        }
+    }
+    return [keys objectEnumerator];
+}
+
+- (void)enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block {
+    __block BOOL stopAll = NO;
+    for (NSDictionary *shard in _shards) {
+        [shard enumerateKeysAndObjectsWithOptions:opts usingBlock:^(AFCacheKey *key, id obj, BOOL *stop) {
+            block(key.URLString, obj, &stopAll);
+            *stop = stopAll;
+        }];
+        if (stopAll) {
+            break;
+        }
+    }
+}
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block {
+    [self enumerateKeysAndObjectsWithOptions:0 usingBlock:block];
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    return self;
+}
+
+- (NSDictionary*)dictionaryWithURLStringKeys {
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:_count];
+    [self enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+        dictionary[key] = obj;
+    }];
+    return dictionary;
+}
+
+- (Class)classForCoder {
+    return [NSMutableDictionary class];
+}
+
+- (Class)classForKeyedArchiver {
+    return [NSMutableDictionary class];
+}
+
+// archived with the URL strings as keys, as before there were AFCacheKeys
+- (void)encodeWithCoder:(NSCoder *)aCoder {
+    [[self dictionaryWithURLStringKeys] encodeWithCoder:aCoder];
+}
+
+@end
+
+@implementation AFCacheInfoStore {
+    NSMutableDictionary *_shards[kAFCacheInfoStoreShardCount];
+    BOOL _shared[kAFCacheInfoStoreShardCount]; // YES if the shard is part of a snapshot and must be copied before writing
+    pthread_rwlock_t _locks[kAFCacheInfoStoreShardCount];
+    volatile int64_t _version;
+    NSArray *_observers; // replaced as a whole, read with a shard lock held
+    pthread_mutex_t _observersLock; // not the store itself, clients synchronize on it (see -[AFCache pinCachedItemForURL:])
+}
+
+#pragma mark - Initialization (primitive methods of NSMutableDictionary)
+
+- (instancetype)initWithCapacity:(NSUInteger)numItems {
+    self = [super init];
+    if (self) {
+        NSUInteger shardCapacity = numItems / kAFCacheInfoStoreShardCount + 1;
+        for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+            _shards[i] = [[NSMutableDictionary alloc] initWithCapacity:shardCapacity];
+            pthread_rwlock_init(&_locks[i], NULL);
+        }
+        pthread_mutex_init(&_observersLock, NULL);
+    }
+    return self;
+}
+
+- (instancetype)init {
+    return [self initWithCapacity:0];
+}
+
+- (instancetype)initWithObjects:(const id [])objects forKeys:(const id<NSCopying> [])keys count:(NSUInteger)cnt {
+    self = [self initWithCapacity:cnt];
+    if (self) {
+        for (NSUInteger i = 0; i < cnt; i++) {
+            [self setObject:objects[i] forKey:keys[i]];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_destroy(&_locks[i]);
+    }
+    pthread_mutex_destroy(&_observersLock);
+}
+
+- (uint64_t)version {
+    return (uint64_t)OSAtomicAdd64Barrier(0, &_version);
+}
+
+#pragma mark - Primitive methods
+
+- (NSUInteger)count {
+    NSUInteger count = 0;
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_rdlock(&_locks[i]);
+        count += [_shards[i] count];
+        pthread_rwlock_unlock(&_locks[i]);
+    }
+    return count;
+}
+
+- (id)objectForKey:(id)aKey {
+    AFCacheKey *key = [AFCacheKey keyWithObject:aKey];
+    if (!key) {
+        return nil;
+    }
+    NSUInteger index = AFCacheInfoStoreShardIndex(key);
+    pthread_rwlock_rdlock(&_locks[index]);
+    id object = [_shards[index] objectForKey:key];
+    pthread_rwlock_unlock(&_locks[index]);
+    return object;
+}
+
+// must be called with the shard's write lock held
+- (NSMutableDictionary*)writableShardAtIndex:(NSUInteger)index {
+    if (_shared[index]) {
+        _shards[index] = [_shards[index] mutableCopy];
+        _shared[index] = NO;
+    }
+    OSAtomicIncrement64Barrier(&_version);
+    return _shards[index];
+}
+
+- (void)setObject:(id)anObject forKey:(id<NSCopying>)aKey {
+    AFCacheKey *key = [AFCacheKey keyWithObject:aKey];
+    NSUInteger index = AFCacheInfoStoreShardIndex(key);
+    pthread_rwlock_wrlock(&_locks[index]);
+    [[self writableShardAtIndex:index] setObject:anObject forKey:key];
+    for (id<AFCacheInfoStoreObserver> observer in [self observers]) {
+        [observer infoStore:self didSetObject:anObject forKey:key];
+    }
+    pthread_rwlock_unlock(&_locks[index]);
+}
+
+- (void)removeObjectForKey:(id)aKey {
+    AFCacheKey *key = [AFCacheKey keyWithObject:aKey];
+    if (!key) {
+        return;
+    }
+    NSUInteger index = AFCacheInfoStoreShardIndex(key);
+    pthread_rwlock_wrlock(&_locks[index]);
+    [[self writableShardAtIndex:index] removeObjectForKey:key];
+    for (id<AFCacheInfoStoreObserver> observer in [self observers]) {
+        [observer infoStore:self didRemoveObjectForKey:key];
+    }
+    pthread_rwlock_unlock(&_locks[index]);
+}
+
+// holds every lock while the observer is told, so it cannot miss a write that follows
+- (void)removeAllObjects {
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_wrlock(&_locks[i]);
+        _shards[i] = [NSMutableDictionary dictionary];
+        _shared[i] = NO;
+        OSAtomicIncrement64Barrier(&_version);
+    }
+    for (id<AFCacheInfoStoreObserver> observer in [self observers]) {
+        [observer infoStoreDidRemoveAllObjects:self];
+    }
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_unlock(&_locks[i]);
+    }
+}
+
+- (NSEnumerator *)keyEnumerator {
+    return [[self allKeys] objectEnumerator];
+}
+
+#pragma mark - Observers
+
+- (NSArray*)observers {
+    pthread_mutex_lock(&_observersLock);
+    NSArray *observers = _observers;
+    pthread_mutex_unlock(&_observersLock);
+    return observers;
+}
+
+- (void)addObserver:(id<AFCacheInfoStoreObserver>)observer {
+    pthread_mutex_lock(&_observersLock);
+    if (observer && ![_observers containsObject:observer]) {
+        _observers = _observers ? [_observers arrayByAddingObject:observer] : @[observer];
+    }
+    pthread_mutex_unlock(&_observersLock);
+}
+
+- (void)removeObserver:(id<AFCacheInfoStoreObserver>)observer {
+    pthread_mutex_lock(&_observersLock);
+    if (observer && [_observers containsObject:observer]) {
+        NSMutableArray *observers = [_observers mutableCopy];
+        [observers removeObject:observer];
+        _observers = [observers count] > 0 ? [observers copy] : nil;
+    }
+    pthread_mutex_unlock(&_observersLock);
+}
+
+#pragma mark - Sampling
+
+// entries further into a shard than this are never sampled, which bounds the cost of a pick
+#define kAFCacheInfoStoreMaxSampleOffset 64
+
+- (NSDictionary*)sampleWithCount:(NSUInteger)count {
+    NSMutableDictionary *sample = [NSMutableDictionary dictionaryWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        NSUInteger index = arc4random_uniform(kAFCacheInfoStoreShardCount);
+        pthread_rwlock_rdlock(&_locks[index]);
+        NSDictionary *shard = _shards[index];
+        NSUInteger shardCount = [shard count];
+        if (shardCount > 0) {
+            __block NSUInteger offset = arc4random_uniform((uint32_t)MIN(shardCount, kAFCacheInfoStoreMaxSampleOffset));
+            [shard enumerateKeysAndObjectsUsingBlock:^(AFCacheKey *key, id obj, BOOL *stop) {
+                if (offset-- == 0) {
+                    sample[key.URLString] = obj;
+                    *stop = YES;
+                }
+            }];
+        }
+        pthread_rwlock_unlock(&_locks[index]);
+    }
+    return sample;
+}
+
+#pragma mark - Compaction
+
+- (void)compact {
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_wrlock(&_locks[i]);
+        if (!_shared[i]) {
+            // a shared shard is kept alive by its snapshot anyway, it is copied on the next write
+            _shards[i] = [[NSMutableDictionary alloc] initWithDictionary:_shards[i]];
+        }
+        pthread_rwlock_unlock(&_locks[i]);
+    }
+}
+
+#pragma mark - Snapshots
+
+- (NSDictionary*)snapshot {
+    NSMutableArray *shards = [NSMutableArray arrayWithCapacity:kAFCacheInfoStoreShardCount];
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_wrlock(&_locks[i]);
+        _shared[i] = YES;
+        [shards addObject:_shards[i]];
+        pthread_rwlock_unlock(&_locks[i]);
+    }
+    return [[AFCacheInfoStoreSnapshot alloc] initWithShards:shards];
+}
+
+#pragma mark - Keys and values
+
+/*
+ * Copied shard by shard under its read lock. Taking a snapshot instead would make the next write to every shard
+ * copy it. Enumeration with a block still works on a snapshot, the block may write to the store.
+ */
+- (NSArray *)allKeys {
+    NSMutableArray *keys = [NSMutableArray array];
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_rdlock(&_locks[i]);
+        for (AFCacheKey *key in _shards[i]) {
+            [keys addObject:key.URLString];
+        }
+        pthread_rwlock_unlock(&_locks[i]);
+    }
+    return keys;
+}
+
+- (NSArray *)allValues {
+    NSMutableArray *values = [NSMutableArray array];
+    for (NSUInteger i = 0; i < kAFCacheInfoStoreShardCount; i++) {
+        pthread_rwlock_rdlock(&_locks[i]);
+        [values addObjectsFromArray:[_shards[i] allValues]];
+        pthread_rwlock_unlock(&_locks[i]);
+    }
+    return values;
+}
+
+#pragma mark - Enumeration
+
+- (void)enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block {
+    [[self snapshot] enumerateKeysAndObjectsWithOptions:opts usingBlock:block];
+}
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block {
+    [[self snapshot] enumerateKeysAndObjectsUsingBlock:block];
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    return [self snapshot];
+}
+
+- (id)mutableCopyWithZone:(NSZone *)zone {
+    return [[NSMutableDictionary allocWithZone:zone] initWithDictionary:[self snapshot]];
+}
+
+#pragma mark - Archiving
+
+- (Class)classForCoder {
+    return [NSMutableDictionary class];
+}
+
+- (Class)classForKeyedArchiver {
+    return [NSMutableDictionary class];
+}
+
+- (void)encodeWithCoder:(NSCoder *)aCoder {
+    [[self snapshot] encodeWithCoder:aCoder];
+}
+
+@end
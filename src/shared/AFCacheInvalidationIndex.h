@@ -0,0 +1,70 @@
+//
+//  AFCacheInvalidationIndex.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFCacheInfoStore.h"
+
+@class AFCacheKey;
+
+#define kAFCacheDefaultSurrogateKeyHeaderName @"Surrogate-Key"
+
+// keys of the dictionary returned by -[AFCacheInvalidationIndex statistics]
+#define kAFCacheInvalidationIndexKeysKey @"keys"
+#define kAFCacheInvalidationIndexNodesKey @"nodes"
+#define kAFCacheInvalidationIndexTagsKey @"tags"
+
+/*
+ * Index of the keys of the cache's info store, by URL prefix and by tag, so that -[AFCache invalidateURLsWithPrefix:]
+ * and -[AFCache invalidateURLsWithSurrogateKey:] find the entries to remove without looking at any other entry.
+ *
+ * Prefixes are looked up in a trie over the "/"-separated components of the normalized URL strings of the keys.
+ * A string starts with a prefix if all of its components but the last are those of the prefix and the next one starts
+ * with the prefix's last component, so finding the keys with a prefix costs a lookup per component of the prefix,
+ * a scan of the children of the last node it reaches and a step per key and node beneath.
+ *
+ * Tags are the space- or comma-separated values of the response header named tagHeaderName (e.g. "Surrogate-Key: a b"
+ * or "Cache-Tag: a,b"), read from the entry's retained headers. The header must be retained, see
+ * +[AFCacheableItemInfo retainHeaderNamed:]. Every tag maps to the set of its keys.
+ *
+ * The index observes the store, it is not archived. Attaching it indexes the entries already stored.
+ * All methods may be called from any thread.
+ */
+@interface AFCacheInvalidationIndex : NSObject <AFCacheInfoStoreObserver>
+
+@property (nonatomic, readonly) NSString *tagHeaderName;
+
+- (instancetype)initWithTagHeaderName:(NSString*)tagHeaderName;
+
+/*
+ * becomes the observer of store and indexes its entries, forgetting those of any store observed before
+ */
+- (void)attachToInfoStore:(AFCacheInfoStore*)store;
+
+/*
+ * AFCacheKeys whose normalized URL string starts with the normalized prefix.
+ * "http://example.com/api/" matches everything under /api/, "http://example.com/api" /api.json and /apidocs as well.
+ */
+- (NSArray*)keysWithPrefix:(NSString*)prefix;
+
+/*
+ * AFCacheKeys of the entries tagged with tag, compared case-sensitively
+ */
+- (NSArray*)keysWithTag:(NSString*)tag;
+
+/*
+ * tags of an entry, nil if it has none
+ */
+- (NSArray*)tagsOfKey:(AFCacheKey*)key;
+
+/*
+ * the tags of a header value
+ */
++ (NSArray*)tagsInHeaderValue:(NSString*)value;
+
+- (NSDictionary*)statistics;
+
+@end
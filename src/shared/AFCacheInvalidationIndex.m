@@ -0,0 +1,295 @@
+//
+//  AFCacheInvalidationIndex.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheInvalidationIndex.h"
+#import "AFCacheKey.h"
+#import "AFCacheableItemInfo.h"
+
+/*
+ * Node of the trie, one per distinct sequence of leading components
+ */
+@interface AFCacheInvalidationIndexNode : NSObject
+@property (nonatomic, strong) NSMutableDictionary *children; // component -> node, nil while it has none
+@property (nonatomic, strong) AFCacheKey *key;               // set if a key ends here
+@end
+
+@implementation AFCacheInvalidationIndexNode
+@end
+
+@implementation AFCacheInvalidationIndex {
+    AFCacheInvalidationIndexNode *_root;
+    NSMutableDictionary *_keysByTag;  // tag -> NSMutableSet of AFCacheKeys
+    NSMutableDictionary *_tagsByKey;  // AFCacheKey -> NSArray of tags
+    NSUInteger _keyCount;
+    NSUInteger _nodeCount;
+    NSMutableSet *_touchedKeys;       // keys written while attaching, their stored entries are outdated
+    __weak AFCacheInfoStore *_store;
+}
+
+- (instancetype)init {
+    return [self initWithTagHeaderName:kAFCacheDefaultSurrogateKeyHeaderName];
+}
+
+- (instancetype)initWithTagHeaderName:(NSString*)tagHeaderName {
+    self = [super init];
+    if (self) {
+        _tagHeaderName = [tagHeaderName copy];
+        [self reset];
+    }
+    return self;
+}
+
+// must be called while synchronized
+- (void)reset {
+    _root = [[AFCacheInvalidationIndexNode alloc] init];
+    _keysByTag = [NSMutableDictionary dictionary];
+    _tagsByKey = [NSMutableDictionary dictionary];
+    _keyCount = 0;
+    _nodeCount = 1;
+}
+
++ (NSArray*)tagsInHeaderValue:(NSString*)value {
+    static NSCharacterSet *separators = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableCharacterSet *characterSet = [NSMutableCharacterSet whitespaceCharacterSet];
+        [characterSet addCharactersInString:@","];
+        separators = [characterSet copy];
+    });
+    if (![value isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+    NSMutableArray *tags = [NSMutableArray array];
+    for (NSString *tag in [value componentsSeparatedByCharactersInSet:separators]) {
+        if ([tag length] > 0 && ![tags containsObject:tag]) {
+            [tags addObject:tag];
+        }
+    }
+    return [tags count] > 0 ? tags : nil;
+}
+
+- (NSArray*)tagsOfInfo:(id)info {
+    if (!self.tagHeaderName || ![info isKindOfClass:[AFCacheableItemInfo class]]) {
+        return nil;
+    }
+    __block NSString *value = nil;
+    [[(AFCacheableItemInfo*)info headers] enumerateKeysAndObjectsUsingBlock:^(NSString *name, id headerValue, BOOL *stop) {
+        if ([name caseInsensitiveCompare:self.tagHeaderName] == NSOrderedSame) {
+            value = headerValue;
+            *stop = YES;
+        }
+    }];
+    return [[self class] tagsInHeaderValue:value];
+}
+
+#pragma mark - Attaching
+
+- (void)attachToInfoStore:(AFCacheInfoStore*)store {
+    AFCacheInfoStore *previousStore = nil;
+    @synchronized (self) {
+        [self reset];
+        _touchedKeys = [NSMutableSet set];
+        previousStore = _store;
+        _store = store;
+    }
+    if (previousStore != store) {
+        [previousStore removeObserver:self];
+    }
+    // writes from now on are observed, the snapshot is taken afterwards, so nothing is missed.
+    // The snapshot may be older than what has been observed, though, so keys written meanwhile are skipped.
+    [store addObserver:self];
+    NSDictionary *snapshot = [store copy];
+    @synchronized (self) {
+        [snapshot enumerateKeysAndObjectsUsingBlock:^(NSString *URLString, id info, BOOL *stop) {
+            AFCacheKey *key = [AFCacheKey keyWithURLString:URLString];
+            if (![_touchedKeys containsObject:key]) {
+                [self addKey:key info:info];
+            }
+        }];
+        _touchedKeys = nil;
+    }
+}
+
+#pragma mark - AFCacheInfoStoreObserver
+
+- (void)infoStore:(AFCacheInfoStore*)store didSetObject:(id)object forKey:(AFCacheKey*)key {
+    @synchronized (self) {
+        if (store != _store) {
+            return;
+        }
+        [_touchedKeys addObject:key];
+        [self addKey:key info:object];
+    }
+}
+
+- (void)infoStore:(AFCacheInfoStore*)store didRemoveObjectForKey:(AFCacheKey*)key {
+    @synchronized (self) {
+        if (store != _store) {
+            return;
+        }
+        [_touchedKeys addObject:key];
+        [self removeKey:key];
+    }
+}
+
+- (void)infoStoreDidRemoveAllObjects:(AFCacheInfoStore*)store {
+    @synchronized (self) {
+        if (store == _store) {
+            [self reset];
+        }
+    }
+}
+
+#pragma mark - Updating (synchronized)
+
+- (void)addKey:(AFCacheKey*)key info:(id)info {
+    AFCacheInvalidationIndexNode *node = _root;
+    for (NSString *component in [key.URLString componentsSeparatedByString:@"/"]) {
+        AFCacheInvalidationIndexNode *child = node.children[component];
+        if (!child) {
+            child = [[AFCacheInvalidationIndexNode alloc] init];
+            if (!node.children) {
+                node.children = [NSMutableDictionary dictionary];
+            }
+            node.children[component] = child;
+            _nodeCount++;
+        }
+        node = child;
+    }
+    if (!node.key) {
+        node.key = key;
+        _keyCount++;
+    }
+
+    // the entry may have been revalidated with other tags
+    NSArray *tags = [self tagsOfInfo:info];
+    NSArray *oldTags = _tagsByKey[key];
+    if ([tags isEqualToArray:oldTags] || (!tags && !oldTags)) {
+        return;
+    }
+    [self removeTagsOfKey:key];
+    for (NSString *tag in tags) {
+        NSMutableSet *keys = _keysByTag[tag];
+        if (!keys) {
+            keys = [NSMutableSet set];
+            _keysByTag[tag] = keys;
+        }
+        [keys addObject:key];
+    }
+    if (tags) {
+        _tagsByKey[key] = tags;
+    }
+}
+
+- (void)removeKey:(AFCacheKey*)key {
+    NSArray *components = [key.URLString componentsSeparatedByString:@"/"];
+    NSMutableArray *path = [NSMutableArray arrayWithCapacity:[components count] + 1];
+    AFCacheInvalidationIndexNode *node = _root;
+    [path addObject:node];
+    for (NSString *component in components) {
+        node = node.children[component];
+        if (!node) {
+            return;
+        }
+        [path addObject:node];
+    }
+    if (!node.key) {
+        return;
+    }
+    node.key = nil;
+    _keyCount--;
+    [self removeTagsOfKey:key];
+
+    // prune the nodes nothing ends at or beneath anymore
+    for (NSInteger i = (NSInteger)[components count] - 1; i >= 0; i--) {
+        AFCacheInvalidationIndexNode *child = path[i + 1];
+        if (child.key || [child.children count] > 0) {
+            break;
+        }
+        AFCacheInvalidationIndexNode *parent = path[i];
+        [parent.children removeObjectForKey:components[i]];
+        if ([parent.children count] == 0) {
+            parent.children = nil;
+        }
+        _nodeCount--;
+    }
+}
+
+- (void)removeTagsOfKey:(AFCacheKey*)key {
+    for (NSString *tag in _tagsByKey[key]) {
+        NSMutableSet *keys = _keysByTag[tag];
+        [keys removeObject:key];
+        if ([keys count] == 0) {
+            [_keysByTag removeObjectForKey:tag];
+        }
+    }
+    [_tagsByKey removeObjectForKey:key];
+}
+
+#pragma mark - Lookup
+
+- (NSArray*)keysWithPrefix:(NSString*)prefix {
+    if (!prefix) {
+        return @[];
+    }
+    NSArray *components = [[AFCacheKey normalizedURLString:prefix] componentsSeparatedByString:@"/"];
+    NSString *lastComponent = [components lastObject];
+    NSMutableArray *keys = [NSMutableArray array];
+    @synchronized (self) {
+        AFCacheInvalidationIndexNode *node = _root;
+        for (NSUInteger i = 0; i + 1 < [components count]; i++) {
+            node = node.children[components[i]];
+            if (!node) {
+                return keys;
+            }
+        }
+        NSMutableArray *stack = [NSMutableArray array];
+        [node.children enumerateKeysAndObjectsUsingBlock:^(NSString *component, AFCacheInvalidationIndexNode *child, BOOL *stop) {
+            if ([component hasPrefix:lastComponent]) {
+                [stack addObject:child];
+            }
+        }];
+        while ([stack count] > 0) {
+            AFCacheInvalidationIndexNode *next = [stack lastObject];
+            [stack removeLastObject];
+            if (next.key) {
+                [keys addObject:next.key];
+            }
+            [stack addObjectsFromArray:[next.children allValues]];
+        }
+    }
+    return keys;
+}
+
+- (NSArray*)keysWithTag:(NSString*)tag {
+    if (!tag) {
+        return @[];
+    }
+    @synchronized (self) {
+        return [_keysByTag[tag] allObjects] ?: @[];
+    }
+}
+
+- (NSArray*)tagsOfKey:(AFCacheKey*)key {
+    if (!key) {
+        return nil;
+    }
+    @synchronized (self) {
+        return _tagsByKey[key];
+    }
+}
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFCacheInvalidationIndexKeysKey : @(_keyCount),
+                 kAFCacheInvalidationIndexNodesKey : @(_nodeCount),
+                 kAFCacheInvalidationIndexTagsKey : @([_keysByTag count]),
+                 };
+    }
+}
+
+@end
@@ -0,0 +1,54 @@
+//
+//  AFCacheKey.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef struct {
+    uint64_t h1;
+    uint64_t h2;
+} AFCacheKeyHash128;
+
+/*
+ * Key of a cache entry: the normalized URL string and its 128 bit MurmurHash3 (x64 variant, seed 0, over the UTF-8 bytes).
+ *
+ * Normalizing lowercases scheme and host, removes the default port of http and https, makes an empty path "/"
+ * and drops the fragment, which is never sent to the server. Strings that are no hierarchical URLs are used as they are.
+ *
+ * The hash is computed once, when the key is created. -hash returns its first half, -isEqual: compares both halves
+ * and only compares the strings if they are equal, to rule out a collision. So a dictionary lookup costs the same
+ * however long the URL is, apart from that one comparison when the entry is found.
+ *
+ * Every AFCacheableItem carries the key of its URL. AFCacheInfoStore keys its entries by AFCacheKey and turns
+ * NSString keys into keys, so lookups by string keep working. Immutable, thread-safe.
+ */
+@interface AFCacheKey : NSObject <NSCopying>
+
+@property (nonatomic, readonly) NSString *URLString;
+@property (nonatomic, readonly) AFCacheKeyHash128 hash128;
+
++ (AFCacheKey*)keyWithURL:(NSURL*)URL;
++ (AFCacheKey*)keyWithURLString:(NSString*)URLString;
+
+/*
+ * object itself if it is an AFCacheKey, the key of an NSURL or NSString, nil otherwise
+ */
++ (AFCacheKey*)keyWithObject:(id)object;
+
++ (NSString*)normalizedURLString:(NSString*)URLString;
+
+/*
+ * MurmurHash3_x64_128 of length bytes
+ */
++ (AFCacheKeyHash128)hash128OfBytes:(const void*)bytes length:(NSUInteger)length;
+
+- (instancetype)initWithURLString:(NSString*)URLString;
+
+- (BOOL)isEqualToKey:(AFCacheKey*)key;
+
+- (NSURL*)URL;
+
+@end
@@ -0,0 +1,223 @@
+//
+//  AFCacheKey.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheKey.h"
+
+// URL strings up to this length are hashed without allocating a buffer
+#define kAFCacheKeyStackBufferSize 512
+
+#pragma mark - MurmurHash3
+
+static inline uint64_t AFCacheKeyRotl64(uint64_t x, int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t AFCacheKeyFmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t AFCacheKeyRead64(const uint8_t *bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value)); // unaligned; little endian on all supported platforms
+    return value;
+}
+
+// MurmurHash3_x64_128 by Austin Appleby, public domain
+static AFCacheKeyHash128 AFCacheKeyMurmurHash3(const uint8_t *data, size_t length, uint32_t seed) {
+    const size_t blockCount = length / 16;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    for (size_t i = 0; i < blockCount; i++) {
+        uint64_t k1 = AFCacheKeyRead64(data + i * 16);
+        uint64_t k2 = AFCacheKeyRead64(data + i * 16 + 8);
+
+        k1 *= c1; k1 = AFCacheKeyRotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = AFCacheKeyRotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = AFCacheKeyRotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = AFCacheKeyRotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + blockCount * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (length & 15) {
+        case 15: k2 ^= ((uint64_t)tail[14]) << 48;
+        case 14: k2 ^= ((uint64_t)tail[13]) << 40;
+        case 13: k2 ^= ((uint64_t)tail[12]) << 32;
+        case 12: k2 ^= ((uint64_t)tail[11]) << 24;
+        case 11: k2 ^= ((uint64_t)tail[10]) << 16;
+        case 10: k2 ^= ((uint64_t)tail[ 9]) << 8;
+        case  9: k2 ^= ((uint64_t)tail[ 8]) << 0;
+            k2 *= c2; k2 = AFCacheKeyRotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        case  8: k1 ^= ((uint64_t)tail[ 7]) << 56;
+        case  7: k1 ^= ((uint64_t)tail[ 6]) << 48;
+        case  6: k1 ^= ((uint64_t)tail[ 5]) << 40;
+        case  5: k1 ^= ((uint64_t)tail[ 4]) << 32;
+        case  4: k1 ^= ((uint64_t)tail[ 3]) << 24;
+        case  3: k1 ^= ((uint64_t)tail[ 2]) << 16;
+        case  2: k1 ^= ((uint64_t)tail[ 1]) << 8;
+        case  1: k1 ^= ((uint64_t)tail[ 0]) << 0;
+            k1 *= c1; k1 = AFCacheKeyRotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = AFCacheKeyFmix64(h1);
+    h2 = AFCacheKeyFmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    AFCacheKeyHash128 hash = {h1, h2};
+    return hash;
+}
+
+#pragma mark - Key
+
+@implementation AFCacheKey
+
++ (AFCacheKey*)keyWithURL:(NSURL*)URL {
+    NSString *URLString = [URL absoluteString];
+    return URLString ? [[self alloc] initWithURLString:URLString] : nil;
+}
+
++ (AFCacheKey*)keyWithURLString:(NSString*)URLString {
+    return URLString ? [[self alloc] initWithURLString:URLString] : nil;
+}
+
++ (AFCacheKey*)keyWithObject:(id)object {
+    if ([object isKindOfClass:[AFCacheKey class]]) {
+        return object;
+    }
+    if ([object isKindOfClass:[NSString class]]) {
+        return [self keyWithURLString:object];
+    }
+    if ([object isKindOfClass:[NSURL class]]) {
+        return [self keyWithURL:object];
+    }
+    return nil;
+}
+
++ (AFCacheKeyHash128)hash128OfBytes:(const void*)bytes length:(NSUInteger)length {
+    return AFCacheKeyMurmurHash3(bytes, length, 0);
+}
+
+/*
+ * Returns URLString itself if it is normalized already, which is the common case
+ */
++ (NSString*)normalizedURLString:(NSString*)URLString {
+    NSRange separator = [URLString rangeOfString:@"://"];
+    if (separator.location == NSNotFound || separator.location == 0) {
+        return URLString;
+    }
+    NSUInteger length = [URLString length];
+    NSUInteger authorityStart = NSMaxRange(separator);
+    NSRange authorityEnd = [URLString rangeOfCharacterFromSet:[NSCharacterSet characterSetWithCharactersInString:@"/?#"]
+                                                      options:0
+                                                        range:NSMakeRange(authorityStart, length - authorityStart)];
+    NSUInteger pathStart = authorityEnd.location == NSNotFound ? length : authorityEnd.location;
+
+    NSString *scheme = [URLString substringToIndex:separator.location];
+    NSString *authority = [URLString substringWithRange:NSMakeRange(authorityStart, pathStart - authorityStart)];
+    NSString *rest = [URLString substringFromIndex:pathStart];
+
+    // user info is case-sensitive, only the host is not
+    NSRange userInfoEnd = [authority rangeOfString:@"@" options:NSBackwardsSearch];
+    NSString *userInfo = userInfoEnd.location == NSNotFound ? @"" : [authority substringToIndex:NSMaxRange(userInfoEnd)];
+    NSString *hostAndPort = [authority substringFromIndex:[userInfo length]];
+
+    NSString *normalizedScheme = [scheme lowercaseString];
+    NSString *normalizedHostAndPort = [hostAndPort lowercaseString];
+    if (([normalizedScheme isEqualToString:@"http"] && [normalizedHostAndPort hasSuffix:@":80"]) ||
+        ([normalizedScheme isEqualToString:@"https"] && [normalizedHostAndPort hasSuffix:@":443"])) {
+        normalizedHostAndPort = [normalizedHostAndPort substringToIndex:[normalizedHostAndPort rangeOfString:@":" options:NSBackwardsSearch].location];
+    }
+    NSString *normalizedRest = rest;
+    NSRange fragment = [normalizedRest rangeOfString:@"#"];
+    if (fragment.location != NSNotFound) {
+        normalizedRest = [normalizedRest substringToIndex:fragment.location];
+    }
+    if (![normalizedRest hasPrefix:@"/"]) {
+        normalizedRest = [@"/" stringByAppendingString:normalizedRest];
+    }
+
+    if ([normalizedScheme isEqualToString:scheme] && [normalizedHostAndPort isEqualToString:hostAndPort] &&
+        [normalizedRest isEqualToString:rest]) {
+        return URLString;
+    }
+    return [NSString stringWithFormat:@"%@://%@%@%@", normalizedScheme, userInfo, normalizedHostAndPort, normalizedRest];
+}
+
+- (instancetype)initWithURLString:(NSString*)URLString {
+    self = [super init];
+    if (self) {
+        _URLString = [[AFCacheKey normalizedURLString:URLString] copy];
+
+        NSUInteger maxLength = [_URLString maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        uint8_t stackBuffer[kAFCacheKeyStackBufferSize];
+        uint8_t *buffer = maxLength <= kAFCacheKeyStackBufferSize ? stackBuffer : malloc(maxLength);
+        NSUInteger usedLength = 0;
+        [_URLString getBytes:buffer
+                   maxLength:maxLength
+                  usedLength:&usedLength
+                    encoding:NSUTF8StringEncoding
+                     options:0
+                       range:NSMakeRange(0, [_URLString length])
+              remainingRange:NULL];
+        _hash128 = AFCacheKeyMurmurHash3(buffer, usedLength, 0);
+        if (buffer != stackBuffer) {
+            free(buffer);
+        }
+    }
+    return self;
+}
+
+- (NSUInteger)hash {
+    return (NSUInteger)_hash128.h1;
+}
+
+- (BOOL)isEqual:(id)object {
+    if (object == self) {
+        return YES;
+    }
+    return [object isKindOfClass:[AFCacheKey class]] && [self isEqualToKey:object];
+}
+
+- (BOOL)isEqualToKey:(AFCacheKey*)key {
+    if (key == self) {
+        return YES;
+    }
+    if (!key || key->_hash128.h1 != _hash128.h1 || key->_hash128.h2 != _hash128.h2) {
+        return NO;
+    }
+    // collision check
+    return [key->_URLString isEqualToString:_URLString];
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    return self;
+}
+
+- (NSURL*)URL {
+    return [NSURL URLWithString:self.URLString];
+}
+
+- (NSString*)description {
+    return self.URLString;
+}
+
+@end
@@ -0,0 +1,35 @@
+//
+//  AFCacheLookup+Private.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheLookup.h"
+#import "AFCacheableItem.h"
+
+@class AFCache;
+
+@interface AFCacheLookup ()
+
+@property (nonatomic, weak) AFCache *cache;
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t deliveryQueue;
+#else
+@property (nonatomic, assign) dispatch_queue_t deliveryQueue;
+#endif
+
+// the blocks the lookup added to its item, removed again when it is cancelled
+@property (nonatomic, copy) AFCacheableItemBlock completionBlock;
+@property (nonatomic, copy) AFCacheableItemBlock failBlock;
+@property (nonatomic, copy) AFCacheableItemBlock progressBlock;
+
+- (instancetype)initWithURL:(NSURL*)url cache:(AFCache*)cache;
+
+// called on the cache's I/O queue when the item has been looked up
+- (void)didLookUpItem:(AFCacheableItem*)item;
+
+// calls the block on the delivery queue, unless the lookup has been cancelled
+- (void)deliverBlock:(AFCacheableItemBlock)block item:(AFCacheableItem*)item;
+
+@end
@@ -0,0 +1,32 @@
+//
+//  AFCacheLookup.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheableItem;
+
+/*
+ * Handle for an asynchronous lookup, see -[AFCache cacheItemForURL:urlCredential:requestConfiguration:deliveryQueue:completionBlock:failBlock:progressBlock:]
+ */
+@interface AFCacheLookup : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *url;
+
+/*
+ * the item of the lookup, nil until the lookup has been performed on the cache's I/O queue
+ */
+@property (strong, readonly) AFCacheableItem *item;
+
+@property (readonly, getter=isCancelled) BOOL cancelled;
+
+/*
+ * No block of the lookup is called after cancel returns, unless it is already running on the delivery queue.
+ * A download that has been started for this lookup only is cancelled, too.
+ */
+- (void)cancel;
+
+@end
@@ -0,0 +1,97 @@
+//
+//  AFCacheLookup.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheLookup.h"
+#import "AFCacheLookup+Private.h"
+#import "AFCacheableItem.h"
+#import "AFCache+PrivateAPI.h"
+
+@interface AFCacheLookup ()
+@property (nonatomic, strong) NSURL *url;
+@property (strong) AFCacheableItem *item;
+@property (assign) BOOL cancelled;
+@end
+
+@implementation AFCacheLookup
+
+- (instancetype)initWithURL:(NSURL*)url cache:(AFCache*)cache {
+    self = [super init];
+    if (self) {
+        _url = url;
+        _cache = cache;
+    }
+    return self;
+}
+
+- (void)dealloc {
+#if !OS_OBJECT_USE_OBJC
+    if (_deliveryQueue) {
+        dispatch_release(_deliveryQueue);
+    }
+#endif
+}
+
+- (void)setDeliveryQueue:(dispatch_queue_t)deliveryQueue {
+#if !OS_OBJECT_USE_OBJC
+    if (deliveryQueue) {
+        dispatch_retain(deliveryQueue);
+    }
+    if (_deliveryQueue) {
+        dispatch_release(_deliveryQueue);
+    }
+#endif
+    _deliveryQueue = deliveryQueue;
+}
+
+- (void)cancel {
+    AFCacheableItem *item = nil;
+    @synchronized (self) {
+        if (self.cancelled) {
+            return;
+        }
+        self.cancelled = YES;
+        item = self.item;
+    }
+    if (item) {
+        [self detachFromItem:item];
+    }
+}
+
+- (void)didLookUpItem:(AFCacheableItem*)item {
+    BOOL cancelled;
+    @synchronized (self) {
+        self.item = item;
+        cancelled = self.cancelled;
+    }
+    // cancel has been called while the lookup was running
+    if (cancelled && item) {
+        [self detachFromItem:item];
+    }
+}
+
+// the download goes on if other clients have joined it
+- (void)detachFromItem:(AFCacheableItem*)item {
+    [item removeCompletionBlock:self.completionBlock failBlock:self.failBlock progressBlock:self.progressBlock];
+    [self.cache cancelDownloadForItem:item];
+}
+
+- (void)deliverBlock:(AFCacheableItemBlock)block item:(AFCacheableItem*)item {
+    if (!block || self.cancelled) {
+        return;
+    }
+    dispatch_async(self.deliveryQueue, ^{
+        if (!self.cancelled) {
+            block(item);
+        }
+    });
+}
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"<%@: %p url: %@ cancelled: %d>", [self class], self, self.url, self.cancelled];
+}
+
+@end
@@ -24,9 +24,31 @@
 #define kPackagerOptionUserDataFolder @"userdata"
 #define kPackagerOptionUserDataKey @"userdatakey"
 #define kPackagerOptionFileToURLMap @"FileToURLMap"
+#define kPackagerOptionVersion @"version"
+// options for creating a delta package: only files of folder that are new or differ from basefolder are packed
+#define kPackagerOptionBaseFolder @"basefolder"
+#define kPackagerOptionBasePackageURL @"basepackageurl"
+#define kPackagerOptionBaseVersion @"baseversion"
+// package built before from the same folder. Entries of files with the same size and modification date are copied from it.
+#define kPackagerOptionPreviousPackage @"previouspackage"
+
+// keys of statistics
+#define kPackagerStatisticsFileCountKey @"files"
+#define kPackagerStatisticsReusedFileCountKey @"reusedFiles"
+#define kPackagerStatisticsBytesReadKey @"bytesRead"
+#define kPackagerStatisticsBytesWrittenKey @"bytesWritten"
+#define kPackagerStatisticsDurationKey @"duration"
+#define kPackagerStatisticsBytesPerSecondKey @"bytesPerSecond"
+#define kPackagerStatisticsFilesPerSecondKey @"filesPerSecond"
 
 @interface AFCachePackageCreator : NSObject
 
+/*
+ * Throughput of the last package created, see kPackagerStatistics...Key
+ */
+@property (nonatomic, readonly) NSDictionary *statistics;
+
+- (NSURL*)URLForFileAtPath:(NSString*)filepath baseURL:(NSString*)baseURL;
 - (AFCacheableItem*)newCacheableItemForFileAtPath:(NSString*)filepath lastModified:(NSDate*)lastModified baseURL:(NSString*)baseURL maxAge:(NSNumber*)maxAge baseFolder:(NSString*)folder;
 - (BOOL)createPackageWithOptions:(NSDictionary*)options error:(NSError**)inError;
 
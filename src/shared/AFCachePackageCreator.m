@@ -7,31 +7,61 @@
 //
 
 #import "AFCachePackageCreator.h"
-#import "ZipArchive.h"
+#import "AFPackageArchive.h"
+#import "AFPackageArchiveWriter.h"
+#import "AFCache_Logging.h"
 
 #define kDefaultMaxItemFileSize kAFCacheInfiniteFileSize
 
+// files compressed at the same time, bounds the memory held by compressed data that waits to be written
+#define kAFCachePackageCreatorBatchSize 256
+
+/*
+ * A file of the package, from when it is found until it is written to the archive
+ */
+@interface AFCachePackageEntry : NSObject
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, copy) NSString *name;             // in the archive
+@property (nonatomic, copy) NSString *previousName;     // entry of the previous package to copy instead of compressing
+@property (nonatomic, strong) NSDate *modificationDate;
+@property (nonatomic, assign) uint64_t size;
+@property (nonatomic, strong) AFCacheableItem *item;    // nil for user data
+@property (nonatomic, strong) NSData *compressedData;
+@property (nonatomic, assign) uint16_t method;
+@property (nonatomic, assign) uint32_t crc;
+@end
+
+@implementation AFCachePackageEntry
+@end
+
 @implementation AFCachePackageCreator
 
 /* ================================================================================================
  * Create a new AFCacheableItem with file at path and a given last modification data
  * ================================================================================================ */
 
-- (AFCacheableItem*)newCacheableItemForFileAtPath:(NSString*)filepath lastModified:(NSDate*)lastModified baseURL:(NSString*)baseURL maxAge:(NSNumber*)maxAge baseFolder:(NSString*)folder {	
-	NSURL *url;	
+- (NSURL*)URLForFileAtPath:(NSString*)filepath baseURL:(NSString*)baseURL {
 	NSString* escapedUrlString = [AFCacheableItem urlEncodeValue:filepath];
 	if (baseURL) {
-		url = [NSURL URLWithString:[NSString stringWithFormat:@"%@/%@", baseURL, escapedUrlString]];
+		return [NSURL URLWithString:[NSString stringWithFormat:@"%@/%@", baseURL, escapedUrlString]];
 	} else {
-		url = [NSURL URLWithString:[NSString stringWithFormat:@"afcpkg://localhost/%@", escapedUrlString]];
+		return [NSURL URLWithString:[NSString stringWithFormat:@"afcpkg://localhost/%@", escapedUrlString]];
 	}
+}
+
+- (AFCacheableItem*)newItemForFileAtPath:(NSString*)filepath lastModified:(NSDate*)lastModified baseURL:(NSString*)baseURL maxAge:(NSNumber*)maxAge {
+	NSURL *url = [self URLForFileAtPath:filepath baseURL:baseURL];
 	NSDate *expireDate = nil;
 	if (maxAge) {
 		NSTimeInterval seconds = [maxAge doubleValue];
 		expireDate = [lastModified dateByAddingTimeInterval:seconds];
 	}
+	return [[AFCacheableItem alloc] initWithURL:url lastModified:lastModified expireDate:expireDate];
+}
+
+- (AFCacheableItem*)newCacheableItemForFileAtPath:(NSString*)filepath lastModified:(NSDate*)lastModified baseURL:(NSString*)baseURL maxAge:(NSNumber*)maxAge baseFolder:(NSString*)folder {	
 	NSString *completePathToFile = [NSString stringWithFormat:@"%@/%@", folder, filepath];
-	AFCacheableItem *item = [[AFCacheableItem alloc] initWithURL:url lastModified:lastModified expireDate:expireDate];
+	AFCacheableItem *item = [self newItemForFileAtPath:filepath lastModified:lastModified baseURL:baseURL maxAge:maxAge];
 	NSData *data = [NSData dataWithContentsOfMappedFile:completePathToFile];
 	[item setDataAndFile:data];
 	return item;
@@ -63,17 +93,130 @@
     }
 }
 
+/* ================================================================================================
+ * YES if the file exists in both folders with the same contents
+ * ================================================================================================ */
+
+- (BOOL)fileAtPath:(NSString*)file inFolder:(NSString*)folder equalsFileInFolder:(NSString*)otherFolder {
+	NSFileManager *fileManager = [[NSFileManager alloc] init];
+	NSString *path = [folder stringByAppendingPathComponent:file];
+	NSString *otherPath = [otherFolder stringByAppendingPathComponent:file];
+	NSDictionary *attributes = [fileManager attributesOfItemAtPath:path error:nil];
+	NSDictionary *otherAttributes = [fileManager attributesOfItemAtPath:otherPath error:nil];
+	if (!attributes || !otherAttributes || [attributes fileSize] != [otherAttributes fileSize]) {
+		return NO;
+	}
+	return [fileManager contentsEqualAtPath:path andPath:otherPath];
+}
+
+/* ================================================================================================
+ * Files of the package that have not been read yet, see createPackageWithOptions:error:
+ * ================================================================================================ */
+
+- (AFCachePackageEntry*)newEntryForFileAtPath:(NSString*)path name:(NSString*)name attributes:(NSDictionary*)attributes {
+	AFCachePackageEntry *entry = [[AFCachePackageEntry alloc] init];
+	entry.path = path;
+	entry.name = name;
+	entry.modificationDate = [attributes fileModificationDate];
+	entry.size = [attributes fileSize];
+	return entry;
+}
+
+/*
+ * The entry of the previous package can be copied if it has the same size and modification date as the file.
+ * The manifest only has the modification date to the second.
+ */
+- (BOOL)canReuseEntryNamed:(NSString*)name info:(AFCacheableItemInfo*)previousInfo ofArchive:(AFPackageArchive*)previousArchive forItem:(AFCacheableItem*)item size:(uint64_t)size {
+	if (!previousInfo || ![previousArchive hasEntryNamed:name]) {
+		return NO;
+	}
+	return [previousArchive uncompressedSizeOfEntryNamed:name] == size &&
+	       floor([previousInfo.lastModified timeIntervalSince1970]) == floor([item.info.lastModified timeIntervalSince1970]);
+}
+
+/*
+ * Runs on any thread. Keeps the compressed data in the entry until it is written.
+ */
+- (BOOL)compressEntry:(AFCachePackageEntry*)entry {
+	NSError *error = nil;
+	NSData *data = [NSData dataWithContentsOfFile:entry.path options:NSDataReadingMappedIfSafe error:&error];
+	if (!data) {
+		NSLog(@"Could not read %@ (Error: %@)", entry.path, [error localizedDescription]);
+		return NO;
+	}
+	uint32_t crc = 0;
+	NSData *deflated = [AFPackageArchiveWriter deflatedData:data crc:&crc];
+	entry.compressedData = deflated ?: data;
+	entry.method = deflated ? kAFPackageArchiveMethodDeflated : kAFPackageArchiveMethodStored;
+	entry.crc = crc;
+	entry.size = [data length];
+	return YES;
+}
+
+/*
+ * Compresses the entries on all cores, a batch at a time so only one batch is held in memory, and writes them in order.
+ */
+- (BOOL)writeEntries:(NSArray*)entries toArchive:(AFPackageArchiveWriter*)writer previousArchive:(AFPackageArchive*)previousArchive bytesRead:(uint64_t*)bytesRead {
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	for (NSUInteger start = 0; start < [entries count]; start += kAFCachePackageCreatorBatchSize) {
+		@autoreleasepool {
+			NSArray *batch = [entries subarrayWithRange:NSMakeRange(start, MIN(kAFCachePackageCreatorBatchSize, [entries count] - start))];
+			dispatch_apply([batch count], queue, ^(size_t i) {
+				@autoreleasepool {
+					AFCachePackageEntry *entry = batch[i];
+					if (!entry.previousName) {
+						[self compressEntry:entry];
+					}
+				}
+			});
+
+			for (AFCachePackageEntry *entry in batch) {
+				if (entry.previousName) {
+					uint16_t method = 0;
+					uint32_t crc = 0;
+					entry.compressedData = [previousArchive compressedDataForEntryNamed:entry.previousName method:&method crc:&crc];
+					entry.method = method;
+					entry.crc = crc;
+					if (!entry.compressedData) {
+						entry.previousName = nil;
+						[self compressEntry:entry];
+					}
+				}
+				if (!entry.compressedData) {
+					return NO;
+				}
+				if (entry.item) {
+					AFLog(@"%@ %@", entry.previousName ? @"Reusing" : @"Adding", entry.name);
+				} else {
+					printf("Adding userdata: %s\n", [entry.name cStringUsingEncoding:NSUTF8StringEncoding]);
+				}
+				if (![writer addEntryNamed:entry.name
+				            compressedData:entry.compressedData
+				                    method:entry.method
+				                       crc:entry.crc
+				          uncompressedSize:entry.size
+				          modificationDate:entry.modificationDate]) {
+					return NO;
+				}
+				entry.compressedData = nil;
+				*bytesRead += entry.size;
+			}
+		}
+	}
+	return YES;
+}
+
 /* ================================================================================================
  * Create AFCache Package with given commandline args
  * ================================================================================================ */
 
 - (BOOL)createPackageWithOptions:(NSDictionary*)options error:(NSError**)inError {
-    NSError *error = *inError;    
+    NSError *error = nil;
     NSString *folder;
 	NSString *baseURL;
 	NSNumber *maxAge;
-	NSTimeInterval lastModifiedOffset;
-    BOOL success = YES;
+	NSTimeInterval lastModifiedOffset = 0;
+    NSDate *startDate = [NSDate date];
     
 	// folder containing resources
 	folder = [options valueForKey:kPackagerOptionResourcesFolder];
@@ -86,15 +229,11 @@
 	// max-age in seconds
 	maxAge = [NSNumber numberWithDouble:[[options valueForKey:kPackagerOptionMaxAge] doubleValue]];
 	
-	// Maximum filesize of a cacheable item. Default is unlimited.
+	// Maximum filesize of a cacheable item. Default is unlimited. Larger files are left out.
 	double maxItemFileSize = [[options valueForKey:kPackagerOptionMaxItemFileSize] doubleValue];
 	if (maxItemFileSize == 0) {
 		maxItemFileSize = kDefaultMaxItemFileSize;
 	}
-#if MAINTAINER_WARNINGS
-#warning not good to change the max item file size in the cache singleton then calling this method!
-#endif
-	[AFCache sharedInstance].maxItemFileSize = maxItemFileSize;
 	
 	// add n seconds to file's lastmodfied date
 	if ([[options valueForKey:kPackagerOptionLastModifiedMinus] doubleValue] > 0) {
@@ -114,6 +253,9 @@
     
 	// output filename
 	NSString *outfile = [options valueForKey:kPackagerOptionOutputFilename];
+	if ([outfile length] == 0) {
+		outfile = @"afcache-archive.zip";
+	}
 	
 	// Folder containing arbitrary user data (will be accesible via userDataPathForPackageArchiveKey: in AFCache+Packaging.m
 	NSString *userDataFolder = [options valueForKey:kPackagerOptionUserDataFolder];
@@ -122,19 +264,44 @@
 	NSString *userDataKey = [options valueForKey:kPackagerOptionUserDataKey];
 	
     NSDictionary *fileToURLMap = [options valueForKey:kPackagerOptionFileToURLMap];
-    
-	// Create ZIP archive
-	__block ZipArchive *zip = [[ZipArchive alloc] init];
+
+	// Version of the package, referenced by delta packages. Default is a unique string.
+	NSString *version = [options valueForKey:kPackagerOptionVersion];
+	if ([version length] == 0) {
+		version = [[NSProcessInfo processInfo] globallyUniqueString];
+	}
+
+	// Folder containing the resources of the base package. If given, a delta package against it is created.
+	NSString *baseFolder = [options valueForKey:kPackagerOptionBaseFolder];
+	NSString *basePackageURL = [options valueForKey:kPackagerOptionBasePackageURL];
+	NSString *baseVersion = [options valueForKey:kPackagerOptionBaseVersion];
+	if ([baseFolder length] > 0 && [basePackageURL length] == 0) {
+		NSLog(@"A delta package needs the URL of its base package (%@).\n", kPackagerOptionBasePackageURL);
+		return NO;
+	}
+	__block NSMutableArray *removedURLs = [[NSMutableArray alloc] init];
+
+	// Package built before from the same folder. Entries of unchanged files are copied from it instead of compressing them again.
+	NSString *previousPackage = [options valueForKey:kPackagerOptionPreviousPackage];
+	AFPackageArchive *previousArchive = nil;
+	NSDictionary *previousInfos = nil;
+	if ([previousPackage length] > 0) {
+		previousArchive = [[AFPackageArchive alloc] initWithContentsOfFile:previousPackage];
+		NSData *previousManifest = [previousArchive dataForEntryNamed:@"manifest.afcache"];
+		if (previousManifest) {
+			NSString *manifest = [[NSString alloc] initWithData:previousManifest encoding:NSASCIIStringEncoding];
+			previousInfos = [[[AFCache sharedInstance] manifestWithString:manifest filesAtPath:nil archive:previousArchive] objectForKey:kAFPackageManifestCacheInfosKey];
+		}
+		if (!previousInfos) {
+			printf("Cannot reuse %s, packing all files.\n", [previousPackage cStringUsingEncoding:NSUTF8StringEncoding]);
+		}
+	}
     
 	NSMutableString *result = [[NSMutableString alloc] init];
+	__block NSMutableArray *entries = [[NSMutableArray alloc] init];
+	__block NSUInteger reusedCount = 0;
 	@try {
 			if (!folder) folder = @".";
-			// Create ZIP file or exit on error
-			BOOL ret = [zip CreateZipFile2:(outfile)?outfile:@"afcache-archive.zip"];
-			if (!ret) {
-				NSLog(@"Failed creating zip file.\n");
-                return NO;
-			}
             
 			// Exit if given folder containing data doesn't exist
 			NSFileManager *localFileManager=[[NSFileManager alloc] init];
@@ -151,6 +318,7 @@
 			BOOL processHiddenFiles = ([addAllFiles length] > 0)?YES:NO;
 			__block NSMutableArray *metaDescriptions = [[NSMutableArray alloc] init];
 			
+			// Collect the files first, the items only describe them. Nothing is read or stored in the cache here.
 			[self enumerateFilesInFolder:folder processHiddenFiles:processHiddenFiles usingBlock: ^ (NSString *file, NSDictionary *fileAttributes) {
 				NSDate *lastModificationDate = [fileAttributes objectForKey:NSFileModificationDate];
 				NSString *fileType = [fileAttributes objectForKey:NSFileType];
@@ -158,17 +326,41 @@
 				
 				if ([fileType isEqualToString:NSFileTypeRegular]) {
 					if (!hidden || addAllFiles) {
+						if ([baseFolder length] > 0 && [self fileAtPath:file inFolder:folder equalsFileInFolder:baseFolder]) {
+							// unchanged since the base package
+							return;
+						}
+						if ([fileAttributes fileSize] > maxItemFileSize) {
+							printf("Skipping %s, it is larger than %.0f bytes\n", [file cStringUsingEncoding:NSUTF8StringEncoding], maxItemFileSize);
+							return;
+						}
 						if (lastModifiedOffset != 0) {
 							lastModificationDate = [lastModificationDate dateByAddingTimeInterval:lastModifiedOffset];
 						}						
-						AFCacheableItem *item = [self newCacheableItemForFileAtPath:file lastModified:lastModificationDate baseURL:baseURL maxAge:maxAge baseFolder:folder];
+						AFCacheableItem *item = [self newItemForFileAtPath:file lastModified:lastModificationDate baseURL:baseURL maxAge:maxAge];
+						if (!item.info.filename) {
+							item.info.filename = [[AFCache sharedInstance] filenameForURL:item.url];
+						}
                         NSString *mappedURL = [fileToURLMap valueForKey:item.info.filename];
                         if (mappedURL) {
                             item.url = [NSURL URLWithString:mappedURL];
                         }
-						NSString *completePathToFile = [NSString stringWithFormat:@"%@/%@", folder, file];
-						NSLog(@"Adding %s\n", [item.info.filename cStringUsingEncoding:NSUTF8StringEncoding]); //, [file cStringUsingEncoding:NSUTF8StringEncoding]);
-						[zip addFileToZip:completePathToFile newname:item.info.filename];
+						item.info.contentLength = [fileAttributes fileSize];
+
+						AFCachePackageEntry *entry = [self newEntryForFileAtPath:[NSString stringWithFormat:@"%@/%@", folder, file]
+						                                                    name:item.info.filename
+						                                              attributes:fileAttributes];
+						entry.item = item;
+						AFCacheableItemInfo *previousInfo = [previousInfos objectForKey:[item.url absoluteString]];
+						if ([self canReuseEntryNamed:previousInfo.filename info:previousInfo ofArchive:previousArchive forItem:item size:entry.size]) {
+							// keep the name, so the entry can be copied as it is
+							item.info.filename = previousInfo.filename;
+							entry.name = previousInfo.filename;
+							entry.previousName = previousInfo.filename;
+							reusedCount++;
+						}
+						[entries addObject:entry];
+
 						NSString *metaDescription = (json)?[item metaJSON]:[item metaDescription];						
 						if (metaDescription) {
 							[metaDescriptions addObject:metaDescription];
@@ -184,17 +376,36 @@
 					NSString *completePathToFile = [NSString stringWithFormat:@"%@/%@", userDataFolder, file];
 					NSString *userDataPath = ([userDataKey length] > 0)?[NSString stringWithFormat:@"%@/%@", kAFCacheUserDataFolder, userDataKey]:kAFCacheUserDataFolder;
 					NSString *filePathInZip = [NSString stringWithFormat:@"%@/%@", userDataPath, file];					
-					printf("Adding userdata: %s\n", [filePathInZip cStringUsingEncoding:NSUTF8StringEncoding]);
-					[zip addFileToZip:completePathToFile newname:filePathInZip];				
+					[entries addObject:[self newEntryForFileAtPath:completePathToFile name:filePathInZip attributes:fileAttributes]];
 				}];
 			}				
             
-			if ([metaDescriptions count] == 0 && [userDataFolder length] == 0) {
+			if ([baseFolder length] > 0) {
+				[self enumerateFilesInFolder:baseFolder processHiddenFiles:processHiddenFiles usingBlock: ^ (NSString *file, NSDictionary *fileAttributes) {
+					if (![localFileManager fileExistsAtPath:[folder stringByAppendingPathComponent:file]]) {
+						NSString *removedURL = [[self URLForFileAtPath:file baseURL:baseURL] absoluteString];
+						printf("Removing %s\n", [removedURL cStringUsingEncoding:NSUTF8StringEncoding]);
+						[removedURLs addObject:removedURL];
+					}
+				}];
+			}
+            
+			if ([metaDescriptions count] == 0 && [userDataFolder length] == 0 && [removedURLs count] == 0) {
 				printf("No input files. Aborting.\n");
                 return NO;
 			}
 			
 			[result appendFormat:@"baseURL = %@\n", baseURL];
+			[result appendFormat:@"%@ = %@\n", kAFPackageManifestVersionKey, version];
+			if ([baseFolder length] > 0) {
+				[result appendFormat:@"%@ = %@\n", kAFPackageManifestBasePackageURLKey, basePackageURL];
+				if ([baseVersion length] > 0) {
+					[result appendFormat:@"%@ = %@\n", kAFPackageManifestBaseVersionKey, baseVersion];
+				}
+				for (NSString *removedURL in removedURLs) {
+					[result appendFormat:@"%@ = %@\n", kAFPackageManifestRemovedKey, removedURL];
+				}
+			}
 			
 			// write meta descriptions into result string
 			NSUInteger i = [metaDescriptions count];
@@ -212,39 +423,62 @@
 			if (json) {
 				[result appendString: @"]\n}"];
 			}
-			i++;
 			
 	}
 	@catch (NSException * e) {
         NSDictionary *userInfo = [NSDictionary dictionaryWithObject:[e description] forKey:NSLocalizedDescriptionKey];
         error = [NSError errorWithDomain:@"AFCache" code:99 userInfo:userInfo];
+        if (inError) {
+            *inError = error;
+        }
         return NO;
 	}
-	
-	// create manifest tmp file
-	const char *template = (char*)[[NSTemporaryDirectory() stringByAppendingPathComponent:@"AFCache.XXXXXX"] UTF8String];
-    char *buffer = strdup(template);
-    mktemp(buffer);
-    NSString *manifestPath = [NSString stringWithFormat:@"%s", buffer];
-    free(buffer);
-
-	BOOL ok = [result writeToFile:manifestPath atomically:YES
-						 encoding:NSASCIIStringEncoding error:&error];
-	if (!ok) {
-        NSDictionary *userInfo = [NSDictionary dictionaryWithObject: [NSString stringWithFormat: @"Error writing file at %s\n%@", 
-                                                                      [manifestPath cStringUsingEncoding:NSUTF8StringEncoding], 
-                                                                      [error localizedFailureReason]]
+
+	NSData *manifestData = [result dataUsingEncoding:NSASCIIStringEncoding];
+	if (!manifestData) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"The manifest contains characters that are not ASCII" forKey:NSLocalizedDescriptionKey];
+        error = [NSError errorWithDomain:@"AFCache" code:0 userInfo:userInfo];
+        if (inError) {
+            *inError = error;
+        }
+        return NO;
+	}
+
+	// Write next to the output file and replace it when done, the previous package may be the output file
+	NSString *partialPath = [outfile stringByAppendingString:@".partial"];
+	AFPackageArchiveWriter *writer = [[AFPackageArchiveWriter alloc] initWithPath:partialPath];
+	if (!writer) {
+		NSLog(@"Failed creating zip file.\n");
+		return NO;
+	}
+	uint64_t bytesRead = 0;
+	BOOL success = [self writeEntries:entries toArchive:writer previousArchive:previousArchive bytesRead:&bytesRead];
+	success = success && [writer addEntryNamed:@"manifest.afcache" data:manifestData modificationDate:startDate];
+	success = [writer close] && success;
+	if (success) {
+		[[NSFileManager defaultManager] removeItemAtPath:outfile error:nil];
+		success = [[NSFileManager defaultManager] moveItemAtPath:partialPath toPath:outfile error:&error];
+	}
+	if (!success) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"Error writing file at %@\n%@", outfile, [error localizedDescription] ?: @""]
                                                              forKey:NSLocalizedDescriptionKey];
         error = [NSError errorWithDomain:@"AFCache" code:0 userInfo:userInfo];
+        if (inError) {
+            *inError = error;
+        }
+		[[NSFileManager defaultManager] removeItemAtPath:partialPath error:nil];
         return NO;
 	}
-	
-	[zip addFileToZip:manifestPath newname:@"manifest.afcache"];
-    
-	// cleanup
-	[[NSFileManager defaultManager] removeItemAtPath:manifestPath error:&error];
-bailout:
-    return success;
+
+	NSTimeInterval duration = MAX(-[startDate timeIntervalSinceNow], 0.001);
+	_statistics = @{kPackagerStatisticsFileCountKey: @([entries count]),
+	                kPackagerStatisticsReusedFileCountKey: @(reusedCount),
+	                kPackagerStatisticsBytesReadKey: @(bytesRead),
+	                kPackagerStatisticsBytesWrittenKey: @(writer.bytesWritten),
+	                kPackagerStatisticsDurationKey: @(duration),
+	                kPackagerStatisticsBytesPerSecondKey: @(bytesRead / duration),
+	                kPackagerStatisticsFilesPerSecondKey: @([entries count] / duration)};
+    return YES;
 }
 
 @end
@@ -0,0 +1,126 @@
+//
+//  AFCacheSharedStore.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFCacheInfoStore.h"
+
+@class AFCacheKey;
+
+#define kAFCacheSharedStoreIndexFilename @"afcache_shared.index"
+#define kAFCacheSharedStoreJournalFilename @"afcache_shared.journal"
+#define kAFCacheSharedStoreLockFilename @"afcache_shared.lock"
+
+// download claims in the index. A slot is freed when its claim is released, so this bounds the number of URLs
+// downloaded at the same time whose downloads are coordinated.
+#define kAFCacheSharedStoreSlotCount 65536
+#define kAFCacheSharedStoreMaxProbes 64
+
+#define kAFCacheSharedStoreDefaultFlushInterval 0.1
+#define kAFCacheSharedStoreDefaultCheckpointJournalLength (4 * 1024 * 1024)
+// a claim older than this is taken over even if its process is still running
+#define kAFCacheSharedStoreDefaultClaimTimeout (5 * 60.0)
+
+// keys of the dictionary returned by -[AFCacheSharedStore statistics]
+#define kAFCacheSharedStoreJournaledRecordsKey @"journaledRecords"
+#define kAFCacheSharedStoreReplayedRecordsKey @"replayedRecords"
+#define kAFCacheSharedStoreCheckpointsKey @"checkpoints"
+#define kAFCacheSharedStoreReloadsKey @"reloads"            // checkpoints of other processes loaded
+#define kAFCacheSharedStoreClaimedDownloadsKey @"claimedDownloads"
+#define kAFCacheSharedStoreContendedDownloadsKey @"contendedDownloads" // claims held by another process
+#define kAFCacheSharedStoreTakenOverClaimsKey @"takenOverClaims"       // of dead processes or timed out
+#define kAFCacheSharedStoreJournalLengthKey @"journalLength"
+
+/*
+ * Lets several processes use the same cache directory, see -[AFCache shareStoreAcrossProcesses].
+ *
+ * Every process keeps its info stores in memory. Their modifications are not archived wholesale but appended
+ * to a journal in the cache directory, which the other processes replay, so no process overwrites the entries of another:
+ * - the stores are observed, every modification becomes a record (store name, key and the archived object, or a removal).
+ *   Records are buffered and appended every flushInterval, 0 leaves flushing to the caller (flush, synchronize).
+ * - appends, replays and checkpoints take an flock on the lock file, shared for replays and exclusive otherwise.
+ *   Records are appended in one write and only become visible once the length in the index has been updated,
+ *   so a process that crashes while appending leaves nothing behind.
+ * - synchronize replays the records other processes appended since the last call. Records are tagged with the
+ *   writing process and store, own ones are skipped so the objects this process stored stay the live ones, and so are
+ *   records of other processes that an own record of the same key follows. It only reads two words of the mapped
+ *   index if nothing has been appended, so it is called before every lookup.
+ * - a checkpoint writes the stores with checkpointWriter (the cache's usual archives) and truncates the journal.
+ *   Other processes notice the new generation in the index and load the checkpoint with checkpointLoader before
+ *   they replay the new journal. checkpointIfNeeded checkpoints once the journal exceeds checkpointJournalLength.
+ *
+ * The index file is mapped into every process. Besides the journal length and generation it has a table of download
+ * claims, one slot per URL, found by the hash of its key. A claim is the owning process and the claim time in one word,
+ * updated with atomic compare-and-swap only:
+ * beginDownloadForKey: claims a URL for the calling process unless another live process holds it. A claim is released
+ * by endDownloadForKey:, which frees the slot, and taken over if its process has died or it is older than claimTimeout.
+ * The slots of such claims are freed when a key finds no other. If the table is full, downloads are not coordinated.
+ *
+ * Objects in the stores must conform to NSCoding. Replacing a store is not shared, only modifications are.
+ * All methods may be called from any thread.
+ */
+@interface AFCacheSharedStore : NSObject <AFCacheInfoStoreObserver>
+
+@property (nonatomic, readonly) NSString *directory;
+
+@property (nonatomic, assign) NSTimeInterval flushInterval;
+@property (nonatomic, assign) uint64_t checkpointJournalLength;
+@property (nonatomic, assign) NSTimeInterval claimTimeout;
+
+/*
+ * returns the archived stores by name, read from the last checkpoint. Called with the lock file held.
+ */
+@property (nonatomic, copy) NSDictionary* (^checkpointLoader)(void);
+
+/*
+ * archives the stores. Called with the lock file held exclusively, after every record has been replayed.
+ */
+@property (nonatomic, copy) void (^checkpointWriter)(void);
+
+/*
+ * opens or creates the index, journal and lock file in directory. nil if they cannot be opened or mapped.
+ */
+- (instancetype)initWithDirectory:(NSString*)directory;
+
+/*
+ * shares the modifications of store under name, replacing the store shared under that name before
+ */
+- (void)setInfoStore:(AFCacheInfoStore*)store forName:(NSString*)name;
+
+/*
+ * appends the buffered records
+ */
+- (void)flush;
+
+/*
+ * appends the buffered records and replays those appended by any process since the last call.
+ * The first call loads the last checkpoint.
+ */
+- (void)synchronize;
+
+- (void)checkpoint;
+- (void)checkpointIfNeeded;
+
+/*
+ * YES if the calling process may download the URL, either because it holds the claim now or because claims cannot
+ * be recorded. NO if another live process holds it.
+ */
+- (BOOL)beginDownloadForKey:(AFCacheKey*)key;
+- (void)endDownloadForKey:(AFCacheKey*)key;
+
+/*
+ * process holding the claim, 0 if none
+ */
+- (pid_t)downloadingProcessForKey:(AFCacheKey*)key;
+
+/*
+ * flushes, releases the claims of this process and unmaps the index. The store must not be used afterwards.
+ */
+- (void)close;
+
+- (NSDictionary*)statistics;
+
+@end
@@ -0,0 +1,846 @@
+//
+//  AFCacheSharedStore.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheSharedStore.h"
+#import "AFCacheKey.h"
+#import "AFCache_Logging.h"
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
+
+#define kAFCacheSharedStoreMagic 0x41464353 // "AFCS"
+#define kAFCacheSharedStoreLayoutVersion 2
+// yields to wait for a slot whose key is being published. A process that died in between leaves it unpublished.
+#define kAFCacheSharedStorePublishSpinLimit 1000
+// h1 of a slot whose claim has been released. The h1 of a key has the lowest bit set.
+#define kAFCacheSharedStoreFreedSlot ((int64_t)2)
+// claim of a slot while it is freed
+#define kAFCacheSharedStoreFreeingClaim ((int64_t)0xFFFFFFFF00000000ULL)
+
+// keys of a journal record
+#define kAFCacheSharedStoreRecordStoreKey @"s"
+#define kAFCacheSharedStoreRecordKeyKey @"k"
+#define kAFCacheSharedStoreRecordObjectKey @"o"   // missing if the key was removed
+#define kAFCacheSharedStoreRecordClearKey @"c"    // set if every key was removed
+#define kAFCacheSharedStoreRecordPIDKey @"p"      // of the writing process
+#define kAFCacheSharedStoreRecordInstanceKey @"i" // of the writing AFCacheSharedStore, as pids are reused
+
+/*
+ * Layout of the index file, shared by every process that maps it
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t layoutVersion;
+    uint32_t slotCount;
+    uint32_t reserved;
+    volatile int64_t generation;    // incremented by every checkpoint, which truncates the journal
+    volatile int64_t journalLength; // bytes of complete records in the journal
+} AFCacheSharedStoreHeader;
+
+typedef struct {
+    volatile int64_t h1;        // of the key's hash with the lowest bit set, 0 until first used, kAFCacheSharedStoreFreedSlot once freed
+    volatile int64_t h2;        // same, 0 until the key has been published
+    volatile int64_t claim;     // process downloading the URL in the upper 32 bits, seconds since 1970 in the lower ones. 0 if none
+    int64_t reserved;
+} AFCacheSharedStoreSlot;
+
+static inline int64_t AFCacheSharedStoreLoad64(volatile int64_t *value) {
+    return OSAtomicAdd64Barrier(0, value);
+}
+
+// owner and time are swapped in one compare-and-swap, so a claim is never seen with the time of the one before
+static inline int64_t AFCacheSharedStoreClaimMake(pid_t ownerPID, time_t claimTime) {
+    return (int64_t)(((uint64_t)(uint32_t)ownerPID << 32) | (uint32_t)claimTime);
+}
+
+static inline pid_t AFCacheSharedStoreClaimOwnerPID(int64_t claim) {
+    return (pid_t)(uint32_t)((uint64_t)claim >> 32);
+}
+
+static inline int64_t AFCacheSharedStoreClaimTime(int64_t claim) {
+    return (int64_t)(uint32_t)claim;
+}
+
+@implementation AFCacheSharedStore {
+    int _lockFD;
+    int _journalFD;
+    int _indexFD;
+    AFCacheSharedStoreHeader *_header;
+    AFCacheSharedStoreSlot *_slots;
+    size_t _mappedLength;
+
+    // replay state, synchronized on self
+    int64_t _generation;
+    int64_t _journalOffset;
+    int64_t _ownRecordsReplayedUntil; // own records before this offset are replayed, the stores were reloaded after they were appended
+    volatile BOOL _replaying;
+    pthread_t _replayingThread;  // its writes to the stores are not journaled again
+
+    // written by the observer methods with a shard lock of a store held, so never synchronized on self
+    pthread_mutex_t _pendingLock;
+    NSDictionary *_stores;            // name -> AFCacheInfoStore, replaced as a whole
+    NSMutableData *_pendingRecords;   // length-prefixed records not yet appended
+    NSUInteger _pendingRecordCount;
+    BOOL _pendingPredatesReload;      // pending records may have been overwritten locally by a checkpoint
+
+    NSCountedSet *_claimedKeys;
+    pid_t _pid;
+    NSNumber *_instanceID;
+
+    NSUInteger _journaledRecordCount;
+    NSUInteger _replayedRecordCount;
+    NSUInteger _checkpointCount;
+    NSUInteger _reloadCount;
+    NSUInteger _claimedDownloadCount;
+    NSUInteger _contendedDownloadCount;
+    NSUInteger _takenOverClaimCount;
+}
+
+- (instancetype)initWithDirectory:(NSString*)directory {
+    self = [super init];
+    if (self) {
+        _directory = [directory copy];
+        _flushInterval = kAFCacheSharedStoreDefaultFlushInterval;
+        _checkpointJournalLength = kAFCacheSharedStoreDefaultCheckpointJournalLength;
+        _claimTimeout = kAFCacheSharedStoreDefaultClaimTimeout;
+        _lockFD = -1;
+        _journalFD = -1;
+        _indexFD = -1;
+        _generation = -1; // the first synchronize loads the checkpoint
+        _stores = @{};
+        _pendingRecords = [NSMutableData data];
+        _claimedKeys = [NSCountedSet set];
+        _pid = getpid();
+        _instanceID = @(((uint64_t)arc4random() << 32) | arc4random());
+        pthread_mutex_init(&_pendingLock, NULL);
+        if (![self open]) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self close];
+    pthread_mutex_destroy(&_pendingLock);
+}
+
+#pragma mark - Files
+
+- (int)openFileNamed:(NSString*)filename {
+    NSString *path = [self.directory stringByAppendingPathComponent:filename];
+    int fd = open([path fileSystemRepresentation], O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        NSLog(@"AFCache: Could not open %@ (errno %d)", path, errno);
+    }
+    return fd;
+}
+
+- (BOOL)open {
+    _lockFD = [self openFileNamed:kAFCacheSharedStoreLockFilename];
+    _journalFD = [self openFileNamed:kAFCacheSharedStoreJournalFilename];
+    _indexFD = [self openFileNamed:kAFCacheSharedStoreIndexFilename];
+    if (_lockFD < 0 || _journalFD < 0 || _indexFD < 0) {
+        [self closeFiles];
+        return NO;
+    }
+
+    // the first process creates the index, or replaces one of another layout
+    size_t mappedLength = sizeof(AFCacheSharedStoreHeader) + kAFCacheSharedStoreSlotCount * sizeof(AFCacheSharedStoreSlot);
+    flock(_lockFD, LOCK_EX);
+    struct stat indexStat;
+    BOOL created = fstat(_indexFD, &indexStat) != 0 || (size_t)indexStat.st_size < mappedLength;
+    if (created && ftruncate(_indexFD, (off_t)mappedLength) != 0) {
+        NSLog(@"AFCache: Could not create the shared index in %@ (errno %d)", self.directory, errno);
+        flock(_lockFD, LOCK_UN);
+        [self closeFiles];
+        return NO;
+    }
+    void *mapping = mmap(NULL, mappedLength, PROT_READ | PROT_WRITE, MAP_SHARED, _indexFD, 0);
+    if (mapping == MAP_FAILED) {
+        NSLog(@"AFCache: Could not map the shared index in %@ (errno %d)", self.directory, errno);
+        flock(_lockFD, LOCK_UN);
+        [self closeFiles];
+        return NO;
+    }
+    _header = mapping;
+    _slots = (AFCacheSharedStoreSlot*)(_header + 1);
+    _mappedLength = mappedLength;
+    if (created || _header->magic != kAFCacheSharedStoreMagic || _header->layoutVersion != kAFCacheSharedStoreLayoutVersion ||
+        _header->slotCount != kAFCacheSharedStoreSlotCount) {
+        // the journal belongs to the index, the stores start from the last checkpoint
+        memset(mapping, 0, mappedLength);
+        ftruncate(_journalFD, 0);
+        _header->layoutVersion = kAFCacheSharedStoreLayoutVersion;
+        _header->slotCount = kAFCacheSharedStoreSlotCount;
+        _header->generation = 1;
+        OSMemoryBarrier();
+        _header->magic = kAFCacheSharedStoreMagic;
+    }
+    flock(_lockFD, LOCK_UN);
+    return YES;
+}
+
+- (void)closeFiles {
+    if (_lockFD >= 0) {
+        close(_lockFD);
+        _lockFD = -1;
+    }
+    if (_journalFD >= 0) {
+        close(_journalFD);
+        _journalFD = -1;
+    }
+    if (_indexFD >= 0) {
+        close(_indexFD);
+        _indexFD = -1;
+    }
+}
+
+- (void)close {
+    NSDictionary *stores = [self stores];
+    for (AFCacheInfoStore *store in [stores allValues]) {
+        [store removeObserver:self];
+    }
+    @synchronized (self) {
+        if (!_header) {
+            return;
+        }
+        [self appendPendingRecords];
+        for (AFCacheKey *key in _claimedKeys) {
+            [self releaseClaimOfSlot:[self slotForKey:key create:NO]];
+        }
+        [_claimedKeys removeAllObjects];
+        munmap(_header, _mappedLength);
+        _header = NULL;
+        _slots = NULL;
+        [self closeFiles];
+    }
+}
+
+- (BOOL)writeData:(NSData*)data atOffset:(int64_t)offset {
+    const uint8_t *bytes = [data bytes];
+    NSUInteger written = 0;
+    while (written < [data length]) {
+        ssize_t result = pwrite(_journalFD, bytes + written, [data length] - written, (off_t)(offset + written));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            NSLog(@"AFCache: Could not append to the shared journal in %@ (errno %d)", self.directory, errno);
+            return NO;
+        }
+        written += (NSUInteger)result;
+    }
+    return YES;
+}
+
+- (NSData*)readDataAtOffset:(int64_t)offset length:(int64_t)length {
+    NSMutableData *data = [NSMutableData dataWithLength:(NSUInteger)length];
+    uint8_t *bytes = [data mutableBytes];
+    int64_t read = 0;
+    while (read < length) {
+        ssize_t result = pread(_journalFD, bytes + read, (size_t)(length - read), (off_t)(offset + read));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            NSLog(@"AFCache: Could not read the shared journal in %@ (errno %d)", self.directory, result < 0 ? errno : 0);
+            return nil;
+        }
+        read += result;
+    }
+    return data;
+}
+
+#pragma mark - Stores
+
+- (NSDictionary*)stores {
+    pthread_mutex_lock(&_pendingLock);
+    NSDictionary *stores = _stores;
+    pthread_mutex_unlock(&_pendingLock);
+    return stores;
+}
+
+- (void)setInfoStore:(AFCacheInfoStore*)store forName:(NSString*)name {
+    if (!name) {
+        return;
+    }
+    pthread_mutex_lock(&_pendingLock);
+    AFCacheInfoStore *previousStore = _stores[name];
+    NSMutableDictionary *stores = [_stores mutableCopy];
+    stores[name] = store;
+    _stores = [stores copy];
+    pthread_mutex_unlock(&_pendingLock);
+    if (previousStore != store) {
+        [previousStore removeObserver:self];
+        [store addObserver:self];
+    }
+}
+
+#pragma mark - AFCacheInfoStoreObserver
+
+- (void)infoStore:(AFCacheInfoStore*)store didSetObject:(id)object forKey:(AFCacheKey*)key {
+    [self recordModificationOfStore:store key:key object:object clear:NO];
+}
+
+- (void)infoStore:(AFCacheInfoStore*)store didRemoveObjectForKey:(AFCacheKey*)key {
+    [self recordModificationOfStore:store key:key object:nil clear:NO];
+}
+
+- (void)infoStoreDidRemoveAllObjects:(AFCacheInfoStore*)store {
+    [self recordModificationOfStore:store key:nil object:nil clear:YES];
+}
+
+- (void)recordModificationOfStore:(AFCacheInfoStore*)store key:(AFCacheKey*)key object:(id)object clear:(BOOL)clear {
+    if (_replaying && pthread_equal(_replayingThread, pthread_self())) {
+        return;
+    }
+    __block NSString *name = nil;
+    [[self stores] enumerateKeysAndObjectsUsingBlock:^(NSString *storeName, AFCacheInfoStore *sharedStore, BOOL *stop) {
+        if (sharedStore == store) {
+            name = storeName;
+            *stop = YES;
+        }
+    }];
+    if (!name || (!clear && !key)) {
+        return;
+    }
+
+    NSMutableDictionary *record = [NSMutableDictionary dictionaryWithObject:name forKey:kAFCacheSharedStoreRecordStoreKey];
+    record[kAFCacheSharedStoreRecordPIDKey] = @(_pid);
+    record[kAFCacheSharedStoreRecordInstanceKey] = _instanceID;
+    if (clear) {
+        record[kAFCacheSharedStoreRecordClearKey] = @YES;
+    } else {
+        record[kAFCacheSharedStoreRecordKeyKey] = key.URLString;
+        if (object) {
+            record[kAFCacheSharedStoreRecordObjectKey] = object;
+        }
+    }
+    NSData *data = nil;
+    @try {
+        data = [NSKeyedArchiver archivedDataWithRootObject:record];
+    }
+    @catch (NSException *exception) {
+        NSLog(@"AFCache: Could not journal %@ (Error: %@)", key.URLString, exception);
+        return;
+    }
+    uint32_t length = (uint32_t)[data length];
+
+    pthread_mutex_lock(&_pendingLock);
+    BOOL scheduleFlush = [_pendingRecords length] == 0;
+    [_pendingRecords appendBytes:&length length:sizeof(length)];
+    [_pendingRecords appendData:data];
+    _pendingRecordCount++;
+    pthread_mutex_unlock(&_pendingLock);
+
+    NSTimeInterval flushInterval = self.flushInterval;
+    if (scheduleFlush && flushInterval > 0) {
+        __weak AFCacheSharedStore *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(flushInterval * NSEC_PER_SEC)),
+                       dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+                           [weakSelf flush];
+                       });
+    }
+}
+
+#pragma mark - Journal
+
+- (void)flush {
+    @synchronized (self) {
+        [self appendPendingRecords];
+    }
+}
+
+// synchronized
+- (void)appendPendingRecords {
+    if (!_header) {
+        return;
+    }
+    pthread_mutex_lock(&_pendingLock);
+    NSData *records = _pendingRecords;
+    NSUInteger recordCount = _pendingRecordCount;
+    BOOL predatesReload = _pendingPredatesReload;
+    _pendingRecords = [NSMutableData data];
+    _pendingRecordCount = 0;
+    _pendingPredatesReload = NO;
+    pthread_mutex_unlock(&_pendingLock);
+    if ([records length] == 0) {
+        return;
+    }
+
+    if (flock(_lockFD, LOCK_EX) != 0) {
+        NSLog(@"AFCache: Could not lock the shared store in %@ (errno %d)", self.directory, errno);
+        return;
+    }
+    // records are written behind the published length, a record a crashed process left half written is overwritten
+    int64_t end = AFCacheSharedStoreLoad64(&_header->journalLength);
+    BOOL upToDate = !predatesReload && _generation == AFCacheSharedStoreLoad64(&_header->generation) && _journalOffset == end;
+    if ([self writeData:records atOffset:end]) {
+        OSMemoryBarrier();
+        _header->journalLength = end + (int64_t)[records length];
+        OSMemoryBarrier();
+        // the stores already are what replaying the records would make them
+        if (upToDate) {
+            _journalOffset = end + (int64_t)[records length];
+        }
+        if (predatesReload) {
+            _ownRecordsReplayedUntil = MAX(_ownRecordsReplayedUntil, end + (int64_t)[records length]);
+        }
+        _journaledRecordCount += recordCount;
+    }
+    flock(_lockFD, LOCK_UN);
+}
+
+- (void)synchronize {
+    @synchronized (self) {
+        if (!_header) {
+            return;
+        }
+        pthread_mutex_lock(&_pendingLock);
+        BOOL hasPendingRecords = [_pendingRecords length] > 0;
+        pthread_mutex_unlock(&_pendingLock);
+        if (!hasPendingRecords && _generation == AFCacheSharedStoreLoad64(&_header->generation) &&
+            _journalOffset == AFCacheSharedStoreLoad64(&_header->journalLength)) {
+            return;
+        }
+        // own records are appended first, so they are replayed after those they follow in the journal
+        [self appendPendingRecords];
+        if (flock(_lockFD, LOCK_SH) != 0) {
+            NSLog(@"AFCache: Could not lock the shared store in %@ (errno %d)", self.directory, errno);
+            return;
+        }
+        [self replayJournal];
+        flock(_lockFD, LOCK_UN);
+    }
+}
+
+// synchronized, with the lock file held
+- (void)replayJournal {
+    _replayingThread = pthread_self();
+    _replaying = YES;
+
+    int64_t generation = AFCacheSharedStoreLoad64(&_header->generation);
+    int64_t end = AFCacheSharedStoreLoad64(&_header->journalLength);
+    if (generation != _generation) {
+        // the checkpoint replaces what own records appended since it was written stored, so they are replayed too
+        _ownRecordsReplayedUntil = [self reloadCheckpoint] ? end : 0;
+        _generation = generation;
+        _journalOffset = 0;
+    }
+
+    NSData *journal = _journalOffset < end ? [self readDataAtOffset:_journalOffset length:end - _journalOffset] : nil;
+    if (journal) {
+        NSMutableArray *records = [NSMutableArray array];
+        NSMutableIndexSet *ownRecordIndexes = [NSMutableIndexSet indexSet];
+        const uint8_t *bytes = [journal bytes];
+        NSUInteger position = 0;
+        while (position + sizeof(uint32_t) <= [journal length]) {
+            int64_t offset = _journalOffset + (int64_t)position;
+            uint32_t length;
+            memcpy(&length, bytes + position, sizeof(length));
+            position += sizeof(length);
+            if (position + length > [journal length]) {
+                break;
+            }
+            @autoreleasepool {
+                NSData *recordData = [NSData dataWithBytesNoCopy:(void*)(bytes + position) length:length freeWhenDone:NO];
+                NSDictionary *record = nil;
+                @try {
+                    record = [NSKeyedUnarchiver unarchiveObjectWithData:recordData];
+                }
+                @catch (NSException *exception) {
+                    NSLog(@"AFCache: Could not read a record of the shared journal in %@ (Error: %@)", self.directory, exception);
+                }
+                if ([record isKindOfClass:[NSDictionary class]]) {
+                    if ([self isOwnRecord:record] && offset >= _ownRecordsReplayedUntil) {
+                        [ownRecordIndexes addIndex:[records count]];
+                    }
+                    [records addObject:record];
+                }
+            }
+            position += length;
+        }
+        [self applyRecords:records ownRecordIndexes:ownRecordIndexes];
+        _journalOffset = end;
+    }
+
+    _replaying = NO;
+}
+
+- (BOOL)isOwnRecord:(NSDictionary*)record {
+    return [record[kAFCacheSharedStoreRecordPIDKey] intValue] == _pid &&
+           [record[kAFCacheSharedStoreRecordInstanceKey] isEqual:_instanceID];
+}
+
+/*
+ * Own records are not applied: the stores hold the objects that were set, which may have been modified since they
+ * were archived. Neither are records of other processes that an own record of the same key follows, and a removal of
+ * every key by another process keeps the keys set by this process afterwards.
+ */
+- (void)applyRecords:(NSArray*)records ownRecordIndexes:(NSIndexSet*)ownRecordIndexes {
+    NSDictionary *stores = [self stores];
+    NSMutableDictionary *ownKeysByStore = [NSMutableDictionary dictionary]; // of the own records after the current one
+    NSMutableSet *clearedStores = [NSMutableSet set];
+    NSMutableIndexSet *skippedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableDictionary *keptKeysByIndex = [NSMutableDictionary dictionary];
+    for (NSUInteger index = [records count]; index-- > 0;) {
+        NSDictionary *record = records[index];
+        NSString *name = record[kAFCacheSharedStoreRecordStoreKey];
+        NSString *key = record[kAFCacheSharedStoreRecordKeyKey];
+        BOOL clear = [record[kAFCacheSharedStoreRecordClearKey] boolValue];
+        if (!name) {
+            [skippedIndexes addIndex:index];
+            continue;
+        }
+        NSMutableSet *ownKeys = ownKeysByStore[name];
+        if ([ownRecordIndexes containsIndex:index]) {
+            [skippedIndexes addIndex:index];
+            if (clear) {
+                [clearedStores addObject:name];
+            } else if (key) {
+                if (!ownKeys) {
+                    ownKeys = [NSMutableSet set];
+                    ownKeysByStore[name] = ownKeys;
+                }
+                [ownKeys addObject:key];
+            }
+        } else if ([clearedStores containsObject:name] || (!clear && key && [ownKeys containsObject:key])) {
+            [skippedIndexes addIndex:index];
+        } else if (clear && [ownKeys count] > 0) {
+            keptKeysByIndex[@(index)] = [ownKeys copy];
+        }
+    }
+
+    [records enumerateObjectsUsingBlock:^(NSDictionary *record, NSUInteger index, BOOL *stop) {
+        if (![skippedIndexes containsIndex:index]) {
+            [self applyRecord:record stores:stores keepingKeys:keptKeysByIndex[@(index)]];
+        }
+    }];
+}
+
+- (void)applyRecord:(NSDictionary*)record stores:(NSDictionary*)stores keepingKeys:(NSSet*)keptKeys {
+    AFCacheInfoStore *store = stores[record[kAFCacheSharedStoreRecordStoreKey]];
+    if (!store) {
+        return;
+    }
+    if ([record[kAFCacheSharedStoreRecordClearKey] boolValue]) {
+        if (keptKeys) {
+            NSDictionary *currentStore = [store copy];
+            [currentStore enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stop) {
+                if (![keptKeys containsObject:key]) {
+                    [store removeObjectForKey:key];
+                }
+            }];
+        } else {
+            [store removeAllObjects];
+        }
+    } else {
+        NSString *key = record[kAFCacheSharedStoreRecordKeyKey];
+        id object = record[kAFCacheSharedStoreRecordObjectKey];
+        if (!key) {
+            return;
+        }
+        if (object) {
+            [store setObject:object forKey:key];
+        } else {
+            [store removeObjectForKey:key];
+        }
+    }
+    _replayedRecordCount++;
+}
+
+// synchronized, with the lock file held, while replaying. NO if there was no checkpoint to load.
+- (BOOL)reloadCheckpoint {
+    NSDictionary *archivedStores = self.checkpointLoader ? self.checkpointLoader() : nil;
+    if (!archivedStores) {
+        return NO;
+    }
+    NSDictionary *stores = [self stores];
+    [stores enumerateKeysAndObjectsUsingBlock:^(NSString *name, AFCacheInfoStore *store, BOOL *stop) {
+        NSDictionary *archivedStore = archivedStores[name];
+        if (![archivedStore isKindOfClass:[NSDictionary class]]) {
+            archivedStore = @{};
+        }
+        NSDictionary *currentStore = [store copy];
+        [currentStore enumerateKeysAndObjectsUsingBlock:^(NSString *key, id object, BOOL *stopCurrent) {
+            if (!archivedStore[key]) {
+                [store removeObjectForKey:key];
+            }
+        }];
+        [archivedStore enumerateKeysAndObjectsUsingBlock:^(id key, id object, BOOL *stopArchived) {
+            [store setObject:object forKey:key];
+        }];
+    }];
+
+    // a record buffered before now may have been overwritten by the checkpoint, it must be replayed when appended
+    pthread_mutex_lock(&_pendingLock);
+    _pendingPredatesReload = _pendingPredatesReload || [_pendingRecords length] > 0;
+    pthread_mutex_unlock(&_pendingLock);
+    _reloadCount++;
+    AFLog(@"reloaded the shared store checkpoint in %@", self.directory);
+    return YES;
+}
+
+#pragma mark - Checkpoints
+
+- (void)checkpoint {
+    @synchronized (self) {
+        if (!_header || !self.checkpointWriter) {
+            return;
+        }
+        [self appendPendingRecords];
+        if (flock(_lockFD, LOCK_EX) != 0) {
+            NSLog(@"AFCache: Could not lock the shared store in %@ (errno %d)", self.directory, errno);
+            return;
+        }
+        [self replayJournal];
+        self.checkpointWriter();
+        if (ftruncate(_journalFD, 0) == 0) {
+            _header->journalLength = 0;
+            OSMemoryBarrier();
+            _generation = OSAtomicIncrement64Barrier(&_header->generation);
+            _journalOffset = 0;
+            _ownRecordsReplayedUntil = 0;
+            _checkpointCount++;
+        } else {
+            // the journal stays valid, it is replayed on top of the checkpoint
+            NSLog(@"AFCache: Could not truncate the shared journal in %@ (errno %d)", self.directory, errno);
+        }
+        flock(_lockFD, LOCK_UN);
+    }
+}
+
+- (void)checkpointIfNeeded {
+    BOOL needed = NO;
+    @synchronized (self) {
+        needed = _header && (uint64_t)AFCacheSharedStoreLoad64(&_header->journalLength) >= self.checkpointJournalLength;
+    }
+    if (needed) {
+        [self checkpoint];
+    }
+}
+
+#pragma mark - Download claims
+
+/*
+ * Open addressing with linear probing. A slot is freed once its claim is released, by marking it
+ * kAFCacheSharedStoreFreedSlot, so lookups go on probing past it and only stop at a slot that was never used.
+ * Freeing swaps the claim for kAFCacheSharedStoreFreeingClaim first, so a slot is never freed while it is claimed,
+ * and beginDownloadForKey: checks after claiming that the slot still belongs to its key.
+ * Two processes adding the same key at once may get a slot each, their downloads are then not coordinated.
+ */
+- (AFCacheSharedStoreSlot*)slotForKey:(AFCacheKey*)key create:(BOOL)create {
+    if (!_header || !key) {
+        return NULL;
+    }
+    AFCacheKeyHash128 hash = key.hash128;
+    int64_t h1 = (int64_t)(hash.h1 | 1);
+    int64_t h2 = (int64_t)(hash.h2 | 1);
+    for (NSUInteger attempt = 0; attempt < kAFCacheSharedStoreMaxProbes; attempt++) {
+        AFCacheSharedStoreSlot *unusedSlot = NULL;
+        int64_t unusedSlotH1 = 0;
+        AFCacheSharedStoreSlot *slot = [self slotWithHash:hash unusedSlot:&unusedSlot unusedSlotH1:&unusedSlotH1];
+        if (slot || !create) {
+            return slot;
+        }
+        if (!unusedSlot) {
+            unusedSlot = [self freeStaleSlotWithHash:hash];
+            unusedSlotH1 = kAFCacheSharedStoreFreedSlot;
+        }
+        if (!unusedSlot) {
+            return NULL;
+        }
+        if (OSAtomicCompareAndSwap64Barrier(unusedSlotH1, h1, &unusedSlot->h1)) {
+            OSAtomicCompareAndSwap64Barrier(0, h2, &unusedSlot->h2);
+            return unusedSlot;
+        }
+        // taken by another thread or process meanwhile, maybe for the same key
+    }
+    return NULL;
+}
+
+// the slot of the key, or NULL and the first freed or never used slot the key may take
+- (AFCacheSharedStoreSlot*)slotWithHash:(AFCacheKeyHash128)hash unusedSlot:(AFCacheSharedStoreSlot**)unusedSlot unusedSlotH1:(int64_t*)unusedSlotH1 {
+    int64_t h1 = (int64_t)(hash.h1 | 1);
+    int64_t h2 = (int64_t)(hash.h2 | 1);
+    uint32_t slotCount = _header->slotCount;
+    for (uint32_t probe = 0; probe < kAFCacheSharedStoreMaxProbes; probe++) {
+        AFCacheSharedStoreSlot *slot = &_slots[(hash.h1 + probe) % slotCount];
+        int64_t slotH1 = AFCacheSharedStoreLoad64(&slot->h1);
+        if (slotH1 == 0 || slotH1 == kAFCacheSharedStoreFreedSlot) {
+            if (!*unusedSlot) {
+                *unusedSlot = slot;
+                *unusedSlotH1 = slotH1;
+            }
+            if (slotH1 == 0) {
+                return NULL;
+            }
+            continue;
+        }
+        if (slotH1 != h1) {
+            continue;
+        }
+        int64_t slotH2 = AFCacheSharedStoreLoad64(&slot->h2);
+        for (NSUInteger spin = 0; slotH2 == 0 && spin < kAFCacheSharedStorePublishSpinLimit; spin++) {
+            sched_yield();
+            slotH2 = AFCacheSharedStoreLoad64(&slot->h2);
+        }
+        if (slotH2 == h2) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// frees a slot of the probe sequence whose claim is not held by a live process, NULL if there is none
+- (AFCacheSharedStoreSlot*)freeStaleSlotWithHash:(AFCacheKeyHash128)hash {
+    uint32_t slotCount = _header->slotCount;
+    for (uint32_t probe = 0; probe < kAFCacheSharedStoreMaxProbes; probe++) {
+        AFCacheSharedStoreSlot *slot = &_slots[(hash.h1 + probe) % slotCount];
+        int64_t claim = AFCacheSharedStoreLoad64(&slot->claim);
+        if (claim != kAFCacheSharedStoreFreeingClaim && ![self isClaimValid:claim] && [self freeSlot:slot claim:claim]) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// NO if the claim has changed meanwhile
+- (BOOL)freeSlot:(AFCacheSharedStoreSlot*)slot claim:(int64_t)claim {
+    if (!OSAtomicCompareAndSwap64Barrier(claim, kAFCacheSharedStoreFreeingClaim, &slot->claim)) {
+        return NO;
+    }
+    slot->h2 = 0;
+    OSMemoryBarrier();
+    slot->h1 = kAFCacheSharedStoreFreedSlot;
+    OSMemoryBarrier();
+    slot->claim = 0;
+    OSMemoryBarrier();
+    return YES;
+}
+
+- (BOOL)slot:(AFCacheSharedStoreSlot*)slot belongsToKey:(AFCacheKey*)key {
+    AFCacheKeyHash128 hash = key.hash128;
+    return AFCacheSharedStoreLoad64(&slot->h1) == (int64_t)(hash.h1 | 1) && AFCacheSharedStoreLoad64(&slot->h2) == (int64_t)(hash.h2 | 1);
+}
+
+- (BOOL)isClaimValid:(int64_t)claim {
+    pid_t ownerPID = AFCacheSharedStoreClaimOwnerPID(claim);
+    if (ownerPID == 0 || claim == kAFCacheSharedStoreFreeingClaim || (kill(ownerPID, 0) != 0 && errno == ESRCH)) {
+        return NO;
+    }
+    return (int64_t)(uint32_t)time(NULL) - AFCacheSharedStoreClaimTime(claim) < (int64_t)self.claimTimeout;
+}
+
+// frees the slot, leaves it alone if another process has taken the claim over
+- (void)releaseClaimOfSlot:(AFCacheSharedStoreSlot*)slot {
+    if (!slot) {
+        return;
+    }
+    while (YES) {
+        int64_t claim = AFCacheSharedStoreLoad64(&slot->claim);
+        if (AFCacheSharedStoreClaimOwnerPID(claim) != _pid || claim == kAFCacheSharedStoreFreeingClaim) {
+            return;
+        }
+        if ([self freeSlot:slot claim:claim]) {
+            return;
+        }
+    }
+}
+
+- (BOOL)beginDownloadForKey:(AFCacheKey*)key {
+    @synchronized (self) {
+        for (NSUInteger spin = 0; YES; spin++) {
+            AFCacheSharedStoreSlot *slot = [self slotForKey:key create:YES];
+            if (!slot || spin == kAFCacheSharedStorePublishSpinLimit) {
+                // a process that died while freeing the slot leaves it behind, the download is not coordinated
+                return YES;
+            }
+            int64_t claim = AFCacheSharedStoreLoad64(&slot->claim);
+            if (claim == kAFCacheSharedStoreFreeingClaim) {
+                // being freed, the key takes another slot
+                sched_yield();
+                continue;
+            }
+            pid_t ownerPID = AFCacheSharedStoreClaimOwnerPID(claim);
+            if (ownerPID == _pid) {
+                // the cache coordinates its own downloads
+                break;
+            }
+            if ([self isClaimValid:claim]) {
+                _contendedDownloadCount++;
+                return NO;
+            }
+            if (!OSAtomicCompareAndSwap64Barrier(claim, AFCacheSharedStoreClaimMake(_pid, time(NULL)), &slot->claim)) {
+                continue;
+            }
+            if (![self slot:slot belongsToKey:key]) {
+                // freed and taken by another key after it was found, a claimed slot is not freed anymore
+                [self releaseClaimOfSlot:slot];
+                continue;
+            }
+            if (ownerPID != 0) {
+                _takenOverClaimCount++;
+                AFLog(@"took over the download claim of process %d for %@", ownerPID, key.URLString);
+            }
+            _claimedDownloadCount++;
+            break;
+        }
+        [_claimedKeys addObject:key];
+        return YES;
+    }
+}
+
+- (void)endDownloadForKey:(AFCacheKey*)key {
+    @synchronized (self) {
+        if (!key || ![_claimedKeys containsObject:key]) {
+            return;
+        }
+        [_claimedKeys removeObject:key];
+        if ([_claimedKeys countForObject:key] == 0) {
+            [self releaseClaimOfSlot:[self slotForKey:key create:NO]];
+        }
+    }
+}
+
+- (pid_t)downloadingProcessForKey:(AFCacheKey*)key {
+    @synchronized (self) {
+        AFCacheSharedStoreSlot *slot = [self slotForKey:key create:NO];
+        if (!slot) {
+            return 0;
+        }
+        int64_t claim = AFCacheSharedStoreLoad64(&slot->claim);
+        return [self isClaimValid:claim] ? AFCacheSharedStoreClaimOwnerPID(claim) : 0;
+    }
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFCacheSharedStoreJournaledRecordsKey : @(_journaledRecordCount),
+                 kAFCacheSharedStoreReplayedRecordsKey : @(_replayedRecordCount),
+                 kAFCacheSharedStoreCheckpointsKey : @(_checkpointCount),
+                 kAFCacheSharedStoreReloadsKey : @(_reloadCount),
+                 kAFCacheSharedStoreClaimedDownloadsKey : @(_claimedDownloadCount),
+                 kAFCacheSharedStoreContendedDownloadsKey : @(_contendedDownloadCount),
+                 kAFCacheSharedStoreTakenOverClaimsKey : @(_takenOverClaimCount),
+                 kAFCacheSharedStoreJournalLengthKey : @(_header ? AFCacheSharedStoreLoad64(&_header->journalLength) : 0),
+                 };
+    }
+}
+
+@end
@@ -0,0 +1,91 @@
+//
+//  AFCacheSimulator.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheTraceReader;
+
+// keys of the dictionary returned by -runWithConfiguration:
+#define kAFCacheSimulatorConfigurationKey @"configuration" // description of the configuration
+#define kAFCacheSimulatorRequestsKey @"requests"
+#define kAFCacheSimulatorHitsKey @"hits"
+#define kAFCacheSimulatorMissesKey @"misses"
+#define kAFCacheSimulatorRevalidationsKey @"revalidations"
+#define kAFCacheSimulatorFailuresKey @"failures"
+#define kAFCacheSimulatorRejectedItemsKey @"rejectedItems"
+#define kAFCacheSimulatorEvictedItemsKey @"evictedItems"
+#define kAFCacheSimulatorRequestedBytesKey @"requestedBytes"
+#define kAFCacheSimulatorHitBytesKey @"hitBytes"
+#define kAFCacheSimulatorTransferredBytesKey @"transferredBytes" // downloaded from the network
+#define kAFCacheSimulatorWrittenBytesKey @"writtenBytes"         // written to the store
+#define kAFCacheSimulatorEvictedBytesKey @"evictedBytes"
+#define kAFCacheSimulatorHitRatioKey @"hitRatio"                 // hits per request
+#define kAFCacheSimulatorByteHitRatioKey @"byteHitRatio"         // hit bytes per requested byte
+#define kAFCacheSimulatorWriteAmplificationKey @"writeAmplification" // written bytes per requested byte
+
+/*
+ * Settings of one simulated cache
+ */
+@interface AFCacheSimulatorConfiguration : NSObject <NSCopying>
+
+@property (nonatomic, copy) NSString *name;
+
+/*
+ * diskCacheDisplacementTresholdSize of the cache and the storage governor's budget (0 = unlimited). Default is kDefaultDiskCacheDisplacementTresholdSize
+ */
+@property (nonatomic, assign) uint64_t byteBudget;
+
+/*
+ * simulate an admission filter, see -[AFCache admissionFilter]. Default is NO
+ */
+@property (nonatomic, assign) BOOL admissionFilter;
+
+/*
+ * passed to -[AFCacheAdmissionFilter initWithExpectedItemCount:]. Default is 10000
+ */
+@property (nonatomic, assign) NSUInteger expectedItemCount;
+
+/*
+ * see -[AFStorageGovernor utilityHalfLife]. Default is one day
+ */
+@property (nonatomic, assign) NSTimeInterval utilityHalfLife;
+
+/*
+ * the storage governor enforces the budget when the cache archives, so the store may exceed it in between.
+ * Default is 30 seconds, the cache's default archive interval.
+ */
+@property (nonatomic, assign) NSTimeInterval enforcementInterval;
+
+@end
+
+/*
+ * Replays a trace recorded by -[AFCache traceRecorder] against the cache's own decision code to compare configurations
+ * offline, before changing them in production:
+ * - freshness is decided by -[AFCacheableItemInfo remainingFreshness],
+ * - admission by -[AFCacheAdmissionFilter shouldAdmitCandidateKey:info:size:storeSize:byteBudget:sample:], on an AFCacheInfoStore,
+ * - eviction by an AFStorageGovernor of its own, with the budget as the maximum of the replay's context,
+ *   every enforcementInterval. The governor evicts on the main thread, a replay off the main thread waits for it.
+ *
+ * Time is the trace's: every replay has an AFCacheManualClock of its own that is set to every record's timestamp and
+ * passed to the decision code and the governor. The process's clock is not touched, so replays do not disturb caches in use.
+ *
+ * The store starts empty. A stale entry is revalidated; if the size recorded for the lookup differs from the stored one
+ * the body is taken as modified and downloaded and written again, otherwise as not modified. Failed lookups are counted
+ * as requests, but neither served nor stored. The cache's estimate of its size is replaced by the exact size.
+ *
+ * Not thread-safe. Replays run one after the other.
+ */
+@interface AFCacheSimulator : NSObject
+
+- (instancetype)initWithTraceReader:(AFCacheTraceReader*)traceReader;
+
+/*
+ * replays the whole trace, see kAFCacheSimulator... keys for the result
+ */
+- (NSDictionary*)runWithConfiguration:(AFCacheSimulatorConfiguration*)configuration;
+
+@end
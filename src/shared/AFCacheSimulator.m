@@ -0,0 +1,262 @@
+//
+//  AFCacheSimulator.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheSimulator.h"
+#import "AFCache.h"
+#import "AFCacheTrace.h"
+#import "AFCacheClock.h"
+#import "AFCacheInfoStore.h"
+#import "AFCacheAdmissionFilter.h"
+#import "AFCacheableItemInfo.h"
+#import "AFStorageGovernor.h"
+#import "AFCache_Logging.h"
+
+#define kAFCacheSimulatorDefaultExpectedItemCount 10000
+#define kAFCacheSimulatorDefaultUtilityHalfLife (24 * 60 * 60)
+#define kAFCacheSimulatorDefaultEnforcementInterval 30
+
+// context of the store every replay registers with its own storage governor
+#define kAFCacheSimulatorContext @"simulator"
+
+@implementation AFCacheSimulatorConfiguration
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _byteBudget = kDefaultDiskCacheDisplacementTresholdSize;
+        _expectedItemCount = kAFCacheSimulatorDefaultExpectedItemCount;
+        _utilityHalfLife = kAFCacheSimulatorDefaultUtilityHalfLife;
+        _enforcementInterval = kAFCacheSimulatorDefaultEnforcementInterval;
+    }
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    AFCacheSimulatorConfiguration *copy = [[[self class] allocWithZone:zone] init];
+    copy.name = self.name;
+    copy.byteBudget = self.byteBudget;
+    copy.admissionFilter = self.admissionFilter;
+    copy.expectedItemCount = self.expectedItemCount;
+    copy.utilityHalfLife = self.utilityHalfLife;
+    copy.enforcementInterval = self.enforcementInterval;
+    return copy;
+}
+
+- (NSString*)description {
+    return [NSString stringWithFormat:@"%@budget %llu, admission filter %@, half-life %.0fs, enforcement every %.0fs",
+            self.name ? [self.name stringByAppendingString:@": "] : @"", self.byteBudget,
+            self.admissionFilter ? @"on" : @"off", self.utilityHalfLife, self.enforcementInterval];
+}
+
+@end
+
+/*
+ * State of one replay, and the store its storage governor measures and evicts
+ */
+@interface AFCacheSimulatorRun : NSObject <AFStorageGovernorStore>
+@property (nonatomic, strong) AFCacheSimulatorConfiguration *configuration;
+@property (nonatomic, strong) AFCacheManualClock *clock; // the trace's time, see -[AFCacheableItemInfo remainingFreshnessAtTime:]
+@property (nonatomic, strong) AFCacheInfoStore *store;
+@property (nonatomic, strong) AFCacheAdmissionFilter *admissionFilter;
+@property (nonatomic, strong) AFStorageGovernor *governor;
+@property (nonatomic, assign) uint64_t storeSize;
+@property (nonatomic, assign) NSUInteger requests;
+@property (nonatomic, assign) NSUInteger hits;
+@property (nonatomic, assign) NSUInteger misses;
+@property (nonatomic, assign) NSUInteger revalidations;
+@property (nonatomic, assign) NSUInteger failures;
+@property (nonatomic, assign) NSUInteger rejectedItems;
+@property (nonatomic, assign) NSUInteger evictedItems;
+@property (nonatomic, assign) uint64_t requestedBytes;
+@property (nonatomic, assign) uint64_t hitBytes;
+@property (nonatomic, assign) uint64_t transferredBytes;
+@property (nonatomic, assign) uint64_t writtenBytes;
+@property (nonatomic, assign) uint64_t evictedBytes;
+@end
+
+@implementation AFCacheSimulatorRun
+
+- (NSString*)storageGovernorContext {
+    return kAFCacheSimulatorContext;
+}
+
+- (NSDictionary*)storageGovernorItemInfos {
+    return [self.store copy];
+}
+
+- (BOOL)storageGovernorIsPinnedKey:(NSString*)key {
+    return NO;
+}
+
+- (NSSet*)storageGovernorRetainedKeys {
+    return nil;
+}
+
+- (BOOL)storageGovernorEvictKey:(NSString*)key info:(AFCacheableItemInfo*)info {
+    if (self.store[key] != info) {
+        return NO;
+    }
+    [self.store removeObjectForKey:key];
+    self.storeSize -= MIN(self.storeSize, info.contentLength);
+    self.evictedItems++;
+    self.evictedBytes += info.contentLength;
+    return YES;
+}
+
+- (void)storageGovernorDidEvict {
+}
+
+@end
+
+@implementation AFCacheSimulator {
+    AFCacheTraceReader *_traceReader;
+}
+
+- (instancetype)initWithTraceReader:(AFCacheTraceReader*)traceReader {
+    self = [super init];
+    if (self) {
+        _traceReader = traceReader;
+    }
+    return self;
+}
+
+- (NSDictionary*)runWithConfiguration:(AFCacheSimulatorConfiguration*)configuration {
+    AFCacheSimulatorRun *run = [[AFCacheSimulatorRun alloc] init];
+    run.configuration = [configuration copy];
+    run.store = [AFCacheInfoStore dictionary];
+    if (configuration.admissionFilter) {
+        run.admissionFilter = [[AFCacheAdmissionFilter alloc] initWithExpectedItemCount:configuration.expectedItemCount];
+    }
+
+    run.clock = [[AFCacheManualClock alloc] initWithTime:_traceReader.startTimestamp];
+    if (configuration.byteBudget > 0) {
+        run.governor = [[AFStorageGovernor alloc] init];
+        run.governor.clock = run.clock;
+        run.governor.utilityHalfLife = configuration.utilityHalfLife;
+        [run.governor setMinimumBytes:0 maximumBytes:configuration.byteBudget forContext:kAFCacheSimulatorContext];
+        // the enforcement the quota schedules finds no store yet, only the replay's own enforcements evict
+        [run.governor enforce];
+        [run.governor registerStore:run];
+    }
+
+    NSTimeInterval lastEnforcement = _traceReader.startTimestamp;
+    AFCacheTraceRecord record;
+    [_traceReader rewind];
+    while ([_traceReader readRecord:&record]) {
+        [run.clock setNow:record.timestamp];
+        if (record.timestamp - lastEnforcement >= configuration.enforcementInterval) {
+            [self enforceBudgetOfRun:run];
+            lastEnforcement = record.timestamp;
+        }
+        @autoreleasepool {
+            [self replayRecord:&record run:run];
+        }
+    }
+
+    [run.governor unregisterStore:run];
+    AFLog(@"simulated %lu requests with %@", (unsigned long)run.requests, run.configuration);
+    return [self resultOfRun:run];
+}
+
+- (void)replayRecord:(AFCacheTraceRecord*)record run:(AFCacheSimulatorRun*)run {
+    run.requests++;
+    if (record->status == kAFCacheTraceStatusFailed) {
+        run.failures++;
+        return;
+    }
+    run.requestedBytes += record->size;
+
+    // the trace has no URLs, the hash stands in for one
+    NSString *key = [NSString stringWithFormat:@"%016llx%016llx", record->keyHash.h1, record->keyHash.h2];
+    AFCacheableItemInfo *info = run.store[key];
+
+    // like -[AFCache recordAccessForItem:]
+    [run.admissionFilter recordAccessForKey:key];
+    [info recordAccessAtTime:[run.clock now]];
+
+    if (info && [info remainingFreshnessAtTime:[run.clock now]] > 0) {
+        run.hits++;
+        run.hitBytes += record->size;
+        return;
+    }
+
+    [run.clock setNow:record->timestamp + record->duration];
+    if (info) {
+        run.revalidations++;
+        [self updateInfo:info withRecord:record];
+        if (info.contentLength != record->size) {
+            // modified
+            run.transferredBytes += record->size;
+            run.writtenBytes += record->size;
+            run.storeSize = run.storeSize - MIN(run.storeSize, info.contentLength) + record->size;
+            info.contentLength = record->size;
+        }
+        return;
+    }
+
+    run.misses++;
+    run.transferredBytes += record->size;
+    info = [[AFCacheableItemInfo alloc] init];
+    info.accessCount = 1;
+    info.lastAccessTimestamp = record->timestamp;
+    info.contentLength = record->size;
+    [self updateInfo:info withRecord:record];
+    BOOL admit = !run.admissionFilter || [run.admissionFilter shouldAdmitCandidateKey:key
+                                                                                 info:info
+                                                                                 size:info.contentLength
+                                                                            storeSize:run.storeSize
+                                                                           byteBudget:run.configuration.byteBudget
+                                                                               sample:^NSDictionary *{
+        return [run.store sampleWithCount:kAFCacheAdmissionVictimSampleCount];
+    }];
+    if (!admit) {
+        run.rejectedItems++;
+        return;
+    }
+    run.store[key] = info;
+    run.storeSize += record->size;
+    run.writtenBytes += record->size;
+}
+
+// timestamps as set by the download operation
+- (void)updateInfo:(AFCacheableItemInfo*)info withRecord:(AFCacheTraceRecord*)record {
+    NSTimeInterval responseTimestamp = record->timestamp + record->duration;
+    info.requestTimestamp = record->timestamp;
+    info.responseTimestamp = responseTimestamp;
+    info.serverDate = [NSDate dateWithTimeIntervalSinceReferenceDate:responseTimestamp];
+    info.maxAge = record->freshnessLifetime > 0 ? @(record->freshnessLifetime) : nil;
+}
+
+// the governor's maximum for the context of the run is its budget, so step 1 of -[AFStorageGovernor enforce] applies it
+- (void)enforceBudgetOfRun:(AFCacheSimulatorRun*)run {
+    if (!run.governor || run.storeSize <= run.configuration.byteBudget) {
+        return;
+    }
+    [run.governor enforce];
+}
+
+- (NSDictionary*)resultOfRun:(AFCacheSimulatorRun*)run {
+    return @{kAFCacheSimulatorConfigurationKey : [run.configuration description],
+             kAFCacheSimulatorRequestsKey : @(run.requests),
+             kAFCacheSimulatorHitsKey : @(run.hits),
+             kAFCacheSimulatorMissesKey : @(run.misses),
+             kAFCacheSimulatorRevalidationsKey : @(run.revalidations),
+             kAFCacheSimulatorFailuresKey : @(run.failures),
+             kAFCacheSimulatorRejectedItemsKey : @(run.rejectedItems),
+             kAFCacheSimulatorEvictedItemsKey : @(run.evictedItems),
+             kAFCacheSimulatorRequestedBytesKey : @(run.requestedBytes),
+             kAFCacheSimulatorHitBytesKey : @(run.hitBytes),
+             kAFCacheSimulatorTransferredBytesKey : @(run.transferredBytes),
+             kAFCacheSimulatorWrittenBytesKey : @(run.writtenBytes),
+             kAFCacheSimulatorEvictedBytesKey : @(run.evictedBytes),
+             kAFCacheSimulatorHitRatioKey : @(run.requests > 0 ? (double)run.hits / run.requests : 0),
+             kAFCacheSimulatorByteHitRatioKey : @(run.requestedBytes > 0 ? (double)run.hitBytes / run.requestedBytes : 0),
+             kAFCacheSimulatorWriteAmplificationKey : @(run.requestedBytes > 0 ? (double)run.writtenBytes / run.requestedBytes : 0),
+             };
+}
+
+@end
@@ -0,0 +1,96 @@
+//
+//  AFCacheSlabStore.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFCacheBodySource.h"
+
+@class AFCache;
+
+// the store is registered as body source under this key, the bodySourceEntry of an info is "segment:offset:length"
+#define kAFCacheSlabStoreBodySourceKey @"afcache-slabs"
+// directory of the segment files in the cache directory, skipped by the garbage collector
+#define kAFCacheSlabStoreDirectoryName @"afcache_slabs"
+#define kAFCacheSlabStoreSegmentExtension @"slab"
+
+// a segment is sealed once the next body would not fit anymore. Larger bodies cannot be packed.
+#define kAFCacheSlabStoreDefaultSegmentLength (4 * 1024 * 1024)
+#define kAFCacheSlabStoreDefaultCompactionDelay 5.0
+// segments with less live bytes than this fraction of their length are compacted
+#define kAFCacheSlabStoreDefaultCompactionLiveRatio 0.5
+// younger segments are left alone, e.g. one another process sharing the cache directory has just created
+#define kAFCacheSlabStoreDefaultCompactionMinimumAge 60.0
+#define kAFCacheSlabStoreDefaultMaximumMappedSegmentCount 16
+
+// keys of the dictionary returned by -[AFCacheSlabStore statistics]
+#define kAFCacheSlabStoreAppendedBodiesKey @"appendedBodies"
+#define kAFCacheSlabStoreAppendedBytesKey @"appendedBytes"
+#define kAFCacheSlabStoreMappedSegmentsKey @"mappedSegments"
+#define kAFCacheSlabStoreUnmappedSegmentsKey @"unmappedSegments" // least recently used, to stay below maximumMappedSegmentCount
+#define kAFCacheSlabStoreCompactionsKey @"compactions"
+#define kAFCacheSlabStoreMovedBodiesKey @"movedBodies"         // copied out of compacted segments
+#define kAFCacheSlabStoreRemovedSegmentsKey @"removedSegments"
+#define kAFCacheSlabStoreReclaimedBytesKey @"reclaimedBytes"
+
+/*
+ * Packs small bodies into append-only segment files, see -[AFCache slabObjectThreshold], instead of giving
+ * each of them a file of its own with its inode, extended attributes and the syscalls to create them.
+ *
+ * A body is appended to the segment this process writes, its segment, offset and length are recorded in the entry's
+ * bodySourceEntry, so the info store is the only index. Every process sharing the cache directory writes
+ * segments of its own, named by a UUID.
+ * Bodies are read from read-only mappings of the segments, which are made on demand. The files are closed once mapped,
+ * and at most maximumMappedSegmentCount mappings are kept, the least recently used one is given up for a new one.
+ * -bodyForItemInfo: returns a slice of the mapping without copying, which keeps the mapping alive.
+ *
+ * Removing or replacing an entry leaves its bytes behind as dead space. Compaction runs on a background queue
+ * after removals (setNeedsCompaction): it sums up the live bytes of every segment from the info store, removes
+ * segments without any and copies the live bodies of those below compactionLiveRatio into the current segment before
+ * it removes them. The moved entries are rewritten on the main thread. A process holds an flock on the segment
+ * it writes until it is sealed, locked segments and those modified less than compactionMinimumAge ago are left alone.
+ *
+ * All methods may be called from any thread, except compact.
+ */
+@interface AFCacheSlabStore : NSObject <AFCacheBodySource>
+
+@property (nonatomic, weak, readonly) AFCache *cache;
+
+@property (nonatomic, assign) uint64_t segmentLength;
+@property (nonatomic, assign) NSTimeInterval compactionDelay;
+@property (nonatomic, assign) double compactionLiveRatio;
+@property (nonatomic, assign) NSTimeInterval compactionMinimumAge;
+@property (nonatomic, assign) NSUInteger maximumMappedSegmentCount;
+
+- (instancetype)initWithCache:(AFCache*)cache;
+
+/*
+ * appends a body and returns its bodySourceEntry, nil if it is longer than segmentLength or cannot be written
+ */
+- (NSString*)appendBody:(NSData*)body;
+
+/*
+ * YES if info's body is stored here
+ */
+- (BOOL)containsBodyOfItemInfo:(AFCacheableItemInfo*)info;
+
+/*
+ * compacts soon. Calls are coalesced.
+ */
+- (void)setNeedsCompaction;
+
+/*
+ * Blocks until done and waits for the main thread, do not call on the main thread
+ */
+- (void)compact;
+
+/*
+ * forgets the segment written and the mappings, e.g. after the cache directory has been removed
+ */
+- (void)reset;
+
+- (NSDictionary*)statistics;
+
+@end
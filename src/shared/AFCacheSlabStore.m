@@ -0,0 +1,496 @@
+//
+//  AFCacheSlabStore.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheSlabStore.h"
+#import "AFCache+PrivateAPI.h"
+#import "AFCacheableItemInfo.h"
+#import "AFCacheSharedStore.h"
+#import "AFCache_Logging.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+static BOOL AFCacheSlabStoreParseEntry(NSString *entry, NSString **segmentName, uint64_t *offset, uint64_t *length) {
+    NSArray *components = [entry componentsSeparatedByString:@":"];
+    if ([components count] != 3 || [components[0] length] == 0 || [components[0] rangeOfString:@"/"].location != NSNotFound) {
+        return NO;
+    }
+    *segmentName = components[0];
+    *offset = strtoull([components[1] UTF8String], NULL, 10);
+    *length = strtoull([components[2] UTF8String], NULL, 10);
+    return *length > 0;
+}
+
+/*
+ * Read-only mapping of a segment file. The mapping is as long as a segment may grow, the bytes beyond the end
+ * of the file are never touched. The file is closed once it is mapped, so only the mapping counts against the process.
+ */
+@interface AFCacheSlabSegment : NSObject
+@property (nonatomic, readonly) const uint8_t *bytes;
+@property (nonatomic, readonly) uint64_t mappedLength;
+@property (nonatomic, assign) uint64_t lastUse; // synchronized on the store
+- (instancetype)initWithPath:(NSString*)path mappedLength:(uint64_t)mappedLength;
+- (BOOL)containsRangeAtOffset:(uint64_t)offset length:(uint64_t)length;
+@end
+
+@implementation AFCacheSlabSegment {
+    NSString *_path;
+    uint64_t _knownLength; // bytes known to be in the file, synchronized on self
+}
+
+- (instancetype)initWithPath:(NSString*)path mappedLength:(uint64_t)mappedLength {
+    self = [super init];
+    if (self) {
+        int fd = open([path fileSystemRepresentation], O_RDONLY);
+        if (fd < 0) {
+            AFLog(@"no slab segment at %@ (errno %d)", path, errno);
+            return nil;
+        }
+        struct stat segmentStat;
+        if (fstat(fd, &segmentStat) == 0) {
+            _knownLength = (uint64_t)segmentStat.st_size;
+        }
+        _mappedLength = MAX(mappedLength, _knownLength);
+        void *mapping = mmap(NULL, (size_t)_mappedLength, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            NSLog(@"AFCache: Could not map %@ (errno %d)", path, errno);
+            return nil;
+        }
+        _bytes = mapping;
+        _path = [path copy];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_bytes) {
+        munmap((void*)_bytes, (size_t)_mappedLength);
+    }
+}
+
+- (BOOL)containsRangeAtOffset:(uint64_t)offset length:(uint64_t)length {
+    uint64_t end = offset + length;
+    if (end < offset || end > self.mappedLength) {
+        return NO;
+    }
+    @synchronized (self) {
+        if (end > _knownLength) {
+            // appended since
+            struct stat segmentStat;
+            if (stat([_path fileSystemRepresentation], &segmentStat) == 0) {
+                _knownLength = (uint64_t)segmentStat.st_size;
+            }
+        }
+        return end <= _knownLength;
+    }
+}
+
+@end
+
+@interface AFCacheSlabStore ()
+@property (nonatomic, weak) AFCache *cache;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@end
+
+@implementation AFCacheSlabStore {
+    BOOL _compactionScheduled; // on the queue
+
+    // synchronized on self
+    NSMutableDictionary *_segments; // name -> AFCacheSlabSegment
+    uint64_t _segmentUseCount;      // stamps lastUse of the segments
+    int _writeFD;
+    NSString *_writeSegmentName;
+    uint64_t _writeOffset;
+
+    NSUInteger _appendedBodyCount;
+    uint64_t _appendedByteCount;
+    NSUInteger _compactionCount;
+    NSUInteger _movedBodyCount;
+    NSUInteger _removedSegmentCount;
+    uint64_t _reclaimedByteCount;
+    NSUInteger _unmappedSegmentCount;
+}
+
+- (instancetype)initWithCache:(AFCache*)cache {
+    self = [super init];
+    if (self) {
+        _cache = cache;
+        _segmentLength = kAFCacheSlabStoreDefaultSegmentLength;
+        _compactionDelay = kAFCacheSlabStoreDefaultCompactionDelay;
+        _compactionLiveRatio = kAFCacheSlabStoreDefaultCompactionLiveRatio;
+        _compactionMinimumAge = kAFCacheSlabStoreDefaultCompactionMinimumAge;
+        _maximumMappedSegmentCount = kAFCacheSlabStoreDefaultMaximumMappedSegmentCount;
+        _segments = [NSMutableDictionary dictionary];
+        _writeFD = -1;
+        _queue = dispatch_queue_create("de.artifacts.afcache.slabstore", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(_queue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_writeFD >= 0) {
+        close(_writeFD);
+    }
+#if !OS_OBJECT_USE_OBJC
+    if (_queue) {
+        dispatch_release(_queue);
+    }
+#endif
+}
+
+- (NSString*)directory {
+    NSString *dataPath = self.cache.dataPath;
+    return dataPath ? [dataPath stringByAppendingPathComponent:kAFCacheSlabStoreDirectoryName] : nil;
+}
+
+- (NSString*)pathOfSegmentNamed:(NSString*)segmentName {
+    return [[[self directory] stringByAppendingPathComponent:segmentName] stringByAppendingPathExtension:kAFCacheSlabStoreSegmentExtension];
+}
+
+#pragma mark - Writing
+
+- (NSString*)appendBody:(NSData*)body {
+    uint64_t length = [body length];
+    if (length == 0 || length > self.segmentLength) {
+        return nil;
+    }
+    @synchronized (self) {
+        if (_writeFD >= 0 && _writeOffset + length > self.segmentLength) {
+            [self sealSegment];
+        }
+        if (_writeFD < 0 && ![self openSegment]) {
+            return nil;
+        }
+        if (![self writeBody:body]) {
+            // the next body goes into a new segment, the bytes written so far are dead
+            [self sealSegment];
+            return nil;
+        }
+        NSString *entry = [NSString stringWithFormat:@"%@:%llu:%llu", _writeSegmentName, _writeOffset, length];
+        _writeOffset += length;
+        _appendedBodyCount++;
+        _appendedByteCount += length;
+        return entry;
+    }
+}
+
+// synchronized
+- (BOOL)openSegment {
+    NSString *directory = [self directory];
+    if (!directory) {
+        return NO;
+    }
+    if (![[NSFileManager defaultManager] fileExistsAtPath:directory]) {
+        NSError *error = nil;
+        if (![[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:&error]) {
+            NSLog(@"AFCache: Could not create directory \"%@\" (Error: %@)", directory, [error localizedDescription]);
+            return NO;
+        }
+        [AFCache addSkipBackupAttributeToItemAtURL:[NSURL fileURLWithPath:directory]];
+    }
+    NSString *segmentName = [[NSUUID UUID] UUIDString];
+    NSString *path = [self pathOfSegmentNamed:segmentName];
+    int fd = open([path fileSystemRepresentation], O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        NSLog(@"AFCache: Could not create %@ (errno %d)", path, errno);
+        return NO;
+    }
+    // held until the segment is sealed, so other processes never compact it meanwhile
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        NSLog(@"AFCache: Could not lock %@ (errno %d)", path, errno);
+    }
+    _writeFD = fd;
+    _writeSegmentName = segmentName;
+    _writeOffset = 0;
+    AFLog(@"opened slab segment %@", path);
+    return YES;
+}
+
+// synchronized
+- (void)sealSegment {
+    if (_writeFD >= 0) {
+        close(_writeFD);
+    }
+    _writeFD = -1;
+    _writeSegmentName = nil;
+    _writeOffset = 0;
+}
+
+// synchronized
+- (BOOL)writeBody:(NSData*)body {
+    const uint8_t *bytes = [body bytes];
+    NSUInteger written = 0;
+    while (written < [body length]) {
+        ssize_t result = pwrite(_writeFD, bytes + written, [body length] - written, (off_t)(_writeOffset + written));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            NSLog(@"AFCache: Could not append to slab segment %@ (errno %d)", _writeSegmentName, errno);
+            return NO;
+        }
+        written += (NSUInteger)result;
+    }
+    return YES;
+}
+
+#pragma mark - AFCacheBodySource
+
+- (AFCacheSlabSegment*)segmentNamed:(NSString*)segmentName {
+    @synchronized (self) {
+        AFCacheSlabSegment *segment = _segments[segmentName];
+        if (!segment) {
+            segment = [[AFCacheSlabSegment alloc] initWithPath:[self pathOfSegmentNamed:segmentName] mappedLength:self.segmentLength];
+            if (segment) {
+                [self unmapLeastRecentlyUsedSegments];
+                _segments[segmentName] = segment;
+            }
+        }
+        segment.lastUse = ++_segmentUseCount;
+        return segment;
+    }
+}
+
+// synchronized. Makes room for one more mapping. Slices of an unmapped segment keep its mapping until they are released.
+- (void)unmapLeastRecentlyUsedSegments {
+    while ([_segments count] > 0 && [_segments count] >= MAX(self.maximumMappedSegmentCount, (NSUInteger)1)) {
+        __block NSString *leastRecentlyUsedName = nil;
+        __block uint64_t leastRecentUse = UINT64_MAX;
+        [_segments enumerateKeysAndObjectsUsingBlock:^(NSString *segmentName, AFCacheSlabSegment *segment, BOOL *stop) {
+            if (segment.lastUse < leastRecentUse) {
+                leastRecentUse = segment.lastUse;
+                leastRecentlyUsedName = segmentName;
+            }
+        }];
+        [_segments removeObjectForKey:leastRecentlyUsedName];
+        _unmappedSegmentCount++;
+    }
+}
+
+- (BOOL)containsBodyOfItemInfo:(AFCacheableItemInfo*)info {
+    return [info.bodySourceKey isEqualToString:kAFCacheSlabStoreBodySourceKey];
+}
+
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info {
+    NSString *segmentName = nil;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    if (!AFCacheSlabStoreParseEntry(info.bodySourceEntry, &segmentName, &offset, &length)) {
+        return NO;
+    }
+    return [[self segmentNamed:segmentName] containsRangeAtOffset:offset length:length];
+}
+
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info {
+    NSString *segmentName = nil;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    if (!AFCacheSlabStoreParseEntry(info.bodySourceEntry, &segmentName, &offset, &length)) {
+        return nil;
+    }
+    AFCacheSlabSegment *segment = [self segmentNamed:segmentName];
+    if (![segment containsRangeAtOffset:offset length:length]) {
+        return nil;
+    }
+    // the slice keeps the mapping alive, even after the segment has been compacted
+    return [[NSData alloc] initWithBytesNoCopy:(void*)(segment.bytes + offset) length:(NSUInteger)length deallocator:^(void *bytes, NSUInteger sliceLength) {
+        (void)segment;
+    }];
+}
+
+#pragma mark - Compaction
+
+- (void)setNeedsCompaction {
+    dispatch_async(self.queue, ^{
+        if (self->_compactionScheduled) {
+            return;
+        }
+        self->_compactionScheduled = YES;
+        __weak AFCacheSlabStore *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.compactionDelay * NSEC_PER_SEC)), self.queue, ^{
+            AFCacheSlabStore *store = weakSelf;
+            if (!store) {
+                return;
+            }
+            store->_compactionScheduled = NO;
+            [store performCompaction];
+        });
+    });
+}
+
+- (void)compact {
+    dispatch_sync(self.queue, ^{
+        [self performCompaction];
+    });
+}
+
+// on the queue
+- (void)performCompaction {
+    AFCache *cache = self.cache;
+    NSString *directory = [self directory];
+    if (!cache || !directory) {
+        return;
+    }
+
+    // live bytes and entries by segment, entries of other processes sharing the directory included
+    [cache.sharedStore synchronize];
+    NSDictionary *cachedItemInfos = [cache.cachedItemInfos copy];
+    NSMutableDictionary *liveBytes = [NSMutableDictionary dictionary];
+    NSMutableDictionary *liveEntries = [NSMutableDictionary dictionary]; // segment -> @[key, bodySourceEntry]
+    [cachedItemInfos enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+        NSString *segmentName = nil;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        if (![info isKindOfClass:[AFCacheableItemInfo class]] || ![self containsBodyOfItemInfo:info] ||
+            !AFCacheSlabStoreParseEntry(info.bodySourceEntry, &segmentName, &offset, &length)) {
+            return;
+        }
+        liveBytes[segmentName] = @([liveBytes[segmentName] unsignedLongLongValue] + length);
+        NSMutableArray *entries = liveEntries[segmentName];
+        if (!entries) {
+            entries = [NSMutableArray array];
+            liveEntries[segmentName] = entries;
+        }
+        [entries addObject:@[key, info.bodySourceEntry]];
+    }];
+
+    NSString *writeSegmentName = nil;
+    @synchronized (self) {
+        writeSegmentName = _writeSegmentName;
+    }
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+    BOOL movedBodies = NO;
+    for (NSString *filename in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:nil]) {
+        NSString *segmentName = [filename stringByDeletingPathExtension];
+        if (![[filename pathExtension] isEqualToString:kAFCacheSlabStoreSegmentExtension] || [segmentName isEqualToString:writeSegmentName]) {
+            continue;
+        }
+        NSString *path = [directory stringByAppendingPathComponent:filename];
+        struct stat segmentStat;
+        if (stat([path fileSystemRepresentation], &segmentStat) != 0 || now - segmentStat.st_mtime < self.compactionMinimumAge) {
+            continue;
+        }
+        uint64_t segmentLength = (uint64_t)segmentStat.st_size;
+        uint64_t live = [liveBytes[segmentName] unsignedLongLongValue];
+        if (live > 0 && live >= segmentLength * self.compactionLiveRatio) {
+            continue;
+        }
+        // a process holds the lock of the segment it writes, however long it has been idle
+        int fd = open([path fileSystemRepresentation], O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            AFLog(@"slab segment %@ is being written", segmentName);
+            close(fd);
+            continue;
+        }
+        BOOL moved = live == 0 || [self moveEntries:liveEntries[segmentName] ofSegmentAtPath:path cache:cache];
+        BOOL removed = moved && unlink([path fileSystemRepresentation]) == 0;
+        if (moved && !removed) {
+            NSLog(@"AFCache: Could not remove %@ (errno %d)", path, errno);
+        }
+        close(fd);
+        movedBodies = movedBodies || (moved && live > 0);
+        if (!removed) {
+            continue;
+        }
+        @synchronized (self) {
+            [_segments removeObjectForKey:segmentName];
+            _removedSegmentCount++;
+            _reclaimedByteCount += segmentLength - MIN(live, segmentLength);
+        }
+        AFLog(@"compacted slab segment %@ with %llu of %llu bytes live", segmentName, live, segmentLength);
+    }
+    @synchronized (self) {
+        _compactionCount++;
+    }
+    if (movedBodies) {
+        // the timer needs the main run loop
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [cache archive];
+        });
+    }
+}
+
+/*
+ * On the queue. Copies the bodies into the segment written now, NO if one could not be copied.
+ * The entries are then pointed at the copies on the main thread, which owns the infos, so an entry replaced meanwhile
+ * keeps its new body.
+ */
+- (BOOL)moveEntries:(NSArray*)entries ofSegmentAtPath:(NSString*)path cache:(AFCache*)cache {
+    NSError *error = nil;
+    NSData *segmentData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:&error];
+    if (!segmentData) {
+        NSLog(@"AFCache: Could not read %@ (Error: %@)", path, [error localizedDescription]);
+        return NO;
+    }
+    NSMutableArray *moves = [NSMutableArray arrayWithCapacity:[entries count]]; // @[key, bodySourceEntry, moved bodySourceEntry]
+    for (NSArray *keyAndEntry in entries) {
+        @autoreleasepool {
+            NSString *key = keyAndEntry[0];
+            NSString *entry = keyAndEntry[1];
+            NSString *segmentName = nil;
+            uint64_t offset = 0;
+            uint64_t length = 0;
+            if (!AFCacheSlabStoreParseEntry(entry, &segmentName, &offset, &length) || offset + length > [segmentData length]) {
+                // truncated by a crash, the entry is dropped with the segment
+                continue;
+            }
+            NSString *movedEntry = [self appendBody:[segmentData subdataWithRange:NSMakeRange((NSUInteger)offset, (NSUInteger)length)]];
+            if (!movedEntry) {
+                return NO;
+            }
+            [moves addObject:@[key, entry, movedEntry]];
+        }
+    }
+
+    dispatch_sync(dispatch_get_main_queue(), ^{
+        for (NSArray *move in moves) {
+            // an entry replaced meanwhile keeps its new body, the copy is dead space
+            AFCacheableItemInfo *info = [cache.cachedItemInfos objectForKey:move[0]];
+            if ([self containsBodyOfItemInfo:info] && [info.bodySourceEntry isEqualToString:move[1]]) {
+                info.bodySourceEntry = move[2];
+                [cache.cachedItemInfos setObject:info forKey:move[0]];
+                @synchronized (self) {
+                    self->_movedBodyCount++;
+                }
+            }
+        }
+    });
+    return YES;
+}
+
+- (void)reset {
+    @synchronized (self) {
+        [self sealSegment];
+        [_segments removeAllObjects];
+    }
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFCacheSlabStoreAppendedBodiesKey : @(_appendedBodyCount),
+                 kAFCacheSlabStoreAppendedBytesKey : @(_appendedByteCount),
+                 kAFCacheSlabStoreMappedSegmentsKey : @([_segments count]),
+                 kAFCacheSlabStoreUnmappedSegmentsKey : @(_unmappedSegmentCount),
+                 kAFCacheSlabStoreCompactionsKey : @(_compactionCount),
+                 kAFCacheSlabStoreMovedBodiesKey : @(_movedBodyCount),
+                 kAFCacheSlabStoreRemovedSegmentsKey : @(_removedSegmentCount),
+                 kAFCacheSlabStoreReclaimedBytesKey : @(_reclaimedByteCount),
+                 };
+    }
+}
+
+@end
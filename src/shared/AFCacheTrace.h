@@ -0,0 +1,91 @@
+//
+//  AFCacheTrace.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFCacheKey.h"
+
+typedef enum {
+    kAFCacheTraceStatusHit = 0,         // served from the store without a request
+    kAFCacheTraceStatusMiss = 1,        // not in the store, downloaded
+    kAFCacheTraceStatusRevalidated = 2, // in the store but stale, revalidated with the server
+    kAFCacheTraceStatusFailed = 3,      // neither served nor downloaded
+} AFCacheTraceStatus;
+
+/*
+ * One lookup as recorded in a trace
+ */
+typedef struct {
+    NSTimeInterval timestamp;           // of the lookup, since the reference date
+    NSTimeInterval duration;            // until the lookup was served or failed
+    AFCacheKeyHash128 keyHash;
+    uint64_t size;                      // content length, 0 if unknown
+    NSTimeInterval freshnessLifetime;   // of the entry served, 0 if it has none
+    AFCacheTraceStatus status;
+} AFCacheTraceRecord;
+
+/*
+ * Binary log of the lookups of a cache, to replay them in AFCacheSimulator.
+ *
+ * A trace starts with a 16 byte header: the magic "AFCT", a version (uint32) and the time the recording started
+ * (float64, seconds since the reference date). Each record is 40 bytes:
+ *
+ *   uint32   milliseconds from the start of the trace to the lookup
+ *   uint32   milliseconds until the lookup was served or failed
+ *   uint64   first half of the key's hash, see AFCacheKey.h
+ *   uint64   second half of the key's hash
+ *   uint64   size in bytes
+ *   float32  freshness lifetime in seconds
+ *   uint8    AFCacheTraceStatus
+ *   uint8[3] reserved, 0
+ *
+ * All values are little endian. URLs are not recorded, so traces of production clients can be collected
+ * without collecting what their users looked at.
+ *
+ * Records are buffered by stdio, so recording costs a copy of 40 bytes per lookup. All methods may be called from any thread.
+ */
+@interface AFCacheTraceRecorder : NSObject
+
+@property (nonatomic, readonly) NSString *path;
+@property (nonatomic, readonly) NSUInteger recordCount;
+
+/*
+ * creates or truncates the file at path. nil if it cannot be written.
+ */
+- (instancetype)initWithPath:(NSString*)path;
+
+- (void)addRecord:(AFCacheTraceRecord)record;
+
+/*
+ * writes the buffered records
+ */
+- (void)flush;
+
+/*
+ * flushes and closes the file. Records added afterwards are dropped.
+ */
+- (void)close;
+
+@end
+
+@interface AFCacheTraceReader : NSObject
+
+@property (nonatomic, readonly) NSTimeInterval startTimestamp;
+@property (nonatomic, readonly) NSUInteger recordCount;
+
+/*
+ * maps the trace at path. nil if it is no trace.
+ */
+- (instancetype)initWithPath:(NSString*)path;
+
+/*
+ * reads the next record. NO at the end of the trace.
+ */
+- (BOOL)readRecord:(AFCacheTraceRecord*)record;
+
+- (void)rewind;
+
+@end
@@ -0,0 +1,197 @@
+//
+//  AFCacheTrace.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFCacheTrace.h"
+#import "AFCacheClock.h"
+#import "AFCache_Logging.h"
+
+#define kAFCacheTraceMagic 0x54434641 // "AFCT"
+#define kAFCacheTraceVersion 1
+#define kAFCacheTraceHeaderSize 16
+#define kAFCacheTraceRecordSize 40
+
+static inline void AFCacheTraceWrite32(uint8_t *bytes, uint32_t value) {
+    for (NSUInteger i = 0; i < 4; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static inline void AFCacheTraceWrite64(uint8_t *bytes, uint64_t value) {
+    for (NSUInteger i = 0; i < 8; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static inline uint32_t AFCacheTraceRead32(const uint8_t *bytes) {
+    uint32_t value = 0;
+    for (NSUInteger i = 0; i < 4; i++) {
+        value |= (uint32_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static inline uint64_t AFCacheTraceRead64(const uint8_t *bytes) {
+    uint64_t value = 0;
+    for (NSUInteger i = 0; i < 8; i++) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// milliseconds, clamped to what fits into 32 bits (about 49 days)
+static inline uint32_t AFCacheTraceMilliseconds(NSTimeInterval interval) {
+    return (uint32_t)MIN(MAX(0, interval * 1000), (double)UINT32_MAX);
+}
+
+#pragma mark - Recorder
+
+@implementation AFCacheTraceRecorder {
+    FILE *_file;
+    NSTimeInterval _startTimestamp;
+    NSUInteger _recordCount;
+}
+
+- (instancetype)initWithPath:(NSString*)path {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _file = fopen([path fileSystemRepresentation], "wb");
+        if (!_file) {
+            NSLog(@"AFCache: Could not create trace %@ (errno %d)", path, errno);
+            return nil;
+        }
+        _startTimestamp = AFCacheNow();
+
+        uint8_t header[kAFCacheTraceHeaderSize];
+        uint64_t start;
+        memcpy(&start, &_startTimestamp, sizeof(start));
+        AFCacheTraceWrite32(header, kAFCacheTraceMagic);
+        AFCacheTraceWrite32(header + 4, kAFCacheTraceVersion);
+        AFCacheTraceWrite64(header + 8, start);
+        fwrite(header, 1, sizeof(header), _file);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+- (void)addRecord:(AFCacheTraceRecord)record {
+    uint8_t bytes[kAFCacheTraceRecordSize];
+    float freshnessLifetime = (float)record.freshnessLifetime;
+    uint32_t freshnessLifetimeBits;
+    memcpy(&freshnessLifetimeBits, &freshnessLifetime, sizeof(freshnessLifetimeBits));
+    AFCacheTraceWrite32(bytes, AFCacheTraceMilliseconds(record.timestamp - _startTimestamp));
+    AFCacheTraceWrite32(bytes + 4, AFCacheTraceMilliseconds(record.duration));
+    AFCacheTraceWrite64(bytes + 8, record.keyHash.h1);
+    AFCacheTraceWrite64(bytes + 16, record.keyHash.h2);
+    AFCacheTraceWrite64(bytes + 24, record.size);
+    AFCacheTraceWrite32(bytes + 32, freshnessLifetimeBits);
+    AFCacheTraceWrite32(bytes + 36, (uint32_t)record.status);
+
+    @synchronized (self) {
+        if (!_file) {
+            return;
+        }
+        if (fwrite(bytes, 1, sizeof(bytes), _file) != sizeof(bytes)) {
+            NSLog(@"AFCache: Could not write trace %@ (errno %d), recording stopped", self.path, errno);
+            fclose(_file);
+            _file = NULL;
+            return;
+        }
+        _recordCount++;
+    }
+}
+
+- (NSUInteger)recordCount {
+    @synchronized (self) {
+        return _recordCount;
+    }
+}
+
+- (void)flush {
+    @synchronized (self) {
+        if (_file) {
+            fflush(_file);
+        }
+    }
+}
+
+- (void)close {
+    @synchronized (self) {
+        if (_file) {
+            fclose(_file);
+            _file = NULL;
+            AFLog(@"closed trace %@ with %lu records", self.path, (unsigned long)_recordCount);
+        }
+    }
+}
+
+@end
+
+#pragma mark - Reader
+
+@implementation AFCacheTraceReader {
+    NSData *_mapping;
+    NSUInteger _offset;
+}
+
+- (instancetype)initWithPath:(NSString*)path {
+    self = [super init];
+    if (self) {
+        NSError *error = nil;
+        _mapping = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:&error];
+        if (!_mapping) {
+            NSLog(@"AFCache: Could not read trace %@ (Error: %@)", path, [error localizedDescription]);
+            return nil;
+        }
+        const uint8_t *bytes = [_mapping bytes];
+        if ([_mapping length] < kAFCacheTraceHeaderSize || AFCacheTraceRead32(bytes) != kAFCacheTraceMagic) {
+            NSLog(@"AFCache: %@ is no trace", path);
+            return nil;
+        }
+        if (AFCacheTraceRead32(bytes + 4) != kAFCacheTraceVersion) {
+            NSLog(@"AFCache: Trace %@ has unsupported version %u", path, AFCacheTraceRead32(bytes + 4));
+            return nil;
+        }
+        uint64_t start = AFCacheTraceRead64(bytes + 8);
+        memcpy(&_startTimestamp, &start, sizeof(_startTimestamp));
+        // a trace that was not closed may end with part of a record
+        _recordCount = ([_mapping length] - kAFCacheTraceHeaderSize) / kAFCacheTraceRecordSize;
+        _offset = kAFCacheTraceHeaderSize;
+    }
+    return self;
+}
+
+- (BOOL)readRecord:(AFCacheTraceRecord*)record {
+    if (_offset + kAFCacheTraceRecordSize > kAFCacheTraceHeaderSize + _recordCount * kAFCacheTraceRecordSize) {
+        return NO;
+    }
+    const uint8_t *bytes = (const uint8_t *)[_mapping bytes] + _offset;
+    _offset += kAFCacheTraceRecordSize;
+
+    uint32_t freshnessLifetimeBits = AFCacheTraceRead32(bytes + 32);
+    float freshnessLifetime;
+    memcpy(&freshnessLifetime, &freshnessLifetimeBits, sizeof(freshnessLifetime));
+    record->timestamp = _startTimestamp + AFCacheTraceRead32(bytes) / 1000.0;
+    record->duration = AFCacheTraceRead32(bytes + 4) / 1000.0;
+    record->keyHash.h1 = AFCacheTraceRead64(bytes + 8);
+    record->keyHash.h2 = AFCacheTraceRead64(bytes + 16);
+    record->size = AFCacheTraceRead64(bytes + 24);
+    record->freshnessLifetime = freshnessLifetime;
+    record->status = (AFCacheTraceStatus)bytes[36];
+    return YES;
+}
+
+- (void)rewind {
+    _offset = kAFCacheTraceHeaderSize;
+}
+
+@end
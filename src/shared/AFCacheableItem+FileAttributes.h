@@ -16,4 +16,7 @@ extern const char* kAFCacheDownloadingFileAttribute;
 - (void)flagAsDownloadStartedWithContentLength:(uint64_t)contentLength;
 - (void)flagAsDownloadFinishedWithContentLength:(uint64_t)contentLength;
 - (uint64_t)getContentLengthFromFile;
+// Looks at the file with a single stat: complete if it has the info's contentLength, or else the length in its
+// content length attribute, and is not flagged as being downloaded. exists is set to NO if there is no file.
+- (BOOL)hasCompleteFileAtPath:(NSString*)filePath exists:(BOOL*)exists;
 @end
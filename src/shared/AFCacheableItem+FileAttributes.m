@@ -12,6 +12,7 @@
 #import "AFCache_Logging.h"
 #import "AFCacheableItem.h"
 #include <sys/xattr.h>
+#include <sys/stat.h>
 
 const char* kAFCacheContentLengthFileAttribute = "de.artifacts.contentLength";
 const char* kAFCacheDownloadingFileAttribute = "de.artifacts.downloading";
@@ -51,6 +52,28 @@ const char* kAFCacheDownloadingFileAttribute = "de.artifacts.downloading";
     }
 }
 
+- (BOOL)hasCompleteFileAtPath:(NSString*)filePath exists:(BOOL*)exists {
+    const char *path = [filePath fileSystemRepresentation];
+    struct stat fileStat;
+    if (!path || stat(path, &fileStat) != 0) {
+        *exists = NO;
+        return NO;
+    }
+    *exists = YES;
+
+    unsigned int downloading = 0;
+    if (sizeof(downloading) == getxattr(path, kAFCacheDownloadingFileAttribute, &downloading, sizeof(downloading), 0, 0)) {
+        return NO;
+    }
+    uint64_t fileSize = (uint64_t)fileStat.st_size;
+    if (self.info.contentLength > 0 && fileSize == self.info.contentLength) {
+        return YES;
+    }
+    uint64_t realContentLength = 0;
+    return sizeof(realContentLength) == getxattr(path, kAFCacheContentLengthFileAttribute, &realContentLength, sizeof(realContentLength), 0, 0) &&
+        realContentLength > 0 && realContentLength == fileSize;
+}
+
 - (uint64_t)getContentLengthFromFile {
     if ([self isQueuedOrDownloading]) {
         return 0LL;
@@ -59,6 +59,10 @@
 
     // Store data into file
     NSOutputStream *outputStream = [self.cache createOutputStreamForItem:self];
+    if (self.rejectedByAdmissionFilter) {
+        // the data stays in memory only
+        return;
+    }
     if (outputStream.hasSpaceAvailable) {
         NSInteger bytesWritten = [outputStream write:data.bytes maxLength:data.length];
         if (bytesWritten != data.length) {
@@ -71,7 +75,11 @@
             [self.delegate cannotWriteDataForItem:self];
         }
     }
+    NSData *packedBody = [outputStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
     [outputStream close];
+    if (packedBody && [self.cache storeBody:packedBody inSlabStoreForItem:self]) {
+        return;
+    }
     
     [self flagAsDownloadFinishedWithContentLength:data.length];
 }
@@ -23,6 +23,7 @@
 #endif
 
 #import "AFCacheableItemInfo.h"
+#import "AFCacheKey.h"
 
 #ifdef USE_TOUCHXML
 #import "TouchXML.h"
@@ -47,6 +48,11 @@ typedef void (^AFCacheableItemBlock)(AFCacheableItem* item);
 @interface AFCacheableItem : NSObject
 
 @property (nonatomic, strong) NSURL *url;
+@property (nonatomic, readonly) AFCacheKey *cacheKey; // of url, computed when url is set
+/*
+ * read from the cache file or the entry's body source on first access. AFMemoryGovernor may release what was read
+ * while the item is idle or on memory pressure, it is read again on the next access. Data that was set is kept.
+ */
 @property (nonatomic, strong) NSData *data;
 @property (nonatomic, strong) AFCache *cache;
 @property (nonatomic, weak) id <AFCacheableItemDelegate> delegate;
@@ -64,6 +70,7 @@ typedef void (^AFCacheableItemBlock)(AFCacheableItem* item);
 @property (nonatomic, strong) AFCacheableItemInfo *info;
 @property (nonatomic, weak) id userData;
 @property (nonatomic, assign) BOOL isPackageArchive;
+@property (nonatomic, assign) BOOL isPrefetch;
 @property (nonatomic, assign) uint64_t currentContentLength;
 /*
  Data for URL authentication
@@ -71,11 +78,14 @@ typedef void (^AFCacheableItemBlock)(AFCacheableItem* item);
 @property (nonatomic, strong) NSURLCredential *urlCredential;
 
 @property (nonatomic, assign) BOOL isRevalidating;
+@property (nonatomic, assign) BOOL isBackgroundRevalidation; // revalidation issued by the cache itself, nobody is waiting for it
 @property (nonatomic, readonly) BOOL canMapData;
 
 @property (nonatomic, strong) NSURLRequest *IMSRequest;
 @property (nonatomic, assign) BOOL servedFromCache;
 @property (nonatomic, assign) BOOL URLInternallyRewritten;
+@property (nonatomic, assign) BOOL rejectedByAdmissionFilter; // the body is only kept in memory, see -[AFCache admissionFilter]
+@property (nonatomic, assign) BOOL admissionDeferred; // the length was unknown, the admission filter decides once the body is complete
 
 // for debugging and testing purposes
 @property (nonatomic, assign) int tag;
@@ -93,6 +103,10 @@ typedef void (^AFCacheableItemBlock)(AFCacheableItem* item);
 // TODO: Move completionBlocks to AFDownloadOperation
 - (void)addCompletionBlock:(AFCacheableItemBlock)completionBlock failBlock:(AFCacheableItemBlock)failBlock progressBlock:(AFCacheableItemBlock)progressBlock;
 - (void)removeBlocks;
+// removes blocks added with addCompletionBlock:failBlock:progressBlock:, compared by identity
+- (void)removeCompletionBlock:(AFCacheableItemBlock)completionBlock failBlock:(AFCacheableItemBlock)failBlock progressBlock:(AFCacheableItemBlock)progressBlock;
+// YES while a completion or fail block is registered, i.e. a client is waiting for the item
+- (BOOL)hasClientBlocks;
 
 - (void)sendFailSignalToClientItems;
 - (void)sendSuccessSignalToClientItems;
@@ -106,6 +120,18 @@ typedef void (^AFCacheableItemBlock)(AFCacheableItem* item);
 - (BOOL)isComplete;
 - (BOOL)isDataLoaded;
 
+/*
+ * length of the body without reading it: of the data if it is loaded, otherwise of the cache file or the body source entry
+ */
+- (uint64_t)bodyLength;
+
+/*
+ * bytes of the body in range, nil if range exceeds the body or it cannot be read. Unless the data is loaded
+ * only the bytes of the range are read from the cache file, e.g. to serve Range requests, see AFHTTPRangeResponse.h.
+ * Like -data, returns nil while the file is incomplete.
+ */
+- (NSData*)dataInRange:(NSRange)range;
+
 - (NSString *)asString;
 - (NSString*)mimeType __attribute__((deprecated)); // mimeType moved to AFCacheableItemInfo. 
 // TODO: (Michael Markowski:) This method is implicitly guessing the mimetype which might be confusing because there's a property mimeType in AFCacheableItemInfo.
@@ -22,6 +22,10 @@
 #import "AFCacheableItem+FileAttributes.h"
 #import "AFCache+PrivateAPI.h"
 #import "AFCache_Logging.h"
+#import "AFMemoryGovernor.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 @interface AFCacheableItem ()
 @property NSMutableArray *completionBlocks;
@@ -30,7 +34,10 @@
 @property BOOL hasReturnedCachedItemBeforeRevalidation;
 @end
 
-@implementation AFCacheableItem
+@implementation AFCacheableItem {
+    uint64_t _residentDataLength;      // length of _data if it was read by -data and may be read again, see AFMemoryGovernor.h
+    NSTimeInterval _lastDataAccessTime;
+}
 
 - (instancetype)init {
 	self = [super init];
@@ -45,10 +52,15 @@
         _completionBlocks = [NSMutableArray array];
         _failBlocks = [NSMutableArray array];
         _progressBlocks = [NSMutableArray array];
+        [[AFMemoryGovernor sharedGovernor] itemDidInitialize:self];
 	}
 	return self;
 }
 
+- (void)dealloc {
+    [[AFMemoryGovernor sharedGovernor] itemDidDeallocateWithResidentDataOfLength:_residentDataLength];
+}
+
 - (AFCacheableItem*)initWithURL:(NSURL*)URL
                    lastModified:(NSDate*)lastModified
                      expireDate:(NSDate*)expireDate
@@ -61,6 +73,7 @@
         _info.expireDate = expireDate;
         _info.mimeType = contentType;
         _url = URL;
+        _cacheKey = [AFCacheKey keyWithURL:URL];
         _cacheStatus = kCacheStatusFresh;
         _validUntil = _info.expireDate;
         _cache = [AFCache sharedInstance];
@@ -98,6 +111,26 @@
     }
 }
 
+- (void)removeCompletionBlock:(AFCacheableItemBlock)completionBlock failBlock:(AFCacheableItemBlock)failBlock progressBlock:(AFCacheableItemBlock)progressBlock {
+    @synchronized (self) {
+        if (completionBlock) {
+            [self.completionBlocks removeObjectIdenticalTo:completionBlock];
+        }
+        if (failBlock) {
+            [self.failBlocks removeObjectIdenticalTo:failBlock];
+        }
+        if (progressBlock) {
+            [self.progressBlocks removeObjectIdenticalTo:progressBlock];
+        }
+    }
+}
+
+- (BOOL)hasClientBlocks {
+    @synchronized (self) {
+        return [self.completionBlocks count] > 0 || [self.failBlocks count] > 0;
+    }
+}
+
 - (void)performBlocks:(NSArray*)blocks {
     @synchronized (self) {
         blocks = [blocks copy];
@@ -107,9 +140,26 @@
     }
 }
 
+- (void)setUrl:(NSURL *)url {
+    _url = url;
+    _cacheKey = [AFCacheKey keyWithURL:url];
+}
+
+#pragma mark - Data
+
+// _data is read lazily and may be released by the memory governor from another thread, it is only accessed within @synchronized (self)
 - (NSData*)data {
-    if (!_data) {
-        
+    @synchronized (self) {
+        _lastDataAccessTime = [NSDate timeIntervalSinceReferenceDate];
+        if (_data) {
+            return _data;
+        }
+    }
+
+    NSData *data = nil;
+    if (self.info.bodySourceKey) {
+        data = [self.cache bodyForItemInfo:self.info];
+    } else {
 		if (!self.cache.skipValidContentLengthCheck && ![self hasValidContentLength])
 		{
 			return nil;
@@ -122,15 +172,121 @@
 		}
 
         NSError* error = nil;
-        _data = [NSData dataWithContentsOfFile:filePath options:NSDataReadingMappedIfSafe error:&error];
-        if (!_data)
+        data = [NSData dataWithContentsOfFile:filePath options:NSDataReadingMappedIfSafe error:&error];
+        if (!data)
         {
             NSLog(@"Error: Could not map file %@ because of error: %@", filePath, error);
         }
-        _canMapData = (_data != nil);
     }
-	
-    return _data;
+
+    @synchronized (self) {
+        _canMapData = (data != nil);
+        if (_data || !data) {
+            // set or read by another thread meanwhile
+            return _data;
+        }
+        _data = data;
+        _residentDataLength = [data length];
+    }
+    if ([data length] > 0) {
+        [[AFMemoryGovernor sharedGovernor] item:self didLoadResidentDataOfLength:[data length]];
+    }
+    return data;
+}
+
+- (void)setData:(NSData*)data {
+    uint64_t releasedLength = 0;
+    @synchronized (self) {
+        _data = data;
+        releasedLength = _residentDataLength;
+        _residentDataLength = 0;
+    }
+    if (releasedLength > 0) {
+        [[AFMemoryGovernor sharedGovernor] item:self didReleaseResidentDataOfLength:releasedLength];
+    }
+}
+
+- (uint64_t)bodyLength {
+    @synchronized (self) {
+        if (_data) {
+            return [_data length];
+        }
+    }
+    if (self.info.bodySourceKey) {
+        // e.g. the uncompressed size from the central directory of a package archive, reading the body may inflate it
+        if (self.info.contentLength > 0) {
+            return self.info.contentLength;
+        }
+        return [[self.cache bodyForItemInfo:self.info] length];
+    }
+    NSString *filePath = [self.cache fullPathForCacheableItem:self];
+    struct stat fileStatus;
+    if (!filePath || stat([filePath fileSystemRepresentation], &fileStatus) != 0) {
+        return 0;
+    }
+    return (uint64_t)fileStatus.st_size;
+}
+
+// Reads with pread instead of mapping the file, so neither the rest of the body nor the mapping stay resident
+- (NSData*)dataInRange:(NSRange)range {
+    @synchronized (self) {
+        if (_data) {
+            _lastDataAccessTime = [NSDate timeIntervalSinceReferenceDate];
+            return NSMaxRange(range) <= [_data length] ? [_data subdataWithRange:range] : nil;
+        }
+    }
+    if (self.info.bodySourceKey) {
+        NSData *body = [self.cache bodyForItemInfo:self.info];
+        return NSMaxRange(range) <= [body length] ? [body subdataWithRange:range] : nil;
+    }
+    if (!self.cache.skipValidContentLengthCheck && ![self hasValidContentLength]) {
+        return nil;
+    }
+
+    NSString *filePath = [self.cache fullPathForCacheableItem:self];
+    int fd = filePath ? open([filePath fileSystemRepresentation], O_RDONLY) : -1;
+    if (fd < 0) {
+        return nil;
+    }
+    NSMutableData *data = [NSMutableData dataWithLength:range.length];
+    NSUInteger readLength = 0;
+    while (readLength < range.length) {
+        ssize_t result = pread(fd, (uint8_t*)[data mutableBytes] + readLength, range.length - readLength, (off_t)(range.location + readLength));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        readLength += (NSUInteger)result;
+    }
+    int readErrno = errno;
+    close(fd);
+    if (readLength < range.length) {
+        NSLog(@"AFCache: Could not read bytes %lu-%lu of %@ (errno %d)", (unsigned long)range.location, (unsigned long)NSMaxRange(range) - 1, filePath, readErrno);
+        return nil;
+    }
+    return data;
+}
+
+- (NSTimeInterval)lastDataAccessTime {
+    @synchronized (self) {
+        return _lastDataAccessTime;
+    }
+}
+
+- (uint64_t)releaseResidentData {
+    uint64_t releasedLength = 0;
+    @synchronized (self) {
+        if (_residentDataLength == 0) {
+            return 0;
+        }
+        _data = nil;
+        releasedLength = _residentDataLength;
+        _residentDataLength = 0;
+    }
+    [[AFMemoryGovernor sharedGovernor] item:self didReleaseResidentDataOfLength:releasedLength];
+    return releasedLength;
 }
 
 - (void)sendFailSignalToClientItems {
@@ -177,46 +333,15 @@
 	NSAssert(self.info!=nil, @"AFCache internal inconsistency detected while validating freshness. AFCacheableItem's info object must not be nil. This is a software bug.");
 #endif
 	
-	NSTimeInterval apparent_age = fmax(0, self.info.responseTimestamp - [self.info.serverDate timeIntervalSinceReferenceDate]);
-	NSTimeInterval corrected_received_age = fmax(apparent_age, self.info.age);
-	NSTimeInterval response_delay = (self.info.responseTimestamp>0)?self.info.responseTimestamp - self.info.requestTimestamp:0;
-
-    // A zero (or negative) response delay indicates a transfer or connection error.
-    // This happened when the archiever started between request start and response.
-    if (response_delay < 0) {
-        NSLog(@"WARNING: response_delay must never be negative!");
-        return NO;
-    }
-    
-	NSTimeInterval corrected_initial_age = corrected_received_age + response_delay;
-	NSTimeInterval resident_time = [NSDate timeIntervalSinceReferenceDate] - self.info.responseTimestamp;
-	NSTimeInterval current_age = corrected_initial_age + resident_time;
-	
-	NSTimeInterval freshness_lifetime = 0;
-	
-	if (self.info.expireDate) {
-		freshness_lifetime = [self.info.expireDate timeIntervalSinceReferenceDate] - [self.info.serverDate timeIntervalSinceReferenceDate];
-	}
-	
-	// The max-age directive takes priority over Expires! Thanks, Serge ;)
-	if (self.info.maxAge) {
-		freshness_lifetime = [self.info.maxAge doubleValue];
-	}
-	
-	// Note:
-	// If none of Expires, Cache-Control: max-age, or Cache-Control: s- maxage (see section 14.9.3) appears in the response,
-	// and the response does not include other restrictions on caching, the cache MAY compute a freshness lifetime using a heuristic.
-	// The cache MUST attach Warning 113 to any response whose age is more than 24 hours if such warning has not already been added.
-	
-	BOOL fresh = (freshness_lifetime > current_age);
-	AFLog(@"freshness_lifetime: %@", [NSDate dateWithTimeIntervalSinceReferenceDate: freshness_lifetime]);
-	AFLog(@"current_age: %@", [NSDate dateWithTimeIntervalSinceReferenceDate: current_age]);
-	
-	return fresh;
+	return [self.info remainingFreshness] > 0;
 }
 
 - (BOOL)hasValidContentLength
 {
+	if (self.info.bodySourceKey) {
+		return [self.cache hasBodyForItemInfo:self.info];
+	}
+
 	NSString* filePath = [self.cache fullPathForCacheableItem:self];
 	if (![[NSFileManager defaultManager] fileExistsAtPath:filePath]) {
 		return NO;
@@ -242,7 +367,7 @@
 
 - (BOOL)isQueuedOrDownloading
 {
-    return [self.cache isQueuedOrDownloadingURL:self.url];
+    return [self.cache isQueuedOrDownloadingKey:self.cacheKey];
 }
 
 - (NSString *)asString {
@@ -266,7 +391,7 @@
 }
 
 - (BOOL)isCachedOnDisk {
-	return [self.cache.cachedItemInfos objectForKey: [self.url absoluteString]] != nil;
+	return [self.cache.cachedItemInfos objectForKey: self.cacheKey] != nil;
 }
 
 - (NSString*)guessContentType {
@@ -312,6 +437,6 @@
 }
 
 - (BOOL)isDownloading {
-    return [self.cache isDownloadingURL: self.url];
+    return [self.cache isDownloadingKey:self.cacheKey];
 }
 @end
@@ -28,6 +28,16 @@ typedef enum {
     kAFCachePackageArchiveStatusLoadingFailed = 4,
 } AFCachePackageArchiveStatus;
 
+/*
+ * Metadata of a cache entry. There is one per entry in the info store, so it is kept small:
+ * - dates are stored as time intervals, NSDate and NSNumber objects are created when the properties are read,
+ * - MIME types, header names and the scheme and host part of URLs are interned (see AFStringInterner.h),
+ * - only the headers named by +retainedHeaderNames are kept,
+ * - once the entry has been downloaded (-compact, called by the download operation) request and response objects
+ *   are replaced by records of their URL, method, status and headers. They are created again whenever the
+ *   properties are read, e.g. when AFHTTPURLProtocol serves the entry. The request body is not kept.
+ * Entries are archived in this form.
+ */
 @interface AFCacheableItemInfo : NSObject <NSCoding>
 
 @property (nonatomic, assign) NSTimeInterval requestTimestamp;
@@ -43,7 +53,7 @@ typedef enum {
 @property (nonatomic, assign) uint64_t contentLength;
 @property (nonatomic, assign) uint64_t actualLength;
 @property (nonatomic, copy) NSString *mimeType;
-@property (nonatomic, strong) NSDictionary *headers;
+@property (nonatomic, strong) NSDictionary *headers; // only the retained headers of what is set
 @property (nonatomic, strong) NSURL *responseURL; // may differ from url when redirection or URL rewriting has occured. nil if URL has not been modified.
 
 @property (nonatomic, strong) NSURLRequest *request;
@@ -54,5 +64,42 @@ typedef enum {
 @property (nonatomic, strong) NSString *cachePath;
 @property (nonatomic, assign) AFCachePackageArchiveStatus packageArchiveStatus;
 
+// set if the body is not stored in a file of its own but in a body source of the cache, see AFCacheBodySource.h
+@property (nonatomic, copy) NSString *bodySourceKey;
+@property (nonatomic, copy) NSString *bodySourceEntry;
+
+// how often and when the entry has been requested, used to decide what is worth revalidating in the background.
+// Lookups record accesses on any thread, so these are atomic.
+@property (atomic, assign) NSUInteger accessCount;
+@property (atomic, assign) NSTimeInterval lastAccessTimestamp;
+
+/*
+ * increments accessCount and sets lastAccessTimestamp, may be called from any thread
+ */
+- (void)recordAccess;
+- (void)recordAccessAtTime:(NSTimeInterval)now; // of a clock other than +[AFCacheClock currentClock], e.g. a simulated one
+
+/*
+ * names of the response headers that are kept, compared case-insensitively: the ones the cache evaluates and the
+ * ones needed to serve an entry again (Content-Type, Content-Length, Content-Disposition, Location, ...).
+ */
++ (NSSet*)retainedHeaderNames;
+
+/*
+ * keeps the header from now on, for entries stored afterwards. For applications that read other headers of cached responses.
+ */
++ (void)retainHeaderNamed:(NSString*)name;
+
+/*
+ * freshness lifetime minus current age (see -[AFCacheableItem isFresh]). Negative if the entry is stale.
+ */
+- (NSTimeInterval)remainingFreshness;
+- (NSTimeInterval)remainingFreshnessAtTime:(NSTimeInterval)now;
+
+/*
+ * seconds the response is fresh for, from max-age or Expires. 0 if it has neither.
+ */
+- (NSTimeInterval)freshnessLifetime;
+
 @end
 
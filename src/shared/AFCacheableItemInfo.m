@@ -20,8 +20,296 @@
 
 #import "AFCacheableItemInfo.h"
 #import "AFCache+PrivateAPI.h"
+#import "AFCache_Logging.h"
+#import "AFStringInterner.h"
+#import "AFCacheClock.h"
 
-@implementation AFCacheableItemInfo
+// timestamp of a date property that is nil
+#define kAFCacheableItemInfoNoTimestamp NAN
+
+static NSSet *AFCacheableItemInfoRetainedHeaderNames = nil; // lowercase, replaced as a whole when a name is added
+
+static NSSet *AFCacheableItemInfoCurrentRetainedHeaderNames(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        AFCacheableItemInfoRetainedHeaderNames = [NSSet setWithObjects:@"cache-control", @"expires", @"last-modified",
+                                                  @"etag", @"date", @"age", @"pragma", @"vary",
+                                                  @"content-type", @"content-length", @"content-language",
+                                                  @"content-disposition", @"content-range", @"accept-ranges",
+                                                  @"location", @"access-control-allow-origin", nil];
+    });
+    @synchronized ([AFCacheableItemInfo class]) {
+        return AFCacheableItemInfoRetainedHeaderNames;
+    }
+}
+
+/*
+ * the retained headers of headers with interned names. Returns headers itself if it has nothing else.
+ */
+static NSDictionary *AFCacheableItemInfoRetainedHeaders(NSDictionary *headers) {
+    if ([headers count] == 0) {
+        return nil;
+    }
+    NSSet *retainedHeaderNames = AFCacheableItemInfoCurrentRetainedHeaderNames();
+    AFStringInterner *interner = [AFStringInterner sharedInterner];
+    NSMutableDictionary *retainedHeaders = [NSMutableDictionary dictionaryWithCapacity:[headers count]];
+    __block BOOL interned = YES;
+    [headers enumerateKeysAndObjectsUsingBlock:^(NSString *name, id value, BOOL *stop) {
+        if ([retainedHeaderNames containsObject:[name lowercaseString]]) {
+            NSString *internedName = [interner internedString:name];
+            interned = interned && internedName == name;
+            retainedHeaders[internedName] = value;
+        }
+    }];
+    if (interned && [retainedHeaders count] == [headers count] && ![headers isKindOfClass:[NSMutableDictionary class]]) {
+        return headers;
+    }
+    return [retainedHeaders copy];
+}
+
+static inline NSDate *AFCacheableItemInfoDate(NSTimeInterval timestamp) {
+    return isnan(timestamp) ? nil : [NSDate dateWithTimeIntervalSinceReferenceDate:timestamp];
+}
+
+static inline NSTimeInterval AFCacheableItemInfoTimestamp(NSDate *date) {
+    return date ? [date timeIntervalSinceReferenceDate] : kAFCacheableItemInfoNoTimestamp;
+}
+
+// like -[NSDate timeIntervalSinceReferenceDate] of a date that may be nil
+static inline NSTimeInterval AFCacheableItemInfoTimeInterval(NSTimeInterval timestamp) {
+    return isnan(timestamp) ? 0 : timestamp;
+}
+
+static NSTimeInterval AFCacheableItemInfoDecodeTimestamp(NSCoder *coder, NSString *key, NSString *legacyKey) {
+    if ([coder containsValueForKey:key]) {
+        return [coder decodeDoubleForKey:key];
+    }
+    // archived before dates were stored as timestamps
+    id legacyValue = [coder decodeObjectForKey:legacyKey];
+    if ([legacyValue isKindOfClass:[NSDate class]]) {
+        return [legacyValue timeIntervalSinceReferenceDate];
+    }
+    if ([legacyValue isKindOfClass:[NSNumber class]]) {
+        return [legacyValue doubleValue];
+    }
+    return kAFCacheableItemInfoNoTimestamp;
+}
+
+static void AFCacheableItemInfoEncodeTimestamp(NSCoder *coder, NSTimeInterval timestamp, NSString *key) {
+    if (!isnan(timestamp)) {
+        [coder encodeDouble:timestamp forKey:key];
+    }
+}
+
+#pragma mark - URL records
+
+/*
+ * A URL split into its origin (scheme, host and port), which is interned, and the rest
+ */
+static void AFCacheableItemInfoSplitURL(NSURL *URL, NSString **origin, NSString **resource) {
+    NSString *string = [URL absoluteString];
+    NSRange scheme = string ? [string rangeOfString:@"://"] : NSMakeRange(NSNotFound, 0);
+    if (scheme.location == NSNotFound) {
+        *origin = nil;
+        *resource = string;
+        return;
+    }
+    static NSCharacterSet *originEnd = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        originEnd = [NSCharacterSet characterSetWithCharactersInString:@"/?#"];
+    });
+    NSUInteger start = NSMaxRange(scheme);
+    NSRange end = [string rangeOfCharacterFromSet:originEnd options:0 range:NSMakeRange(start, [string length] - start)];
+    NSUInteger split = end.location == NSNotFound ? [string length] : end.location;
+    *origin = AFInternedString([string substringToIndex:split]);
+    *resource = [string substringFromIndex:split];
+}
+
+static NSURL *AFCacheableItemInfoJoinURL(NSString *origin, NSString *resource) {
+    NSString *string = origin ? [origin stringByAppendingString:resource ?: @""] : resource;
+    return string ? [NSURL URLWithString:string] : nil;
+}
+
+/*
+ * What is kept of an NSURLRequest once the entry has been downloaded
+ */
+@interface AFCacheableItemRequestRecord : NSObject <NSCoding>
+@property (nonatomic, copy) NSString *origin;
+@property (nonatomic, copy) NSString *resource;
+@property (nonatomic, copy) NSString *HTTPMethod;      // nil for GET
+@property (nonatomic, copy) NSDictionary *headerFields;
+@property (nonatomic, assign) NSURLRequestCachePolicy cachePolicy;
+@property (nonatomic, assign) NSTimeInterval timeoutInterval;
+- (instancetype)initWithRequest:(NSURLRequest*)request;
+- (NSURLRequest*)request;
+@end
+
+@implementation AFCacheableItemRequestRecord
+
+- (instancetype)initWithRequest:(NSURLRequest*)request {
+    self = [super init];
+    if (self) {
+        NSString *origin = nil, *resource = nil;
+        AFCacheableItemInfoSplitURL([request URL], &origin, &resource);
+        _origin = origin;
+        _resource = resource;
+        NSString *method = [request HTTPMethod];
+        _HTTPMethod = [method isEqualToString:@"GET"] ? nil : AFInternedString(method);
+        _headerFields = [[request allHTTPHeaderFields] count] > 0 ? [request allHTTPHeaderFields] : nil;
+        _cachePolicy = [request cachePolicy];
+        _timeoutInterval = [request timeoutInterval];
+    }
+    return self;
+}
+
+// mutable, so the cache can add its headers when the request is sent again
+- (NSURLRequest*)request {
+    NSURL *URL = AFCacheableItemInfoJoinURL(self.origin, self.resource);
+    if (!URL) {
+        return nil;
+    }
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL cachePolicy:self.cachePolicy timeoutInterval:self.timeoutInterval];
+    if (self.HTTPMethod) {
+        [request setHTTPMethod:self.HTTPMethod];
+    }
+    [request setAllHTTPHeaderFields:self.headerFields];
+    return request;
+}
+
+- (id)initWithCoder:(NSCoder *)coder {
+    self = [super init];
+    if (self) {
+        _origin = AFInternedString([coder decodeObjectForKey:@"origin"]);
+        _resource = [coder decodeObjectForKey:@"resource"];
+        _HTTPMethod = AFInternedString([coder decodeObjectForKey:@"method"]);
+        _headerFields = [coder decodeObjectForKey:@"headers"];
+        _cachePolicy = (NSURLRequestCachePolicy)[coder decodeIntegerForKey:@"cachePolicy"];
+        _timeoutInterval = [coder decodeDoubleForKey:@"timeout"];
+    }
+    return self;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.origin forKey:@"origin"];
+    [coder encodeObject:self.resource forKey:@"resource"];
+    [coder encodeObject:self.HTTPMethod forKey:@"method"];
+    [coder encodeObject:self.headerFields forKey:@"headers"];
+    [coder encodeInteger:self.cachePolicy forKey:@"cachePolicy"];
+    [coder encodeDouble:self.timeoutInterval forKey:@"timeout"];
+}
+
+@end
+
+/*
+ * What is kept of an NSURLResponse once the entry has been downloaded
+ */
+@interface AFCacheableItemResponseRecord : NSObject <NSCoding>
+@property (nonatomic, copy) NSString *origin;
+@property (nonatomic, copy) NSString *resource;
+@property (nonatomic, assign) BOOL HTTP;
+@property (nonatomic, assign) NSInteger statusCode;
+@property (nonatomic, copy) NSDictionary *headerFields; // retained headers only
+@property (nonatomic, copy) NSString *MIMEType;
+@property (nonatomic, assign) long long expectedContentLength;
+@property (nonatomic, copy) NSString *textEncodingName;
+- (instancetype)initWithResponse:(NSURLResponse*)response;
+- (NSURLResponse*)response;
+@end
+
+@implementation AFCacheableItemResponseRecord
+
+- (instancetype)initWithResponse:(NSURLResponse*)response {
+    self = [super init];
+    if (self) {
+        NSString *origin = nil, *resource = nil;
+        AFCacheableItemInfoSplitURL([response URL], &origin, &resource);
+        _origin = origin;
+        _resource = resource;
+        if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+            _HTTP = YES;
+            _statusCode = [(NSHTTPURLResponse*)response statusCode];
+            _headerFields = AFCacheableItemInfoRetainedHeaders([(NSHTTPURLResponse*)response allHeaderFields]);
+        } else {
+            _MIMEType = AFInternedString([response MIMEType]);
+            _expectedContentLength = [response expectedContentLength];
+            _textEncodingName = AFInternedString([response textEncodingName]);
+        }
+    }
+    return self;
+}
+
+- (NSURLResponse*)response {
+    NSURL *URL = AFCacheableItemInfoJoinURL(self.origin, self.resource);
+    if (!URL) {
+        return nil;
+    }
+    if (self.HTTP) {
+        return [[NSHTTPURLResponse alloc] initWithURL:URL statusCode:self.statusCode HTTPVersion:@"HTTP/1.1" headerFields:self.headerFields];
+    }
+    return [[NSURLResponse alloc] initWithURL:URL MIMEType:self.MIMEType expectedContentLength:(NSInteger)self.expectedContentLength textEncodingName:self.textEncodingName];
+}
+
+- (id)initWithCoder:(NSCoder *)coder {
+    self = [super init];
+    if (self) {
+        _origin = AFInternedString([coder decodeObjectForKey:@"origin"]);
+        _resource = [coder decodeObjectForKey:@"resource"];
+        _HTTP = [coder decodeBoolForKey:@"HTTP"];
+        _statusCode = [coder decodeIntegerForKey:@"statusCode"];
+        _headerFields = AFCacheableItemInfoRetainedHeaders([coder decodeObjectForKey:@"headers"]);
+        _MIMEType = AFInternedString([coder decodeObjectForKey:@"mimeType"]);
+        _expectedContentLength = [coder decodeInt64ForKey:@"expectedContentLength"];
+        _textEncodingName = AFInternedString([coder decodeObjectForKey:@"textEncodingName"]);
+    }
+    return self;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.origin forKey:@"origin"];
+    [coder encodeObject:self.resource forKey:@"resource"];
+    [coder encodeBool:self.HTTP forKey:@"HTTP"];
+    [coder encodeInteger:self.statusCode forKey:@"statusCode"];
+    [coder encodeObject:self.headerFields forKey:@"headers"];
+    [coder encodeObject:self.MIMEType forKey:@"mimeType"];
+    [coder encodeInt64:self.expectedContentLength forKey:@"expectedContentLength"];
+    [coder encodeObject:self.textEncodingName forKey:@"textEncodingName"];
+}
+
+@end
+
+#pragma mark - Info
+
+@implementation AFCacheableItemInfo {
+    NSTimeInterval _lastModifiedTimestamp;
+    NSTimeInterval _serverDateTimestamp;
+    NSTimeInterval _expireTimestamp;
+    NSTimeInterval _maxAgeValue;
+    NSString *_mimeType;
+    NSDictionary *_headers;
+    // request and response objects until -compact, records afterwards
+    NSURLRequest *_request;
+    NSURLResponse *_response;
+    NSURLRequest *_redirectRequest;
+    NSURLResponse *_redirectResponse;
+    AFCacheableItemRequestRecord *_requestRecord;
+    AFCacheableItemResponseRecord *_responseRecord;
+    AFCacheableItemRequestRecord *_redirectRequestRecord;
+    AFCacheableItemResponseRecord *_redirectResponseRecord;
+}
+
++ (NSSet*)retainedHeaderNames {
+    return AFCacheableItemInfoCurrentRetainedHeaderNames();
+}
+
++ (void)retainHeaderNamed:(NSString*)name {
+    if (!name) {
+        return;
+    }
+    @synchronized ([AFCacheableItemInfo class]) {
+        AFCacheableItemInfoRetainedHeaderNames = [AFCacheableItemInfoCurrentRetainedHeaderNames() setByAddingObject:[name lowercaseString]];
+    }
+}
 
 - (NSString*)newUniqueFilename {
     CFUUIDRef uuidRef = CFUUIDCreate(kCFAllocatorDefault);
@@ -33,9 +321,17 @@
 }
 
 
+- (void)clearTimestamps {
+    _lastModifiedTimestamp = kAFCacheableItemInfoNoTimestamp;
+    _serverDateTimestamp = kAFCacheableItemInfoNoTimestamp;
+    _expireTimestamp = kAFCacheableItemInfoNoTimestamp;
+    _maxAgeValue = kAFCacheableItemInfoNoTimestamp;
+}
+
 - (id)init {
     self = [super init];
     if (self) {
+        [self clearTimestamps];
         // TODO: We cannot assume that this item's cache is the default sharedInstance
         _filename = [AFCache sharedInstance].cacheWithHashname ? [self newUniqueFilename] : nil;
     }
@@ -47,22 +343,34 @@
     if (self) {
         _requestTimestamp = [[coder decodeObjectForKey:@"requestTimestamp"] doubleValue];
         _responseTimestamp = [[coder decodeObjectForKey:@"responseTimestamp"] doubleValue];
-        _serverDate = [coder decodeObjectForKey:@"serverDate"];
-        _lastModified = [coder decodeObjectForKey:@"lastModified"];
+        _serverDateTimestamp = AFCacheableItemInfoDecodeTimestamp(coder, @"serverDateTimestamp", @"serverDate");
+        _lastModifiedTimestamp = AFCacheableItemInfoDecodeTimestamp(coder, @"lastModifiedTimestamp", @"lastModified");
         _age = [[coder decodeObjectForKey:@"age"] doubleValue];
-        _maxAge = [coder decodeObjectForKey:@"maxAge"];
-        _expireDate = [coder decodeObjectForKey:@"expireDate"];
+        _maxAgeValue = AFCacheableItemInfoDecodeTimestamp(coder, @"maxAgeValue", @"maxAge");
+        _expireTimestamp = AFCacheableItemInfoDecodeTimestamp(coder, @"expireTimestamp", @"expireDate");
         _eTag = [coder decodeObjectForKey:@"eTag"];
         _statusCode = [[coder decodeObjectForKey:@"statusCode"] unsignedIntegerValue];
         _contentLength = [[coder decodeObjectForKey:@"contentLength"] unsignedIntValue];
-        _mimeType = [coder decodeObjectForKey:@"mimeType"];
+        _mimeType = AFInternedString([coder decodeObjectForKey:@"mimeType"]);
         _responseURL = [coder decodeObjectForKey:@"responseURL"];
-        _request = [coder decodeObjectForKey:@"request"];
-        _response = [coder decodeObjectForKey:@"response"];
-        _redirectRequest = [coder decodeObjectForKey:@"redirectRequest"];
-        _redirectResponse = [coder decodeObjectForKey:@"redirectResponse"];
+        _requestRecord = [coder decodeObjectForKey:@"requestRecord"];
+        _responseRecord = [coder decodeObjectForKey:@"responseRecord"];
+        _redirectRequestRecord = [coder decodeObjectForKey:@"redirectRequestRecord"];
+        _redirectResponseRecord = [coder decodeObjectForKey:@"redirectResponseRecord"];
         _filename = [coder decodeObjectForKey:@"filename"];
-        _headers = [coder decodeObjectForKey:@"headers"];
+        _headers = AFCacheableItemInfoRetainedHeaders([coder decodeObjectForKey:@"headers"]);
+        if (!_requestRecord && !_responseRecord) {
+            // archived with request and response objects
+            _request = [coder decodeObjectForKey:@"request"];
+            _response = [coder decodeObjectForKey:@"response"];
+            _redirectRequest = [coder decodeObjectForKey:@"redirectRequest"];
+            _redirectResponse = [coder decodeObjectForKey:@"redirectResponse"];
+            [self compact];
+        }
+        _accessCount = [[coder decodeObjectForKey:@"accessCount"] unsignedIntegerValue];
+        _lastAccessTimestamp = [[coder decodeObjectForKey:@"lastAccessTimestamp"] doubleValue];
+        _bodySourceKey = [coder decodeObjectForKey:@"bodySourceKey"];
+        _bodySourceEntry = [coder decodeObjectForKey:@"bodySourceEntry"];
     }
 
     return self;
@@ -71,22 +379,35 @@
 - (void)encodeWithCoder: (NSCoder *) coder {
 	[coder encodeObject: [NSNumber numberWithDouble: self.requestTimestamp] forKey: @"requestTimestamp"];
 	[coder encodeObject: [NSNumber numberWithDouble: self.responseTimestamp] forKey: @"responseTimestamp"];
-	[coder encodeObject: self.serverDate forKey: @"serverDate"];
-	[coder encodeObject: self.lastModified forKey: @"lastModified"];
+	AFCacheableItemInfoEncodeTimestamp(coder, _serverDateTimestamp, @"serverDateTimestamp");
+	AFCacheableItemInfoEncodeTimestamp(coder, _lastModifiedTimestamp, @"lastModifiedTimestamp");
 	[coder encodeObject: [NSNumber numberWithDouble: self.age] forKey: @"age"];
-	[coder encodeObject: self.maxAge forKey: @"maxAge"];
-	[coder encodeObject: self.expireDate forKey: @"expireDate"];
+	AFCacheableItemInfoEncodeTimestamp(coder, _maxAgeValue, @"maxAgeValue");
+	AFCacheableItemInfoEncodeTimestamp(coder, _expireTimestamp, @"expireTimestamp");
 	[coder encodeObject: self.eTag forKey: @"eTag"];
 	[coder encodeObject: [NSNumber numberWithUnsignedInteger:self.statusCode] forKey: @"statusCode"];
 	[coder encodeObject: [NSNumber numberWithUnsignedLongLong:self.contentLength] forKey: @"contentLength"];
 	[coder encodeObject: self.mimeType forKey: @"mimeType"];
 	[coder encodeObject: self.responseURL forKey: @"responseURL"];
-	[coder encodeObject: self.request forKey: @"request"];
-    [coder encodeObject: self.response forKey: @"response"];
-	[coder encodeObject: self.redirectRequest forKey: @"redirectRequest"];
-    [coder encodeObject: self.redirectResponse forKey: @"redirectResponse"];
+	// an entry that is still being downloaded is archived compact as well, without compacting it
+	AFCacheableItemRequestRecord *requestRecord, *redirectRequestRecord;
+	AFCacheableItemResponseRecord *responseRecord, *redirectResponseRecord;
+	@synchronized (self) {
+		requestRecord = _request ? [[AFCacheableItemRequestRecord alloc] initWithRequest:_request] : _requestRecord;
+		responseRecord = _response ? [[AFCacheableItemResponseRecord alloc] initWithResponse:_response] : _responseRecord;
+		redirectRequestRecord = _redirectRequest ? [[AFCacheableItemRequestRecord alloc] initWithRequest:_redirectRequest] : _redirectRequestRecord;
+		redirectResponseRecord = _redirectResponse ? [[AFCacheableItemResponseRecord alloc] initWithResponse:_redirectResponse] : _redirectResponseRecord;
+	}
+	[coder encodeObject: requestRecord forKey: @"requestRecord"];
+	[coder encodeObject: responseRecord forKey: @"responseRecord"];
+	[coder encodeObject: redirectRequestRecord forKey: @"redirectRequestRecord"];
+	[coder encodeObject: redirectResponseRecord forKey: @"redirectResponseRecord"];
 	[coder encodeObject: self.filename forKey: @"filename"];
 	[coder encodeObject: self.headers forKey: @"headers"];
+	[coder encodeObject: [NSNumber numberWithUnsignedInteger:self.accessCount] forKey: @"accessCount"];
+	[coder encodeObject: [NSNumber numberWithDouble: self.lastAccessTimestamp] forKey: @"lastAccessTimestamp"];
+	[coder encodeObject: self.bodySourceKey forKey: @"bodySourceKey"];
+	[coder encodeObject: self.bodySourceEntry forKey: @"bodySourceEntry"];
 }
 
 - (NSString*)description {
@@ -111,14 +432,231 @@
     [s appendFormat:@"filename: %@\n", self.filename];
 	[s appendFormat:@"packageArchiveStatus: %d\n", self.packageArchiveStatus];
 	[s appendFormat:@"headers: %d\n", self.headers];
+	[s appendFormat:@"accessCount: %lu\n", (unsigned long)self.accessCount];
+	if (self.bodySourceKey) {
+		[s appendFormat:@"bodySource: %@ (%@)\n", self.bodySourceKey, self.bodySourceEntry];
+	}
 	return s;
 }
 
+#pragma mark - Compact storage
+
+- (NSDate*)lastModified {
+    return AFCacheableItemInfoDate(_lastModifiedTimestamp);
+}
+
+- (void)setLastModified:(NSDate*)lastModified {
+    _lastModifiedTimestamp = AFCacheableItemInfoTimestamp(lastModified);
+}
+
+- (NSDate*)serverDate {
+    return AFCacheableItemInfoDate(_serverDateTimestamp);
+}
+
+- (void)setServerDate:(NSDate*)serverDate {
+    _serverDateTimestamp = AFCacheableItemInfoTimestamp(serverDate);
+}
+
+- (NSDate*)expireDate {
+    return AFCacheableItemInfoDate(_expireTimestamp);
+}
+
+- (void)setExpireDate:(NSDate*)expireDate {
+    _expireTimestamp = AFCacheableItemInfoTimestamp(expireDate);
+}
+
+- (NSNumber*)maxAge {
+    return isnan(_maxAgeValue) ? nil : @(_maxAgeValue);
+}
+
+- (void)setMaxAge:(NSNumber*)maxAge {
+    _maxAgeValue = maxAge ? [maxAge doubleValue] : kAFCacheableItemInfoNoTimestamp;
+}
+
+- (NSString*)mimeType {
+    return _mimeType;
+}
+
+- (void)setMimeType:(NSString*)mimeType {
+    _mimeType = AFInternedString(mimeType);
+}
+
+- (NSDictionary*)headers {
+    return _headers;
+}
+
+- (void)setHeaders:(NSDictionary*)headers {
+    _headers = AFCacheableItemInfoRetainedHeaders(headers);
+}
+
+// Objects and records are swapped by -compact on the thread that finished the download while other threads read
+// them, so every pair is read and written under the lock. Records are not changed once they have been set.
+- (NSURLRequest*)request {
+    NSURLRequest *request;
+    AFCacheableItemRequestRecord *record;
+    @synchronized (self) {
+        request = _request;
+        record = _requestRecord;
+    }
+    return request ?: [record request];
+}
+
+- (void)setRequest:(NSURLRequest*)request {
+    @synchronized (self) {
+        _request = request;
+        _requestRecord = nil;
+    }
+}
+
+- (NSURLResponse*)response {
+    NSURLResponse *response;
+    AFCacheableItemResponseRecord *record;
+    @synchronized (self) {
+        response = _response;
+        record = _responseRecord;
+    }
+    return response ?: [record response];
+}
+
+- (void)setResponse:(NSURLResponse*)response {
+    @synchronized (self) {
+        _response = response;
+        _responseRecord = nil;
+    }
+}
+
+- (NSURLRequest*)redirectRequest {
+    NSURLRequest *request;
+    AFCacheableItemRequestRecord *record;
+    @synchronized (self) {
+        request = _redirectRequest;
+        record = _redirectRequestRecord;
+    }
+    return request ?: [record request];
+}
+
+- (void)setRedirectRequest:(NSURLRequest*)redirectRequest {
+    @synchronized (self) {
+        _redirectRequest = redirectRequest;
+        _redirectRequestRecord = nil;
+    }
+}
+
+- (NSURLResponse*)redirectResponse {
+    NSURLResponse *response;
+    AFCacheableItemResponseRecord *record;
+    @synchronized (self) {
+        response = _redirectResponse;
+        record = _redirectResponseRecord;
+    }
+    return response ?: [record response];
+}
+
+- (void)setRedirectResponse:(NSURLResponse*)redirectResponse {
+    @synchronized (self) {
+        _redirectResponse = redirectResponse;
+        _redirectResponseRecord = nil;
+    }
+}
+
+- (void)compact {
+    @synchronized (self) {
+        if (_request) {
+            _requestRecord = [[AFCacheableItemRequestRecord alloc] initWithRequest:_request];
+            _request = nil;
+        }
+        if (_response) {
+            AFCacheableItemResponseRecord *record = [[AFCacheableItemResponseRecord alloc] initWithResponse:_response];
+            if (record.headerFields && [record.headerFields isEqualToDictionary:_headers]) {
+                // both are usually the retained headers of the same response
+                record.headerFields = _headers;
+            }
+            _responseRecord = record;
+            _response = nil;
+        }
+        if (_redirectRequest) {
+            _redirectRequestRecord = [[AFCacheableItemRequestRecord alloc] initWithRequest:_redirectRequest];
+            _redirectRequest = nil;
+        }
+        if (_redirectResponse) {
+            _redirectResponseRecord = [[AFCacheableItemResponseRecord alloc] initWithResponse:_redirectResponse];
+            _redirectResponse = nil;
+        }
+    }
+}
+
+#pragma mark - Freshness
+
+- (void)recordAccess {
+    [self recordAccessAtTime:AFCacheNow()];
+}
+
+- (void)recordAccessAtTime:(NSTimeInterval)now {
+    @synchronized (self) {
+        self.accessCount++;
+        self.lastAccessTimestamp = now;
+    }
+}
+
+- (NSTimeInterval)remainingFreshness {
+    return [self remainingFreshnessAtTime:AFCacheNow()];
+}
+
+- (NSTimeInterval)remainingFreshnessAtTime:(NSTimeInterval)now {
+	NSTimeInterval serverDate = AFCacheableItemInfoTimeInterval(_serverDateTimestamp);
+	NSTimeInterval apparent_age = fmax(0, self.responseTimestamp - serverDate);
+	NSTimeInterval corrected_received_age = fmax(apparent_age, self.age);
+	NSTimeInterval response_delay = (self.responseTimestamp>0)?self.responseTimestamp - self.requestTimestamp:0;
+
+    // A zero (or negative) response delay indicates a transfer or connection error.
+    // This happened when the archiever started between request start and response.
+    if (response_delay < 0) {
+        NSLog(@"WARNING: response_delay must never be negative!");
+        return -1;
+    }
+
+	NSTimeInterval corrected_initial_age = corrected_received_age + response_delay;
+	NSTimeInterval resident_time = now - self.responseTimestamp;
+	NSTimeInterval current_age = corrected_initial_age + resident_time;
+
+	NSTimeInterval freshness_lifetime = [self freshnessLifetime];
+
+	AFLog(@"freshness_lifetime: %@", [NSDate dateWithTimeIntervalSinceReferenceDate: freshness_lifetime]);
+	AFLog(@"current_age: %@", [NSDate dateWithTimeIntervalSinceReferenceDate: current_age]);
+
+	return freshness_lifetime - current_age;
+}
+
+- (NSTimeInterval)freshnessLifetime {
+	NSTimeInterval freshness_lifetime = 0;
+
+	if (!isnan(_expireTimestamp)) {
+		freshness_lifetime = _expireTimestamp - AFCacheableItemInfoTimeInterval(_serverDateTimestamp);
+	}
+
+	// The max-age directive takes priority over Expires! Thanks, Serge ;)
+	if (!isnan(_maxAgeValue)) {
+		freshness_lifetime = _maxAgeValue;
+	}
+
+	// Note:
+	// If none of Expires, Cache-Control: max-age, or Cache-Control: s- maxage (see section 14.9.3) appears in the response,
+	// and the response does not include other restrictions on caching, the cache MAY compute a freshness lifetime using a heuristic.
+	// The cache MUST attach Warning 113 to any response whose age is more than 24 hours if such warning has not already been added.
+
+	return freshness_lifetime;
+}
+
 -(uint64_t)actualLength
 {
 	if(!_actualLength)
 	{
-		if(self.cachePath)
+		if(self.bodySourceKey)
+		{
+			// the body source holds the complete body
+			return self.contentLength;
+		}
+		else if(self.cachePath)
 		{
 			NSError* err = nil;
 			NSDictionary* attr = [[NSFileManager defaultManager] attributesOfItemAtPath:self.cachePath error:&err];
@@ -14,6 +14,16 @@
 @property (nonatomic, readonly) BOOL isExecuting;
 @property (nonatomic, readonly) BOOL isFinished;
 
+// timing and size of the download, e.g. for adaptive concurrency control. Timestamps are 0 until the event occured.
+@property (nonatomic, readonly) NSTimeInterval startTimestamp;
+@property (nonatomic, readonly) NSTimeInterval responseTimestamp;
+@property (nonatomic, readonly) NSTimeInterval finishTimestamp;
+@property (nonatomic, readonly) uint64_t receivedByteCount;
+// YES if the connection failed (as opposed to e.g. a HTTP status code >= 400)
+@property (nonatomic, readonly) BOOL failedWithNetworkError;
+// attempts that failed and were tried again, see AFRetryPolicy.h
+@property (nonatomic, readonly) NSUInteger retryCount;
+
 - (instancetype)initWithCacheableItem:(AFCacheableItem*)cacheableItem;
 
 @end
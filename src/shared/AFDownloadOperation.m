@@ -13,10 +13,26 @@
 #import "AFCache+PrivateAPI.h"
 #import "AFCache_Logging.h"
 #import "DateParser.h"
+#import "AFRetryPolicy.h"
+#import "AFCacheClock.h"
+#import "AFCacheSharedStore.h"
+#import "AFDownloadScheduler.h"
+
+// waiting for another process sharing the cache directory to download the URL, see startConnectionUnlessDownloadedElsewhere
+#define kAFDownloadOperationClaimPollInterval 0.1
+#define kAFDownloadOperationClaimWaitTimeout 60.0
+// a body that was not admitted to disk is collected in memory up to this size, a larger one in a temporary file
+#define kAFDownloadOperationMemoryBufferLimit (4 * 1024 * 1024)
 
 @interface AFDownloadOperation () <NSURLConnectionDataDelegate>
 @property(nonatomic, strong) NSURLConnection *connection;
 @property(nonatomic, strong) NSOutputStream *outputStream;
+@property(nonatomic, strong) NSMutableData *memoryBuffer; // body of an item the cache did not admit to disk
+@property(nonatomic, strong) NSString *spillFilePath;     // temporary file of such a body beyond kAFDownloadOperationMemoryBufferLimit
+@property(nonatomic, assign) BOOL holdsDownloadClaim;     // of the cache's shared store
+@property(nonatomic, assign) NSTimeInterval claimWaitTimestamp; // 0 unless another process was downloading the URL
+@property(nonatomic, strong) AFCacheableItemInfo *revalidatedInfo; // the entry as it was before revalidating, for stale-if-error
+@property(nonatomic, assign) BOOL replacedStoredBody;              // the stored file was given up for a new body
 @end
 
 @implementation AFDownloadOperation
@@ -65,13 +81,135 @@
     _isExecuting = YES;
     [self didChangeValueForKey:@"isExecuting"];
     
+    _startTimestamp = [NSDate timeIntervalSinceReferenceDate];
+    if (self.cacheableItem.isRevalidating && self.cacheableItem.cache.retryPolicy.serveStaleOnError) {
+        self.revalidatedInfo = [self snapshotOfInfo:self.cacheableItem.info];
+    }
+    [self.cacheableItem.cache.retryPolicy recordAttempt];
+    if (self.cacheableItem.cache.sharedStore && !self.cacheableItem.justFetchHTTPHeader) {
+        [self startConnectionUnlessDownloadedElsewhere];
+    } else {
+        [self startConnection];
+    }
+}
+
+/*
+ * Another process sharing the cache directory may be downloading the URL already. Then the operation waits until it is
+ * done and delivers the entry it stored, or downloads the URL itself if that entry is not fresh and complete.
+ * If the other process takes longer than kAFDownloadOperationClaimWaitTimeout, the URL is downloaded anyway.
+ * While waiting, the operation gives its slot in the download scheduler to others.
+ */
+- (void)startConnectionUnlessDownloadedElsewhere {
+    if (self.isCancelled) {
+        [self finish];
+        return;
+    }
+    AFCacheSharedStore *sharedStore = self.cacheableItem.cache.sharedStore;
+    AFCacheKey *key = self.cacheableItem.cacheKey;
+    if (!sharedStore || !key) {
+        [self startConnection];
+        return;
+    }
+
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    if (![sharedStore beginDownloadForKey:key]) {
+        if (self.claimWaitTimestamp == 0) {
+            self.claimWaitTimestamp = now;
+        }
+        if (now - self.claimWaitTimestamp < kAFDownloadOperationClaimWaitTimeout) {
+            BOOL yielded = [self.cacheableItem.cache.downloadScheduler yieldOperation:self forInterval:kAFDownloadOperationClaimPollInterval resumeBlock:^{
+                [self performSelectorOnMainThread:@selector(startConnectionUnlessDownloadedElsewhere) withObject:nil waitUntilDone:NO];
+            }];
+            if (!yielded) {
+                // not started by the cache's scheduler
+                [self performSelector:@selector(startConnectionUnlessDownloadedElsewhere) withObject:nil afterDelay:kAFDownloadOperationClaimPollInterval];
+            }
+            return;
+        }
+        AFLog(@"Gave up waiting for process %d to download %@", [sharedStore downloadingProcessForKey:key], self.cacheableItem.url);
+        [self startConnection];
+        return;
+    }
+    self.holdsDownloadClaim = YES;
+    if (self.claimWaitTimestamp > 0 && [self finishWithEntryDownloadedElsewhere]) {
+        return;
+    }
+    [self startConnection];
+}
+
+- (BOOL)finishWithEntryDownloadedElsewhere {
+    AFCache *cache = self.cacheableItem.cache;
+    [cache.sharedStore synchronize];
+    AFCacheableItemInfo *info = [cache.cachedItemInfos objectForKey:self.cacheableItem.cacheKey];
+    if (![info isKindOfClass:[AFCacheableItemInfo class]] || info.actualLength == 0 || info.actualLength < info.contentLength ||
+        [info remainingFreshness] <= 0) {
+        return NO;
+    }
+    AFLog(@"%@ was downloaded by another process", self.cacheableItem.url);
+    self.cacheableItem.info = info;
+    self.cacheableItem.cacheStatus = kCacheStatusFresh;
+    [self finish];
+    [self.cacheableItem sendSuccessSignalToClientItems];
+    return YES;
+}
+
+- (void)startConnection {
+    if (self.isCancelled) {
+        [self finish];
+        return;
+    }
     self.connection = [[NSURLConnection alloc] initWithRequest:self.cacheableItem.info.request delegate:self startImmediately:YES];
 }
 
+/*
+ * Asks the cache's retry policy whether the failed attempt is tried again. If so, the attempt is dropped and a new
+ * connection is started after the backoff. Meanwhile the operation gives its slot in the download scheduler to others.
+ */
+- (BOOL)retryAfterStatusCode:(NSInteger)statusCode error:(NSError*)error retryAfter:(NSString*)retryAfter {
+    AFRetryPolicy *retryPolicy = self.cacheableItem.cache.retryPolicy;
+    if (!retryPolicy) {
+        return NO;
+    }
+    NSTimeInterval delay = [retryPolicy retryDelayForStatusCode:statusCode error:error retryCount:_retryCount retryAfter:retryAfter];
+    if (delay < 0) {
+        return NO;
+    }
+    _retryCount++;
+    AFLog(@"Retrying %@ in %.2f s (retry %lu, status %ld, error %@)", self.cacheableItem.url, delay, (unsigned long)_retryCount, (long)statusCode, error);
+
+    [self.connection cancel];
+    self.connection = nil;
+    [self.outputStream close];
+    [self.outputStream removeFromRunLoop:[NSRunLoop currentRunLoop] forMode:NSRunLoopCommonModes];
+    self.outputStream = nil;
+    self.memoryBuffer = nil;
+    [self removeSpillFile];
+    self.cacheableItem.info.actualLength = 0;
+    self.cacheableItem.currentContentLength = 0;
+    BOOL yielded = [self.cacheableItem.cache.downloadScheduler yieldOperation:self forInterval:delay resumeBlock:^{
+        [self performSelectorOnMainThread:@selector(startConnection) withObject:nil waitUntilDone:NO];
+    }];
+    if (!yielded) {
+        // not started by the cache's scheduler
+        [self performSelector:@selector(startConnection) withObject:nil afterDelay:delay];
+    }
+    return YES;
+}
+
 - (void)finish {
+    _finishTimestamp = [NSDate timeIntervalSinceReferenceDate];
     [self.connection cancel];
+    [self.cacheableItem.info compact];
     [self.outputStream close];
     [self.outputStream removeFromRunLoop:[NSRunLoop currentRunLoop] forMode:NSRunLoopCommonModes];
+    [self removeSpillFile];
+    if (self.holdsDownloadClaim) {
+        // processes waiting for the claim find the entry right away
+        AFCacheSharedStore *sharedStore = self.cacheableItem.cache.sharedStore;
+        [sharedStore flush];
+        [sharedStore endDownloadForKey:self.cacheableItem.cacheKey];
+        self.holdsDownloadClaim = NO;
+    }
     
     [self willChangeValueForKey:@"isExecuting"];
     [self willChangeValueForKey:@"isFinished"];
@@ -81,6 +219,46 @@
     [self didChangeValueForKey:@"isExecuting"];
 }
 
+// a copy of the entry that the response of a revalidation does not touch. The length of its file is taken along.
+- (AFCacheableItemInfo*)snapshotOfInfo:(AFCacheableItemInfo*)info {
+    if (!info) {
+        return nil;
+    }
+    AFCacheableItemInfo *snapshot = [NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:info]];
+    snapshot.cachePath = info.cachePath;
+    snapshot.actualLength = info.actualLength;
+    return snapshot;
+}
+
+#pragma mark - Bodies not admitted to disk
+
+// moves the memory buffer into a temporary file that takes the rest of the body
+- (BOOL)spillMemoryBuffer {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:path append:NO];
+    [outputStream open];
+    NSUInteger length = self.memoryBuffer.length;
+    NSInteger bytesWritten = [outputStream write:self.memoryBuffer.bytes maxLength:length];
+    self.spillFilePath = path;
+    self.outputStream = outputStream;
+    self.memoryBuffer = nil;
+    return bytesWritten >= 0 && (NSUInteger)bytesWritten == length;
+}
+
+// a mapping stays valid after the file has been removed
+- (NSData*)mapAndRemoveFileAtPath:(NSString*)path {
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    return data;
+}
+
+- (void)removeSpillFile {
+    if (self.spillFilePath) {
+        [[NSFileManager defaultManager] removeItemAtPath:self.spillFilePath error:nil];
+        self.spillFilePath = nil;
+    }
+}
+
 #pragma mark - NSURLConnectionDelegate and NSURLConnectionDataDelegate methods
 
 /*
@@ -107,7 +285,7 @@
         self.cacheableItem.info.redirectResponse = redirectResponse;
         
         // TODO: Do not access #urlRedirects directly but provide access method
-        [self.cacheableItem.cache.urlRedirects setValue:[self.cacheableItem.info.responseURL absoluteString] forKey:[self.cacheableItem.url absoluteString]];
+        [self.cacheableItem.cache.urlRedirects setObject:[self.cacheableItem.info.responseURL absoluteString] forKey:self.cacheableItem.cacheKey];
     }
     
     return theRequest;
@@ -123,11 +301,21 @@
  */
 - (void)connection:(NSURLConnection*)connection didReceiveResponse:(NSURLResponse*)response {
     self.cacheableItem.cache.connectedToNetwork = YES;
+    if (_responseTimestamp == 0) {
+        _responseTimestamp = [NSDate timeIntervalSinceReferenceDate];
+    }
     
     if (self.isCancelled) {
         [self finish];
         return;
     }
+
+    if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+        NSHTTPURLResponse *HTTPResponse = (NSHTTPURLResponse*)response;
+        if ([self retryAfterStatusCode:[HTTPResponse statusCode] error:nil retryAfter:[HTTPResponse allHeaderFields][@"Retry-After"]]) {
+            return;
+        }
+    }
     
     [self handleResponse:response];
     
@@ -137,9 +325,12 @@
         return;
     }
     
-    if (self.cacheableItem.validUntil) {
-        // TODO: Do not expose #cachedItemInfos directly but provide access method
-        [self.cacheableItem.cache.cachedItemInfos setObject: self.cacheableItem.info forKey: [self.cacheableItem.url absoluteString]];
+    // An entry whose headers were updated in place is stored again as well, so that the observers of the store
+    // (e.g. the invalidation index with its tags) see the new headers
+    // TODO: Do not expose #cachedItemInfos directly but provide access method
+    NSMutableDictionary *cachedItemInfos = self.cacheableItem.cache.cachedItemInfos;
+    if (self.cacheableItem.validUntil || [cachedItemInfos objectForKey:self.cacheableItem.cacheKey] == self.cacheableItem.info) {
+        [cachedItemInfos setObject: self.cacheableItem.info forKey: self.cacheableItem.cacheKey];
     }
     
     if (self.cacheableItem.justFetchHTTPHeader) {
@@ -153,7 +344,16 @@
         return;
     }
     
-    if (self.outputStream.hasSpaceAvailable) {
+    if (self.memoryBuffer) {
+        [self.memoryBuffer appendData:data];
+        if ([self.memoryBuffer length] > kAFDownloadOperationMemoryBufferLimit && ![self spillMemoryBuffer]) {
+            if ([self.cacheableItem.delegate respondsToSelector:@selector(cannotWriteDataForItem:)]) {
+                [self.cacheableItem.delegate cannotWriteDataForItem:self.cacheableItem];
+            }
+            [self finishWithError];
+            return;
+        }
+    } else if (self.outputStream.hasSpaceAvailable) {
         NSInteger bytesWritten = [self.outputStream write:data.bytes maxLength:data.length];
         if (bytesWritten != data.length) {
             if ([self.cacheableItem.delegate respondsToSelector:@selector(cannotWriteDataForItem:)]) {
@@ -171,6 +371,7 @@
     }
     
     self.cacheableItem.info.actualLength += [data length];
+    _receivedByteCount += [data length];
     [self.cacheableItem sendProgressSignalToClientItems];
 }
 
@@ -215,6 +416,28 @@
             break;
             
         default: {
+            if (self.memoryBuffer || self.spillFilePath) {
+                // Not admitted to the disk store: deliver the body from memory and forget the entry
+                NSData *body = self.memoryBuffer;
+                if (self.spillFilePath) {
+                    [self.outputStream close];
+                    body = [self mapAndRemoveFileAtPath:self.spillFilePath];
+                    self.spillFilePath = nil;
+                }
+                self.cacheableItem.data = body;
+                self.cacheableItem.info.contentLength = [body length];
+                [self.cacheableItem.cache.cachedItemInfos removeObjectForKey:self.cacheableItem.cacheKey];
+                break;
+            }
+
+            NSData *packedBody = [self.outputStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+            if (packedBody && [self.cacheableItem.cache storeBody:packedBody inSlabStoreForItem:self.cacheableItem]) {
+                if (self.cacheableItem.validUntil) {
+                    [self.cacheableItem.cache updateModificationDataAndTriggerArchiving:self.cacheableItem];
+                }
+                break;
+            }
+
             NSError *error = nil;
             
             if (!self.cacheableItem.url) {
@@ -232,6 +455,19 @@
             } else {
                 AFLog(@"Failed to get file attributes for file at path %@. Error: %@", path, [err description]);
             }
+
+            // the server did not announce a length, now the admission filter can weigh the body
+            if (self.cacheableItem.admissionDeferred) {
+                self.cacheableItem.admissionDeferred = NO;
+                if (attr && ![self.cacheableItem.cache shouldAdmitItem:self.cacheableItem size:self.cacheableItem.info.contentLength]) {
+                    AFLog(@"admission filter rejected %@", self.cacheableItem.url);
+                    self.cacheableItem.rejectedByAdmissionFilter = YES;
+                    [self.outputStream close];
+                    self.cacheableItem.data = [self mapAndRemoveFileAtPath:path];
+                    [self.cacheableItem.cache.cachedItemInfos removeObjectForKey:self.cacheableItem.cacheKey];
+                    break;
+                }
+            }
             
             [self.cacheableItem flagAsDownloadFinishedWithContentLength:self.cacheableItem.info.contentLength];
             
@@ -265,8 +501,14 @@
         [self finish];
         return;
     }
+
+    // failures by status code have been offered to the retry policy when the response arrived
+    if ([self retryAfterStatusCode:0 error:anError retryAfter:nil]) {
+        return;
+    }
     
     self.cacheableItem.error = anError;
+    _failedWithNetworkError = [[anError domain] isEqualToString:NSURLErrorDomain];
     
     BOOL connectionLostOrNoConnection = ([anError code] == kCFURLErrorNotConnectedToInternet || [anError code] == kCFURLErrorNetworkConnectionLost);
     if (connectionLostOrNoConnection) {
@@ -284,9 +526,21 @@
     // - The response status is below 400 (e.g. no 404)
     // - The item is complete (the data size on disk matches the content size in the response header)
     // - OR: Connection lost while revalidating
+    // - OR: The retry policy serves the stale entry that is still on disk when revalidating fails (stale-if-error).
+    //   This is decided by the entry as it was before the response of the revalidation overwrote it.
     BOOL sendSuccessDespiteError =
     (connectionLostOrNoConnection && self.cacheableItem.info.statusCode < 400 && self.cacheableItem.isComplete) ||
     (self.cacheableItem.isRevalidating && connectionLostOrNoConnection);
+    AFCacheableItemInfo *staleInfo = self.revalidatedInfo;
+    if (!sendSuccessDespiteError && staleInfo && !self.replacedStoredBody &&
+        staleInfo.actualLength > 0 && staleInfo.actualLength >= staleInfo.contentLength &&
+        [self.cacheableItem.cache.retryPolicy shouldServeStaleEntryWithInfo:staleInfo]) {
+        AFLog(@"Serving stale entry for %@ after error %@", self.cacheableItem.url, anError);
+        self.cacheableItem.info = staleInfo;
+        [self.cacheableItem.cache.cachedItemInfos setObject:staleInfo forKey:self.cacheableItem.cacheKey];
+        self.cacheableItem.cacheStatus = kCacheStatusStale;
+        sendSuccessDespiteError = YES;
+    }
     if (sendSuccessDespiteError) {
         [self.cacheableItem sendSuccessSignalToClientItems];
     } else {
@@ -355,7 +609,7 @@
 - (void)handleResponse:(NSURLResponse *)response {
     self.cacheableItem.info.mimeType = [response MIMEType];
     
-    NSDate *now = [NSDate date];
+    NSDate *now = AFCacheNowDate();
     
     self.cacheableItem.info.responseTimestamp = [now timeIntervalSinceReferenceDate];
     self.cacheableItem.info.mimeType = [response MIMEType];
@@ -372,6 +626,9 @@
         switch (self.cacheableItem.info.statusCode) {
             case 304:
                 self.cacheableItem.cacheStatus = kCacheStatusNotModified;
+                if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+                    [self handleNotModifiedHeaderFields:[(NSHTTPURLResponse *) response allHeaderFields] now:now];
+                }
                 self.cacheableItem.validUntil = self.cacheableItem.info.expireDate;
                 // The resource has not been modified, so we exit here
                 return;
@@ -384,8 +641,13 @@
         self.cacheableItem.info.response = response;
     }
     
+    self.memoryBuffer = nil;
     if (self.cacheableItem.info.statusCode == 200) {
-        self.outputStream = [self.cacheableItem.cache createOutputStreamForItem:self.cacheableItem];
+        self.replacedStoredBody = YES;
+        self.outputStream = [self.cacheableItem.cache createOutputStreamForItem:self.cacheableItem expectedLength:[response expectedContentLength]];
+        if (!self.outputStream && self.cacheableItem.rejectedByAdmissionFilter) {
+            self.memoryBuffer = [NSMutableData data];
+        }
     }
     
     // TODO: Isn't self.cacheableItem.info.contentLength always 0 at this moment?
@@ -397,6 +659,46 @@
     }
 }
 
+/*
+ * A 304 response carries updated freshness information for the stored entity (RFC 2616 10.3.5).
+ * Without taking it over a revalidated entry would be stale again immediately.
+ */
+- (void)handleNotModifiedHeaderFields:(NSDictionary *)headerFields now:(NSDate*) now {
+    NSString *ageField =           headerFields[@"Age"];
+    NSString *dateField =          headerFields[@"Date"];
+    NSString *expiresField =       headerFields[@"Expires"];
+    NSString *cacheControlField =  headerFields[@"Cache-Control"];
+    NSString *eTagField =          headerFields[@"Etag"];
+
+    self.cacheableItem.info.age = [ageField intValue];
+    self.cacheableItem.info.serverDate = dateField ? [DateParser gh_parseHTTP:dateField] : now;
+    if (expiresField) {
+        self.cacheableItem.info.expireDate = [DateParser gh_parseHTTP:expiresField];
+    }
+    if (eTagField) {
+        self.cacheableItem.info.eTag = eTagField;
+    }
+    NSRange range = cacheControlField ? [cacheControlField rangeOfString:@"max-age="] : NSMakeRange(NSNotFound, 0);
+    if (range.location != NSNotFound) {
+        self.cacheableItem.info.maxAge = @([[cacheControlField substringFromIndex:range.location + range.length] intValue]);
+    }
+
+    // The stored headers are replaced by those of the 304 (RFC 7234 4.3.4), e.g. new tags. Content-Length is the stored body's.
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithDictionary:self.cacheableItem.info.headers];
+    for (NSString *name in headerFields) {
+        if ([name caseInsensitiveCompare:@"Content-Length"] == NSOrderedSame) {
+            continue;
+        }
+        for (NSString *storedName in [headers allKeys]) {
+            if ([storedName caseInsensitiveCompare:name] == NSOrderedSame) {
+                [headers removeObjectForKey:storedName];
+            }
+        }
+        headers[name] = headerFields[name];
+    }
+    self.cacheableItem.info.headers = headers;
+}
+
 - (void)handleResponseHeaderFields:(NSDictionary *)headerFields now:(NSDate*) now {
 #ifdef AFCACHE_LOGGING_ENABLED
     // log headers
@@ -0,0 +1,98 @@
+//
+//  AFDownloadScheduler.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFDownloadOperation;
+@class AFAdaptiveConcurrencyController;
+@class AFCacheKey;
+
+/*
+ * Lanes are ordered by their base priority: an operation waiting in a higher lane is started first,
+ * unless an operation in a lower lane has been waiting long enough to age past it.
+ */
+typedef enum {
+    AFDownloadLanePrefetch = 0,
+    AFDownloadLanePackage = 1,
+    AFDownloadLaneRevalidation = 2,
+    AFDownloadLaneInteractive = 3,
+} AFDownloadLane;
+
+#define kAFDownloadLaneCount 4
+
+/*
+ * Starts AFDownloadOperations with a global and a per-host concurrency limit.
+ * Replaces the former NSOperationQueue so that a single slow host cannot occupy every connection slot.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFDownloadScheduler : NSObject
+
+/*
+ * maximum number of operations executing at the same time (0 = unlimited)
+ */
+@property (nonatomic, assign) NSInteger maxConcurrentOperationCount;
+
+/*
+ * maximum number of operations executing at the same time for the same host (0 = unlimited)
+ */
+@property (nonatomic, assign) NSInteger maxConcurrentOperationCountPerHost;
+
+/*
+ * waiting this long raises an operation's priority by one lane, so low priority work is never starved forever
+ */
+@property (nonatomic, assign) NSTimeInterval agingInterval;
+
+/*
+ * if set, every finished operation is reported to the controller, which adjusts maxConcurrentOperationCount
+ */
+@property (nonatomic, strong) AFAdaptiveConcurrencyController *concurrencyController;
+
+/*
+ * no new operations are started while suspended. Running operations are not affected.
+ */
+@property (nonatomic, assign, getter=isSuspended) BOOL suspended;
+
+/*
+ * pending and executing operations
+ */
+@property (nonatomic, readonly) NSArray *operations;
+
+/*
+ * operations for the key of their item's URL that have not finished yet, in the order they were added.
+ * Looked up in a dictionary, so asking for a URL does not scan the lanes.
+ */
+- (NSArray*)operationsForKey:(AFCacheKey*)key;
+- (AFDownloadOperation*)nonCancelledOperationForKey:(AFCacheKey*)key;
+
+- (void)addOperation:(AFDownloadOperation*)operation lane:(AFDownloadLane)lane;
+
+/*
+ * adds several operations to the same lane and schedules them once, in the order given
+ */
+- (void)addOperations:(NSArray*)operations lane:(AFDownloadLane)lane;
+
+/*
+ * Gives the slot of an executing operation to others while it waits, e.g. for the backoff before a retry.
+ * The operation stays in operations and is pending in its lane again, but does not get a slot before the interval
+ * has passed. Then resumeBlock is called instead of -start, or as soon as the operation is cancelled.
+ * Returns NO if the operation is not executing in this scheduler.
+ */
+- (BOOL)yieldOperation:(AFDownloadOperation*)operation forInterval:(NSTimeInterval)interval resumeBlock:(void (^)(void))resumeBlock;
+
+/*
+ * moves a pending operation to the head of the interactive lane
+ */
+- (void)prioritizeOperation:(AFDownloadOperation*)operation;
+
+- (void)cancelAllOperations;
+
+- (NSUInteger)executingOperationCount;
+- (NSUInteger)executingOperationCountForHost:(NSString*)host;
+- (NSUInteger)pendingOperationCountForLane:(AFDownloadLane)lane;
+
+@end
@@ -0,0 +1,448 @@
+//
+//  AFDownloadScheduler.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFDownloadScheduler.h"
+#import "AFCache.h"
+#import "AFCacheableItem.h"
+#import "AFCacheKey.h"
+#import "AFDownloadOperation.h"
+#import "AFAdaptiveConcurrencyController.h"
+#import "AFCache_Logging.h"
+
+static void *kAFDownloadSchedulerCancelledContext = &kAFDownloadSchedulerCancelledContext;
+
+@interface AFDownloadSchedulerEntry : NSObject
+@property (nonatomic, strong) AFDownloadOperation *operation;
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic, strong) AFCacheKey *key; // of the item's URL when the operation was added
+@property (nonatomic, assign) AFDownloadLane lane;
+@property (nonatomic, assign) NSTimeInterval enqueueTimestamp;
+@property (nonatomic, assign) NSTimeInterval notBeforeTimestamp; // of a yielded operation, see yieldOperation:forInterval:resumeBlock:
+@property (nonatomic, copy) void (^resumeBlock)(void);
+@end
+
+@implementation AFDownloadSchedulerEntry
+@end
+
+@interface AFDownloadScheduler ()
+@property (nonatomic, strong) NSArray *pendingEntries; // one NSMutableArray per lane, FIFO
+@property (nonatomic, strong) NSMutableArray *executingEntries;
+@property (nonatomic, strong) NSCountedSet *executingHosts;
+@property (nonatomic, strong) NSMutableDictionary *operationsByKey; // AFCacheKey -> NSMutableArray of the operations until they finish
+@end
+
+@implementation AFDownloadScheduler
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        NSMutableArray *lanes = [NSMutableArray arrayWithCapacity:kAFDownloadLaneCount];
+        for (NSUInteger lane = 0; lane < kAFDownloadLaneCount; lane++) {
+            [lanes addObject:[NSMutableArray array]];
+        }
+        _pendingEntries = lanes;
+        _executingEntries = [NSMutableArray array];
+        _executingHosts = [[NSCountedSet alloc] init];
+        _operationsByKey = [NSMutableDictionary dictionary];
+        _agingInterval = kAFCacheDefaultDownloadAgingInterval;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSArray *lane in _pendingEntries) {
+        for (AFDownloadSchedulerEntry *entry in lane) {
+            [entry.operation removeObserver:self forKeyPath:@"isCancelled" context:kAFDownloadSchedulerCancelledContext];
+        }
+    }
+}
+
+#pragma mark - Configuration
+
+- (void)setMaxConcurrentOperationCount:(NSInteger)maxConcurrentOperationCount {
+    @synchronized (self) {
+        _maxConcurrentOperationCount = maxConcurrentOperationCount;
+    }
+    [self schedule];
+}
+
+- (void)setMaxConcurrentOperationCountPerHost:(NSInteger)maxConcurrentOperationCountPerHost {
+    @synchronized (self) {
+        _maxConcurrentOperationCountPerHost = maxConcurrentOperationCountPerHost;
+    }
+    [self schedule];
+}
+
+- (void)setAgingInterval:(NSTimeInterval)agingInterval {
+    @synchronized (self) {
+        _agingInterval = agingInterval;
+    }
+    [self schedule];
+}
+
+- (void)setConcurrencyController:(AFAdaptiveConcurrencyController *)concurrencyController {
+    @synchronized (self) {
+        _concurrencyController = concurrencyController;
+        if (concurrencyController) {
+            _maxConcurrentOperationCount = [concurrencyController concurrency];
+        }
+    }
+    [self schedule];
+}
+
+- (void)setSuspended:(BOOL)suspended {
+    @synchronized (self) {
+        _suspended = suspended;
+    }
+    [self schedule];
+}
+
+#pragma mark - Queue state
+
+- (NSArray*)operations {
+    NSMutableArray *operations = [NSMutableArray array];
+    @synchronized (self) {
+        for (AFDownloadSchedulerEntry *entry in self.executingEntries) {
+            [operations addObject:entry.operation];
+        }
+        for (NSArray *lane in self.pendingEntries) {
+            for (AFDownloadSchedulerEntry *entry in lane) {
+                [operations addObject:entry.operation];
+            }
+        }
+    }
+    return operations;
+}
+
+- (NSArray*)operationsForKey:(AFCacheKey*)key {
+    if (!key) {
+        return @[];
+    }
+    @synchronized (self) {
+        return [self.operationsByKey[key] copy] ?: @[];
+    }
+}
+
+- (AFDownloadOperation*)nonCancelledOperationForKey:(AFCacheKey*)key {
+    if (!key) {
+        return nil;
+    }
+    @synchronized (self) {
+        for (AFDownloadOperation *operation in self.operationsByKey[key]) {
+            if (![operation isCancelled]) {
+                return operation;
+            }
+        }
+    }
+    return nil;
+}
+
+- (NSUInteger)executingOperationCount {
+    @synchronized (self) {
+        return [self.executingEntries count];
+    }
+}
+
+- (NSUInteger)executingOperationCountForHost:(NSString*)host {
+    @synchronized (self) {
+        return [self.executingHosts countForObject:[self normalizedHost:host]];
+    }
+}
+
+- (NSUInteger)pendingOperationCountForLane:(AFDownloadLane)lane {
+    @synchronized (self) {
+        return [self.pendingEntries[lane] count];
+    }
+}
+
+#pragma mark - Adding, prioritizing and cancelling operations
+
+- (void)addOperation:(AFDownloadOperation*)operation lane:(AFDownloadLane)lane {
+    if (!operation) {
+        return;
+    }
+    [self addOperations:@[operation] lane:lane];
+}
+
+- (void)addOperations:(NSArray*)operations lane:(AFDownloadLane)lane {
+    NSMutableArray *entries = [NSMutableArray arrayWithCapacity:[operations count]];
+    for (AFDownloadOperation *operation in operations) {
+        [entries addObject:[self entryForOperation:operation lane:lane]];
+    }
+
+    @synchronized (self) {
+        [self.pendingEntries[lane] addObjectsFromArray:entries];
+        for (AFDownloadSchedulerEntry *entry in entries) {
+            if (!entry.key) {
+                continue;
+            }
+            NSMutableArray *operationsOfKey = self.operationsByKey[entry.key];
+            if (!operationsOfKey) {
+                operationsOfKey = [NSMutableArray arrayWithCapacity:1];
+                self.operationsByKey[entry.key] = operationsOfKey;
+            }
+            [operationsOfKey addObject:entry.operation];
+        }
+    }
+    [self schedule];
+}
+
+- (AFDownloadSchedulerEntry*)entryForOperation:(AFDownloadOperation*)operation lane:(AFDownloadLane)lane {
+    AFDownloadSchedulerEntry *entry = [[AFDownloadSchedulerEntry alloc] init];
+    entry.operation = operation;
+    entry.host = [self normalizedHost:[[operation.cacheableItem.info.request URL] host]];
+    entry.key = operation.cacheableItem.cacheKey;
+    entry.lane = lane;
+    entry.enqueueTimestamp = [NSDate timeIntervalSinceReferenceDate];
+
+    // We are informed about finished operations via their completion block, which is called by NSOperation as soon
+    // as isFinished changes to YES. A completion block set before is still called afterwards.
+    __weak AFDownloadScheduler *weakSelf = self;
+    __weak AFDownloadOperation *weakOperation = operation;
+    void (^previousCompletionBlock)(void) = [operation completionBlock];
+    [operation setCompletionBlock:^{
+        [weakSelf operationDidFinish:weakOperation];
+        if (previousCompletionBlock) {
+            previousCompletionBlock();
+        }
+    }];
+
+    // Cancelled operations finish as soon as they are started, which is done right away instead of
+    // leaving them in their lane until the next operation finishes. Observed while the entry is pending.
+    [operation addObserver:self forKeyPath:@"isCancelled" options:0 context:kAFDownloadSchedulerCancelledContext];
+    return entry;
+}
+
+- (void)prioritizeOperation:(AFDownloadOperation*)operation {
+    if (!operation) {
+        return;
+    }
+    @synchronized (self) {
+        AFDownloadSchedulerEntry *entry = [self pendingEntryForOperation:operation];
+        if (entry) {
+            [self.pendingEntries[entry.lane] removeObjectIdenticalTo:entry];
+            entry.lane = AFDownloadLaneInteractive;
+            [self.pendingEntries[AFDownloadLaneInteractive] insertObject:entry atIndex:0];
+        }
+    }
+    [self schedule];
+}
+
+- (BOOL)yieldOperation:(AFDownloadOperation*)operation forInterval:(NSTimeInterval)interval resumeBlock:(void (^)(void))resumeBlock {
+    if (!operation || !resumeBlock) {
+        return NO;
+    }
+    interval = MAX(interval, 0);
+    // Observed before the entry is visible in its lane, so -schedule never removes the observer before it is added.
+    // Not added within the lock, like in entryForOperation:lane:, as the KVO notification takes the lock.
+    [operation addObserver:self forKeyPath:@"isCancelled" options:0 context:kAFDownloadSchedulerCancelledContext];
+    BOOL yielded = NO;
+    @synchronized (self) {
+        AFDownloadSchedulerEntry *entry = [self executingEntryForOperation:operation];
+        if (entry) {
+            yielded = YES;
+            [self.executingHosts removeObject:entry.host];
+            [self.executingEntries removeObjectIdenticalTo:entry];
+            entry.notBeforeTimestamp = [NSDate timeIntervalSinceReferenceDate] + interval;
+            // ages from the end of the interval on, like an operation added then
+            entry.enqueueTimestamp = entry.notBeforeTimestamp;
+            entry.resumeBlock = resumeBlock;
+            [self.pendingEntries[entry.lane] addObject:entry];
+        }
+    }
+    if (!yielded) {
+        [operation removeObserver:self forKeyPath:@"isCancelled" context:kAFDownloadSchedulerCancelledContext];
+        return NO;
+    }
+
+    __weak AFDownloadScheduler *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [weakSelf schedule];
+    });
+    [self schedule];
+    return YES;
+}
+
+- (void)cancelAllOperations {
+    for (AFDownloadOperation *operation in [self operations]) {
+        [operation cancel];
+    }
+    [self schedule];
+}
+
+#pragma mark - Scheduling
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context {
+    if (context != kAFDownloadSchedulerCancelledContext) {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+        return;
+    }
+    if ([object isCancelled]) {
+        [self schedule];
+    }
+}
+
+- (void)operationDidFinish:(AFDownloadOperation*)operation {
+    AFDownloadSchedulerEntry *yieldedEntry = nil;
+    @synchronized (self) {
+        [self removeOperationFromKeyIndex:operation];
+        AFDownloadSchedulerEntry *entry = [self executingEntryForOperation:operation];
+        if (entry) {
+            [self.executingHosts removeObject:entry.host];
+            [self.executingEntries removeObjectIdenticalTo:entry];
+        } else {
+            // a yielded operation that finished on its own while waiting
+            yieldedEntry = [self pendingEntryForOperation:operation];
+            if (yieldedEntry) {
+                [self.pendingEntries[yieldedEntry.lane] removeObjectIdenticalTo:yieldedEntry];
+            }
+        }
+
+        // Cancelled operations and operations that never got started say nothing about the network
+        if (self.concurrencyController && ![operation isCancelled] && operation.startTimestamp > 0) {
+            NSTimeInterval latency = (operation.responseTimestamp > 0 ? operation.responseTimestamp : operation.finishTimestamp) - operation.startTimestamp;
+            _maxConcurrentOperationCount = [self.concurrencyController recordSampleWithLatency:latency
+                                                                                     duration:operation.finishTimestamp - operation.startTimestamp
+                                                                                    byteCount:operation.receivedByteCount
+                                                                                       failed:operation.failedWithNetworkError];
+        }
+    }
+    if (yieldedEntry) {
+        [operation removeObserver:self forKeyPath:@"isCancelled" context:kAFDownloadSchedulerCancelledContext];
+    }
+    [self schedule];
+}
+
+- (void)schedule {
+    NSMutableArray *startBlocks = [NSMutableArray array];
+    NSMutableArray *entriesLeavingLanes = [NSMutableArray array];
+
+    @synchronized (self) {
+        // Cancelled operations do not need a connection slot, they finish as soon as they are started.
+        for (NSMutableArray *lane in self.pendingEntries) {
+            NSIndexSet *cancelled = [lane indexesOfObjectsPassingTest:^BOOL(AFDownloadSchedulerEntry *entry, NSUInteger idx, BOOL *stop) {
+                return [entry.operation isCancelled];
+            }];
+            for (AFDownloadSchedulerEntry *entry in [lane objectsAtIndexes:cancelled]) {
+                [startBlocks addObject:[self startBlockForEntry:entry]];
+                [entriesLeavingLanes addObject:entry];
+            }
+            [lane removeObjectsAtIndexes:cancelled];
+        }
+
+        while (!self.suspended && (self.maxConcurrentOperationCount <= 0 || (NSInteger)[self.executingEntries count] < self.maxConcurrentOperationCount)) {
+            AFDownloadSchedulerEntry *entry = [self nextEntry];
+            if (!entry) {
+                break;
+            }
+            [self.pendingEntries[entry.lane] removeObjectIdenticalTo:entry];
+            [self.executingEntries addObject:entry];
+            [self.executingHosts addObject:entry.host];
+            [startBlocks addObject:[self startBlockForEntry:entry]];
+            [entriesLeavingLanes addObject:entry];
+        }
+    }
+
+    // Outside of the lock: the cancelling thread calls -schedule from within its KVO notification
+    for (AFDownloadSchedulerEntry *entry in entriesLeavingLanes) {
+        [entry.operation removeObserver:self forKeyPath:@"isCancelled" context:kAFDownloadSchedulerCancelledContext];
+    }
+
+    // Start outside of the lock: AFDownloadOperation may start its connection synchronously
+    for (void (^startBlock)(void) in startBlocks) {
+        startBlock();
+    }
+}
+
+// starts a new operation, or resumes a yielded one. Called with the lock held.
+- (void (^)(void))startBlockForEntry:(AFDownloadSchedulerEntry*)entry {
+    void (^resumeBlock)(void) = entry.resumeBlock;
+    entry.resumeBlock = nil;
+    entry.notBeforeTimestamp = 0;
+    if (resumeBlock) {
+        return resumeBlock;
+    }
+    AFDownloadOperation *operation = entry.operation;
+    return ^{
+        [operation start];
+    };
+}
+
+/*
+ * Returns the pending entry with the best score, skipping hosts that have reached their limit and yielded
+ * operations that are still waiting.
+ * The score is the lane's base priority plus one for every agingInterval the entry has been waiting.
+ * Within a lane entries are FIFO, so only the first startable entry of every lane needs to be looked at.
+ */
+- (AFDownloadSchedulerEntry*)nextEntry {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    AFDownloadSchedulerEntry *bestEntry = nil;
+    double bestScore = -1.0;
+
+    for (NSArray *lane in self.pendingEntries) {
+        for (AFDownloadSchedulerEntry *entry in lane) {
+            if (entry.notBeforeTimestamp > now) {
+                continue;
+            }
+            if (self.maxConcurrentOperationCountPerHost > 0 && (NSInteger)[self.executingHosts countForObject:entry.host] >= self.maxConcurrentOperationCountPerHost) {
+                continue;
+            }
+            double score = entry.lane;
+            if (self.agingInterval > 0) {
+                score += (now - entry.enqueueTimestamp) / self.agingInterval;
+            }
+            if (score > bestScore) {
+                bestScore = score;
+                bestEntry = entry;
+            }
+            break;
+        }
+    }
+    return bestEntry;
+}
+
+#pragma mark - Helper
+
+// Called with the lock held. Cancelled pending operations are started without an executing entry,
+// so the key is taken from the item, which keeps its URL while it is being downloaded.
+- (void)removeOperationFromKeyIndex:(AFDownloadOperation*)operation {
+    AFCacheKey *key = operation.cacheableItem.cacheKey;
+    NSMutableArray *operationsOfKey = key ? self.operationsByKey[key] : nil;
+    if (!operationsOfKey) {
+        return;
+    }
+    [operationsOfKey removeObjectIdenticalTo:operation];
+    if ([operationsOfKey count] == 0) {
+        [self.operationsByKey removeObjectForKey:key];
+    }
+}
+
+- (AFDownloadSchedulerEntry*)executingEntryForOperation:(AFDownloadOperation*)operation {
+    for (AFDownloadSchedulerEntry *entry in self.executingEntries) {
+        if (entry.operation == operation) {
+            return entry;
+        }
+    }
+    return nil;
+}
+
+- (AFDownloadSchedulerEntry*)pendingEntryForOperation:(AFDownloadOperation*)operation {
+    for (NSArray *lane in self.pendingEntries) {
+        for (AFDownloadSchedulerEntry *entry in lane) {
+            if (entry.operation == operation) {
+                return entry;
+            }
+        }
+    }
+    return nil;
+}
+
+- (NSString*)normalizedHost:(NSString*)host {
+    return [host lowercaseString] ?: @"";
+}
+
+@end
@@ -0,0 +1,21 @@
+//
+//  AFFakeReachabilityProvider.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFReachabilityProvider.h"
+
+/*
+ * Reachability provider for tests: reports whatever reachable is set to.
+ */
+@interface AFFakeReachabilityProvider : NSObject <AFReachabilityProvider>
+
+@property (nonatomic, assign) BOOL reachable;
+@property (nonatomic, readonly, getter=isMonitoring) BOOL monitoring;
+
+- (instancetype)initWithReachable:(BOOL)reachable;
+
+@end
@@ -0,0 +1,46 @@
+//
+//  AFFakeReachabilityProvider.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFFakeReachabilityProvider.h"
+
+@interface AFFakeReachabilityProvider ()
+@property (nonatomic, copy) AFReachabilityChangeBlock changeBlock;
+@end
+
+@implementation AFFakeReachabilityProvider
+
+- (instancetype)initWithReachable:(BOOL)reachable {
+    self = [super init];
+    if (self) {
+        _reachable = reachable;
+    }
+    return self;
+}
+
+- (BOOL)isMonitoring {
+    return self.changeBlock != nil;
+}
+
+- (void)setReachable:(BOOL)reachable {
+    _reachable = reachable;
+    if (self.changeBlock) {
+        self.changeBlock(reachable);
+    }
+}
+
+- (void)startMonitoringWithChangeBlock:(AFReachabilityChangeBlock)changeBlock {
+    self.changeBlock = changeBlock;
+    if (changeBlock) {
+        changeBlock(self.reachable);
+    }
+}
+
+- (void)stopMonitoring {
+    self.changeBlock = nil;
+}
+
+@end
@@ -0,0 +1,65 @@
+//
+//  AFHTTPRangeResponse.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheableItem;
+
+// more ranges than this are not worth a multipart response, the Range header is ignored
+#define kAFHTTPRangeResponseMaxRanges 32
+#define kAFHTTPRangeResponseChunkSize (256 * 1024)
+
+/*
+ * Partial response (RFC 7233) to a GET request with a Range header, served from a cached item by AFHTTPURLProtocol
+ * and AFURLCache.
+ *
+ * One satisfiable range is answered with 206 and a Content-Range header, several with 206 and a multipart/byteranges body,
+ * none with 416. Ranges are served in the order requested, overlapping ranges are not merged.
+ * The body is read range by range with -[AFCacheableItem dataInRange:], so serving a range of a large file only
+ * reads the bytes of the range. A body from a body source (slab store, package archive) is read once per response
+ * and sliced.
+ *
+ * The request is served whole (init returns nil) if it has no Range header, if the header is not a valid bytes range,
+ * or if an If-Range header does not match the entry's strong ETag or Last-Modified date.
+ */
+@interface AFHTTPRangeResponse : NSObject
+
+@property (nonatomic, readonly) NSHTTPURLResponse *response;
+
+/*
+ * NSValues of NSRanges within the body, empty if the response is 416
+ */
+@property (nonatomic, readonly) NSArray *ranges;
+
+/*
+ * length of the body of the response, including the part headers of a multipart response
+ */
+@property (nonatomic, readonly) uint64_t contentLength;
+
+/*
+ * the satisfiable ranges of a Range header for a body of length bytes. nil if the header is not a valid bytes range
+ * or has more than kAFHTTPRangeResponseMaxRanges ranges, empty if none of its ranges is satisfiable.
+ */
++ (NSArray*)rangesForHeader:(NSString*)header length:(uint64_t)length;
+
+/*
+ * nil if the request is to be served whole, see above. The item must be complete.
+ */
+- (instancetype)initWithRequest:(NSURLRequest*)request item:(AFCacheableItem*)item;
+
+/*
+ * passes the body to block in chunks of at most kAFHTTPRangeResponseChunkSize. Returns NO if the item could not be read,
+ * after the chunks read before.
+ */
+- (BOOL)enumerateBodyChunksUsingBlock:(void (^)(NSData *chunk))block;
+
+/*
+ * the whole body of the response, nil if the item could not be read
+ */
+- (NSData*)body;
+
+@end
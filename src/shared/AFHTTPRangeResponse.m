@@ -0,0 +1,218 @@
+//
+//  AFHTTPRangeResponse.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFHTTPRangeResponse.h"
+#import "AFCacheableItem.h"
+#import "AFCache+PrivateAPI.h"
+#import "DateParser.h"
+
+static BOOL AFHTTPRangeParseNumber(NSString *string, uint64_t *number) {
+    static NSCharacterSet *nonDigits = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        nonDigits = [[NSCharacterSet characterSetWithCharactersInString:@"0123456789"] invertedSet];
+    });
+    // 19 digits always fit into 64 bits
+    if ([string length] == 0 || [string length] > 19 || [string rangeOfCharacterFromSet:nonDigits].location != NSNotFound) {
+        return NO;
+    }
+    *number = strtoull([string UTF8String], NULL, 10);
+    return YES;
+}
+
+static NSString *AFHTTPRangeTrimmed(NSString *string) {
+    return [string stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+}
+
+@implementation AFHTTPRangeResponse {
+    AFCacheableItem *_item;
+    NSArray *_partHeaders;  // NSData per range of a multipart response, nil otherwise
+    NSData *_closingBoundary;
+}
+
++ (NSArray*)rangesForHeader:(NSString*)header length:(uint64_t)length {
+    NSString *trimmedHeader = AFHTTPRangeTrimmed(header);
+    NSRange equals = [trimmedHeader rangeOfString:@"="];
+    if (equals.location == NSNotFound ||
+        [AFHTTPRangeTrimmed([trimmedHeader substringToIndex:equals.location]) caseInsensitiveCompare:@"bytes"] != NSOrderedSame) {
+        return nil;
+    }
+    NSArray *specs = [[trimmedHeader substringFromIndex:NSMaxRange(equals)] componentsSeparatedByString:@","];
+    if ([specs count] > kAFHTTPRangeResponseMaxRanges) {
+        return nil;
+    }
+
+    NSMutableArray *ranges = [NSMutableArray array];
+    BOOL hasSpec = NO;
+    for (NSString *rawSpec in specs) {
+        NSString *spec = AFHTTPRangeTrimmed(rawSpec);
+        if ([spec length] == 0) {
+            // empty list elements are allowed
+            continue;
+        }
+        hasSpec = YES;
+        NSRange dash = [spec rangeOfString:@"-"];
+        if (dash.location == NSNotFound) {
+            return nil;
+        }
+        NSString *firstString = AFHTTPRangeTrimmed([spec substringToIndex:dash.location]);
+        NSString *lastString = AFHTTPRangeTrimmed([spec substringFromIndex:NSMaxRange(dash)]);
+        uint64_t first = 0;
+        uint64_t last = UINT64_MAX;
+
+        if ([firstString length] == 0) {
+            // suffix range: the last bytes
+            uint64_t suffixLength = 0;
+            if (!AFHTTPRangeParseNumber(lastString, &suffixLength)) {
+                return nil;
+            }
+            if (suffixLength == 0 || length == 0) {
+                continue;
+            }
+            suffixLength = MIN(suffixLength, length);
+            [ranges addObject:[NSValue valueWithRange:NSMakeRange((NSUInteger)(length - suffixLength), (NSUInteger)suffixLength)]];
+            continue;
+        }
+
+        if (!AFHTTPRangeParseNumber(firstString, &first)) {
+            return nil;
+        }
+        if ([lastString length] > 0 && (!AFHTTPRangeParseNumber(lastString, &last) || last < first)) {
+            return nil;
+        }
+        if (first >= length) {
+            continue;
+        }
+        last = MIN(last, length - 1);
+        [ranges addObject:[NSValue valueWithRange:NSMakeRange((NSUInteger)first, (NSUInteger)(last - first + 1))]];
+    }
+    return hasSpec ? ranges : nil;
+}
+
+// If-Range takes a strong entity tag or a date, anything else means the client's copy may be outdated
++ (BOOL)request:(NSURLRequest*)request matchesIfRangeOfItem:(AFCacheableItem*)item {
+    NSString *ifRange = AFHTTPRangeTrimmed([request valueForHTTPHeaderField:@"If-Range"]);
+    if (!ifRange) {
+        return YES;
+    }
+    if ([ifRange hasPrefix:@"\""] || [ifRange hasPrefix:@"W/"]) {
+        NSString *eTag = item.info.eTag;
+        return eTag && ![eTag hasPrefix:@"W/"] && [ifRange isEqualToString:eTag];
+    }
+    NSDate *date = [DateParser gh_parseHTTP:ifRange];
+    NSDate *lastModified = item.info.lastModified;
+    return date && lastModified && fabs([date timeIntervalSinceDate:lastModified]) < 1;
+}
+
+- (instancetype)initWithRequest:(NSURLRequest*)request item:(AFCacheableItem*)item {
+    NSString *rangeHeader = [request valueForHTTPHeaderField:@"Range"];
+    NSString *method = [request HTTPMethod] ?: @"GET";
+    if (!rangeHeader || !item || ![method isEqualToString:@"GET"] || ![[self class] request:request matchesIfRangeOfItem:item]) {
+        return nil;
+    }
+    uint64_t length = [item bodyLength];
+    NSArray *ranges = [[self class] rangesForHeader:rangeHeader length:length];
+    if (!ranges) {
+        return nil;
+    }
+
+    self = [super init];
+    if (self) {
+        _item = item;
+        _ranges = ranges;
+
+        // the body was stored decoded, its length and encoding are those of the part
+        NSMutableDictionary *headers = [NSMutableDictionary dictionary];
+        NSURLResponse *cachedResponse = item.info.response;
+        if ([cachedResponse isKindOfClass:[NSHTTPURLResponse class]]) {
+            NSSet *replacedHeaders = [NSSet setWithObjects:@"content-length", @"content-range", @"content-encoding", @"transfer-encoding", nil];
+            [[(NSHTTPURLResponse*)cachedResponse allHeaderFields] enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSString *value, BOOL *stop) {
+                if (![replacedHeaders containsObject:[name lowercaseString]]) {
+                    headers[name] = value;
+                }
+            }];
+        }
+        headers[@"Accept-Ranges"] = @"bytes";
+
+        NSInteger statusCode = 206;
+        if ([ranges count] == 0) {
+            statusCode = 416;
+            headers[@"Content-Range"] = [NSString stringWithFormat:@"bytes */%llu", length];
+            _contentLength = 0;
+        } else if ([ranges count] == 1) {
+            NSRange range = [ranges[0] rangeValue];
+            headers[@"Content-Range"] = [NSString stringWithFormat:@"bytes %lu-%lu/%llu", (unsigned long)range.location, (unsigned long)NSMaxRange(range) - 1, length];
+            _contentLength = range.length;
+        } else {
+            NSString *boundary = [[NSUUID UUID] UUIDString];
+            NSString *contentType = item.info.mimeType ?: @"application/octet-stream";
+            NSMutableArray *partHeaders = [NSMutableArray arrayWithCapacity:[ranges count]];
+            for (NSValue *value in ranges) {
+                NSRange range = [value rangeValue];
+                NSString *partHeader = [NSString stringWithFormat:@"\r\n--%@\r\nContent-Type: %@\r\nContent-Range: bytes %lu-%lu/%llu\r\n\r\n",
+                                        boundary, contentType, (unsigned long)range.location, (unsigned long)NSMaxRange(range) - 1, length];
+                NSData *partHeaderData = [partHeader dataUsingEncoding:NSUTF8StringEncoding];
+                [partHeaders addObject:partHeaderData];
+                _contentLength += [partHeaderData length] + range.length;
+            }
+            _partHeaders = partHeaders;
+            _closingBoundary = [[NSString stringWithFormat:@"\r\n--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding];
+            _contentLength += [_closingBoundary length];
+            headers[@"Content-Type"] = [NSString stringWithFormat:@"multipart/byteranges; boundary=%@", boundary];
+        }
+        headers[@"Content-Length"] = [NSString stringWithFormat:@"%llu", _contentLength];
+
+        _response = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    }
+    return self;
+}
+
+- (BOOL)enumerateBodyChunksUsingBlock:(void (^)(NSData *chunk))block {
+    // a body source hands out the whole body, e.g. a package archive inflates the entry. It is read once and sliced.
+    NSData *sourceBody = nil;
+    if (_item.info.bodySourceKey && [self.ranges count] > 0) {
+        sourceBody = [_item.cache bodyForItemInfo:_item.info];
+        if (!sourceBody) {
+            return NO;
+        }
+    }
+    for (NSUInteger i = 0; i < [self.ranges count]; i++) {
+        NSRange range = [self.ranges[i] rangeValue];
+        if (_partHeaders) {
+            block(_partHeaders[i]);
+        }
+        for (NSUInteger offset = 0; offset < range.length; offset += kAFHTTPRangeResponseChunkSize) {
+            @autoreleasepool {
+                NSRange chunkRange = NSMakeRange(range.location + offset, MIN(kAFHTTPRangeResponseChunkSize, range.length - offset));
+                NSData *chunk = nil;
+                if (!sourceBody) {
+                    chunk = [_item dataInRange:chunkRange];
+                } else if (NSMaxRange(chunkRange) <= [sourceBody length]) {
+                    chunk = [sourceBody subdataWithRange:chunkRange];
+                }
+                if (!chunk) {
+                    return NO;
+                }
+                block(chunk);
+            }
+        }
+    }
+    if (_closingBoundary) {
+        block(_closingBoundary);
+    }
+    return YES;
+}
+
+- (NSData*)body {
+    NSMutableData *body = [NSMutableData dataWithCapacity:(NSUInteger)self.contentLength];
+    BOOL complete = [self enumerateBodyChunksUsingBlock:^(NSData *chunk) {
+        [body appendData:chunk];
+    }];
+    return complete ? body : nil;
+}
+
+@end
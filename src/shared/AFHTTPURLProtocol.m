@@ -29,6 +29,7 @@
  */
  
 #import "AFHTTPURLProtocol.h"
+#import "AFHTTPRangeResponse.h"
 
 @implementation AFHTTPURLProtocol
 
@@ -81,13 +82,32 @@
         NSURLRequest *redirectRequest = cacheableItem.servedFromCache && !cacheableItem.URLInternallyRewritten ? self.request : cacheableItem.info.redirectRequest;
         NSURLResponse *redirectResponse = cacheableItem.info.redirectResponse;
         [[self client] URLProtocol:self wasRedirectedToRequest:redirectRequest redirectResponse:redirectResponse];
-    } else {
+    } else if (![self loadRangesOfItem:cacheableItem]) {
         [[self client] URLProtocol:self didReceiveResponse:cacheableItem.info.response cacheStoragePolicy:NSURLCacheStorageAllowed];
         [[self client] URLProtocol:self didLoadData:cacheableItem.data];
         [[self client] URLProtocolDidFinishLoading:self];
     }
 }
 
+// Answers a Range request from the cached body, chunk by chunk. NO if the request is to be served whole.
+- (BOOL)loadRangesOfItem:(AFCacheableItem*)cacheableItem {
+    AFHTTPRangeResponse *rangeResponse = [[AFHTTPRangeResponse alloc] initWithRequest:self.request item:cacheableItem];
+    if (!rangeResponse) {
+        return NO;
+    }
+    // partial responses must not replace the full one in the URL cache
+    [[self client] URLProtocol:self didReceiveResponse:rangeResponse.response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    BOOL complete = [rangeResponse enumerateBodyChunksUsingBlock:^(NSData *chunk) {
+        [[self client] URLProtocol:self didLoadData:chunk];
+    }];
+    if (complete) {
+        [[self client] URLProtocolDidFinishLoading:self];
+    } else {
+        [[self client] URLProtocol:self didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotOpenFile userInfo:nil]];
+    }
+    return YES;
+}
+
 - (void)connectionHasBeenRedirected: (AFCacheableItem*) cacheableItem {
     // don't inform client right now, but when finished downloading. Otherwise the response will not come back to AFCache...
 }
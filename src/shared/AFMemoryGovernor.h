@@ -0,0 +1,90 @@
+//
+//  AFMemoryGovernor.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheableItem;
+
+// keys of -statistics
+#define kAFMemoryGovernorLiveItemsKey @"liveItems"
+#define kAFMemoryGovernorResidentItemsKey @"residentItems"
+#define kAFMemoryGovernorResidentBytesKey @"residentBytes"
+#define kAFMemoryGovernorResidentByteLimitKey @"residentByteLimit"
+#define kAFMemoryGovernorReleasedItemsKey @"releasedItems"
+#define kAFMemoryGovernorReleasedBytesKey @"releasedBytes"
+#define kAFMemoryGovernorMemoryPressureEventsKey @"memoryPressureEvents"
+
+/*
+ * Posted by -handleMemoryPressure on the thread that called it, after the bodies of all items have been released.
+ * Every AFCache drops its in-memory tiers when it receives it.
+ */
+#define kAFMemoryGovernorMemoryPressureNotification @"AFMemoryGovernorMemoryPressureNotification"
+
+/*
+ * Process-wide bound for the memory held by AFCacheableItems.
+ *
+ * -[AFCacheableItem data] maps the cache file (or reads the body from its body source) on first access and keeps it.
+ * Such bodies are resident: they can be dropped at any time and are read again on the next access. Bodies that were
+ * set on the item (e.g. of entries the cache did not admit to disk) are not resident, they cannot be read again.
+ *
+ * The governor counts live items and the resident bytes of all items. Once the resident bytes exceed residentByteLimit,
+ * the bodies of items that have not been accessed for idleInterval are released, least recently accessed first,
+ * until the total is within the limit. Items that are still in use are checked again after idleInterval.
+ *
+ * On memory pressure (-handleMemoryPressure) the bodies of all items are released, idle or not, and
+ * kAFMemoryGovernorMemoryPressureNotification makes every cache close the archives it serves bodies from and
+ * shrink its info stores. The system's memory warnings call -handleMemoryPressure unless observesSystemMemoryPressure
+ * is turned off; any other signal (e.g. the host's own memory accounting) may call it as well.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFMemoryGovernor : NSObject
+
+/*
+ * resident bytes all items together may hold before idle ones are released (0 = unlimited). Default is 0
+ */
+@property (nonatomic, assign) uint64_t residentByteLimit;
+
+/*
+ * time since the last access to its data after which an item is idle. Default is 10 seconds
+ */
+@property (nonatomic, assign) NSTimeInterval idleInterval;
+
+/*
+ * YES to call -handleMemoryPressure on the system's memory warnings
+ * (UIApplicationDidReceiveMemoryWarningNotification on iOS, the memory pressure dispatch source on OS X). Default is YES
+ */
+@property (nonatomic, assign) BOOL observesSystemMemoryPressure;
+
++ (AFMemoryGovernor*)sharedGovernor;
+
+/*
+ * releases the bodies of all items and posts kAFMemoryGovernorMemoryPressureNotification
+ */
+- (void)handleMemoryPressure;
+
+/*
+ * schedules an enforcement of residentByteLimit. Calls are coalesced while an enforcement is pending.
+ */
+- (void)setNeedsEnforcement;
+
+/*
+ * enforces residentByteLimit now and returns when done
+ */
+- (void)enforce;
+
+- (NSDictionary*)statistics;
+
+/*
+ * called by AFCacheableItem. Items are held weakly.
+ */
+- (void)itemDidInitialize:(AFCacheableItem*)item;
+- (void)item:(AFCacheableItem*)item didLoadResidentDataOfLength:(uint64_t)length;
+- (void)item:(AFCacheableItem*)item didReleaseResidentDataOfLength:(uint64_t)length;
+- (void)itemDidDeallocateWithResidentDataOfLength:(uint64_t)length;
+
+@end
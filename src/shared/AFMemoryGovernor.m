@@ -0,0 +1,267 @@
+//
+//  AFMemoryGovernor.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFMemoryGovernor.h"
+#import "AFCacheableItem.h"
+#import "AFCache+PrivateAPI.h"
+#import "AFCache_Logging.h"
+
+#define kAFMemoryGovernorDefaultIdleInterval 10
+
+@interface AFMemoryGovernor ()
+@property (nonatomic, strong) NSHashTable *residentItems; // items holding resident data, weak
+@property (nonatomic, assign) uint64_t residentBytes;
+@property (nonatomic, assign) NSUInteger liveItems;
+@property (nonatomic, assign) NSUInteger releasedItems;
+@property (nonatomic, assign) uint64_t releasedBytes;
+@property (nonatomic, assign) NSUInteger memoryPressureEvents;
+@property (nonatomic, assign) BOOL enforcementPending;
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t memoryPressureSource;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+@property (nonatomic, assign) dispatch_source_t memoryPressureSource;
+#endif
+@end
+
+@implementation AFMemoryGovernor
+
++ (AFMemoryGovernor*)sharedGovernor {
+    static AFMemoryGovernor *sharedGovernor = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedGovernor = [[self alloc] init];
+    });
+    return sharedGovernor;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _residentItems = [NSHashTable weakObjectsHashTable];
+        _idleInterval = kAFMemoryGovernorDefaultIdleInterval;
+        _queue = dispatch_queue_create("de.artifacts.afcache.memorygovernor", DISPATCH_QUEUE_SERIAL);
+        [self setObservesSystemMemoryPressure:YES];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self setObservesSystemMemoryPressure:NO];
+#if !OS_OBJECT_USE_OBJC
+    if (_queue) {
+        dispatch_release(_queue);
+    }
+#endif
+}
+
+#pragma mark - Configuration
+
+- (void)setResidentByteLimit:(uint64_t)residentByteLimit {
+    @synchronized (self) {
+        _residentByteLimit = residentByteLimit;
+    }
+    [self setNeedsEnforcement];
+}
+
+- (void)setObservesSystemMemoryPressure:(BOOL)observesSystemMemoryPressure {
+    @synchronized (self) {
+        if (_observesSystemMemoryPressure == observesSystemMemoryPressure) {
+            return;
+        }
+        _observesSystemMemoryPressure = observesSystemMemoryPressure;
+#if TARGET_OS_IPHONE
+        if (observesSystemMemoryPressure) {
+            [[NSNotificationCenter defaultCenter] addObserver:self
+                                                     selector:@selector(handleMemoryPressure)
+                                                         name:UIApplicationDidReceiveMemoryWarningNotification
+                                                       object:nil];
+        } else {
+            [[NSNotificationCenter defaultCenter] removeObserver:self
+                                                            name:UIApplicationDidReceiveMemoryWarningNotification
+                                                          object:nil];
+        }
+#elif defined(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE)
+        if (observesSystemMemoryPressure) {
+            dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+                                                              DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                                              self.queue);
+            __weak AFMemoryGovernor *weakSelf = self;
+            dispatch_source_set_event_handler(source, ^{
+                [weakSelf handleMemoryPressure];
+            });
+            dispatch_resume(source);
+            self.memoryPressureSource = source;
+        } else if (self.memoryPressureSource) {
+            dispatch_source_cancel(self.memoryPressureSource);
+#if !OS_OBJECT_USE_OBJC
+            dispatch_release(self.memoryPressureSource);
+#endif
+            self.memoryPressureSource = nil;
+        }
+#endif
+    }
+}
+
+#pragma mark - Items
+
+- (void)itemDidInitialize:(AFCacheableItem*)item {
+    @synchronized (self) {
+        self.liveItems++;
+    }
+}
+
+- (void)item:(AFCacheableItem*)item didLoadResidentDataOfLength:(uint64_t)length {
+    BOOL exceedsLimit = NO;
+    @synchronized (self) {
+        [self.residentItems addObject:item];
+        self.residentBytes += length;
+        exceedsLimit = self.residentByteLimit > 0 && self.residentBytes > self.residentByteLimit;
+    }
+    if (exceedsLimit) {
+        [self setNeedsEnforcement];
+    }
+}
+
+- (void)item:(AFCacheableItem*)item didReleaseResidentDataOfLength:(uint64_t)length {
+    @synchronized (self) {
+        [self.residentItems removeObject:item];
+        self.residentBytes -= MIN(length, self.residentBytes);
+    }
+}
+
+// The weak hash table drops the item by itself, it must not be passed in while it deallocates
+- (void)itemDidDeallocateWithResidentDataOfLength:(uint64_t)length {
+    @synchronized (self) {
+        self.liveItems -= MIN((NSUInteger)1, self.liveItems);
+        self.residentBytes -= MIN(length, self.residentBytes);
+    }
+}
+
+#pragma mark - Enforcement
+
+- (void)setNeedsEnforcement {
+    @synchronized (self) {
+        if (self.enforcementPending || self.residentByteLimit == 0) {
+            return;
+        }
+        self.enforcementPending = YES;
+    }
+    dispatch_async(self.queue, ^{
+        [self enforceOnQueue];
+    });
+}
+
+- (void)enforce {
+    dispatch_sync(self.queue, ^{
+        [self enforceOnQueue];
+    });
+}
+
+- (void)enforceOnQueue {
+    NSArray *items = nil;
+    uint64_t limit = 0;
+    uint64_t residentBytes = 0;
+    NSTimeInterval idleInterval = 0;
+    @synchronized (self) {
+        self.enforcementPending = NO;
+        limit = self.residentByteLimit;
+        residentBytes = self.residentBytes;
+        idleInterval = self.idleInterval;
+        if (limit == 0 || residentBytes <= limit) {
+            return;
+        }
+        items = [self.residentItems allObjects];
+    }
+
+    items = [items sortedArrayUsingComparator:^NSComparisonResult(AFCacheableItem *item1, AFCacheableItem *item2) {
+        NSTimeInterval time1 = [item1 lastDataAccessTime];
+        NSTimeInterval time2 = [item2 lastDataAccessTime];
+        return time1 < time2 ? NSOrderedAscending : (time1 > time2 ? NSOrderedDescending : NSOrderedSame);
+    }];
+
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSUInteger releasedItems = 0;
+    uint64_t releasedBytes = 0;
+    BOOL itemsInUse = NO;
+    for (AFCacheableItem *item in items) {
+        if (releasedBytes >= residentBytes - limit) {
+            break;
+        }
+        if (now - [item lastDataAccessTime] < idleInterval) {
+            // all following items have been accessed even more recently
+            itemsInUse = YES;
+            break;
+        }
+        uint64_t length = [item releaseResidentData];
+        if (length > 0) {
+            releasedItems++;
+            releasedBytes += length;
+        }
+    }
+
+    @synchronized (self) {
+        self.releasedItems += releasedItems;
+        self.releasedBytes += releasedBytes;
+        residentBytes = self.residentBytes;
+    }
+    AFLog(@"memory governor: released %lu items with %llu bytes, %llu resident bytes, limit %llu",
+          (unsigned long)releasedItems, releasedBytes, residentBytes, limit);
+
+    if (itemsInUse && residentBytes > limit) {
+        // check again once the items in use may have become idle
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(idleInterval * NSEC_PER_SEC)), self.queue, ^{
+            [self setNeedsEnforcement];
+        });
+    }
+}
+
+#pragma mark - Memory pressure
+
+- (void)handleMemoryPressure {
+    NSArray *items = nil;
+    @synchronized (self) {
+        self.memoryPressureEvents++;
+        items = [self.residentItems allObjects];
+    }
+
+    NSUInteger releasedItems = 0;
+    uint64_t releasedBytes = 0;
+    for (AFCacheableItem *item in items) {
+        uint64_t length = [item releaseResidentData];
+        if (length > 0) {
+            releasedItems++;
+            releasedBytes += length;
+        }
+    }
+
+    @synchronized (self) {
+        self.releasedItems += releasedItems;
+        self.releasedBytes += releasedBytes;
+    }
+    AFLog(@"memory governor: memory pressure, released %lu items with %llu bytes", (unsigned long)releasedItems, releasedBytes);
+
+    [[NSNotificationCenter defaultCenter] postNotificationName:kAFMemoryGovernorMemoryPressureNotification object:self];
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFMemoryGovernorLiveItemsKey : @(self.liveItems),
+                 kAFMemoryGovernorResidentItemsKey : @([[self.residentItems allObjects] count]),
+                 kAFMemoryGovernorResidentBytesKey : @(self.residentBytes),
+                 kAFMemoryGovernorResidentByteLimitKey : @(self.residentByteLimit),
+                 kAFMemoryGovernorReleasedItemsKey : @(self.releasedItems),
+                 kAFMemoryGovernorReleasedBytesKey : @(self.releasedBytes),
+                 kAFMemoryGovernorMemoryPressureEventsKey : @(self.memoryPressureEvents),
+                 };
+    }
+}
+
+@end
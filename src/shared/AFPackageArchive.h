@@ -0,0 +1,66 @@
+//
+//  AFPackageArchive.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFCacheBodySource.h"
+
+// ZIP format constants shared with AFPackageArchiveWriter
+#define kAFPackageArchiveEndOfCentralDirectorySignature 0x06054b50
+#define kAFPackageArchiveEndOfCentralDirectorySize 22
+#define kAFPackageArchiveCentralDirectoryHeaderSignature 0x02014b50
+#define kAFPackageArchiveCentralDirectoryHeaderSize 46
+#define kAFPackageArchiveLocalHeaderSignature 0x04034b50
+#define kAFPackageArchiveLocalHeaderSize 30
+
+#define kAFPackageArchiveFlagEncrypted (1 << 0)
+#define kAFPackageArchiveFlagUTF8 (1 << 11)
+
+#define kAFPackageArchiveMethodStored 0
+#define kAFPackageArchiveMethodDeflated 8
+
+/*
+ * Read-only view of a package ZIP file that serves its entries without extracting them.
+ *
+ * The file is memory-mapped and the central directory is read once into an index of entry name -> local header offset,
+ * sizes and compression method. Stored (uncompressed) entries are returned as NSData slices of the mapping, which
+ * neither copy nor allocate the body; deflated entries are inflated into a new buffer every time they are read and
+ * checked against their CRC.
+ *
+ * ZIP64 archives, encrypted entries and compression methods other than stored and deflate are not supported.
+ * Such an archive does not open, such entries are not listed.
+ *
+ * As a body source the archive serves cache entries by their bodySourceEntry, which is the name of the entry in the ZIP.
+ * All methods may be called from any thread.
+ */
+@interface AFPackageArchive : NSObject <AFCacheBodySource>
+
+@property (nonatomic, readonly) NSString *path;
+@property (nonatomic, readonly) NSArray *entryNames;
+
+/*
+ * nil if the file cannot be mapped or is no ZIP file this class can read
+ */
+- (instancetype)initWithContentsOfFile:(NSString*)path;
+
+- (BOOL)hasEntryNamed:(NSString*)name;
+
+/*
+ * the size of the entry's data once it is inflated, 0 for unknown entries
+ */
+- (uint64_t)uncompressedSizeOfEntryNamed:(NSString*)name;
+
+/*
+ * nil for unknown entries and entries that fail to inflate
+ */
+- (NSData*)dataForEntryNamed:(NSString*)name;
+
+/*
+ * the entry's data as it is stored in the archive, without inflating it. Used to copy entries into a new archive.
+ */
+- (NSData*)compressedDataForEntryNamed:(NSString*)name method:(uint16_t*)method crc:(uint32_t*)crc;
+
+@end
@@ -0,0 +1,282 @@
+//
+//  AFPackageArchive.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFPackageArchive.h"
+#import "AFCacheableItemInfo.h"
+#import "AFCache_Logging.h"
+#import <zlib.h>
+
+#define kAFPackageArchiveMaxCommentLength 0xFFFF
+
+typedef struct {
+    uint32_t localHeaderOffset;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint32_t crc;
+    uint16_t method;
+} AFPackageArchiveEntry;
+
+static inline uint16_t AFPackageArchiveRead16(const uint8_t *bytes) {
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static inline uint32_t AFPackageArchiveRead32(const uint8_t *bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+#pragma mark - Slices
+
+/*
+ * An NSData that points into the mapping of its archive and keeps the mapping alive
+ */
+@interface AFPackageArchiveSlice : NSData
+- (instancetype)initWithMapping:(NSData*)mapping range:(NSRange)range;
+@end
+
+@implementation AFPackageArchiveSlice {
+    NSData *_mapping;
+    NSRange _range;
+}
+
+- (instancetype)initWithMapping:(NSData*)mapping range:(NSRange)range {
+    self = [super init];
+    if (self) {
+        _mapping = mapping;
+        _range = range;
+    }
+    return self;
+}
+
+- (const void *)bytes {
+    return (const uint8_t *)[_mapping bytes] + _range.location;
+}
+
+- (NSUInteger)length {
+    return _range.length;
+}
+
+@end
+
+#pragma mark - Archive
+
+@implementation AFPackageArchive {
+    NSData *_mapping;
+    NSData *_entries;          // AFPackageArchiveEntry[]
+    NSDictionary *_entryIndex; // entry name -> index into _entries
+}
+
+- (instancetype)initWithContentsOfFile:(NSString*)path {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        NSError *error = nil;
+        _mapping = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:&error];
+        if (!_mapping) {
+            NSLog(@"AFCache: Could not map package archive %@ (Error: %@)", path, [error localizedDescription]);
+            return nil;
+        }
+        if (![self readCentralDirectory]) {
+            NSLog(@"AFCache: %@ is no package archive that can be served without extraction", path);
+            return nil;
+        }
+        AFLog(@"mapped package archive %@ with %lu entries", path, (unsigned long)[_entryIndex count]);
+    }
+    return self;
+}
+
+#pragma mark - Central directory
+
+- (BOOL)readCentralDirectory {
+    const uint8_t *bytes = [_mapping bytes];
+    NSUInteger length = [_mapping length];
+    if (length < kAFPackageArchiveEndOfCentralDirectorySize) {
+        return NO;
+    }
+
+    // The end of central directory record is followed by a comment of up to 64k, search it backwards
+    NSUInteger minimumOffset = length > kAFPackageArchiveEndOfCentralDirectorySize + kAFPackageArchiveMaxCommentLength ? length - kAFPackageArchiveEndOfCentralDirectorySize - kAFPackageArchiveMaxCommentLength : 0;
+    NSUInteger endOffset = NSNotFound;
+    for (NSUInteger offset = length - kAFPackageArchiveEndOfCentralDirectorySize; ; offset--) {
+        if (AFPackageArchiveRead32(bytes + offset) == kAFPackageArchiveEndOfCentralDirectorySignature) {
+            endOffset = offset;
+            break;
+        }
+        if (offset == minimumOffset) {
+            break;
+        }
+    }
+    if (endOffset == NSNotFound) {
+        return NO;
+    }
+
+    uint16_t entryCount = AFPackageArchiveRead16(bytes + endOffset + 10);
+    uint32_t directorySize = AFPackageArchiveRead32(bytes + endOffset + 12);
+    uint32_t directoryOffset = AFPackageArchiveRead32(bytes + endOffset + 16);
+    if (entryCount == 0xFFFF || directoryOffset == 0xFFFFFFFF || (uint64_t)directoryOffset + directorySize > endOffset) {
+        // ZIP64 or broken
+        return NO;
+    }
+
+    NSMutableData *entries = [NSMutableData dataWithCapacity:entryCount * sizeof(AFPackageArchiveEntry)];
+    NSMutableDictionary *entryIndex = [NSMutableDictionary dictionaryWithCapacity:entryCount];
+    NSMutableArray *entryNames = [NSMutableArray arrayWithCapacity:entryCount];
+    NSUInteger offset = directoryOffset;
+    for (uint16_t i = 0; i < entryCount; i++) {
+        if (offset + kAFPackageArchiveCentralDirectoryHeaderSize > endOffset ||
+            AFPackageArchiveRead32(bytes + offset) != kAFPackageArchiveCentralDirectoryHeaderSignature) {
+            return NO;
+        }
+        const uint8_t *header = bytes + offset;
+        uint16_t flags = AFPackageArchiveRead16(header + 8);
+        uint16_t nameLength = AFPackageArchiveRead16(header + 28);
+        uint16_t extraLength = AFPackageArchiveRead16(header + 30);
+        uint16_t commentLength = AFPackageArchiveRead16(header + 32);
+        NSUInteger nextOffset = offset + kAFPackageArchiveCentralDirectoryHeaderSize + nameLength + extraLength + commentLength;
+        if (nextOffset > endOffset) {
+            return NO;
+        }
+
+        AFPackageArchiveEntry entry;
+        entry.method = AFPackageArchiveRead16(header + 10);
+        entry.crc = AFPackageArchiveRead32(header + 16);
+        entry.compressedSize = AFPackageArchiveRead32(header + 20);
+        entry.uncompressedSize = AFPackageArchiveRead32(header + 24);
+        entry.localHeaderOffset = AFPackageArchiveRead32(header + 42);
+
+        NSString *name = [[NSString alloc] initWithBytes:header + kAFPackageArchiveCentralDirectoryHeaderSize
+                                                  length:nameLength
+                                                encoding:(flags & kAFPackageArchiveFlagUTF8) ? NSUTF8StringEncoding : NSISOLatin1StringEncoding];
+        offset = nextOffset;
+
+        if (!name || [name hasSuffix:@"/"]) {
+            continue;
+        }
+        if ((flags & kAFPackageArchiveFlagEncrypted) ||
+            (entry.method != kAFPackageArchiveMethodStored && entry.method != kAFPackageArchiveMethodDeflated) ||
+            (entry.method == kAFPackageArchiveMethodStored && entry.compressedSize != entry.uncompressedSize)) {
+            AFLog(@"skipping unsupported entry %@ (method %u, flags %u) of package archive %@", name, entry.method, flags, self.path);
+            continue;
+        }
+        entryIndex[name] = @([entries length] / sizeof(AFPackageArchiveEntry));
+        [entries appendBytes:&entry length:sizeof(entry)];
+        [entryNames addObject:name];
+    }
+
+    _entries = entries;
+    _entryIndex = entryIndex;
+    _entryNames = entryNames;
+    return YES;
+}
+
+- (BOOL)getEntry:(AFPackageArchiveEntry*)entry named:(NSString*)name {
+    NSNumber *index = name ? _entryIndex[name] : nil;
+    if (!index) {
+        return NO;
+    }
+    *entry = ((const AFPackageArchiveEntry *)[_entries bytes])[[index unsignedIntegerValue]];
+    return YES;
+}
+
+/*
+ * The data follows the local header, whose extra field may differ from the one in the central directory
+ */
+- (NSRange)rangeOfEntry:(AFPackageArchiveEntry)entry {
+    const uint8_t *bytes = [_mapping bytes];
+    NSUInteger length = [_mapping length];
+    if ((NSUInteger)entry.localHeaderOffset + kAFPackageArchiveLocalHeaderSize > length ||
+        AFPackageArchiveRead32(bytes + entry.localHeaderOffset) != kAFPackageArchiveLocalHeaderSignature) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+    const uint8_t *header = bytes + entry.localHeaderOffset;
+    NSUInteger dataOffset = entry.localHeaderOffset + kAFPackageArchiveLocalHeaderSize + AFPackageArchiveRead16(header + 26) + AFPackageArchiveRead16(header + 28);
+    if (dataOffset + entry.compressedSize > length) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+    return NSMakeRange(dataOffset, entry.compressedSize);
+}
+
+#pragma mark - Entries
+
+- (BOOL)hasEntryNamed:(NSString*)name {
+    return name && _entryIndex[name] != nil;
+}
+
+- (uint64_t)uncompressedSizeOfEntryNamed:(NSString*)name {
+    AFPackageArchiveEntry entry;
+    return [self getEntry:&entry named:name] ? entry.uncompressedSize : 0;
+}
+
+- (NSData*)dataForEntryNamed:(NSString*)name {
+    AFPackageArchiveEntry entry;
+    if (![self getEntry:&entry named:name]) {
+        return nil;
+    }
+    NSRange range = [self rangeOfEntry:entry];
+    if (range.location == NSNotFound) {
+        NSLog(@"AFCache: entry %@ of package archive %@ is out of bounds", name, self.path);
+        return nil;
+    }
+    if (entry.method == kAFPackageArchiveMethodStored) {
+        return [[AFPackageArchiveSlice alloc] initWithMapping:_mapping range:range];
+    }
+    return [self inflateEntry:entry range:range name:name];
+}
+
+- (NSData*)compressedDataForEntryNamed:(NSString*)name method:(uint16_t*)method crc:(uint32_t*)crc {
+    AFPackageArchiveEntry entry;
+    if (![self getEntry:&entry named:name]) {
+        return nil;
+    }
+    NSRange range = [self rangeOfEntry:entry];
+    if (range.location == NSNotFound) {
+        return nil;
+    }
+    if (method) {
+        *method = entry.method;
+    }
+    if (crc) {
+        *crc = entry.crc;
+    }
+    return [[AFPackageArchiveSlice alloc] initWithMapping:_mapping range:range];
+}
+
+- (NSData*)inflateEntry:(AFPackageArchiveEntry)entry range:(NSRange)range name:(NSString*)name {
+    NSMutableData *data = [NSMutableData dataWithLength:entry.uncompressedSize];
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.next_in = (Bytef *)[_mapping bytes] + range.location;
+    stream.avail_in = (uInt)range.length;
+    stream.next_out = [data mutableBytes];
+    stream.avail_out = (uInt)entry.uncompressedSize;
+
+    // negative window bits: raw deflate data without zlib header
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return nil;
+    }
+    int status = inflate(&stream, Z_FINISH);
+    uLong inflatedLength = stream.total_out;
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END || inflatedLength != entry.uncompressedSize ||
+        crc32(crc32(0L, Z_NULL, 0), [data bytes], (uInt)[data length]) != entry.crc) {
+        NSLog(@"AFCache: Could not inflate entry %@ of package archive %@ (zlib status %d)", name, self.path, status);
+        return nil;
+    }
+    return data;
+}
+
+#pragma mark - AFCacheBodySource
+
+- (BOOL)hasBodyForItemInfo:(AFCacheableItemInfo*)info {
+    return [self hasEntryNamed:info.bodySourceEntry];
+}
+
+- (NSData*)bodyForItemInfo:(AFCacheableItemInfo*)info {
+    return [self dataForEntryNamed:info.bodySourceEntry];
+}
+
+@end
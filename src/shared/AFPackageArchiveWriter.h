@@ -0,0 +1,59 @@
+//
+//  AFPackageArchiveWriter.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Writes a package ZIP file entry by entry.
+ *
+ * Entries are added already compressed, so the expensive part can run on many threads with +deflatedData:crc:
+ * while the writer appends the results in order. Entries copied from an earlier archive
+ * (-[AFPackageArchive compressedDataForEntryNamed:method:crc:]) are written as they are, without recompressing.
+ *
+ * Entry names are stored as UTF-8. ZIP64 is not written: an archive holds less than 65535 entries and less than 4 GB.
+ * Not thread-safe, use from one thread at a time.
+ */
+@interface AFPackageArchiveWriter : NSObject
+
+@property (nonatomic, readonly) NSString *path;
+@property (nonatomic, readonly) NSUInteger entryCount;
+@property (nonatomic, readonly) uint64_t bytesWritten;
+
+/*
+ * raw deflate data of data and its CRC-32. nil if deflating does not make the data smaller, then store it as it is.
+ * Thread-safe.
+ */
++ (NSData*)deflatedData:(NSData*)data crc:(uint32_t*)crc;
+
++ (uint32_t)crcOfData:(NSData*)data;
+
+/*
+ * nil if the file cannot be created. An existing file is replaced.
+ */
+- (instancetype)initWithPath:(NSString*)path;
+
+/*
+ * compresses data on the calling thread
+ */
+- (BOOL)addEntryNamed:(NSString*)name data:(NSData*)data modificationDate:(NSDate*)modificationDate;
+
+/*
+ * @param method kAFPackageArchiveMethodStored or kAFPackageArchiveMethodDeflated
+ */
+- (BOOL)addEntryNamed:(NSString*)name
+       compressedData:(NSData*)compressedData
+               method:(uint16_t)method
+                  crc:(uint32_t)crc
+     uncompressedSize:(uint64_t)uncompressedSize
+     modificationDate:(NSDate*)modificationDate;
+
+/*
+ * writes the central directory and closes the file. Returns NO if any write failed.
+ */
+- (BOOL)close;
+
+@end
@@ -0,0 +1,214 @@
+//
+//  AFPackageArchiveWriter.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFPackageArchiveWriter.h"
+#import "AFPackageArchive.h"
+#import "AFCache_Logging.h"
+#import <zlib.h>
+
+#define kAFPackageArchiveWriterVersion 20 // 2.0: deflate
+#define kAFPackageArchiveWriterMaxEntryCount 0xFFFF
+#define kAFPackageArchiveWriterMaxSize 0xFFFFFFFFULL
+
+static inline void AFPackageArchiveWrite16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+}
+
+static inline void AFPackageArchiveWrite32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+    bytes[2] = (value >> 16) & 0xFF;
+    bytes[3] = (value >> 24) & 0xFF;
+}
+
+@implementation AFPackageArchiveWriter {
+    FILE *_file;
+    NSMutableData *_centralDirectory;
+    NSCalendar *_calendar;
+    BOOL _failed;
+}
+
++ (uint32_t)crcOfData:(NSData*)data {
+    return (uint32_t)crc32(crc32(0L, Z_NULL, 0), [data bytes], (uInt)[data length]);
+}
+
++ (NSData*)deflatedData:(NSData*)data crc:(uint32_t*)crc {
+    if (crc) {
+        *crc = [self crcOfData:data];
+    }
+    if ([data length] == 0 || [data length] > kAFPackageArchiveWriterMaxSize) {
+        return nil;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // negative window bits: raw deflate data as ZIP expects it, without zlib header
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nil;
+    }
+    NSMutableData *deflated = [NSMutableData dataWithLength:deflateBound(&stream, (uLong)[data length])];
+    stream.next_in = (Bytef *)[data bytes];
+    stream.avail_in = (uInt)[data length];
+    stream.next_out = [deflated mutableBytes];
+    stream.avail_out = (uInt)[deflated length];
+    int status = deflate(&stream, Z_FINISH);
+    uLong deflatedLength = stream.total_out;
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END || deflatedLength >= [data length]) {
+        return nil;
+    }
+    [deflated setLength:deflatedLength];
+    return deflated;
+}
+
+- (instancetype)initWithPath:(NSString*)path {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _file = fopen([path fileSystemRepresentation], "wb");
+        if (!_file) {
+            NSLog(@"AFCache: Could not create package archive %@ (errno %d)", path, errno);
+            return nil;
+        }
+        _centralDirectory = [NSMutableData data];
+        _calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+#pragma mark - Entries
+
+- (void)getDOSTime:(uint16_t*)time date:(uint16_t*)date forDate:(NSDate*)modificationDate {
+    NSDateComponents *components = [_calendar components:NSCalendarUnitYear | NSCalendarUnitMonth | NSCalendarUnitDay |
+                                    NSCalendarUnitHour | NSCalendarUnitMinute | NSCalendarUnitSecond
+                                                fromDate:modificationDate ?: [NSDate date]];
+    NSInteger year = MAX(1980, [components year]);
+    *date = (uint16_t)(((year - 1980) << 9) | ([components month] << 5) | [components day]);
+    *time = (uint16_t)(([components hour] << 11) | ([components minute] << 5) | ([components second] / 2));
+}
+
+- (BOOL)writeBytes:(const void*)bytes length:(NSUInteger)length {
+    if (_failed || !_file) {
+        return NO;
+    }
+    if (length > 0 && fwrite(bytes, 1, length, _file) != length) {
+        NSLog(@"AFCache: Could not write package archive %@ (errno %d)", self.path, errno);
+        _failed = YES;
+        return NO;
+    }
+    _bytesWritten += length;
+    return YES;
+}
+
+- (BOOL)addEntryNamed:(NSString*)name data:(NSData*)data modificationDate:(NSDate*)modificationDate {
+    uint32_t crc = 0;
+    NSData *deflated = [AFPackageArchiveWriter deflatedData:data crc:&crc];
+    return [self addEntryNamed:name
+                compressedData:deflated ?: data
+                        method:deflated ? kAFPackageArchiveMethodDeflated : kAFPackageArchiveMethodStored
+                           crc:crc
+              uncompressedSize:[data length]
+              modificationDate:modificationDate];
+}
+
+- (BOOL)addEntryNamed:(NSString*)name
+       compressedData:(NSData*)compressedData
+               method:(uint16_t)method
+                  crc:(uint32_t)crc
+     uncompressedSize:(uint64_t)uncompressedSize
+     modificationDate:(NSDate*)modificationDate {
+    NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+    if ([nameData length] == 0 || [nameData length] > 0xFFFF) {
+        NSLog(@"AFCache: Invalid entry name %@ for package archive %@", name, self.path);
+        return NO;
+    }
+    if (_entryCount >= kAFPackageArchiveWriterMaxEntryCount || uncompressedSize > kAFPackageArchiveWriterMaxSize ||
+        _bytesWritten > kAFPackageArchiveWriterMaxSize) {
+        NSLog(@"AFCache: Package archive %@ would need ZIP64, which is not supported", self.path);
+        _failed = YES;
+        return NO;
+    }
+
+    uint16_t time = 0, date = 0;
+    [self getDOSTime:&time date:&date forDate:modificationDate];
+    uint32_t localHeaderOffset = (uint32_t)_bytesWritten;
+
+    uint8_t header[kAFPackageArchiveCentralDirectoryHeaderSize];
+    memset(header, 0, sizeof(header));
+    AFPackageArchiveWrite32(header, kAFPackageArchiveLocalHeaderSignature);
+    AFPackageArchiveWrite16(header + 4, kAFPackageArchiveWriterVersion);
+    AFPackageArchiveWrite16(header + 6, kAFPackageArchiveFlagUTF8);
+    AFPackageArchiveWrite16(header + 8, method);
+    AFPackageArchiveWrite16(header + 10, time);
+    AFPackageArchiveWrite16(header + 12, date);
+    AFPackageArchiveWrite32(header + 14, crc);
+    AFPackageArchiveWrite32(header + 18, (uint32_t)[compressedData length]);
+    AFPackageArchiveWrite32(header + 22, (uint32_t)uncompressedSize);
+    AFPackageArchiveWrite16(header + 26, (uint16_t)[nameData length]);
+    AFPackageArchiveWrite16(header + 28, 0);
+    if (![self writeBytes:header length:kAFPackageArchiveLocalHeaderSize] ||
+        ![self writeBytes:[nameData bytes] length:[nameData length]] ||
+        ![self writeBytes:[compressedData bytes] length:[compressedData length]]) {
+        return NO;
+    }
+
+    memset(header, 0, sizeof(header));
+    AFPackageArchiveWrite32(header, kAFPackageArchiveCentralDirectoryHeaderSignature);
+    AFPackageArchiveWrite16(header + 4, kAFPackageArchiveWriterVersion);
+    AFPackageArchiveWrite16(header + 6, kAFPackageArchiveWriterVersion);
+    AFPackageArchiveWrite16(header + 8, kAFPackageArchiveFlagUTF8);
+    AFPackageArchiveWrite16(header + 10, method);
+    AFPackageArchiveWrite16(header + 12, time);
+    AFPackageArchiveWrite16(header + 14, date);
+    AFPackageArchiveWrite32(header + 16, crc);
+    AFPackageArchiveWrite32(header + 20, (uint32_t)[compressedData length]);
+    AFPackageArchiveWrite32(header + 24, (uint32_t)uncompressedSize);
+    AFPackageArchiveWrite16(header + 28, (uint16_t)[nameData length]);
+    AFPackageArchiveWrite32(header + 42, localHeaderOffset);
+    [_centralDirectory appendBytes:header length:kAFPackageArchiveCentralDirectoryHeaderSize];
+    [_centralDirectory appendData:nameData];
+
+    _entryCount++;
+    return YES;
+}
+
+- (BOOL)close {
+    if (!_file) {
+        return NO;
+    }
+    if (_bytesWritten > kAFPackageArchiveWriterMaxSize) {
+        NSLog(@"AFCache: Package archive %@ would need ZIP64, which is not supported", self.path);
+        _failed = YES;
+    }
+    uint32_t directoryOffset = (uint32_t)_bytesWritten;
+    uint8_t end[kAFPackageArchiveEndOfCentralDirectorySize];
+    memset(end, 0, sizeof(end));
+    AFPackageArchiveWrite32(end, kAFPackageArchiveEndOfCentralDirectorySignature);
+    AFPackageArchiveWrite16(end + 8, (uint16_t)_entryCount);
+    AFPackageArchiveWrite16(end + 10, (uint16_t)_entryCount);
+    AFPackageArchiveWrite32(end + 12, (uint32_t)[_centralDirectory length]);
+    AFPackageArchiveWrite32(end + 16, directoryOffset);
+    [self writeBytes:[_centralDirectory bytes] length:[_centralDirectory length]];
+    [self writeBytes:end length:kAFPackageArchiveEndOfCentralDirectorySize];
+
+    if (fclose(_file) != 0) {
+        _failed = YES;
+    }
+    _file = NULL;
+    AFLog(@"wrote package archive %@: %lu entries, %llu bytes", self.path, (unsigned long)_entryCount, _bytesWritten);
+    return !_failed;
+}
+
+@end
@@ -8,17 +8,34 @@
 
 #import <Foundation/Foundation.h>
 
+// Header lines of manifest.afcache ("key = value"). A manifest with a basePackageURL describes a delta package.
+#define kAFPackageManifestBaseURLKey @"baseURL"
+#define kAFPackageManifestVersionKey @"version"
+#define kAFPackageManifestBasePackageURLKey @"basePackageURL"
+#define kAFPackageManifestBaseVersionKey @"baseVersion"
+#define kAFPackageManifestRemovedKey @"removed" // one line per URL removed by a delta package
+
+// keys of a parsed manifest in addition to the header keys, see -[AFCache manifestWithString:filesAtPath:archive:]
+#define kAFPackageManifestResourceURLsKey @"resourceURLs"
+#define kAFPackageManifestCacheInfosKey @"cacheInfos"
+
 
 @interface AFPackageInfo : NSObject {
 	NSURL *packageURL;
 	NSURL *baseURL;
 	NSArray *resourceURLs;
 	NSMutableDictionary *userData;
+	NSString *version;
+	NSString *archivePath;
 }
 
 @property (nonatomic, strong) NSURL *packageURL;
 @property (nonatomic, strong) NSURL *baseURL;
 @property (nonatomic, strong) NSArray *resourceURLs;
 @property (nonatomic, strong) NSMutableDictionary *userData;
+// version from the manifest, a delta package only applies to the version it was created against
+@property (nonatomic, copy) NSString *version;
+// path of the package ZIP relative to the cache's dataPath if the resources are served from the archive, otherwise nil
+@property (nonatomic, copy) NSString *archivePath;
 
 @end
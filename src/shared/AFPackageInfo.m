@@ -11,7 +11,7 @@
 
 @implementation AFPackageInfo
 
-@synthesize packageURL, baseURL, resourceURLs, userData;
+@synthesize packageURL, baseURL, resourceURLs, userData, version, archivePath;
 
 - (id)init {
 	self = [super init];
@@ -27,6 +27,8 @@
 	[coder encodeObject: baseURL			forKey: @"AFPkgInfo_baseURL"];
 	[coder encodeObject: resourceURLs		forKey: @"AFPkgInfo_resourceURLs"];
 	[coder encodeObject: userData			forKey: @"AFPkgInfo_userData"];
+	[coder encodeObject: version			forKey: @"AFPkgInfo_version"];
+	[coder encodeObject: archivePath		forKey: @"AFPkgInfo_archivePath"];
 }
 
 - (id)initWithCoder: (NSCoder *) coder {
@@ -34,6 +36,8 @@
 	self.baseURL			= [coder decodeObjectForKey: @"AFPkgInfo_baseURL"];	
 	self.resourceURLs		= [coder decodeObjectForKey: @"AFPkgInfo_resourceURLs"];	
 	self.userData			= [coder decodeObjectForKey: @"AFPkgInfo_userData"];	
+	self.version			= [coder decodeObjectForKey: @"AFPkgInfo_version"];
+	self.archivePath		= [coder decodeObjectForKey: @"AFPkgInfo_archivePath"];
 	return self;
 }
 
@@ -43,6 +47,8 @@
 	[s appendFormat:@"baseURL: %@\n",			baseURL];
 	[s appendFormat:@"resourceURLs: %@\n",		[resourceURLs description]];
 	[s appendFormat:@"userData: %@\n",			[userData description]];
+	[s appendFormat:@"version: %@\n",			version];
+	[s appendFormat:@"archivePath: %@\n",		archivePath];
 	return s;
 }
 
@@ -0,0 +1,26 @@
+//
+//  AFReachabilityProvider.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef void (^AFReachabilityChangeBlock)(BOOL reachable);
+
+/*
+ * Source of connectivity changes for -[AFCache isConnectedToNetwork].
+ *
+ * The cache keeps the last reported state and never asks the provider synchronously, so a lookup does not
+ * cost a system call. Besides its provider the cache is informed by its download operations: a received
+ * response means we are online, a "not connected" or "connection lost" error means we are offline.
+ *
+ * Providers may call the change block on any thread and should report the initial state once monitoring has started.
+ */
+@protocol AFReachabilityProvider <NSObject>
+
+- (void)startMonitoringWithChangeBlock:(AFReachabilityChangeBlock)changeBlock;
+- (void)stopMonitoring;
+
+@end
@@ -0,0 +1,103 @@
+//
+//  AFRetryPolicy.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCacheableItemInfo;
+
+#define kAFRetryPolicyNoRetry -1.0
+
+#define kAFRetryPolicyRetriesKey @"retries"
+#define kAFRetryPolicyRetriesDeniedByBudgetKey @"retriesDeniedByBudget"
+#define kAFRetryPolicyStaleResponsesKey @"staleResponses"
+#define kAFRetryPolicyBudgetKey @"budget"
+
+/*
+ * Decides whether and when a failed download is tried again, see -[AFCache retryPolicy].
+ *
+ * - Classification: a download is retried if it failed with one of retryableStatusCodes or with an NSURLErrorDomain
+ *   error in retryableErrorCodes. Anything else (e.g. 404, a cancelled request, a certificate error) fails at once.
+ * - Backoff: the n-th retry waits initialBackoff * backoffMultiplier^(n-1), at most maximumBackoff, with "full jitter":
+ *   a random time between (1 - jitter) and 1 times that, so clients that failed together do not retry together.
+ *   A Retry-After header with seconds overrides the backoff, up to maximumBackoff.
+ * - Budget: every first attempt deposits retryBudgetRatio tokens (up to retryBudgetCapacity), every retry withdraws one.
+ *   If the origin fails everything, retries add at most that ratio to the load instead of multiplying it.
+ * - Stale if error: if serveStaleOnError is set, a revalidation that finally fails delivers the entry that is
+ *   still on disk instead of failing, if it is stale by no more than the stale-if-error seconds of its Cache-Control
+ *   header (RFC 5861) or, if it has none, maximumStaleness.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFRetryPolicy : NSObject
+
+/*
+ * Default 408, 429, 500, 502, 503, 504
+ */
+@property (nonatomic, copy) NSIndexSet *retryableStatusCodes;
+
+/*
+ * NSURLErrorDomain codes. Default timed out, connection lost, cannot connect to host, cannot find host, DNS lookup failed
+ */
+@property (nonatomic, copy) NSIndexSet *retryableErrorCodes;
+
+/*
+ * retries of one download. Default 3
+ */
+@property (nonatomic, assign) NSUInteger maximumRetryCount;
+
+/*
+ * Default 0.5 s, 2, 30 s and 1 (full jitter)
+ */
+@property (nonatomic, assign) NSTimeInterval initialBackoff;
+@property (nonatomic, assign) double backoffMultiplier;
+@property (nonatomic, assign) NSTimeInterval maximumBackoff;
+@property (nonatomic, assign) double jitter;
+
+/*
+ * Default 0.2 and 10
+ */
+@property (nonatomic, assign) double retryBudgetRatio;
+@property (nonatomic, assign) double retryBudgetCapacity;
+
+/*
+ * Default NO and 0 (no limit)
+ */
+@property (nonatomic, assign) BOOL serveStaleOnError;
+@property (nonatomic, assign) NSTimeInterval maximumStaleness;
+
+/*
+ * counts a first attempt, which adds to the retry budget
+ */
+- (void)recordAttempt;
+
+/*
+ * Seconds to wait before the retry, or kAFRetryPolicyNoRetry.
+ * Withdraws from the budget if a retry is granted.
+ *
+ * @param statusCode HTTP status of the failed attempt, 0 if there was no response
+ * @param error the error of the failed attempt, nil if it failed by its status
+ * @param retryCount retries made so far for this download
+ * @param retryAfter value of the Retry-After header, nil if there was none
+ */
+- (NSTimeInterval)retryDelayForStatusCode:(NSInteger)statusCode
+                                    error:(NSError*)error
+                               retryCount:(NSUInteger)retryCount
+                               retryAfter:(NSString*)retryAfter;
+
+/*
+ * YES if the failure is one a retry may help with, regardless of count and budget
+ */
+- (BOOL)isRetryableStatusCode:(NSInteger)statusCode error:(NSError*)error;
+
+/*
+ * YES if the stale entry may be delivered instead of the error
+ */
+- (BOOL)shouldServeStaleEntryWithInfo:(AFCacheableItemInfo*)info;
+
+- (NSDictionary*)statistics;
+
+@end
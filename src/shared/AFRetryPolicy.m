@@ -0,0 +1,152 @@
+//
+//  AFRetryPolicy.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFRetryPolicy.h"
+#import "AFCacheableItemInfo.h"
+#import "AFCache_Logging.h"
+
+@implementation AFRetryPolicy {
+    double _budget;
+    NSUInteger _retryCount;
+    NSUInteger _deniedCount;
+    NSUInteger _staleCount;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        NSMutableIndexSet *statusCodes = [NSMutableIndexSet indexSet];
+        for (NSNumber *statusCode in @[@408, @429, @500, @502, @503, @504]) {
+            [statusCodes addIndex:[statusCode unsignedIntegerValue]];
+        }
+        _retryableStatusCodes = statusCodes;
+
+        NSMutableIndexSet *errorCodes = [NSMutableIndexSet indexSet];
+        // NSURLError codes are negative, NSIndexSet only holds positive numbers
+        for (NSNumber *errorCode in @[@(NSURLErrorTimedOut), @(NSURLErrorNetworkConnectionLost), @(NSURLErrorCannotConnectToHost),
+                                      @(NSURLErrorCannotFindHost), @(NSURLErrorDNSLookupFailed)]) {
+            [errorCodes addIndex:(NSUInteger)(-[errorCode integerValue])];
+        }
+        _retryableErrorCodes = errorCodes;
+
+        _maximumRetryCount = 3;
+        _initialBackoff = 0.5;
+        _backoffMultiplier = 2.0;
+        _maximumBackoff = 30.0;
+        _jitter = 1.0;
+        _retryBudgetRatio = 0.2;
+        _retryBudgetCapacity = 10.0;
+        _budget = _retryBudgetCapacity;
+        _serveStaleOnError = NO;
+        _maximumStaleness = 0;
+    }
+    return self;
+}
+
+#pragma mark - Classification
+
+- (BOOL)isRetryableStatusCode:(NSInteger)statusCode error:(NSError*)error {
+    if ([[error domain] isEqualToString:NSURLErrorDomain]) {
+        return [error code] < 0 && [self.retryableErrorCodes containsIndex:(NSUInteger)(-[error code])];
+    }
+    return statusCode > 0 && [self.retryableStatusCodes containsIndex:(NSUInteger)statusCode];
+}
+
+#pragma mark - Backoff and budget
+
+- (void)setRetryBudgetCapacity:(double)retryBudgetCapacity {
+    @synchronized (self) {
+        _retryBudgetCapacity = retryBudgetCapacity;
+        _budget = MIN(_budget, retryBudgetCapacity);
+    }
+}
+
+- (void)recordAttempt {
+    @synchronized (self) {
+        _budget = MIN(_budget + self.retryBudgetRatio, self.retryBudgetCapacity);
+    }
+}
+
+- (NSTimeInterval)backoffForRetryCount:(NSUInteger)retryCount retryAfter:(NSString*)retryAfter {
+    NSScanner *scanner = retryAfter ? [NSScanner scannerWithString:retryAfter] : nil;
+    double seconds = 0;
+    if ([scanner scanDouble:&seconds] && [scanner isAtEnd] && seconds >= 0) {
+        // the server knows best, an HTTP date is not worth parsing here
+        return MIN(seconds, self.maximumBackoff);
+    }
+    NSTimeInterval backoff = MIN(self.initialBackoff * pow(self.backoffMultiplier, retryCount), self.maximumBackoff);
+    double jitter = MAX(0.0, MIN(self.jitter, 1.0));
+    double random = (double)arc4random_uniform(UINT32_MAX) / UINT32_MAX;
+    return backoff * (1.0 - jitter * random);
+}
+
+- (NSTimeInterval)retryDelayForStatusCode:(NSInteger)statusCode
+                                    error:(NSError*)error
+                               retryCount:(NSUInteger)retryCount
+                               retryAfter:(NSString*)retryAfter {
+    if (retryCount >= self.maximumRetryCount || ![self isRetryableStatusCode:statusCode error:error]) {
+        return kAFRetryPolicyNoRetry;
+    }
+    @synchronized (self) {
+        if (_budget < 1.0) {
+            _deniedCount++;
+            AFLog(@"retry budget exhausted (%.1f), not retrying status %ld error %@", _budget, (long)statusCode, error);
+            return kAFRetryPolicyNoRetry;
+        }
+        _budget -= 1.0;
+        _retryCount++;
+    }
+    return [self backoffForRetryCount:retryCount retryAfter:retryAfter];
+}
+
+#pragma mark - Stale if error
+
+// seconds of the stale-if-error directive of the Cache-Control header, -1 if there is none
+- (NSTimeInterval)staleIfErrorOfInfo:(AFCacheableItemInfo*)info {
+    NSString *cacheControl = nil;
+    for (NSString *name in info.headers) {
+        if ([name caseInsensitiveCompare:@"Cache-Control"] == NSOrderedSame) {
+            cacheControl = info.headers[name];
+        }
+    }
+    for (NSString *directive in [cacheControl componentsSeparatedByString:@","]) {
+        NSArray *parts = [[directive stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] componentsSeparatedByString:@"="];
+        if ([parts count] == 2 && [[parts[0] lowercaseString] isEqualToString:@"stale-if-error"]) {
+            return [parts[1] doubleValue];
+        }
+    }
+    return -1;
+}
+
+- (BOOL)shouldServeStaleEntryWithInfo:(AFCacheableItemInfo*)info {
+    if (!self.serveStaleOnError || !info) {
+        return NO;
+    }
+    NSTimeInterval staleness = -[info remainingFreshness];
+    NSTimeInterval staleIfError = [self staleIfErrorOfInfo:info];
+    NSTimeInterval limit = staleIfError >= 0 ? staleIfError : self.maximumStaleness;
+    BOOL serve = (staleIfError < 0 && self.maximumStaleness <= 0) || staleness <= limit;
+    if (serve) {
+        @synchronized (self) {
+            _staleCount++;
+        }
+    }
+    return serve;
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        return @{kAFRetryPolicyRetriesKey : @(_retryCount),
+                 kAFRetryPolicyRetriesDeniedByBudgetKey : @(_deniedCount),
+                 kAFRetryPolicyStaleResponsesKey : @(_staleCount),
+                 kAFRetryPolicyBudgetKey : @(_budget)};
+    }
+}
+
+@end
@@ -0,0 +1,68 @@
+//
+//  AFRevalidationSweeper.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCache;
+
+#define kAFRevalidationSweeperDefaultInterval 60.0
+#define kAFRevalidationSweeperDefaultMaxRequestsPerSweep 8
+#define kAFRevalidationSweeperDefaultMaxBytesPerSweep (4 * 1024 * 1024)
+#define kAFRevalidationSweeperDefaultRevalidationWindow 300.0
+
+// keys of the dictionary returned by -[AFRevalidationSweeper statistics]
+#define kAFRevalidationSweeperSweepsKey @"sweeps"
+#define kAFRevalidationSweeperSkippedSweepsKey @"skippedSweeps"
+#define kAFRevalidationSweeperRevalidationsKey @"revalidations"
+#define kAFRevalidationSweeperBudgetedBytesKey @"budgetedBytes"
+
+/*
+ * Revalidates cache entries in the background before they are requested again, so that frequently used
+ * entries are fresh when a client asks for them and the client does not have to wait for an If-Modified-Since request.
+ *
+ * Every interval the sweeper collects the entries that will be stale within revalidationWindow but are not yet,
+ * leaving out entries without a freshness lifetime and entries validated less than half their lifetime ago,
+ * orders them by access count (descending) and remaining freshness (ascending) and issues conditional requests
+ * in the revalidation lane of the download scheduler until one of the budgets of the sweep is used up.
+ * The byte budget is charged with the stored content length, as that is what a modified entry will cost.
+ *
+ * Sweeps are skipped while the cache is in offline mode or suspended.
+ * The sweeper runs on the main thread, like the download operations that update the cache infos.
+ */
+@interface AFRevalidationSweeper : NSObject
+
+@property (nonatomic, weak, readonly) AFCache *cache;
+
+@property (nonatomic, assign) NSTimeInterval interval;
+@property (nonatomic, assign) NSUInteger maxRequestsPerSweep;
+@property (nonatomic, assign) uint64_t maxBytesPerSweep;
+
+/*
+ * entries whose remaining freshness is below this value are revalidated
+ */
+@property (nonatomic, assign) NSTimeInterval revalidationWindow;
+
+/*
+ * entries that have been requested less often are left alone. Default is 1, so imported but never used entries are skipped.
+ */
+@property (nonatomic, assign) NSUInteger minimumAccessCount;
+
+@property (nonatomic, readonly, getter=isRunning) BOOL running;
+
+- (instancetype)initWithCache:(AFCache*)cache;
+
+- (void)start;
+- (void)stop;
+
+/*
+ * performs a single sweep and returns the number of revalidations issued
+ */
+- (NSUInteger)sweep;
+
+- (NSDictionary*)statistics;
+
+@end
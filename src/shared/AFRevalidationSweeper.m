@@ -0,0 +1,184 @@
+//
+//  AFRevalidationSweeper.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFRevalidationSweeper.h"
+#import "AFCache+PrivateAPI.h"
+#import "AFCacheableItemInfo.h"
+#import "AFCache_Logging.h"
+
+@interface AFRevalidationCandidate : NSObject
+@property (nonatomic, strong) NSURL *url;
+@property (nonatomic, strong) AFCacheableItemInfo *info;
+@property (nonatomic, assign) NSTimeInterval remainingFreshness;
+@end
+
+@implementation AFRevalidationCandidate
+@end
+
+@interface AFRevalidationSweeper ()
+@property (nonatomic, weak) AFCache *cache;
+@property (nonatomic, strong) NSTimer *timer;
+@property (nonatomic, assign) NSUInteger sweepCount;
+@property (nonatomic, assign) NSUInteger skippedSweepCount;
+@property (nonatomic, assign) NSUInteger revalidationCount;
+@property (nonatomic, assign) uint64_t budgetedByteCount;
+@end
+
+@implementation AFRevalidationSweeper
+
+- (instancetype)initWithCache:(AFCache*)cache {
+    self = [super init];
+    if (self) {
+        _cache = cache;
+        _interval = kAFRevalidationSweeperDefaultInterval;
+        _maxRequestsPerSweep = kAFRevalidationSweeperDefaultMaxRequestsPerSweep;
+        _maxBytesPerSweep = kAFRevalidationSweeperDefaultMaxBytesPerSweep;
+        _revalidationWindow = kAFRevalidationSweeperDefaultRevalidationWindow;
+        _minimumAccessCount = 1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_timer invalidate];
+}
+
+#pragma mark - Timer
+
+- (BOOL)isRunning {
+    return self.timer != nil;
+}
+
+- (void)start {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self start];
+        });
+        return;
+    }
+    [self.timer invalidate];
+    self.timer = [NSTimer scheduledTimerWithTimeInterval:self.interval
+                                                  target:self
+                                                selector:@selector(timerDidFire:)
+                                                userInfo:nil
+                                                 repeats:YES];
+}
+
+- (void)stop {
+    if (![NSThread isMainThread]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self stop];
+        });
+        return;
+    }
+    [self.timer invalidate];
+    self.timer = nil;
+}
+
+- (void)setInterval:(NSTimeInterval)interval {
+    _interval = interval;
+    if ([self isRunning]) {
+        [self start];
+    }
+}
+
+- (void)timerDidFire:(NSTimer*)timer {
+    [self sweep];
+}
+
+#pragma mark - Sweeping
+
+- (NSUInteger)sweep {
+    AFCache *cache = self.cache;
+    if (!cache || [cache offlineMode] || [cache suspended]) {
+        self.skippedSweepCount++;
+        return 0;
+    }
+    self.sweepCount++;
+
+    NSArray *candidates = [self candidatesForCache:cache];
+    NSUInteger issued = 0;
+    uint64_t budgetedBytes = 0;
+    for (AFRevalidationCandidate *candidate in candidates) {
+        if (issued >= self.maxRequestsPerSweep) {
+            break;
+        }
+        // A smaller entry further down the list may still fit into the budget
+        uint64_t bytes = candidate.info.contentLength;
+        if (budgetedBytes + bytes > self.maxBytesPerSweep) {
+            continue;
+        }
+        if ([cache revalidateCachedItemInBackgroundForURL:candidate.url]) {
+            AFLog(@"revalidating %@ in background (accessed %lu times, fresh for %f seconds)", candidate.url, (unsigned long)candidate.info.accessCount, candidate.remainingFreshness);
+            issued++;
+            budgetedBytes += bytes;
+        }
+    }
+
+    self.revalidationCount += issued;
+    self.budgetedByteCount += budgetedBytes;
+    return issued;
+}
+
+- (NSArray*)candidatesForCache:(AFCache*)cache {
+    NSMutableArray *candidates = [NSMutableArray array];
+    NSDictionary *cachedItemInfos = [cache.cachedItemInfos copy];
+    NSTimeInterval now = AFCacheNow();
+    [cachedItemInfos enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+        if (info.accessCount < self.minimumAccessCount) {
+            return;
+        }
+        // Conditional requests need a validator
+        if (!info.eTag && !info.lastModified) {
+            return;
+        }
+        // Without a lifetime an entry is stale again right after its revalidation
+        NSTimeInterval freshnessLifetime = [info freshnessLifetime];
+        if (freshnessLifetime <= 0) {
+            return;
+        }
+        // Expired entries are revalidated when they are requested, the sweep keeps entries from expiring
+        NSTimeInterval remainingFreshness = [info remainingFreshnessAtTime:now];
+        if (remainingFreshness <= 0 || remainingFreshness >= self.revalidationWindow) {
+            return;
+        }
+        // Lifetimes shorter than the window would put an entry into every sweep
+        if (now - info.responseTimestamp < freshnessLifetime / 2) {
+            return;
+        }
+        AFRevalidationCandidate *candidate = [[AFRevalidationCandidate alloc] init];
+        candidate.url = [NSURL URLWithString:key];
+        candidate.info = info;
+        candidate.remainingFreshness = remainingFreshness;
+        if (candidate.url) {
+            [candidates addObject:candidate];
+        }
+    }];
+
+    [candidates sortUsingComparator:^NSComparisonResult(AFRevalidationCandidate *a, AFRevalidationCandidate *b) {
+        if (a.info.accessCount != b.info.accessCount) {
+            return a.info.accessCount > b.info.accessCount ? NSOrderedAscending : NSOrderedDescending;
+        }
+        if (a.remainingFreshness != b.remainingFreshness) {
+            return a.remainingFreshness < b.remainingFreshness ? NSOrderedAscending : NSOrderedDescending;
+        }
+        return NSOrderedSame;
+    }];
+    return candidates;
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary*)statistics {
+    return @{kAFRevalidationSweeperSweepsKey : @(self.sweepCount),
+             kAFRevalidationSweeperSkippedSweepsKey : @(self.skippedSweepCount),
+             kAFRevalidationSweeperRevalidationsKey : @(self.revalidationCount),
+             kAFRevalidationSweeperBudgetedBytesKey : @(self.budgetedByteCount),
+             };
+}
+
+@end
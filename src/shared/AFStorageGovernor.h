@@ -0,0 +1,146 @@
+//
+//  AFStorageGovernor.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class AFCache;
+@class AFCacheableItemInfo;
+@class AFCacheClock;
+
+// context name of [AFCache sharedInstance], which has no context
+#define kAFStorageGovernorSharedContext @""
+
+// keys of -statistics
+#define kAFStorageGovernorBudgetKey @"budget"
+#define kAFStorageGovernorUsageKey @"usage"
+#define kAFStorageGovernorContextsKey @"contexts" // context name -> dictionary with the keys below
+#define kAFStorageGovernorEnforcementsKey @"enforcements"
+
+// keys of -statisticsForContext:
+#define kAFStorageGovernorContextUsageKey @"usage"
+#define kAFStorageGovernorContextItemCountKey @"itemCount"
+#define kAFStorageGovernorContextMinimumKey @"minimum"
+#define kAFStorageGovernorContextMaximumKey @"maximum"
+#define kAFStorageGovernorContextEvictedItemsKey @"evictedItems"
+#define kAFStorageGovernorContextEvictedBytesKey @"evictedBytes"
+#define kAFStorageGovernorContextPinnedBytesKey @"pinnedBytes" // part of the usage that cannot be evicted, see -[AFCache pinCachedItemForURL:]
+
+/*
+ * What the governor measures and evicts for a context. AFCache is one, AFCacheSimulator replays traces against another.
+ */
+@protocol AFStorageGovernorStore <NSObject>
+
+/*
+ * name of the context, see -[AFStorageGovernor setMinimumBytes:maximumBytes:forContext:]
+ */
+- (NSString*)storageGovernorContext;
+
+/*
+ * snapshot of the entries, key -> AFCacheableItemInfo. Called on the governor's queue.
+ */
+- (NSDictionary*)storageGovernorItemInfos;
+
+/*
+ * keys that count in the usage but are never evicted. Pinned entries are reported as pinnedBytes,
+ * the others, e.g. resources of consumed packages, are only kept.
+ */
+- (BOOL)storageGovernorIsPinnedKey:(NSString*)key;
+- (NSSet*)storageGovernorRetainedKeys;
+
+/*
+ * removes the entry unless it has been replaced since info was measured, is being downloaded or cannot be removed.
+ * Returns YES if it was removed. Called on the main thread.
+ */
+- (BOOL)storageGovernorEvictKey:(NSString*)key info:(AFCacheableItemInfo*)info;
+
+/*
+ * called on the main thread after an enforcement has evicted entries of the store
+ */
+- (void)storageGovernorDidEvict;
+
+@end
+
+/*
+ * Process-wide disk budget for all AFCache instances (the shared instance and every +[AFCache cacheForContext:]).
+ *
+ * Every cache registers itself when it is created and asks for enforcement when it archives. Enforcement measures the
+ * contexts on a private serial queue and evicts on the main thread, where the info stores are modified. It
+ * 1. shrinks every context above its maximum quota to its maximum,
+ * 2. then evicts entries of all contexts, lowest utility first, until the total is within globalByteBudget.
+ *    A context is never shrunk below its minimum quota in this step.
+ * Utility is the number of accesses per byte, halved for every utilityHalfLife since the last access,
+ * so large, rarely and long ago used entries go first, whichever context they belong to.
+ * Entries that are being downloaded, pinned entries, resources of consumed packages and archives they are served from
+ * are never evicted.
+ *
+ * Usage is the sum of the content lengths in a context's info store, measured on every enforcement.
+ *
+ * All methods may be called from any thread.
+ */
+@interface AFStorageGovernor : NSObject
+
+/*
+ * bytes all contexts together may use (0 = unlimited). Default is 0
+ */
+@property (nonatomic, assign) uint64_t globalByteBudget;
+
+/*
+ * time after which an entry that has not been accessed again is worth half as much. Default is one day
+ */
+@property (nonatomic, assign) NSTimeInterval utilityHalfLife;
+
+/*
+ * time the utilities are computed at. Default is nil, the current clock, see AFCacheClock.h
+ */
+@property (nonatomic, strong) AFCacheClock *clock;
+
++ (AFStorageGovernor*)sharedGovernor;
+
+/*
+ * @param minimumBytes the context keeps at least this many bytes when other contexts need room (0 = no guarantee)
+ * @param maximumBytes the context never uses more than this (0 = unlimited)
+ * @param context name passed to +[AFCache cacheForContext:], kAFStorageGovernorSharedContext for the shared instance
+ */
+- (void)setMinimumBytes:(uint64_t)minimumBytes maximumBytes:(uint64_t)maximumBytes forContext:(NSString*)context;
+
+/*
+ * called by AFCache. Caches are held weakly.
+ */
+- (void)registerCache:(AFCache*)cache;
+- (void)unregisterCache:(AFCache*)cache;
+
+/*
+ * the store takes the place of the context's cache. Stores are held weakly.
+ */
+- (void)registerStore:(id<AFStorageGovernorStore>)store;
+- (void)unregisterStore:(id<AFStorageGovernorStore>)store;
+
+/*
+ * schedules an enforcement. Calls are coalesced while an enforcement is pending.
+ */
+- (void)setNeedsEnforcement;
+
+/*
+ * enforces quotas and budget now and returns when done. Called off the main thread, it waits for the main thread.
+ */
+- (void)enforce;
+
+- (NSDictionary*)statistics;
+- (NSDictionary*)statisticsForContext:(NSString*)context;
+
+/*
+ * utility of an entry as used for eviction, see above. Entries with lower utility are evicted first.
+ */
++ (double)utilityOfItemInfo:(AFCacheableItemInfo*)info now:(NSTimeInterval)now halfLife:(NSTimeInterval)halfLife;
+
+/*
+ * bytes an entry is counted with, both when measuring the usage and when evicting it.
+ * Entries with a body source are counted with their body source and count 0 bytes.
+ */
++ (uint64_t)storedBytesOfItemInfo:(AFCacheableItemInfo*)info;
+
+@end
@@ -0,0 +1,378 @@
+//
+//  AFStorageGovernor.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFStorageGovernor.h"
+#import "AFCache.h"
+#import "AFCache+PrivateAPI.h"
+#import "AFCacheableItemInfo.h"
+#import "AFCache_Logging.h"
+#import "AFCacheClock.h"
+
+#define kAFStorageGovernorDefaultUtilityHalfLife (24 * 60 * 60)
+
+@interface AFStorageGovernorContext : NSObject
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, weak) id<AFStorageGovernorStore> store;
+@property (nonatomic, assign) uint64_t minimumBytes;
+@property (nonatomic, assign) uint64_t maximumBytes;
+@property (nonatomic, assign) uint64_t usage;
+@property (nonatomic, assign) NSUInteger itemCount;
+@property (nonatomic, assign) uint64_t pinnedBytes;
+@property (nonatomic, assign) uint64_t evictedBytes;
+@property (nonatomic, assign) NSUInteger evictedItems;
+@end
+
+@implementation AFStorageGovernorContext
+@end
+
+@interface AFStorageGovernorCandidate : NSObject
+@property (nonatomic, strong) AFStorageGovernorContext *context;
+@property (nonatomic, strong) id<AFStorageGovernorStore> store;
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) AFCacheableItemInfo *info;
+@property (nonatomic, assign) double utility;
+@property (nonatomic, assign) uint64_t size; // counted in the usage, see storedBytesOfItemInfo:
+@end
+
+@implementation AFStorageGovernorCandidate
+@end
+
+// what an enforcement measured on the queue and evicts on the main thread
+@interface AFStorageGovernorEnforcement : NSObject
+@property (nonatomic, strong) NSArray *contexts;
+@property (nonatomic, strong) NSArray *candidates; // lowest utility first
+@property (nonatomic, strong) NSMutableDictionary *usages; // context name -> usage
+@property (nonatomic, assign) uint64_t totalUsage;
+@property (nonatomic, assign) uint64_t budget;
+@end
+
+@implementation AFStorageGovernorEnforcement
+@end
+
+@interface AFStorageGovernor ()
+@property (nonatomic, strong) NSMutableDictionary *contexts; // context name -> AFStorageGovernorContext
+@property (nonatomic, assign) BOOL enforcementPending;
+@property (nonatomic, assign) NSUInteger enforcementCount;
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+#endif
+@end
+
+@implementation AFStorageGovernor
+
++ (AFStorageGovernor*)sharedGovernor {
+    static AFStorageGovernor *sharedGovernor = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedGovernor = [[self alloc] init];
+    });
+    return sharedGovernor;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _contexts = [NSMutableDictionary dictionary];
+        _utilityHalfLife = kAFStorageGovernorDefaultUtilityHalfLife;
+        _queue = dispatch_queue_create("de.artifacts.afcache.storagegovernor", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+#if !OS_OBJECT_USE_OBJC
+    if (_queue) {
+        dispatch_release(_queue);
+    }
+#endif
+}
+
+#pragma mark - Configuration
+
+// must be called within @synchronized (self)
+- (AFStorageGovernorContext*)contextNamed:(NSString*)name {
+    name = name ?: kAFStorageGovernorSharedContext;
+    AFStorageGovernorContext *context = self.contexts[name];
+    if (!context) {
+        context = [[AFStorageGovernorContext alloc] init];
+        context.name = name;
+        self.contexts[name] = context;
+    }
+    return context;
+}
+
+- (void)setMinimumBytes:(uint64_t)minimumBytes maximumBytes:(uint64_t)maximumBytes forContext:(NSString*)context {
+    @synchronized (self) {
+        AFStorageGovernorContext *governorContext = [self contextNamed:context];
+        governorContext.minimumBytes = minimumBytes;
+        governorContext.maximumBytes = maximumBytes;
+    }
+    [self setNeedsEnforcement];
+}
+
+- (void)setGlobalByteBudget:(uint64_t)globalByteBudget {
+    @synchronized (self) {
+        _globalByteBudget = globalByteBudget;
+    }
+    [self setNeedsEnforcement];
+}
+
+- (void)registerCache:(AFCache*)cache {
+    [self registerStore:cache];
+}
+
+- (void)unregisterCache:(AFCache*)cache {
+    [self unregisterStore:cache];
+}
+
+- (void)registerStore:(id<AFStorageGovernorStore>)store {
+    @synchronized (self) {
+        [self contextNamed:[store storageGovernorContext]].store = store;
+    }
+}
+
+- (void)unregisterStore:(id<AFStorageGovernorStore>)store {
+    @synchronized (self) {
+        AFStorageGovernorContext *context = self.contexts[[store storageGovernorContext] ?: kAFStorageGovernorSharedContext];
+        if (context.store == store) {
+            context.store = nil;
+        }
+    }
+}
+
+#pragma mark - Enforcement
+
+- (BOOL)hasLimits {
+    if (self.globalByteBudget > 0) {
+        return YES;
+    }
+    for (AFStorageGovernorContext *context in [self.contexts allValues]) {
+        if (context.maximumBytes > 0) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)setNeedsEnforcement {
+    @synchronized (self) {
+        if (self.enforcementPending || ![self hasLimits]) {
+            return;
+        }
+        self.enforcementPending = YES;
+    }
+    dispatch_async(self.queue, ^{
+        AFStorageGovernorEnforcement *enforcement = [self measure];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self evict:enforcement];
+        });
+    });
+}
+
+- (void)enforce {
+    __block AFStorageGovernorEnforcement *enforcement = nil;
+    dispatch_sync(self.queue, ^{
+        enforcement = [self measure];
+    });
+    if ([NSThread isMainThread]) {
+        [self evict:enforcement];
+    } else {
+        dispatch_sync(dispatch_get_main_queue(), ^{
+            [self evict:enforcement];
+        });
+    }
+}
+
+// Measures every context and collects the entries that may be evicted. Runs on the queue.
+- (AFStorageGovernorEnforcement*)measure {
+    AFStorageGovernorEnforcement *enforcement = [[AFStorageGovernorEnforcement alloc] init];
+    NSTimeInterval halfLife = 0;
+    AFCacheClock *clock = nil;
+    @synchronized (self) {
+        self.enforcementPending = NO;
+        self.enforcementCount++;
+        enforcement.contexts = [self.contexts allValues];
+        enforcement.budget = self.globalByteBudget;
+        halfLife = MAX(1, self.utilityHalfLife);
+        clock = self.clock ?: [AFCacheClock currentClock];
+    }
+
+    NSTimeInterval now = [clock now];
+    NSMutableArray *candidates = [NSMutableArray array];
+    NSMutableDictionary *usages = [NSMutableDictionary dictionary]; // context name -> usage
+    uint64_t totalUsage = 0;
+    for (AFStorageGovernorContext *context in enforcement.contexts) {
+        id<AFStorageGovernorStore> store = context.store;
+        if (!store) {
+            continue;
+        }
+        NSSet *retainedKeys = [store storageGovernorRetainedKeys];
+
+        __block uint64_t usage = 0;
+        __block uint64_t pinnedBytes = 0;
+        NSDictionary *infos = [store storageGovernorItemInfos];
+        [infos enumerateKeysAndObjectsUsingBlock:^(NSString *key, AFCacheableItemInfo *info, BOOL *stop) {
+            uint64_t size = [AFStorageGovernor storedBytesOfItemInfo:info];
+            usage += size;
+            if ([store storageGovernorIsPinnedKey:key]) {
+                pinnedBytes += size;
+                return;
+            }
+            if ([retainedKeys containsObject:key]) {
+                return;
+            }
+            AFStorageGovernorCandidate *candidate = [[AFStorageGovernorCandidate alloc] init];
+            candidate.context = context;
+            candidate.store = store;
+            candidate.key = key;
+            candidate.info = info;
+            candidate.size = size;
+            candidate.utility = [AFStorageGovernor utilityOfItemInfo:info now:now halfLife:halfLife];
+            [candidates addObject:candidate];
+        }];
+        usages[context.name] = @(usage);
+        totalUsage += usage;
+        @synchronized (self) {
+            context.usage = usage;
+            context.pinnedBytes = pinnedBytes;
+            context.itemCount = [infos count];
+        }
+    }
+
+    [candidates sortUsingComparator:^NSComparisonResult(AFStorageGovernorCandidate *a, AFStorageGovernorCandidate *b) {
+        return a.utility < b.utility ? NSOrderedAscending : (a.utility > b.utility ? NSOrderedDescending : NSOrderedSame);
+    }];
+    enforcement.candidates = candidates;
+    enforcement.usages = usages;
+    enforcement.totalUsage = totalUsage;
+    return enforcement;
+}
+
+// Evicts the measured candidates. Runs on the main thread, where the info stores are modified, see AFCacheInfoStore.h.
+- (void)evict:(AFStorageGovernorEnforcement*)enforcement {
+    NSMutableDictionary *usages = enforcement.usages;
+    uint64_t totalUsage = enforcement.totalUsage;
+    uint64_t budget = enforcement.budget;
+    NSMutableSet *evicted = [NSMutableSet set];
+    NSMutableSet *modifiedStores = [NSMutableSet set];
+
+    // 1. every context down to its maximum
+    for (AFStorageGovernorCandidate *candidate in enforcement.candidates) {
+        AFStorageGovernorContext *context = candidate.context;
+        uint64_t usage = [usages[context.name] unsignedLongLongValue];
+        if (context.maximumBytes == 0 || usage <= context.maximumBytes) {
+            continue;
+        }
+        if ([self evictCandidate:candidate]) {
+            // measured with the usage, so never more than it
+            usages[context.name] = @(usage - candidate.size);
+            totalUsage -= candidate.size;
+            [evicted addObject:candidate];
+            [modifiedStores addObject:candidate.store];
+        }
+    }
+
+    // 2. all contexts together down to the budget, without taking a context below its minimum
+    if (budget > 0) {
+        for (AFStorageGovernorCandidate *candidate in enforcement.candidates) {
+            if (totalUsage <= budget) {
+                break;
+            }
+            if ([evicted containsObject:candidate]) {
+                continue;
+            }
+            AFStorageGovernorContext *context = candidate.context;
+            uint64_t usage = [usages[context.name] unsignedLongLongValue];
+            if (usage - candidate.size < context.minimumBytes) {
+                continue;
+            }
+            if ([self evictCandidate:candidate]) {
+                usages[context.name] = @(usage - candidate.size);
+                totalUsage -= candidate.size;
+                [modifiedStores addObject:candidate.store];
+            }
+        }
+    }
+
+    @synchronized (self) {
+        for (AFStorageGovernorContext *context in enforcement.contexts) {
+            if (usages[context.name]) {
+                context.usage = [usages[context.name] unsignedLongLongValue];
+            }
+        }
+    }
+
+    if ([modifiedStores count] > 0) {
+        AFLog(@"storage governor: %llu bytes in use, budget %llu", totalUsage, budget);
+        for (id<AFStorageGovernorStore> store in modifiedStores) {
+            [store storageGovernorDidEvict];
+        }
+    }
+}
+
+// the bytes of entries with a body source are counted with their body source
++ (uint64_t)storedBytesOfItemInfo:(AFCacheableItemInfo*)info {
+    return info.bodySourceKey ? 0 : info.contentLength;
+}
+
++ (double)utilityOfItemInfo:(AFCacheableItemInfo*)info now:(NSTimeInterval)now halfLife:(NSTimeInterval)halfLife {
+    NSTimeInterval lastUse = info.lastAccessTimestamp > 0 ? info.lastAccessTimestamp : info.responseTimestamp;
+    return (info.accessCount + 1.0) / MAX(1, info.contentLength) * exp2(-MAX(0, now - lastUse) / MAX(1, halfLife));
+}
+
+- (BOOL)evictCandidate:(AFStorageGovernorCandidate*)candidate {
+    if (![candidate.store storageGovernorEvictKey:candidate.key info:candidate.info]) {
+        return NO;
+    }
+    AFLog(@"storage governor: evicted %@ from context \"%@\"", candidate.key, candidate.context.name);
+    @synchronized (self) {
+        candidate.context.evictedItems++;
+        candidate.context.evictedBytes += candidate.size;
+    }
+    return YES;
+}
+
+#pragma mark - Statistics
+
+// must be called within @synchronized (self)
+- (NSDictionary*)statisticsOfContext:(AFStorageGovernorContext*)context {
+    return @{kAFStorageGovernorContextUsageKey : @(context.usage),
+             kAFStorageGovernorContextItemCountKey : @(context.itemCount),
+             kAFStorageGovernorContextMinimumKey : @(context.minimumBytes),
+             kAFStorageGovernorContextMaximumKey : @(context.maximumBytes),
+             kAFStorageGovernorContextEvictedItemsKey : @(context.evictedItems),
+             kAFStorageGovernorContextEvictedBytesKey : @(context.evictedBytes),
+             kAFStorageGovernorContextPinnedBytesKey : @(context.pinnedBytes),
+             };
+}
+
+- (NSDictionary*)statisticsForContext:(NSString*)context {
+    @synchronized (self) {
+        AFStorageGovernorContext *governorContext = self.contexts[context ?: kAFStorageGovernorSharedContext];
+        return governorContext ? [self statisticsOfContext:governorContext] : nil;
+    }
+}
+
+- (NSDictionary*)statistics {
+    @synchronized (self) {
+        uint64_t usage = 0;
+        NSMutableDictionary *contexts = [NSMutableDictionary dictionary];
+        for (AFStorageGovernorContext *context in [self.contexts allValues]) {
+            usage += context.usage;
+            contexts[context.name] = [self statisticsOfContext:context];
+        }
+        return @{kAFStorageGovernorBudgetKey : @(self.globalByteBudget),
+                 kAFStorageGovernorUsageKey : @(usage),
+                 kAFStorageGovernorContextsKey : contexts,
+                 kAFStorageGovernorEnforcementsKey : @(self.enforcementCount),
+                 };
+    }
+}
+
+@end
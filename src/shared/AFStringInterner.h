@@ -0,0 +1,36 @@
+//
+//  AFStringInterner.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/*
+ * Table of immutable strings that every equal string is replaced with, so a value shared by many cache entries
+ * (a MIME type, a host, a header name) is held once instead of once per entry. NSKeyedArchiver writes an object
+ * that is referenced many times only once, so interned strings also shrink the archive.
+ *
+ * Strings are never removed. Only intern strings with few distinct values, never URLs or header values.
+ * All methods may be called from any thread.
+ */
+@interface AFStringInterner : NSObject
+
++ (AFStringInterner*)sharedInterner;
+
+/*
+ * the string in the table that is equal to string, added if there is none yet. nil for nil.
+ */
+- (NSString*)internedString:(NSString*)string;
+
+/*
+ * number of distinct strings in the table
+ */
+- (NSUInteger)count;
+
+@end
+
+static inline NSString *AFInternedString(NSString *string) {
+    return [[AFStringInterner sharedInterner] internedString:string];
+}
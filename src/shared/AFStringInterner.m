@@ -0,0 +1,67 @@
+//
+//  AFStringInterner.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFStringInterner.h"
+#include <pthread.h>
+
+@implementation AFStringInterner {
+    NSMutableSet *_strings;
+    pthread_rwlock_t _lock; // lookups of strings that are in the table already do not wait for each other
+}
+
++ (AFStringInterner*)sharedInterner {
+    static AFStringInterner *sharedInterner = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedInterner = [[self alloc] init];
+    });
+    return sharedInterner;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _strings = [NSMutableSet set];
+        pthread_rwlock_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_rwlock_destroy(&_lock);
+}
+
+- (NSString*)internedString:(NSString*)string {
+    if (!string) {
+        return nil;
+    }
+    pthread_rwlock_rdlock(&_lock);
+    NSString *interned = [_strings member:string];
+    pthread_rwlock_unlock(&_lock);
+    if (interned) {
+        return interned;
+    }
+
+    pthread_rwlock_wrlock(&_lock);
+    interned = [_strings member:string];
+    if (!interned) {
+        // a mutable string must not change behind the table's back
+        interned = [string copy];
+        [_strings addObject:interned];
+    }
+    pthread_rwlock_unlock(&_lock);
+    return interned;
+}
+
+- (NSUInteger)count {
+    pthread_rwlock_rdlock(&_lock);
+    NSUInteger count = [_strings count];
+    pthread_rwlock_unlock(&_lock);
+    return count;
+}
+
+@end
@@ -0,0 +1,17 @@
+//
+//  AFSystemReachabilityProvider.h
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "AFReachabilityProvider.h"
+
+/*
+ * Reports the reachability of the default route as seen by SCNetworkReachability.
+ * Changes are delivered by the system on a private dispatch queue.
+ */
+@interface AFSystemReachabilityProvider : NSObject <AFReachabilityProvider>
+
+@end
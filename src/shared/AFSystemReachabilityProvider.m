@@ -0,0 +1,99 @@
+//
+//  AFSystemReachabilityProvider.m
+//  AFCache
+//
+//  Copyright (c) 2026 Artifacts - Fine Software Development. All rights reserved.
+//
+
+#import "AFSystemReachabilityProvider.h"
+#import "AFCache_Logging.h"
+#import <SystemConfiguration/SystemConfiguration.h>
+#include <netinet/in.h>
+
+@interface AFSystemReachabilityProvider ()
+@property (copy) AFReachabilityChangeBlock changeBlock; // atomic, read on the reachability queue
+#if OS_OBJECT_USE_OBJC
+@property (nonatomic, strong) dispatch_queue_t queue;
+#else
+@property (nonatomic, assign) dispatch_queue_t queue;
+#endif
+@end
+
+@implementation AFSystemReachabilityProvider {
+    SCNetworkReachabilityRef _reachability;
+}
+
+static BOOL AFReachableWithFlags(SCNetworkReachabilityFlags flags) {
+	BOOL isReachable = (flags & kSCNetworkFlagsReachable) == kSCNetworkFlagsReachable;
+	BOOL needsConnection = (flags & kSCNetworkFlagsConnectionRequired) == kSCNetworkFlagsConnectionRequired;
+	return isReachable && !needsConnection;
+}
+
+static void AFReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info) {
+    AFSystemReachabilityProvider *provider = (__bridge AFSystemReachabilityProvider *)info;
+    AFReachabilityChangeBlock changeBlock = provider.changeBlock;
+    if (changeBlock) {
+        changeBlock(AFReachableWithFlags(flags));
+    }
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _queue = dispatch_queue_create("de.artifacts.afcache.reachability", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self stopMonitoring];
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(_queue);
+#endif
+}
+
+- (void)startMonitoringWithChangeBlock:(AFReachabilityChangeBlock)changeBlock {
+    [self stopMonitoring];
+    self.changeBlock = changeBlock;
+
+	// Create zero address
+	struct sockaddr_in zeroAddress;
+	bzero( &zeroAddress, sizeof(zeroAddress) );
+	zeroAddress.sin_len = sizeof(zeroAddress);
+	zeroAddress.sin_family = AF_INET;
+
+    _reachability = SCNetworkReachabilityCreateWithAddress(NULL, (struct sockaddr *)&zeroAddress);
+    if (!_reachability) {
+        NSLog(@"Error. Could not create network reachability reference");
+        return;
+    }
+
+    // The context does not retain us, stopMonitoring (at the latest in dealloc) removes the callback
+    SCNetworkReachabilityContext context = {0, (__bridge void *)self, NULL, NULL, NULL};
+    if (!SCNetworkReachabilitySetCallback(_reachability, AFReachabilityCallback, &context) ||
+        !SCNetworkReachabilitySetDispatchQueue(_reachability, self.queue)) {
+        NSLog(@"Error. Could not monitor network reachability");
+    }
+
+    // The callback is only called on changes, so report the current state once
+    SCNetworkReachabilityRef reachability = (SCNetworkReachabilityRef)CFRetain(_reachability);
+    dispatch_async(self.queue, ^{
+        SCNetworkReachabilityFlags flags;
+        if (SCNetworkReachabilityGetFlags(reachability, &flags) && changeBlock) {
+            changeBlock(AFReachableWithFlags(flags));
+        }
+        CFRelease(reachability);
+    });
+}
+
+- (void)stopMonitoring {
+    if (_reachability) {
+        SCNetworkReachabilitySetCallback(_reachability, NULL, NULL);
+        SCNetworkReachabilitySetDispatchQueue(_reachability, NULL);
+        CFRelease(_reachability);
+        _reachability = NULL;
+    }
+    self.changeBlock = nil;
+}
+
+@end
@@ -23,6 +23,7 @@
 #import "AFCache+Packaging.h"
 #import "DateParser.h"
 #import "AFMediaTypeParser.h"
+#import "AFHTTPRangeResponse.h"
 
 @implementation AFURLCache
 
@@ -32,6 +33,12 @@
 	AFCacheableItem* item = [[AFCache sharedInstance] cacheableItemFromCacheStore:url];	
 	if (item && item.cacheStatus == kCacheStatusFresh) {
 
+        AFHTTPRangeResponse *rangeResponse = [[AFHTTPRangeResponse alloc] initWithRequest:request item:item];
+        NSData *rangeBody = [rangeResponse body];
+        if (rangeBody) {
+            return [[NSCachedURLResponse alloc] initWithResponse:rangeResponse.response data:rangeBody userInfo:nil storagePolicy:NSURLCacheStorageNotAllowed];
+        }
+
         AFMediaTypeParser *parser = [[AFMediaTypeParser alloc] initWithMIMEType:item.info.mimeType];
 
 		NSURLResponse* response = [[NSURLResponse alloc] initWithURL:item.url 
@@ -40,8 +40,40 @@ def sendFile(s, numBytes=100, delay=0.0, blockSize=100):
 		sentBytes = actualBytes
 		print sentBytes
 
+requestCounts = {}
+
+def sendFlaky(s, id="default", failures=1, after=0, status=503, retryAfter=None, numBytes=100, maxAge=60):
+	"""Fault injection: fails the requests after+1 .. after+failures for the same id, serves numBytes otherwise.
+	status=0 drops the connection without a response."""
+	count = requestCounts.get(id, 0) + 1
+	requestCounts[id] = count
+	print "%s request %d" % (id, count)
+
+	if after < count <= after + failures:
+		if status == 0:
+			s.close_connection = 1
+			return
+		s.send_response(status)
+		if retryAfter is not None:
+			s.send_header("Retry-After", "%s" % retryAfter)
+		s.send_header("Content-Length", "0")
+		s.end_headers()
+		return
+
+	s.send_response(200)
+	s.send_header("Content-type", "text/html")
+	s.send_header("Content-Length", "%d" % numBytes)
+	s.send_header("Cache-Control", "max-age=%d" % maxAge)
+	s.end_headers()
+	s.wfile.write("a" * numBytes)
+
 responses = {
-	"/file" : sendFile
+	"/file" : sendFile,
+}
+
+# not answered with 304 on revalidation, so failures can be injected into revalidations too
+faultResponses = {
+	"/flaky" : sendFlaky,
 }
 
 class MyHandler(BaseHTTPServer.BaseHTTPRequestHandler):
@@ -53,21 +85,26 @@ class MyHandler(BaseHTTPServer.BaseHTTPRequestHandler):
 	def do_GET(self):
 		"""Respond to a GET request."""
 
-		if self.headers.has_key('If-Modified-Since'):
+		components = urlparse.urlsplit(self.path)
+		path = components[2]
+
+		if self.headers.has_key('If-Modified-Since') and not faultResponses.has_key(path):
 			self.send_response(304)
 			return
 
-		components = urlparse.urlsplit(self.path)
-		path = components[2]
 		params = components[3].split('&')
 		print params
 		parameters = {}
 		for p in params:
+			if not p:
+				continue
 			k, v = p.split('=')
 			v = makeBestType(v)
 			parameters[k] = v
 		if responses.has_key(path):
 			responses[path](self, **parameters)
+		elif faultResponses.has_key(path):
+			faultResponses[path](self, **parameters)
 
 if __name__ == '__main__':
 	server_class = BaseHTTPServer.HTTPServer